@@ -33,11 +33,18 @@ public:
     static constexpr size_t BLOCK_MASK = BLOCK_SIZE - 1;
 
     // bufferSize: total buffer size.
-    //      This must be at least 2*requiredSize to avoid blocking on flush, however
-    //      because sometimes the display can get ahead of the render() thread, it's good
-    //      to set it to 3*requiredSize to avoid blocking the render thread (usually the UI thread).
+    //      This must be at least 2*requiredSize to avoid blocking on flush. The engine uses
+    //      exactly 2*requiredSize: rather than keeping more headroom for when the display gets
+    //      ahead of the render() thread, CommandBufferQueue::flush() grows the buffer (see
+    //      grow()) when the commands in flight come close to requiredSize, up to a maximum.
+    //      Growing only happens on flush(), so recording more than requiredSize bytes between
+    //      two flushes is still fatal: it overwrites commands the driver hasn't consumed yet.
     explicit CircularBuffer(size_t bufferSize);
 
+    // Wraps 'size' bytes of memory owned by someone else, typically a range allocated from
+    // another CircularBuffer. Such a buffer is only a linear allocator, it can't be circularized.
+    CircularBuffer(void* data, size_t size) noexcept;
+
     // can't be moved or copy-constructed
     CircularBuffer(CircularBuffer const& rhs) = delete;
     CircularBuffer(CircularBuffer&& rhs) noexcept = delete;
@@ -67,6 +74,19 @@ public:
     // call at least once every getRequiredSize() bytes allocated from the buffer
     void circularize() noexcept;
 
+    // Memory of a CircularBuffer replaced by grow()
+    struct Memory {
+        void* data = nullptr;
+        size_t size = 0;
+        int ashmem = -1;
+    };
+
+    // Reallocates the buffer with a new size. The buffer must be empty, but the memory allocated
+    // from it can still be in use: it's returned and must be freed with free() once it's not.
+    Memory grow(size_t bufferSize);
+
+    static void free(Memory const& memory) noexcept;
+
 private:
     void* alloc(size_t size) noexcept;
     void dealloc() noexcept;
@@ -74,6 +94,7 @@ private:
     // pointer to the beginning of the circular buffer (constant)
     void* mData = nullptr;
     int mUsesAshmem = -1;
+    bool mOwnsData = true;
 
     // size of the circular buffer (constant)
     size_t mSize = 0;
@@ -19,64 +19,173 @@
 
 #include "private/backend/CircularBuffer.h"
 
+#include <utils/architecture.h>
 #include <utils/compiler.h>
 #include <utils/Condition.h>
 #include <utils/Mutex.h>
 
+#include <atomic>
 #include <vector>
 
+#include <stddef.h>
+#include <stdint.h>
+
 namespace filament {
 namespace backend {
 
 /*
- * A producer-consumer command queue that uses a CircularBuffer as main storage
+ * A producer-consumer command queue that uses a CircularBuffer as main storage.
+ *
+ * There must be a single producer thread (calling flush()) and a single consumer thread
+ * (calling waitForCommands() and releaseBuffer()). Command buffers are handed over through a
+ * lock-free ring, threads only park (on a futex on Linux) when the ring is empty or when the
+ * CircularBuffer is full.
  */
 class CommandBufferQueue {
+public:
     struct Slice {
         void* begin;
         void* end;
     };
 
-    const size_t mRequiredSize;
-
-    CircularBuffer mCircularBuffer;
-
-    // space available in the circular buffer
-
-    mutable utils::Mutex mLock;
-    mutable utils::Condition mCondition;
-    mutable std::vector<Slice> mCommandBuffersToExecute;
-    size_t mFreeSpace = 0;
-    size_t mHighWatermark = 0;
-    uint32_t mExitRequested = 0;
-
-    static constexpr uint32_t EXIT_REQUESTED = 0x31415926;
-
-public:
     // requiredSize: guaranteed available space after flush()
-    CommandBufferQueue(size_t requiredSize, size_t bufferSize);
+    // maxRequiredSize: requiredSize grows up to this when the commands don't fit
+    CommandBufferQueue(size_t requiredSize, size_t bufferSize, size_t maxRequiredSize);
     ~CommandBufferQueue();
 
     CircularBuffer& getCircularBuffer() { return mCircularBuffer; }
 
+    // size of the CircularBuffer
+    size_t getSize() const noexcept { return mCircularBuffer.size(); }
+
+    // number of bytes currently flushed but not yet released by the consumer, this includes the
+    // memory the CircularBuffer used before it last grew
+    size_t getUsage() const noexcept {
+        return size_t(mFlushedSize - mReleasedSize.load(std::memory_order_relaxed));
+    }
+
+    // number of bytes recorded in the CircularBuffer since the last flush()
+    size_t getPendingSize() const noexcept {
+        return size_t(intptr_t(mCircularBuffer.getHead()) - intptr_t(mCircularBuffer.getTail()));
+    }
+
+    // peak value of getUsage() since creation
     size_t getHighWatermark() const noexcept { return mHighWatermark; }
 
-    // wait for commands to be available and returns an array containing these commands
-    std::vector<Slice> waitForCommands() const;
+    // number of times flush() had to wait for the consumer, because the CircularBuffer or the
+    // ring of command buffers was full, and the total time spent waiting. Without threading,
+    // flush() never waits.
+    uint32_t getStallCount() const noexcept {
+        return mStallCount.load(std::memory_order_relaxed);
+    }
+    uint64_t getStallDurationNs() const noexcept {
+        return mStallDurationNs.load(std::memory_order_relaxed);
+    }
+
+    // number of times waitForCommands() had to wait for the producer and the total time spent
+    // waiting.
+    uint32_t getWaitCount() const noexcept {
+        return mWaitCount.load(std::memory_order_relaxed);
+    }
+    uint64_t getWaitDurationNs() const noexcept {
+        return mWaitDurationNs.load(std::memory_order_relaxed);
+    }
+
+    // Waits for commands to be available and appends them to 'buffers'. Returns with no new
+    // commands only if exit was requested.
+    void waitForCommands(std::vector<Slice>& buffers);
 
     // return the memory used by this command buffer to the circular buffer
     // WARNING: releaseBuffer() must be called in sequence of the Slices returned by
     // waitForCommands()
     void releaseBuffer(Slice const& buffer);
 
-    // all commands buffers (Slices) written to this point are returned by waitForCommand(). This
+    // All commands buffers (Slices) written to this point are returned by waitForCommand(). This
     // call blocks until the CircularBuffer has at least mRequiredSize bytes available.
+    // When the CircularBuffer comes close to having requiredSize bytes in use, it grows instead
+    // so that requiredSize doubles (up to maxRequiredSize). The commands already flushed stay in
+    // the previous memory, which is freed once the consumer has released them, so growing never
+    // waits and can happen in the middle of a frame. This lets occasional heavy frames go by
+    // without over-provisioning every engine.
     void flush() noexcept;
 
     // returns from waitForCommands() immediately.
     void requestExit();
 
     bool isExitRequested() const;
+
+private:
+    // maximum number of command buffers flushed but not yet picked-up by the consumer
+    static constexpr uint32_t RING_SIZE = 64;
+    static constexpr uint32_t RING_MASK = RING_SIZE - 1;
+    static_assert((RING_SIZE & RING_MASK) == 0, "RING_SIZE must be a power of two");
+
+    static constexpr uint32_t EXIT_REQUESTED = 0x31415926;
+
+    // the buffer grows when more than (1 - 1/GROW_THRESHOLD_DIVISOR) of requiredSize is used
+    static constexpr size_t GROW_THRESHOLD_DIVISOR = 4;
+
+    // free space in the CircularBuffer, called by the producer
+    size_t getFreeSpace() const noexcept;
+
+    // moves the producer to a larger CircularBuffer, called by flush()
+    void grow() noexcept;
+
+    // frees the memory the CircularBuffer used before growing, once it's not used anymore
+    void freeRetiredMemory() noexcept;
+
+    // parks the calling thread until condition() is true
+    template<typename CONDITION>
+    void park(CONDITION condition) noexcept;
+
+    // wakes-up the other thread if it's parked
+    void unpark() noexcept;
+
+    // only used by the producer
+    size_t mRequiredSize;
+    const size_t mMaxRequiredSize;
+
+    CircularBuffer mCircularBuffer;
+
+    Slice mRing[RING_SIZE];
+
+    // Without threading the consumer runs on the producer thread and can't free the ring, the
+    // command buffers that don't fit in it are kept here, in order, until waitForCommands().
+    std::vector<Slice> mOverflow;
+
+    // written by the producer only
+    alignas(utils::CACHELINE_SIZE) std::atomic<uint32_t> mWriteIndex = { 0 };
+
+    // written by the consumer only
+    alignas(utils::CACHELINE_SIZE) std::atomic<uint32_t> mReadIndex = { 0 };
+
+    // Total bytes flushed by the producer and released by the consumer. The command buffers
+    // are released in order, so the ones flushed before mBufferStart, which live in the memory
+    // retired by the last grow(), are released first.
+    uint64_t mFlushedSize = 0;
+    uint64_t mBufferStart = 0;
+    alignas(utils::CACHELINE_SIZE) std::atomic<uint64_t> mReleasedSize = { 0 };
+    std::atomic<uint32_t> mExitRequested = { 0 };
+
+    // memory used by the CircularBuffer before growing, and mFlushedSize when it was replaced,
+    // only used by the producer
+    struct RetiredMemory {
+        CircularBuffer::Memory memory;
+        uint64_t end;
+    };
+    std::vector<RetiredMemory> mRetiredMemory;
+
+    // number of parked threads, and what they park on
+    std::atomic<uint32_t> mParkedCount = { 0 };
+    utils::Mutex mLock;
+    utils::Condition mCondition;
+
+    // statistics
+    size_t mHighWatermark = 0;
+    std::atomic<uint32_t> mStallCount = { 0 };
+    std::atomic<uint64_t> mStallDurationNs = { 0 };
+    std::atomic<uint32_t> mWaitCount = { 0 };
+    std::atomic<uint64_t> mWaitDurationNs = { 0 };
 };
 
 } // namespace backend
@@ -253,6 +253,33 @@ public:
     CommandStream() noexcept = default;
     CommandStream(Driver& driver, CircularBuffer& buffer) noexcept;
 
+    /*
+     * Segments allow several threads to record commands concurrently.
+     *
+     * reserveSegment() reserves room for 'size' bytes of commands in this stream. The segment
+     * can then be recorded, possibly on another thread, by a CommandStream created with
+     * CommandStream(CommandStream const&, CircularBuffer&) over a CircularBuffer wrapping the
+     * segment, which must be terminated with endSegment().
+     *
+     * The commands of a segment are executed in place, i.e. after the commands recorded in this
+     * stream before reserveSegment() and before the ones recorded after it. All segments must
+     * be terminated before the stream is flushed.
+     *
+     * Only asynchronous commands that don't return a value can be recorded in a segment.
+     */
+    struct Segment {
+        void* begin;
+        size_t size;
+    };
+
+    Segment reserveSegment(size_t size) noexcept;
+
+    // creates a CommandStream recording into 'buffer' and dispatching to the driver of 'rhs'
+    CommandStream(CommandStream const& rhs, CircularBuffer& buffer) noexcept;
+
+    // terminates a segment, 'segment' must be the one this stream was created for
+    void endSegment(Segment const& segment) noexcept;
+
     // This is for debugging only. Currently CircularBuffer can only be written from a
     // single thread. In debug builds we assert this condition.
     // Call this first in the render loop.
@@ -262,6 +289,14 @@ public:
 #endif
     }
 
+#ifndef NDEBUG
+    // This is for debugging only. Returns where the next command will be recorded, this can
+    // be used to measure the size of the commands recorded between two calls.
+    void const* debugGetHead() const noexcept {
+        return mCurrentBuffer->getHead();
+    }
+#endif
+
     void execute(void* buffer);
 
     /*
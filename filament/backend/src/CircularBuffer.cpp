@@ -42,8 +42,14 @@ CircularBuffer::CircularBuffer(size_t size) {
     mHead = mData;
 }
 
+CircularBuffer::CircularBuffer(void* data, size_t size) noexcept
+        : mData(data), mOwnsData(false), mSize(size), mTail(data), mHead(data) {
+}
+
 CircularBuffer::~CircularBuffer() noexcept {
-    dealloc();
+    if (mOwnsData) {
+        dealloc();
+    }
 }
 
 // If the system support mmap(), use it for creating a "hard circular buffer" where two virtual
@@ -127,22 +133,38 @@ void* CircularBuffer::alloc(size_t size) noexcept {
 }
 
 void CircularBuffer::dealloc() noexcept {
+    free({ mData, mSize, mUsesAshmem });
+    mData = nullptr;
+    mUsesAshmem = -1;
+}
+
+void CircularBuffer::free(Memory const& memory) noexcept {
 #if HAS_MMAP
-    if (mData) {
-        munmap(mData, mSize * 2 + BLOCK_SIZE);
-        if (mUsesAshmem >= 0) {
-            close(mUsesAshmem);
-            mUsesAshmem = -1;
+    if (memory.data) {
+        munmap(memory.data, memory.size * 2 + BLOCK_SIZE);
+        if (memory.ashmem >= 0) {
+            close(memory.ashmem);
         }
     }
 #else
-    ::free(mData);
+    ::free(memory.data);
 #endif
-    mData = nullptr;
 }
 
+CircularBuffer::Memory CircularBuffer::grow(size_t size) {
+    assert(mOwnsData);
+    assert(empty());
+    const Memory memory{ mData, mSize, mUsesAshmem };
+    mUsesAshmem = -1;
+    mData = alloc(size);
+    mSize = size;
+    mTail = mData;
+    mHead = mData;
+    return memory;
+}
 
 void CircularBuffer::circularize() noexcept {
+    assert(mOwnsData);
     if (mUsesAshmem > 0) {
         intptr_t overflow = intptr_t(mHead) - (intptr_t(mData) + ssize_t(mSize));
         if (overflow >= 0) {
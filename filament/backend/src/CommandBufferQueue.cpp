@@ -24,33 +24,102 @@
 
 #include "private/backend/CommandStream.h"
 
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+
 using namespace utils;
 
 namespace filament {
 namespace backend {
 
-CommandBufferQueue::CommandBufferQueue(size_t requiredSize, size_t bufferSize)
+CommandBufferQueue::CommandBufferQueue(size_t requiredSize, size_t bufferSize,
+        size_t maxRequiredSize)
         : mRequiredSize((requiredSize + CircularBuffer::BLOCK_MASK) & ~CircularBuffer::BLOCK_MASK),
-          mCircularBuffer(bufferSize),
-          mFreeSpace(mCircularBuffer.size()) {
+          mMaxRequiredSize(
+                  (maxRequiredSize + CircularBuffer::BLOCK_MASK) & ~CircularBuffer::BLOCK_MASK),
+          mCircularBuffer(bufferSize) {
     assert(mCircularBuffer.size() > requiredSize);
 }
 
 CommandBufferQueue::~CommandBufferQueue() {
-    assert(mCommandBuffersToExecute.empty());
+    assert(mReadIndex.load() == mWriteIndex.load());
+    for (RetiredMemory const& retired : mRetiredMemory) {
+        CircularBuffer::free(retired.memory);
+    }
 }
 
-void CommandBufferQueue::requestExit() {
+size_t CommandBufferQueue::getFreeSpace() const noexcept {
+    // the bytes released past mBufferStart are the ones of the current memory
+    const uint64_t released = std::max(mBufferStart,
+            mReleasedSize.load(std::memory_order_acquire));
+    return mCircularBuffer.size() - size_t(mFlushedSize - released);
+}
+
+void CommandBufferQueue::grow() noexcept {
+    SYSTRACE_CALL();
+
+    const size_t requiredSize = std::min(mRequiredSize * 2, mMaxRequiredSize);
+
+    // keep the same ratio between the buffer size and the required size
+    const size_t size = mCircularBuffer.size();
+    const size_t bufferSize = size_t(double(size) * double(requiredSize) / double(mRequiredSize)
+            + CircularBuffer::BLOCK_MASK) & ~CircularBuffer::BLOCK_MASK;
+
+    // the command buffers flushed so far are still in the previous memory
+    mRetiredMemory.push_back({ mCircularBuffer.grow(bufferSize), mFlushedSize });
+    mBufferStart = mFlushedSize;
+    mRequiredSize = requiredSize;
+
+#ifndef NDEBUG
+    slog.d << "CircularBuffer grown to " << bufferSize / 1024 << " KiB" << io::endl;
+#endif
+}
+
+void CommandBufferQueue::freeRetiredMemory() noexcept {
+    const uint64_t released = mReleasedSize.load(std::memory_order_acquire);
+    auto const last = std::find_if(mRetiredMemory.begin(), mRetiredMemory.end(),
+            [released](RetiredMemory const& retired) { return retired.end > released; });
+    for (auto it = mRetiredMemory.begin(); it != last; ++it) {
+        CircularBuffer::free(it->memory);
+    }
+    mRetiredMemory.erase(mRetiredMemory.begin(), last);
+}
+
+template<typename CONDITION>
+void CommandBufferQueue::park(CONDITION condition) noexcept {
+    // Announce that we're about to park before checking the condition one last time: either
+    // the other thread sees mParkedCount and wakes us up, or we see its update.
     std::unique_lock<utils::Mutex> lock(mLock);
-    mExitRequested = EXIT_REQUESTED;
-    mCondition.notify_one();
+    mParkedCount.fetch_add(1, std::memory_order_seq_cst);
+    while (!condition()) {
+        mCondition.wait(lock);
+    }
+    mParkedCount.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void CommandBufferQueue::unpark() noexcept {
+    // pairs with the fetch_add() in park(), orders our previous stores before the load below
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (UTILS_UNLIKELY(mParkedCount.load(std::memory_order_relaxed))) {
+        // Taking the lock guarantees the parked thread is either before its condition check
+        // (and will see our update), or waiting on mCondition (and will get the notification).
+        mLock.lock();
+        mLock.unlock();
+        mCondition.notify_all();
+    }
+}
+
+void CommandBufferQueue::requestExit() {
+    mExitRequested.store(EXIT_REQUESTED, std::memory_order_release);
+    unpark();
 }
 
 bool CommandBufferQueue::isExitRequested() const {
-    std::unique_lock<utils::Mutex> lock(mLock);
-    ASSERT_PRECONDITION( mExitRequested == 0 || mExitRequested == EXIT_REQUESTED,
-            "mExitRequested is corrupted (value = 0x%08x)!", mExitRequested);
-    return (bool)mExitRequested;
+    const uint32_t exitRequested = mExitRequested.load(std::memory_order_acquire);
+    ASSERT_PRECONDITION( exitRequested == 0 || exitRequested == EXIT_REQUESTED,
+            "mExitRequested is corrupted (value = 0x%08x)!", exitRequested);
+    return (bool)exitRequested;
 }
 
 
@@ -77,60 +146,107 @@ void CommandBufferQueue::flush() noexcept {
 
     circularBuffer.circularize();
 
-    std::unique_lock<utils::Mutex> lock(mLock);
-    mCommandBuffersToExecute.push_back({ tail, head });
-
     // circular buffer is too small, we corrupted the stream
-    assert(used <= mFreeSpace);
+    assert(used <= getFreeSpace());
 
-    // wait until there is enough space in the buffer
-    mFreeSpace -= used;
-    const size_t requiredSize = mRequiredSize;
+    mFlushedSize += used;
+    freeRetiredMemory();
 
-#ifndef NDEBUG
-    size_t totalUsed = circularBuffer.size() - mFreeSpace;
+    const size_t totalUsed = circularBuffer.size() - getFreeSpace();
     mHighWatermark = std::max(mHighWatermark, totalUsed);
-    if (UTILS_UNLIKELY(totalUsed > requiredSize)) {
-        slog.d << "CommandStream used too much space: " << totalUsed
-            << ", out of " << requiredSize << " (will block)" << io::endl;
-    }
+    if (UTILS_UNLIKELY(totalUsed > mRequiredSize - mRequiredSize / GROW_THRESHOLD_DIVISOR)) {
+        // we're nearing our budget, grow the buffer before the stream actually overflows
+        if (mRequiredSize < mMaxRequiredSize) {
+            grow();
+        }
+#ifndef NDEBUG
+        else if (totalUsed > mRequiredSize) {
+            slog.d << "CommandStream used too much space: " << totalUsed
+                << ", out of " << mRequiredSize << " (will block)" << io::endl;
+        }
 #endif
+    }
+
+    const size_t freeSpace = getFreeSpace();
+    const size_t requiredSize = mRequiredSize;
+
+    const uint32_t writeIndex = mWriteIndex.load(std::memory_order_relaxed);
+    auto canWrite = [this, writeIndex]() {
+        return writeIndex - mReadIndex.load(std::memory_order_acquire) < RING_SIZE;
+    };
+    auto hasFreeSpace = [this, requiredSize]() {
+        return getFreeSpace() >= requiredSize;
+    };
+
+    if (!UTILS_HAS_THREADING && UTILS_UNLIKELY(!mOverflow.empty() || !canWrite())) {
+        // waiting would never return, keep the command buffer until the consumer runs
+        mOverflow.push_back({ tail, head });
+        return;
+    }
+
+    if (UTILS_UNLIKELY(!canWrite())) {
+        // the consumer is lagging behind by more than RING_SIZE command buffers
+        auto start = std::chrono::steady_clock::now();
+        park(canWrite);
+        mStallCount.fetch_add(1, std::memory_order_relaxed);
+        mStallDurationNs.fetch_add(uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count()), std::memory_order_relaxed);
+    }
 
-    if (UTILS_LIKELY(mFreeSpace >= requiredSize)) {
-        // ideally (and usually) we don't have to wait, this is the common case, so special case
-        // the unlock-before-notify, optimization.
-        lock.unlock();
-        mCondition.notify_one();
-    } else {
+    // publish the command buffer
+    mRing[writeIndex & RING_MASK] = { tail, head };
+    mWriteIndex.store(writeIndex + 1, std::memory_order_release);
+    unpark();
+
+    if (UTILS_UNLIKELY(freeSpace < requiredSize) && UTILS_HAS_THREADING) {
         // unfortunately, there is not enough space left, we'll have to wait.
-        mCondition.notify_one(); // too bad there isn't a notify-and-wait
         SYSTRACE_NAME("waiting: CircularBuffer::flush()");
-        mCondition.wait(lock, [this, requiredSize]() -> bool {
-            return mFreeSpace >= requiredSize;
-        });
+        auto start = std::chrono::steady_clock::now();
+        park(hasFreeSpace);
+        mStallCount.fetch_add(1, std::memory_order_relaxed);
+        mStallDurationNs.fetch_add(uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count()), std::memory_order_relaxed);
     }
 }
 
-std::vector<CommandBufferQueue::Slice> CommandBufferQueue::waitForCommands() const {
-    if (!UTILS_HAS_THREADING) {
-        return std::move(mCommandBuffersToExecute);
+void CommandBufferQueue::waitForCommands(std::vector<Slice>& buffers) {
+    const uint32_t readIndex = mReadIndex.load(std::memory_order_relaxed);
+    auto hasCommands = [this, readIndex]() {
+        return mWriteIndex.load(std::memory_order_acquire) != readIndex ||
+               mExitRequested.load(std::memory_order_acquire);
+    };
+
+    if (UTILS_HAS_THREADING && !hasCommands()) {
+        auto start = std::chrono::steady_clock::now();
+        park(hasCommands);
+        mWaitCount.fetch_add(1, std::memory_order_relaxed);
+        mWaitDurationNs.fetch_add(uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count()), std::memory_order_relaxed);
     }
-    std::unique_lock<utils::Mutex> lock(mLock);
-    while (mCommandBuffersToExecute.empty() && !mExitRequested) {
-        mCondition.wait(lock);
+
+    ASSERT_PRECONDITION( !mExitRequested || mExitRequested == EXIT_REQUESTED,
+            "mExitRequested is corrupted (value = 0x%08x)!", mExitRequested.load());
+
+    const uint32_t writeIndex = mWriteIndex.load(std::memory_order_acquire);
+    for (uint32_t i = readIndex; i != writeIndex; i++) {
+        buffers.push_back(mRing[i & RING_MASK]);
     }
 
-    ASSERT_PRECONDITION( mExitRequested == 0 || mExitRequested == EXIT_REQUESTED,
-            "mExitRequested is corrupted (value = 0x%08x)!", mExitRequested);
+    // the ring entries are copied, the producer can reuse them
+    mReadIndex.store(writeIndex, std::memory_order_release);
+    unpark();
 
-    return std::move(mCommandBuffersToExecute);
+    if (!UTILS_HAS_THREADING) {
+        // these were all flushed after the ring entries
+        buffers.insert(buffers.end(), mOverflow.begin(), mOverflow.end());
+        mOverflow.clear();
+    }
 }
 
 void CommandBufferQueue::releaseBuffer(CommandBufferQueue::Slice const& buffer) {
-    std::unique_lock<utils::Mutex> lock(mLock);
-    mFreeSpace += uintptr_t(buffer.end) - uintptr_t(buffer.begin);
-    lock.unlock();
-    mCondition.notify_one();
+    mReleasedSize.fetch_add(uintptr_t(buffer.end) - uintptr_t(buffer.begin),
+            std::memory_order_release);
+    unpark();
 }
 
 } // namespace backend
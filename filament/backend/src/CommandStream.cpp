@@ -18,6 +18,7 @@
 
 #include <utils/CallStack.h>
 #include <utils/Log.h>
+#include <utils/Panic.h>
 #include <utils/Profiler.h>
 #include <utils/Systrace.h>
 
@@ -71,6 +72,33 @@ CommandStream::CommandStream(Driver& driver, CircularBuffer& buffer) noexcept
 #endif
 }
 
+CommandStream::CommandStream(CommandStream const& rhs, CircularBuffer& buffer) noexcept
+        : mDispatcher(rhs.mDispatcher),
+          mDriver(rhs.mDriver),
+          mCurrentBuffer(&buffer)
+#ifndef NDEBUG
+          , mThreadId(std::this_thread::get_id())
+#endif
+          , mUsePerformanceCounter(rhs.mUsePerformanceCounter) {
+}
+
+CommandStream::Segment CommandStream::reserveSegment(size_t size) noexcept {
+    // leave room for the NoopCommand that links the segment to the rest of the stream
+    const size_t s = CommandBase::align(size + sizeof(NoopCommand));
+    return { allocateCommand(s), s };
+}
+
+void CommandStream::endSegment(Segment const& segment) noexcept {
+    char* const end = static_cast<char*>(segment.begin) + segment.size;
+    void* const p = allocateCommand(CommandBase::align(sizeof(NoopCommand)));
+    // the segment overflowed, we corrupted the stream
+    ASSERT_POSTCONDITION(static_cast<char*>(p) + sizeof(NoopCommand) <= end,
+            "command stream segment overflow: %u bytes recorded in a %u bytes segment",
+            unsigned(static_cast<char*>(p) + sizeof(NoopCommand) -
+                    static_cast<char*>(segment.begin)), unsigned(segment.size));
+    new(p) NoopCommand(end);
+}
+
 void CommandStream::execute(void* buffer) {
     SYSTRACE_CALL();
 
@@ -43,6 +43,14 @@ public:
      */
     void copyIntoBuffer(void* src, size_t size);
 
+    /**
+     * Update size bytes of the buffer at byteOffset with data inside src, the rest of the buffer
+     * keeps its current content. This allocates a new buffer allocation only if the current one
+     * has been used for a draw call since it was allocated, in which case the current content is
+     * copied over first.
+     */
+    void copyIntoBufferRange(void* src, size_t size, size_t byteOffset);
+
     /**
      * Denotes that this buffer is used for a draw call ensuring that its allocation remains valid
      * until the end of the current frame.
@@ -73,6 +81,7 @@ private:
 
     size_t mBufferSize = 0;
     const MetalBufferPoolEntry* mBufferPoolEntry = nullptr;
+    bool mBufferPoolEntryUsed = false;  // mBufferPoolEntry was returned by getGpuBufferForDraw()
     void* mCpuBuffer = nullptr;
     MetalContext& mContext;
 
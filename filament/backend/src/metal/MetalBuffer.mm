@@ -64,9 +64,40 @@ void MetalBuffer::copyIntoBuffer(void* src, size_t size) {
     }
 
     mBufferPoolEntry = mContext.bufferPool->acquireBuffer(mBufferSize);
+    mBufferPoolEntryUsed = false;
     memcpy(static_cast<uint8_t*>(mBufferPoolEntry->buffer.contents), src, size);
 }
 
+void MetalBuffer::copyIntoBufferRange(void* src, size_t size, size_t byteOffset) {
+    if (size <= 0) {
+        return;
+    }
+    ASSERT_PRECONDITION(byteOffset + size <= mBufferSize,
+            "Attempting to copy %d bytes at offset %d into a buffer of size %d",
+            size, byteOffset, mBufferSize);
+
+    if (mCpuBuffer) {
+        memcpy(static_cast<uint8_t*>(mCpuBuffer) + byteOffset, src, size);
+        return;
+    }
+
+    // Once the current buffer has been used by a draw call, the GPU may still read it, so we can't
+    // write into it. Instead we acquire a new one and carry over the current content. The new
+    // buffer isn't visible to the GPU until the next draw call, so all the range updates until
+    // then are written in place, i.e. the buffer is renamed at most once per frame when its
+    // ranges are updated before drawing.
+    if (!mBufferPoolEntry || mBufferPoolEntryUsed) {
+        const MetalBufferPoolEntry* previous = mBufferPoolEntry;
+        mBufferPoolEntry = mContext.bufferPool->acquireBuffer(mBufferSize);
+        mBufferPoolEntryUsed = false;
+        if (previous) {
+            memcpy(mBufferPoolEntry->buffer.contents, previous->buffer.contents, mBufferSize);
+            mContext.bufferPool->releaseBuffer(previous);
+        }
+    }
+    memcpy(static_cast<uint8_t*>(mBufferPoolEntry->buffer.contents) + byteOffset, src, size);
+}
+
 id<MTLBuffer> MetalBuffer::getGpuBufferForDraw(id<MTLCommandBuffer> cmdBuffer) noexcept {
     if (!mBufferPoolEntry) {
         // If there's a CPU buffer, then we return nil here, as the CPU-side buffer will be bound
@@ -79,6 +110,7 @@ id<MTLBuffer> MetalBuffer::getGpuBufferForDraw(id<MTLCommandBuffer> cmdBuffer) n
         // avoid an error, we'll allocate an empty buffer.
         mBufferPoolEntry = mContext.bufferPool->acquireBuffer(mBufferSize);
     }
+    mBufferPoolEntryUsed = true;
 
     // This buffer is being used in a draw call, so we retain it so it's not released back into the
     // buffer pool until the frame has finished.
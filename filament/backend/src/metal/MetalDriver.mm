@@ -742,6 +742,18 @@ void MetalDriver::loadUniformBuffer(Handle<HwUniformBuffer> ubh,
     scheduleDestroy(std::move(data));
 }
 
+void MetalDriver::updateUniformBuffer(Handle<HwUniformBuffer> ubh,
+        BufferDescriptor&& data, uint32_t byteOffset) {
+    if (data.size <= 0) {
+       return;
+    }
+
+    auto uniform = handle_cast<MetalUniformBuffer>(mHandleMap, ubh);
+
+    uniform->buffer.copyIntoBufferRange(data.buffer, data.size, byteOffset);
+    scheduleDestroy(std::move(data));
+}
+
 void MetalDriver::updateSamplerGroup(Handle<HwSamplerGroup> sbh,
         SamplerGroup&& samplerGroup) {
     auto sb = handle_cast<MetalSamplerGroup>(mHandleMap, sbh);
@@ -1078,7 +1090,8 @@ void MetalDriver::blit(TargetBufferFlags buffers,
     mContext->blitter->blit(getPendingCommandBuffer(mContext), args);
 }
 
-void MetalDriver::draw(backend::PipelineState ps, Handle<HwRenderPrimitive> rph) {
+void MetalDriver::draw(backend::PipelineState ps, Handle<HwRenderPrimitive> rph,
+        uint32_t instanceCount) {
     ASSERT_PRECONDITION(mContext->currentRenderPassEncoder != nullptr,
             "Attempted to draw without a valid command encoder.");
     auto primitive = handle_cast<MetalRenderPrimitive>(mHandleMap, rph);
@@ -1264,7 +1277,8 @@ void MetalDriver::draw(backend::PipelineState ps, Handle<HwRenderPrimitive> rph)
                                                    indexCount:primitive->count
                                                     indexType:getIndexType(indexBuffer->elementSize)
                                                   indexBuffer:metalIndexBuffer
-                                            indexBufferOffset:primitive->offset];
+                                            indexBufferOffset:primitive->offset
+                                                instanceCount:instanceCount];
 }
 
 void MetalDriver::beginTimerQuery(Handle<HwTimerQuery> tqh) {
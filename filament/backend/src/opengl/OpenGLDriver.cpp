@@ -1656,6 +1656,28 @@ void OpenGLDriver::loadUniformBuffer(Handle<HwUniformBuffer> ubh, BufferDescript
     scheduleDestroy(std::move(p));
 }
 
+void OpenGLDriver::updateUniformBuffer(Handle<HwUniformBuffer> ubh, BufferDescriptor&& p,
+        uint32_t byteOffset) {
+    DEBUG_MARKER()
+
+    GLUniformBuffer* ub = handle_cast<GLUniformBuffer *>(ubh);
+    GLBuffer* buffer = &ub->gl.ubo;
+
+    // STREAM buffers are orphaned on update, their previous content can't be relied upon
+    assert(buffer->usage != BufferUsage::STREAM);
+    assert(byteOffset + p.size <= buffer->capacity);
+
+    auto& gl = mContext;
+    if (p.size > 0) {
+        gl.bindBuffer(GL_UNIFORM_BUFFER, buffer->id);
+        glBufferSubData(GL_UNIFORM_BUFFER, byteOffset, p.size, p.buffer);
+        buffer->size = std::max(buffer->size, uint32_t(byteOffset + p.size));
+    }
+    scheduleDestroy(std::move(p));
+
+    CHECK_GL_ERROR(utils::slog.e)
+}
+
 void OpenGLDriver::updateBuffer(GLenum target,
         GLBuffer* buffer, BufferDescriptor const& p, uint32_t alignment) noexcept {
     assert(buffer->capacity >= p.size);
@@ -3097,7 +3119,8 @@ void OpenGLDriver::updateTextureLodRange(GLTexture* texture, int8_t targetLevel)
     }
 }
 
-void OpenGLDriver::draw(PipelineState state, Handle<HwRenderPrimitive> rph) {
+void OpenGLDriver::draw(PipelineState state, Handle<HwRenderPrimitive> rph,
+        uint32_t instanceCount) {
     DEBUG_MARKER()
     auto& gl = mContext;
 
@@ -3121,8 +3144,14 @@ void OpenGLDriver::draw(PipelineState state, Handle<HwRenderPrimitive> rph) {
 
     setViewportScissor(state.scissor);
 
-    glDrawRangeElements(GLenum(rp->type), rp->minIndex, rp->maxIndex, rp->count,
-            rp->gl.indicesType, reinterpret_cast<const void*>(rp->offset));
+    if (UTILS_LIKELY(instanceCount <= 1)) {
+        glDrawRangeElements(GLenum(rp->type), rp->minIndex, rp->maxIndex, rp->count,
+                rp->gl.indicesType, reinterpret_cast<const void*>(rp->offset));
+    } else {
+        glDrawElementsInstanced(GLenum(rp->type), rp->count,
+                rp->gl.indicesType, reinterpret_cast<const void*>(rp->offset),
+                GLsizei(instanceCount));
+    }
 
     CHECK_GL_ERROR(utils::slog.e)
 }
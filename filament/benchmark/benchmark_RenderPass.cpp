@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PerformanceCounters.h"
+
+#include <benchmark/benchmark.h>
+
+#include "RenderPass.h"
+
+#include <utils/JobSystem.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+using namespace filament;
+using namespace utils;
+
+using Command = RenderPass::Command;
+
+class RenderPassFixture : public benchmark::Fixture {
+protected:
+    JobSystem js;
+    std::vector<Command> input;
+    std::vector<Command> commands;
+    std::vector<Command> scratch;
+
+public:
+    void SetUp(const ::benchmark::State& state) override {
+        js.adopt();
+
+        // Generate keys that look like what RenderPass::generateCommands() produces for a
+        // color pass with a depth pre-pass: a few passes and priorities, many materials and
+        // z-buckets, and a fair amount of sentinels for the culled primitives.
+        std::default_random_engine gen; // NOLINT
+        std::uniform_int_distribution<uint32_t> rand;
+
+        const size_t count = size_t(state.range(0));
+        input.resize(count);
+        for (size_t i = 0; i < count; i++) {
+            const uint32_t r = rand(gen);
+            const uint32_t distanceBits = rand(gen);
+            const uint32_t priority = r & 0x7;
+            RenderPass::CommandKey key;
+            switch ((r >> 3) % 8) {
+                case 0:
+                case 1:
+                    key = uint64_t(RenderPass::Pass::DEPTH);
+                    key |= RenderPass::makeField(priority,
+                            RenderPass::PRIORITY_MASK, RenderPass::PRIORITY_SHIFT);
+                    key |= RenderPass::makeField(distanceBits,
+                            RenderPass::DISTANCE_BITS_MASK, RenderPass::DISTANCE_BITS_SHIFT);
+                    break;
+                case 2:
+                case 3:
+                case 4:
+                    key = uint64_t(RenderPass::Pass::COLOR);
+                    key |= RenderPass::makeField(priority,
+                            RenderPass::PRIORITY_MASK, RenderPass::PRIORITY_SHIFT);
+                    key |= RenderPass::makeFieldTruncate(distanceBits >> 22,
+                            RenderPass::Z_BUCKET_MASK, RenderPass::Z_BUCKET_SHIFT);
+                    key |= RenderPass::makeMaterialSortingKey(r >> 20, (r >> 8) & 0xFFF);
+                    break;
+                case 5:
+                    key = uint64_t(RenderPass::Pass::BLENDED);
+                    key |= RenderPass::makeField(priority,
+                            RenderPass::PRIORITY_MASK, RenderPass::PRIORITY_SHIFT);
+                    key |= RenderPass::makeField(~distanceBits,
+                            RenderPass::BLEND_DISTANCE_MASK, RenderPass::BLEND_DISTANCE_SHIFT);
+                    break;
+                default:
+                    key = uint64_t(RenderPass::Pass::SENTINEL);
+                    break;
+            }
+            input[i].key = key;
+        }
+        commands.resize(count);
+        scratch.resize(count);
+    }
+
+    void TearDown(const ::benchmark::State& state) override {
+        js.emancipate();
+    }
+};
+
+// Both benchmarks include the copy of the unsorted commands, which is the same for both.
+
+BENCHMARK_DEFINE_F(RenderPassFixture, stdSort)(benchmark::State& state) {
+    {
+        PerformanceCounters pc(state);
+        for (auto _ : state) {
+            std::copy(input.begin(), input.end(), commands.begin());
+            std::sort(commands.begin(), commands.end());
+            benchmark::ClobberMemory();
+        }
+        pc.stop();
+        state.SetItemsProcessed(state.iterations() * state.range(0));
+    }
+}
+
+BENCHMARK_DEFINE_F(RenderPassFixture, radixSort)(benchmark::State& state) {
+    {
+        PerformanceCounters pc(state);
+        for (auto _ : state) {
+            std::copy(input.begin(), input.end(), commands.begin());
+            RenderPass::radixSortCommands(js, commands.data(), scratch.data(), commands.size());
+            benchmark::ClobberMemory();
+        }
+        pc.stop();
+        state.SetItemsProcessed(state.iterations() * state.range(0));
+    }
+}
+
+BENCHMARK_REGISTER_F(RenderPassFixture, stdSort)->Range(1024, 64 * 1024);
+BENCHMARK_REGISTER_F(RenderPassFixture, radixSort)->Range(1024, 64 * 1024);
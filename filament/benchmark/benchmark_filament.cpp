@@ -78,6 +78,40 @@ public:
     ~FilamentFixture() override {
         utils::aligned_free(visibles);
     }
+
+    template<typename T>
+    void cull(benchmark::State& state, T const& objects, const char* counterName,
+            Culler::Kernel kernel) {
+        if (!Culler::isKernelSupported(kernel)) {
+            state.SkipWithError("kernel not supported on this CPU");
+            return;
+        }
+        {
+            PerformanceCounters pc(state);
+            for (auto _ : state) {
+                objects(visibles, kernel);
+            }
+            benchmark::ClobberMemory();
+            pc.stop();
+            state.SetItemsProcessed(state.iterations() * BATCH_SIZE);
+            state.counters[counterName] = benchmark::Counter(
+                    double(state.iterations() * BATCH_SIZE) * 1e-9,
+                    benchmark::Counter::kIsRate);
+        }
+    }
+
+    void boxCulling(benchmark::State& state, Culler::Kernel kernel) {
+        cull(state, [this](Culler::result_type* results, Culler::Kernel kernel) {
+            Culler::Test::intersects(results, frustum,
+                    boxesCenter.data(), boxesExtent.data(), BATCH_SIZE, kernel);
+        }, "boxes/ns", kernel);
+    }
+
+    void sphereCulling(benchmark::State& state, Culler::Kernel kernel) {
+        cull(state, [this](Culler::result_type* results, Culler::Kernel kernel) {
+            Culler::Test::intersects(results, frustum, spheres.data(), BATCH_SIZE, kernel);
+        }, "spheres/ns", kernel);
+    }
 };
 
 BENCHMARK_F(FilamentFixture, boxCulling)(benchmark::State& state) {
@@ -103,3 +137,27 @@ BENCHMARK_F(FilamentFixture, sphereCulling)(benchmark::State& state) {
         state.SetItemsProcessed(state.iterations() * BATCH_SIZE);
     }
 }
+
+BENCHMARK_F(FilamentFixture, boxCullingScalar)(benchmark::State& state) {
+    boxCulling(state, Culler::Kernel::SCALAR);
+}
+
+BENCHMARK_F(FilamentFixture, boxCullingAVX2)(benchmark::State& state) {
+    boxCulling(state, Culler::Kernel::AVX2);
+}
+
+BENCHMARK_F(FilamentFixture, boxCullingNEON)(benchmark::State& state) {
+    boxCulling(state, Culler::Kernel::NEON);
+}
+
+BENCHMARK_F(FilamentFixture, sphereCullingScalar)(benchmark::State& state) {
+    sphereCulling(state, Culler::Kernel::SCALAR);
+}
+
+BENCHMARK_F(FilamentFixture, sphereCullingAVX2)(benchmark::State& state) {
+    sphereCulling(state, Culler::Kernel::AVX2);
+}
+
+BENCHMARK_F(FilamentFixture, sphereCullingNEON)(benchmark::State& state) {
+    sphereCulling(state, Culler::Kernel::NEON);
+}
@@ -489,6 +489,46 @@ public:
 
     DebugRegistry& getDebugRegistry() noexcept;
 
+    /**
+     * Returns the size in bytes of the command buffer used to send commands to the backend.
+     *
+     * The command buffer starts small and grows, even in the middle of a frame, when the commands
+     * need more space than it can guarantee.
+     */
+    size_t getCommandBufferSize() const noexcept;
+
+    /**
+     * Returns the number of bytes of the command buffer currently in use, that is, commands
+     * submitted to the backend but not yet executed.
+     */
+    size_t getCommandBufferUsage() const noexcept;
+
+    /**
+     * Returns the peak value of getCommandBufferUsage() since the Engine was created.
+     */
+    size_t getCommandBufferPeakUsage() const noexcept;
+
+    /**
+     * Statistics of the handoff of command buffers between the Engine and the backend.
+     *
+     * @see getCommandBufferStats()
+     */
+    struct CommandBufferStats {
+        uint32_t stallCount = 0;        //!< times the Engine waited for the backend
+        uint64_t stallDurationNs = 0;   //!< total time the Engine waited for the backend
+        uint32_t waitCount = 0;         //!< times the backend waited for commands
+        uint64_t waitDurationNs = 0;    //!< total time the backend waited for commands
+    };
+
+    /**
+     * Returns the statistics of the command buffer handoff since the Engine was created.
+     *
+     * The Engine stalls when the backend is too far behind, that is when the command buffer is
+     * full. A high stall count means the backend is the bottleneck, or that the command buffer
+     * is too small.
+     */
+    CommandBufferStats getCommandBufferStats() const noexcept;
+
 protected:
     //! \privatesection
     Engine() noexcept = default;
@@ -108,6 +108,43 @@ public:
         float reserved = 0;
     };
 
+    /**
+     * How the bones of a renderable are stored on the GPU, see Builder::boneFormat().
+     */
+    enum class BoneFormat : uint8_t {
+        QUATERNION,     //!< unit quaternion, translation and scales, 64 bytes per bone (default)
+        MATRIX_3X4      //!< first three rows of the affine transform, 48 bytes per bone
+    };
+
+    /**
+     * The bone transforms of one renderable, see setBones(BoneTransforms const*, size_t).
+     */
+    struct BoneTransforms {
+        Instance instance;                          //!< the renderable to update
+        math::mat4f const* transforms = nullptr;    //!< boneCount transforms
+        size_t boneCount = 0;
+        size_t offset = 0;                          //!< index of the first bone to update
+    };
+
+    /**
+     * The rest pose of a primitive deformed on the CPU, see Builder::cpuDeformation().
+     *
+     * Each array has one element per vertex of the primitive's VertexBuffer.
+     */
+    struct CpuDeformation {
+        math::float3 const* positions = nullptr;    //!< required
+        math::quatf const* tangents = nullptr;      //!< tangent frames, optional
+        math::ushort4 const* boneIndices = nullptr; //!< required if the renderable is skinned
+        math::float4 const* boneWeights = nullptr;  //!< required if the renderable is skinned
+        uint8_t positionBufferIndex = 0;    //!< buffer receiving the positions, as FLOAT3
+        uint8_t tangentBufferIndex = 1;     //!< buffer receiving the tangents, as FLOAT4
+        /**
+         * The content of the other buffers of the VertexBuffer, e.g. the texture coordinates,
+         * indexed by buffer. Optional, buffers without content are left uninitialized.
+         */
+        void const* const* buffers = nullptr;
+    };
+
     /**
      * Adds renderable components to entities using a builder pattern.
      */
@@ -168,8 +205,8 @@ public:
          * The axis-aligned bounding box of the renderable.
          *
          * This is an object-space AABB used for frustum culling. For skinning and morphing, this
-         * should encompass all possible vertex positions. It is mandatory unless culling is
-         * disabled for the renderable.
+         * should encompass all possible vertex positions. For instancing, this is the bounding box
+         * of a single instance. It is mandatory unless culling is disabled for the renderable.
          *
          * \see computeAABB()
          */
@@ -256,6 +293,15 @@ public:
         Builder& skinning(size_t boneCount, Bone const* bones) noexcept; //!< \overload
         Builder& skinning(size_t boneCount) noexcept; //!< \overload
 
+        /**
+         * Selects how the bones are stored on the GPU, BoneFormat::QUATERNION by default.
+         *
+         * BoneFormat::MATRIX_3X4 takes 25% less memory and bandwidth, and supports any affine
+         * transform, including shears. BoneFormat::QUATERNION is cheaper to evaluate for normals.
+         * Both are given the same transforms with setBones().
+         */
+        Builder& boneFormat(BoneFormat format) noexcept;
+
         /**
          * Controls if the renderable has vertex morphing targets, false by default.
          *
@@ -267,6 +313,101 @@ public:
          */
         Builder& morphing(bool enable) noexcept;
 
+        /**
+         * Enables GPU morphing for up to 128 morph targets, 0 by default.
+         *
+         * Unlike morphing(bool), the morph targets don't use vertex attributes. Their position
+         * and normal deltas are stored in a texture for each primitive, sized from the vertex
+         * count of the primitive's VertexBuffer, and only the targets with a non-zero weight
+         * are evaluated by the vertex shader. Both kinds of morphing can be used together.
+         *
+         * The morph targets use one vertex shader sampler, materials that already use all the
+         * samplers of the backend (16) don't apply them.
+         *
+         * See also RenderableManager::setMorphTargetsAt(), which provides the deltas, and
+         * RenderableManager::setMorphWeights(), which can be called on a per-frame basis
+         * to advance the animation.
+         *
+         * @param targetCount 0 to disable, otherwise the number of morph targets (up to 128)
+         */
+        Builder& morphTargets(size_t targetCount) noexcept;
+
+        /**
+         * Deforms a primitive on the CPU rather than in the vertex shader, e.g. for headless
+         * rendering with a software rasterizer, or to validate GPU skinning.
+         *
+         * The bones and the morph targets of the renderable are applied to the given rest pose
+         * on the engine's worker threads, whenever the renderable is visible and its bones or
+         * morph weights changed. The primitive is then drawn with the static variant of its
+         * material, from a VertexBuffer owned by the renderable, so that the renderables sharing
+         * the primitive's VertexBuffer keep their own pose.
+         *
+         * That VertexBuffer has the layout of the primitive's VertexBuffer. The deformed vertices
+         * are uploaded to the buffers named in deformation, where the POSITION and TANGENTS
+         * attributes must be tightly packed FLOAT3 and FLOAT4 respectively. The content of the
+         * other buffers is copied once from deformation.buffers by build(), later changes to the
+         * primitive's VertexBuffer don't affect it.
+         *
+         * Once one primitive of a renderable is deformed on the CPU, the primitives which are
+         * given no rest pose are drawn without deformation. This can't be used with
+         * morphing(bool).
+         *
+         * @param index 0-based index of the primitive
+         * @param deformation the rest pose of the primitive, which is copied by build()
+         */
+        Builder& cpuDeformation(size_t index, CpuDeformation const& deformation) noexcept;
+
+        /**
+         * Enables GPU instancing for up to 128 instances, 0 by default.
+         *
+         * An instanced renderable draws each of its primitives once per instance, with a single
+         * draw call. Each instance has its own transform, relative to the renderable's transform,
+         * and a float4 of user data which the vertex shader can read with getInstanceData().
+         * Instances are frustum-culled individually, and only the visible ones are drawn.
+         *
+         * Instances share storage with the bones, a renderable that uses both can't have more
+         * than 128 bones. The instance transforms must not change the winding order of the
+         * primitives (i.e. they must have a positive determinant).
+         *
+         * See also RenderableManager::setInstanceTransforms() and
+         * RenderableManager::setInstanceData(), which can be called on a per-frame basis.
+         *
+         * @param instanceCount 0 to disable, otherwise the number of instances (up to 128)
+         * @param transforms the initial set of transforms (one for each instance)
+         */
+        Builder& instances(size_t instanceCount, math::mat4f const* transforms) noexcept;
+        Builder& instances(size_t instanceCount) noexcept; //!< \overload
+
+        /**
+         * Declares up to 8 levels of detail, 1 by default.
+         *
+         * The primitives given to the builder are split into consecutive groups, one per level,
+         * starting with the most detailed level. Each frame, a single level is drawn for each
+         * view and shadow map, chosen from the size of the renderable on screen, that is the
+         * projected diameter of its bounding box's bounding sphere divided by the height of the
+         * viewport (or shadow map).
+         *
+         * Level i is drawn while the screen size is below screenSizes[i - 1] and at least
+         * screenSizes[i], level 0 is drawn above screenSizes[0] and the last level below
+         * screenSizes[levelCount - 2]. To avoid popping back and forth around a threshold, the
+         * screen size must cross it by a relative margin of \p hysteresis before the level
+         * changes.
+         *
+         * Primitive indices used by the builder and by RenderableManager address all the
+         * primitives, across all levels.
+         *
+         * @param levelCount the number of levels of detail, between 1 and 8
+         * @param primitiveCounts the number of primitives of each level, levelCount entries whose
+         *                        sum is the count given to the Builder constructor. Ignored and
+         *                        can be null when levelCount is 1.
+         * @param screenSizes the decreasing screen sizes at which the renderable switches to the
+         *                    next level, levelCount - 1 entries. Can be null when levelCount
+         *                    is 1.
+         * @param hysteresis relative margin around each screen size, 0.1 by default
+         */
+        Builder& levels(size_t levelCount, size_t const* primitiveCounts,
+                float const* screenSizes, float hysteresis = 0.1f) noexcept;
+
         /**
          * Sets an ordering index for blended primitives that all live at the same Z value.
          *
@@ -390,6 +531,16 @@ public:
     void setBones(Instance instance, Bone const* transforms, size_t boneCount = 1, size_t offset = 0) noexcept;
     void setBones(Instance instance, math::mat4f const* transforms, size_t boneCount = 1, size_t offset = 0) noexcept; //!< \overload
 
+    /**
+     * Updates the bone transforms of several renderables at once, e.g. a crowd of skinned
+     * characters. This is equivalent to calling setBones() for each element of updates, but the
+     * transforms are converted on the engine's worker threads.
+     *
+     * The bones of all the renderables are stored in a single buffer, which is uploaded once
+     * per frame, whichever API is used to update them.
+     */
+    void setBones(BoneTransforms const* updates, size_t count) noexcept;
+
     /**
      * Updates the vertex morphing weights on a renderable, all zeroes by default.
      *
@@ -400,6 +551,56 @@ public:
      */
     void setMorphWeights(Instance instance, math::float4 const& weights) noexcept;
 
+    /**
+     * Updates the weights of the morph targets in the range [offset, offset + count), all
+     * zeroes by default. Morph targets with a zero weight cost nothing to draw.
+     *
+     * The morph targets must be pre-allocated using Builder::morphTargets().
+     */
+    void setMorphWeights(Instance instance, float const* weights,
+            size_t count, size_t offset = 0) noexcept;
+
+    /**
+     * Updates the deltas of a morph target for the vertices in the range
+     * [offset, offset + vertexCount) of the given primitive, all zeroes by default.
+     *
+     * @param positions position deltas, in model space, one per vertex
+     * @param normals normal deltas, one per vertex, or nullptr to leave the normals unchanged
+     *
+     * The morph targets must be pre-allocated using Builder::morphTargets().
+     */
+    void setMorphTargetsAt(Instance instance, size_t primitiveIndex, size_t targetIndex,
+            math::float3 const* positions, math::float3 const* normals,
+            size_t vertexCount, size_t offset = 0) noexcept;
+
+    /**
+     * Gets the number of morph targets of a renderable, 0 if it doesn't have any.
+     *
+     * \see Builder::morphTargets()
+     */
+    size_t getMorphTargetCount(Instance instance) const noexcept;
+
+    /**
+     * Updates the instance transforms in the range [offset, offset + count).
+     * The instances must be pre-allocated using Builder::instances().
+     */
+    void setInstanceTransforms(Instance instance, math::mat4f const* transforms,
+            size_t count = 1, size_t offset = 0) noexcept;
+
+    /**
+     * Updates the instance user data in the range [offset, offset + count), all zeroes by default.
+     * The instances must be pre-allocated using Builder::instances().
+     */
+    void setInstanceData(Instance instance, math::float4 const* data,
+            size_t count = 1, size_t offset = 0) noexcept;
+
+    /**
+     * Gets the number of instances of a renderable, 0 if it's not instanced.
+     *
+     * \see Builder::instances()
+     */
+    size_t getInstanceCount(Instance instance) const noexcept;
+
     /**
      * Gets the bounding box used for frustum culling.
      *
@@ -418,10 +619,18 @@ public:
     uint8_t getLayerMask(Instance instance) const noexcept;
 
     /**
-     * Gets the immutable number of primitives in the given renderable.
+     * Gets the immutable number of primitives in the given renderable, across all its levels
+     * of detail.
      */
     size_t getPrimitiveCount(Instance instance) const noexcept;
 
+    /**
+     * Gets the immutable number of levels of detail of the given renderable.
+     *
+     * \see Builder::levels()
+     */
+    size_t getLevelCount(Instance instance) const noexcept;
+
     /**
      * Changes the material instance binding for the given primitive.
      *
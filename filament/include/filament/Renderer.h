@@ -135,6 +135,23 @@ public:
         bool discard = true;
     };
 
+    /**
+     * Statistics of the driver commands recorded by a render pass.
+     *
+     * The state commands are the material and uniform buffer bindings needed by the draws, the
+     * bindings that are already in place are skipped. Draws that use the same material instance
+     * as the previous draw are counted separately, in materialInstanceReused.
+     *
+     * @see getRenderPassStats()
+     */
+    struct RenderPassStats {
+        const char* name = nullptr;             //!< name of the pass
+        uint32_t drawCount = 0;                 //!< draw commands
+        uint32_t stateEmitted = 0;              //!< state commands emitted
+        uint32_t stateSuppressed = 0;           //!< state commands skipped, already set
+        uint32_t materialInstanceReused = 0;    //!< draws that kept the previous material instance
+    };
+
     /**
      * Information about the display this Renderer is associated to. This information is needed
      * to accurately compute dynamic-resolution scaling and for frame-pacing.
@@ -557,6 +574,25 @@ public:
      * getUserTime()
      */
     void resetUserTime();
+
+    /**
+     * Returns the number of render passes executed by the previous frame for which statistics
+     * are available.
+     *
+     * @see getRenderPassStats()
+     */
+    size_t getRenderPassStatsCount() const noexcept;
+
+    /**
+     * Returns the statistics of a render pass executed by the previous frame. The passes are in
+     * execution order, and only the first 16 passes of a frame are kept.
+     *
+     * @param index Index of the render pass, must be less than getRenderPassStatsCount().
+     * @return The statistics of the render pass.
+     *
+     * @see getRenderPassStatsCount()
+     */
+    RenderPassStats getRenderPassStats(size_t index) const noexcept;
 };
 
 } // namespace filament
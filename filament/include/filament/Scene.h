@@ -156,6 +156,52 @@ public:
      * @return Whether the given entity is in the Scene.
      */
     bool hasEntity(utils::Entity entity) const noexcept;
+
+    /**
+     * Enables or disables hierarchical culling for this Scene.
+     *
+     * When enabled, the Scene maintains a bounding volume hierarchy of its renderables, which
+     * lets culling skip whole groups of renderables that are entirely inside or outside of the
+     * camera and shadow frusta. The hierarchy is only refitted when renderables move, which makes
+     * it a good fit for large scenes that are mostly static. Small or very dynamic scenes are
+     * better served by the default linear culling.
+     *
+     * Hierarchical culling is disabled by default.
+     *
+     * @param enabled true to enable hierarchical culling, false to disable it.
+     */
+    void setCullingHierarchyEnabled(bool enabled) noexcept;
+
+    /**
+     * Returns whether hierarchical culling is enabled.
+     *
+     * @return true if hierarchical culling is enabled, false otherwise.
+     */
+    bool isCullingHierarchyEnabled() const noexcept;
+
+    /**
+     * Enables or disables caching of the per-renderable uniforms for this Scene.
+     *
+     * When enabled, each renderable keeps its own slot in the per-renderable uniform buffer
+     * from frame to frame, and only the slots of the renderables whose transform, visibility or
+     * morph weights changed are updated. This makes the per-frame cost of mostly static scenes
+     * proportional to what changes rather than to what is visible, at the expense of a uniform
+     * buffer sized for all the renderables of the Scene, and of a CPU-side copy of it.
+     *
+     * The cache is only effective if the Scene is rendered by a single View.
+     *
+     * Uniform buffer caching is disabled by default.
+     *
+     * @param enabled true to enable uniform buffer caching, false to disable it.
+     */
+    void setUniformBufferCachingEnabled(bool enabled) noexcept;
+
+    /**
+     * Returns whether uniform buffer caching is enabled.
+     *
+     * @return true if uniform buffer caching is enabled, false otherwise.
+     */
+    bool isUniformBufferCachingEnabled() const noexcept;
 };
 
 } // namespace filament
@@ -202,6 +202,21 @@ public:
      */
     void setTransform(Instance ci, const math::mat4f& localTransform) noexcept;
 
+    /**
+     * Sets the local transforms of several transform components at once.
+     *
+     * This is equivalent to calling setTransform() for each instance within a local transform
+     * transaction, which is committed before returning unless a transaction was already open.
+     * It's the most efficient way to update a large number of transforms, e.g. when animating.
+     *
+     * @param instances       Array of \p count instances of the transform components to update.
+     * @param localTransforms Array of \p count local transforms (i.e. relative to the parent).
+     * @param count           Number of transforms to update.
+     * @see setTransform(Instance, const math::mat4f&)
+     */
+    void setTransform(Instance const* instances, const math::mat4f* localTransforms,
+            size_t count) noexcept;
+
     /**
      * Returns the local transform of a transform component.
      * @param ci The instance of the transform component to query the local transform from.
@@ -228,6 +243,9 @@ public:
      * This is useful when updating many transforms and the transform hierarchy is deep (say more
      * than 4 or 5 levels).
      *
+     * Committing the transaction computes the world transforms of the nodes that changed, one
+     * level of the hierarchy at a time, in parallel when the levels are large enough.
+     *
      * @note If the local transform transaction is already open, this is a no-op.
      *
      * @see commitLocalTransformTransaction(), setTransform()
@@ -703,6 +703,25 @@ public:
      */
     void setDynamicLightingOptions(float zLightNear, float zLightFar) noexcept;
 
+    /**
+     * Enables or disables support for a large number of point and spot lights.
+     * Disabled by default.
+     *
+     * By default, at most 256 point and spot lights are used, the ones farthest from the
+     * camera are ignored. When enabled, up to 4096 lights are used, the lights are
+     * assigned to a finer grid of froxels, and the lights past the first 256 are stored in
+     * a texture. This uses more memory, and the light assignment is done per tile of froxels,
+     * which scales better with the number of lights.
+     *
+     * @param enabled true enables the large light count, false disables it.
+     */
+    void setLargeLightCountEnabled(bool enabled) noexcept;
+
+    /**
+     * Returns whether the large light count is enabled.
+     */
+    bool isLargeLightCountEnabled() const noexcept;
+
     /*
      * Set the shadow mapping technique this View uses.
      *
@@ -740,6 +759,54 @@ public:
      */
     VsmShadowOptions getVsmShadowOptions() const noexcept;
 
+    /**
+     * Enables or disables shadow map caching. Disabled by default.
+     *
+     * When enabled, the shadow maps are kept from frame to frame, and a shadow map is only
+     * rendered again when its light moves, or when one of the shadow casters it sees changes
+     * (transform, visibility, geometry, level of detail or material instance). This saves most
+     * of the cost of shadowing in static scenes, at the cost of keeping the shadow texture
+     * in memory.
+     *
+     * Skinned and morphed shadow casters are assumed to change every frame. Changes to the
+     * content of vertex buffers or to material parameters are not detected.
+     *
+     * The cascades of the directional light follow the camera, so they're only reused while
+     * the camera doesn't move.
+     *
+     * @param enabled true enables shadow map caching, false disables it.
+     */
+    void setShadowMapCachingEnabled(bool enabled) noexcept;
+
+    /**
+     * Returns whether shadow map caching is enabled.
+     */
+    bool isShadowMapCachingEnabled() const noexcept;
+
+    /**
+     * Enables or disables the shadow atlas. Disabled by default.
+     *
+     * Without the shadow atlas, only the first two shadow-casting spot lights of the scene
+     * cast shadows, each with its own layer of the shadow texture. With the shadow atlas, up to
+     * 64 visible shadow-casting spot lights share a few layers of the shadow texture, each light
+     * getting a tile whose size depends on how much of the screen the light covers (and is at
+     * most LightManager::ShadowOptions::mapSize).
+     *
+     * Tiles are kept from frame to frame, so with shadow map caching (see
+     * setShadowMapCachingEnabled()), the tiles of stable lights are not rendered again.
+     *
+     * The light space position of the atlas shadows is computed per fragment, which is more
+     * expensive than the regular spot light shadows.
+     *
+     * @param enabled true enables the shadow atlas, false disables it.
+     */
+    void setShadowAtlasEnabled(bool enabled) noexcept;
+
+    /**
+     * Returns whether the shadow atlas is enabled.
+     */
+    bool isShadowAtlasEnabled() const noexcept;
+
     /**
      * Enables or disables post processing. Enabled by default.
      *
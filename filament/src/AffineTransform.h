@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TNT_FILAMENT_AFFINETRANSFORM_H
+#define TNT_FILAMENT_AFFINETRANSFORM_H
+
+#include <utils/compiler.h>
+
+#include <math/mat3.h>
+#include <math/mat4.h>
+#include <math/vec3.h>
+
+namespace filament {
+
+/*
+ * An affine transform, i.e. a mat4f whose last row is { 0, 0, 0, 1 }, stored without its last
+ * row. It takes 48 bytes instead of 64, and composing two of them takes 36 multiplies instead
+ * of 64. The operations below produce the same results as their mat4f equivalents.
+ */
+struct AffineTransform {
+    math::mat3f linear;                 // upper-left 3x3 of the mat4f
+    math::float3 translation = {};      // first three components of the last column
+
+    AffineTransform() noexcept = default;
+
+    AffineTransform(math::mat3f const& linear, math::float3 const& translation) noexcept
+            : linear(linear), translation(translation) {
+    }
+
+    // the last row of m is ignored, it's assumed to be { 0, 0, 0, 1 }
+    explicit AffineTransform(math::mat4f const& m) noexcept
+            : linear(m.upperLeft()), translation(m[3].xyz) {
+    }
+
+    math::mat4f asMat4() const noexcept {
+        return math::mat4f{ linear, translation };
+    }
+
+    math::float3 transformPoint(math::float3 const& p) const noexcept {
+        return linear * p + translation;
+    }
+
+    friend AffineTransform operator*(
+            AffineTransform const& lhs, AffineTransform const& rhs) noexcept {
+        return { lhs.linear * rhs.linear, lhs.transformPoint(rhs.translation) };
+    }
+
+    friend bool operator==(AffineTransform const& lhs, AffineTransform const& rhs) noexcept {
+        return lhs.linear == rhs.linear && lhs.translation == rhs.translation;
+    }
+
+    friend bool operator!=(AffineTransform const& lhs, AffineTransform const& rhs) noexcept {
+        return !(lhs == rhs);
+    }
+
+    // returns whether the last row of m is { 0, 0, 0, 1 }
+    static bool isAffine(math::mat4f const& m) noexcept {
+        return m[0].w == 0.0f && m[1].w == 0.0f && m[2].w == 0.0f && m[3].w == 1.0f;
+    }
+
+    // Returns lhs * rhs, using the affine product when both matrices are affine, which is
+    // almost always the case for transform hierarchies.
+    static math::mat4f multiply(math::mat4f const& lhs, math::mat4f const& rhs) noexcept {
+        if (UTILS_LIKELY(isAffine(lhs) && isAffine(rhs))) {
+            return (AffineTransform(lhs) * AffineTransform(rhs)).asMat4();
+        }
+        return lhs * rhs;
+    }
+};
+
+static_assert(sizeof(AffineTransform) == 48, "AffineTransform should be 48 bytes");
+
+} // namespace filament
+
+#endif // TNT_FILAMENT_AFFINETRANSFORM_H
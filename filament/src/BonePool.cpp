@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "BonePool.h"
+
+#include "private/backend/DriverApi.h"
+
+#include <utils/compiler.h>
+
+#include <algorithm>
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace filament::math;
+
+namespace filament {
+
+using namespace backend;
+
+// the pool starts with room for a few typical skins
+static constexpr size_t MIN_CAPACITY = 4 * BonePool::RANGE_SIZE;
+
+static_assert(BonePool::RANGE_SIZE % BonePool::ALIGNMENT == 0,
+        "the padding at the end of the pool must preserve the alignment");
+
+static inline size_t align(size_t size) noexcept {
+    return (size + BonePool::ALIGNMENT - 1) & ~(BonePool::ALIGNMENT - 1);
+}
+
+BonePool::BonePool() noexcept
+        : mStorage(RANGE_SIZE / sizeof(float4)) {
+}
+
+void BonePool::terminate(DriverApi& driver) noexcept {
+    if (mHandle) {
+        driver.destroyUniformBuffer(mHandle);
+        mHandle.clear();
+    }
+}
+
+uint32_t BonePool::allocate(size_t size) noexcept {
+    if (!size) {
+        return 0;
+    }
+    size = align(size);
+
+    // first fit, ranges are short-lived enough (they live as long as their renderable) that
+    // fragmentation isn't a concern in practice
+    auto pos = std::find_if(mFreeRanges.begin(), mFreeRanges.end(),
+            [size](Range const& range) { return range.size >= size; });
+    if (UTILS_UNLIKELY(pos == mFreeRanges.end())) {
+        grow(size);
+        pos = mFreeRanges.end() - 1;
+        assert(pos->size >= size);
+    }
+
+    const uint32_t offset = pos->offset;
+    pos->offset += uint32_t(size);
+    pos->size -= uint32_t(size);
+    if (!pos->size) {
+        mFreeRanges.erase(pos);
+    }
+    return offset;
+}
+
+void BonePool::free(uint32_t offset, size_t size) noexcept {
+    if (!size) {
+        return;
+    }
+    size = align(size);
+    assert(offset + size <= mCapacity);
+
+    // insert the range, and merge it with its neighbors
+    auto next = std::lower_bound(mFreeRanges.begin(), mFreeRanges.end(), offset,
+            [](Range const& range, uint32_t offset) { return range.offset < offset; });
+    auto pos = mFreeRanges.insert(next, { offset, uint32_t(size) });
+    if (pos + 1 != mFreeRanges.end() && pos->offset + pos->size == (pos + 1)->offset) {
+        pos->size += (pos + 1)->size;
+        mFreeRanges.erase(pos + 1);
+    }
+    if (pos != mFreeRanges.begin() && (pos - 1)->offset + (pos - 1)->size == pos->offset) {
+        (pos - 1)->size += pos->size;
+        mFreeRanges.erase(pos);
+    }
+}
+
+void BonePool::grow(size_t size) noexcept {
+    // the new space is a free range at the end of the pool, which is merged with the last free
+    // range if they're adjacent
+    const size_t capacity = std::max({ MIN_CAPACITY, mCapacity * 2, align(mCapacity + size) });
+    const uint32_t offset = uint32_t(mCapacity);
+    mCapacity = capacity;
+    mStorage.resize((capacity + RANGE_SIZE) / sizeof(float4), float4{});
+    free(offset, capacity - offset);
+}
+
+void* BonePool::invalidate(uint32_t offset, size_t size) noexcept {
+    assert(offset + size <= mCapacity);
+    if (mDirtyBegin == mDirtyEnd) {
+        mDirtyBegin = offset;
+        mDirtyEnd = uint32_t(offset + size);
+    } else {
+        mDirtyBegin = std::min(mDirtyBegin, offset);
+        mDirtyEnd = std::max(mDirtyEnd, uint32_t(offset + size));
+    }
+    return reinterpret_cast<char*>(mStorage.data()) + offset;
+}
+
+void BonePool::commit(DriverApi& driver) noexcept {
+    if (UTILS_UNLIKELY(!mHandle || mHandleCapacity != mCapacity)) {
+        // Commands already recorded keep using the previous UBO, which is destroyed after them.
+        // The new one starts with the whole pool.
+        if (mHandle) {
+            driver.destroyUniformBuffer(mHandle);
+        }
+        mHandle = driver.createUniformBuffer(mCapacity + RANGE_SIZE, BufferUsage::DYNAMIC);
+        mHandleCapacity = mCapacity;
+        mDirtyBegin = 0;
+        mDirtyEnd = uint32_t(mCapacity + RANGE_SIZE);
+    }
+
+    if (mDirtyBegin != mDirtyEnd) {
+        // a single upload covers all the changes, it can be large so it's not allocated in
+        // the command stream
+        const size_t size = mDirtyEnd - mDirtyBegin;
+        void* const buffer = malloc(size);
+        memcpy(buffer, reinterpret_cast<char const*>(mStorage.data()) + mDirtyBegin, size);
+        driver.updateUniformBuffer(mHandle, { buffer, size,
+                [](void* buffer, size_t, void*) { ::free(buffer); } }, mDirtyBegin);
+        mDirtyBegin = mDirtyEnd = 0;
+    }
+}
+
+} // namespace filament
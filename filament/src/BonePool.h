@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TNT_FILAMENT_BONEPOOL_H
+#define TNT_FILAMENT_BONEPOOL_H
+
+#include "private/backend/DriverApiForward.h"
+
+#include <backend/Handle.h>
+
+#include <private/filament/EngineEnums.h>
+#include <private/filament/UibGenerator.h>
+
+#include <math/vec4.h>
+
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace filament {
+
+/*
+ * Storage for the bones (and instances) of all the renderables, in a single UBO.
+ *
+ * Each renderable owns a range of the pool, which is bound with bindUniformBufferRange(). The
+ * bound range must be as large as the bones uniform block (RANGE_SIZE), so it usually overlaps
+ * the ranges of the next renderables, which is why the UBO has RANGE_SIZE bytes of padding at
+ * its end. All the ranges invalidated between two commit() are uploaded at once.
+ */
+class BonePool {
+public:
+    // size of the range bound for each renderable
+    static constexpr size_t RANGE_SIZE = CONFIG_MAX_BONE_COUNT * sizeof(PerRenderableUibBone);
+
+    // ranges start on multiples of the largest UBO offset alignment of the backends
+    static constexpr size_t ALIGNMENT = 256;
+
+    BonePool() noexcept;
+
+    // frees the UBO, the pool can't be used afterwards
+    void terminate(backend::DriverApi& driver) noexcept;
+
+    // Returns the offset in bytes of a new range of at least 'size' bytes. A size of zero
+    // allocates nothing, and returns offset zero.
+    uint32_t allocate(size_t size) noexcept;
+
+    // frees a range returned by allocate(), the same size must be given
+    void free(uint32_t offset, size_t size) noexcept;
+
+    // returns a pointer to the given part of the pool, which is uploaded by the next commit()
+    void* invalidate(uint32_t offset, size_t size) noexcept;
+
+    // returns a pointer to the given part of the pool, for reading
+    void const* getData(uint32_t offset) const noexcept {
+        return reinterpret_cast<char const*>(mStorage.data()) + offset;
+    }
+
+    // (re)creates the UBO if the pool grew, and uploads the invalidated ranges
+    void commit(backend::DriverApi& driver) noexcept;
+
+    backend::Handle<backend::HwUniformBuffer> getHandle() const noexcept { return mHandle; }
+
+    size_t getCapacity() const noexcept { return mCapacity; }
+
+    bool isDirty() const noexcept { return mDirtyBegin != mDirtyEnd; }
+
+private:
+    struct Range {
+        uint32_t offset;
+        uint32_t size;
+    };
+
+    void grow(size_t size) noexcept;
+
+    std::vector<math::float4> mStorage;     // mCapacity + RANGE_SIZE bytes
+    std::vector<Range> mFreeRanges;         // sorted by offset, never adjacent
+    backend::Handle<backend::HwUniformBuffer> mHandle;
+    size_t mCapacity = 0;
+    size_t mHandleCapacity = 0;             // capacity of the pool when mHandle was created
+    uint32_t mDirtyBegin = 0;
+    uint32_t mDirtyEnd = 0;
+};
+
+} // namespace filament
+
+#endif // TNT_FILAMENT_BONEPOOL_H
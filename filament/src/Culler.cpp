@@ -16,26 +16,31 @@
 
 #include "details/Culler.h"
 
+#include "SimdKernel.h"
+
 #include <filament/Box.h>
 
 #include <math/fast.h>
 
+#include <assert.h>
+
 using namespace filament::math;
 
 namespace filament {
 
-void Culler::intersects(
-        result_type* UTILS_RESTRICT results,
-        Frustum const& UTILS_RESTRICT frustum,
+// ------------------------------------------------------------------------------------------------
+// Scalar kernels -- these are the reference implementations
+// ------------------------------------------------------------------------------------------------
+
+static void intersectsScalar(
+        Culler::result_type* UTILS_RESTRICT results,
+        float4 const* UTILS_RESTRICT planes,
         float4 const* UTILS_RESTRICT b,
         size_t count) noexcept {
 
-    float4 const * const UTILS_RESTRICT planes = frustum.mPlanes;
-
     // we use a vectorize width of 8 because, on ARMv8 it allow the compiler to write 8
     // 8-bits results in one go. Without this it has to do 4 separate byte writes, which
     // ends-up being slower.
-    count = round(count); // capacity guaranteed to be multiple of 8
     #pragma clang loop vectorize_width(8)
     for (size_t i = 0; i < count; i++) {
         int visible = ~0;
@@ -51,23 +56,20 @@ void Culler::intersects(
                               planes[j].w - sphere.w;
             visible &= fast::signbit(dot);
         }
-        results[i] = result_type(visible);
+        results[i] = Culler::result_type(visible);
     }
 }
 
-void Culler::intersects(
-        result_type* UTILS_RESTRICT results,
-        Frustum const& UTILS_RESTRICT frustum,
+static void intersectsScalar(
+        Culler::result_type* UTILS_RESTRICT results,
+        float4 const* UTILS_RESTRICT planes,
         float3 const* UTILS_RESTRICT center,
         float3 const* UTILS_RESTRICT extent,
         size_t count, size_t bit) noexcept {
 
-    float4 const * UTILS_RESTRICT const planes = frustum.mPlanes;
-
     // we use a vectorize width of 8 because, on ARMv8 it allows the compiler to write eight
     // 8-bits results in one go. Without this it has to do 4 separate byte writes, which
     // ends-up being slower.
-    count = round(count); // capacity guaranteed to be multiple of 8
     #pragma clang loop vectorize_width(8)
     for (size_t i = 0; i < count; i++) {
         int visible = ~0;
@@ -85,10 +87,245 @@ void Culler::intersects(
             visible &= fast::signbit(dot) << bit;
         }
 
-        results[i] |= result_type(visible);
+        results[i] |= Culler::result_type(visible);
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+// NEON kernels
+// ------------------------------------------------------------------------------------------------
+
+#if defined(FILAMENT_SIMD_USE_NEON)
+
+// Narrows two vectors of 4 sign-bits masks to 8 bytes of 0 or 1
+static inline uint8x8_t narrowSignBits(uint32x4_t lo, uint32x4_t hi) noexcept {
+    return vmovn_u16(vcombine_u16(
+            vmovn_u32(vshrq_n_u32(lo, 31)),
+            vmovn_u32(vshrq_n_u32(hi, 31))));
+}
+
+static void intersectsNeon(
+        Culler::result_type* UTILS_RESTRICT results,
+        float4 const* UTILS_RESTRICT planes,
+        float4 const* UTILS_RESTRICT b,
+        size_t count) noexcept {
+    for (size_t i = 0; i < count; i += 8) {
+        uint32x4_t visible[2];
+        for (size_t h = 0; h < 2; h++) {
+            // de-interleaves 4 spheres into x, y, z and radius vectors
+            const float32x4x4_t s = vld4q_f32(&b[i + h * 4].x);
+            uint32x4_t v = vdupq_n_u32(~0u);
+            for (size_t j = 0; j < 6; j++) {
+                float32x4_t dot = vsubq_f32(vdupq_n_f32(planes[j].w), s.val[3]);
+                dot = vmlaq_n_f32(dot, s.val[0], planes[j].x);
+                dot = vmlaq_n_f32(dot, s.val[1], planes[j].y);
+                dot = vmlaq_n_f32(dot, s.val[2], planes[j].z);
+                v = vandq_u32(v, vreinterpretq_u32_f32(dot));
+            }
+            visible[h] = v;
+        }
+        vst1_u8(results + i, narrowSignBits(visible[0], visible[1]));
     }
 }
 
+static void intersectsNeon(
+        Culler::result_type* UTILS_RESTRICT results,
+        float4 const* UTILS_RESTRICT planes,
+        float3 const* UTILS_RESTRICT center,
+        float3 const* UTILS_RESTRICT extent,
+        size_t count, size_t bit) noexcept {
+    const int8x8_t shift = vdup_n_s8(int8_t(bit));
+    for (size_t i = 0; i < count; i += 8) {
+        uint32x4_t visible[2];
+        for (size_t h = 0; h < 2; h++) {
+            // de-interleaves 4 boxes into x, y and z vectors
+            const float32x4x3_t c = vld3q_f32(&center[i + h * 4].x);
+            const float32x4x3_t e = vld3q_f32(&extent[i + h * 4].x);
+            uint32x4_t v = vdupq_n_u32(~0u);
+            for (size_t j = 0; j < 6; j++) {
+                float32x4_t dot = vdupq_n_f32(planes[j].w);
+                dot = vmlaq_n_f32(dot, c.val[0], planes[j].x);
+                dot = vmlsq_n_f32(dot, e.val[0], std::abs(planes[j].x));
+                dot = vmlaq_n_f32(dot, c.val[1], planes[j].y);
+                dot = vmlsq_n_f32(dot, e.val[1], std::abs(planes[j].y));
+                dot = vmlaq_n_f32(dot, c.val[2], planes[j].z);
+                dot = vmlsq_n_f32(dot, e.val[2], std::abs(planes[j].z));
+                v = vandq_u32(v, vreinterpretq_u32_f32(dot));
+            }
+            visible[h] = v;
+        }
+        const uint8x8_t r = vshl_u8(narrowSignBits(visible[0], visible[1]), shift);
+        vst1_u8(results + i, vorr_u8(vld1_u8(results + i), r));
+    }
+}
+
+#endif // FILAMENT_SIMD_USE_NEON
+
+// ------------------------------------------------------------------------------------------------
+// AVX2 kernels
+// ------------------------------------------------------------------------------------------------
+
+#if defined(FILAMENT_SIMD_USE_AVX2)
+
+// Writes bit 'bit' of results[0..7] from the sign-bits of 'visible'
+FILAMENT_SIMD_AVX2
+static inline void storeSignBits(Culler::result_type* UTILS_RESTRICT results,
+        __m256 visible, size_t bit, bool accumulate) noexcept {
+    const uint32_t mask = uint32_t(_mm256_movemask_ps(visible));
+    for (size_t k = 0; k < 8; k++) {
+        const Culler::result_type r = Culler::result_type(((mask >> k) & 1u) << bit);
+        results[k] = accumulate ? Culler::result_type(results[k] | r) : r;
+    }
+}
+
+FILAMENT_SIMD_AVX2
+static void intersectsAvx2(
+        Culler::result_type* UTILS_RESTRICT results,
+        float4 const* UTILS_RESTRICT planes,
+        float4 const* UTILS_RESTRICT b,
+        size_t count) noexcept {
+    for (size_t i = 0; i < count; i += 8) {
+        // transpose 8 spheres into x, y, z and radius vectors, 4 spheres per 128-bits lane
+        float const* const p = &b[i].x;
+        const __m256 r0 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(p +  0)), _mm_loadu_ps(p + 16), 1);
+        const __m256 r1 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(p +  4)), _mm_loadu_ps(p + 20), 1);
+        const __m256 r2 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(p +  8)), _mm_loadu_ps(p + 24), 1);
+        const __m256 r3 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(p + 12)), _mm_loadu_ps(p + 28), 1);
+        const __m256 t0 = _mm256_unpacklo_ps(r0, r1);
+        const __m256 t1 = _mm256_unpacklo_ps(r2, r3);
+        const __m256 t2 = _mm256_unpackhi_ps(r0, r1);
+        const __m256 t3 = _mm256_unpackhi_ps(r2, r3);
+        const __m256 x = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(1, 0, 1, 0));
+        const __m256 y = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 2, 3, 2));
+        const __m256 z = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(1, 0, 1, 0));
+        const __m256 w = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(3, 2, 3, 2));
+
+        __m256 visible = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (size_t j = 0; j < 6; j++) {
+            __m256 dot = _mm256_sub_ps(_mm256_set1_ps(planes[j].w), w);
+            dot = _mm256_fmadd_ps(_mm256_set1_ps(planes[j].x), x, dot);
+            dot = _mm256_fmadd_ps(_mm256_set1_ps(planes[j].y), y, dot);
+            dot = _mm256_fmadd_ps(_mm256_set1_ps(planes[j].z), z, dot);
+            visible = _mm256_and_ps(visible, dot);
+        }
+        storeSignBits(results + i, visible, 0, false);
+    }
+}
+
+// transpose 8 float3 into x, y and z vectors
+FILAMENT_SIMD_AVX2
+static inline void transpose(float3 const* UTILS_RESTRICT v,
+        __m256& x, __m256& y, __m256& z) noexcept {
+    float const* const p = &v[0].x;
+    // m03 = x0 y0 z0 x1 | x4 y4 z4 x5, m14 = y1 z1 x2 y2 | y5 z5 x6 y6, m25 = z2 x3 y3 z3 | z6 x7 y7 z7
+    const __m256 m03 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(p +  0)), _mm_loadu_ps(p + 12), 1);
+    const __m256 m14 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(p +  4)), _mm_loadu_ps(p + 16), 1);
+    const __m256 m25 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(p +  8)), _mm_loadu_ps(p + 20), 1);
+    const __m256 xy = _mm256_shuffle_ps(m14, m25, _MM_SHUFFLE(2, 1, 3, 2));
+    const __m256 yz = _mm256_shuffle_ps(m03, m14, _MM_SHUFFLE(1, 0, 2, 1));
+    x = _mm256_shuffle_ps(m03, xy, _MM_SHUFFLE(2, 0, 3, 0));
+    y = _mm256_shuffle_ps(yz, xy, _MM_SHUFFLE(3, 1, 2, 0));
+    z = _mm256_shuffle_ps(yz, m25, _MM_SHUFFLE(3, 0, 3, 1));
+}
+
+FILAMENT_SIMD_AVX2
+static void intersectsAvx2(
+        Culler::result_type* UTILS_RESTRICT results,
+        float4 const* UTILS_RESTRICT planes,
+        float3 const* UTILS_RESTRICT center,
+        float3 const* UTILS_RESTRICT extent,
+        size_t count, size_t bit) noexcept {
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+    for (size_t i = 0; i < count; i += 8) {
+        __m256 cx, cy, cz, ex, ey, ez;
+        transpose(center + i, cx, cy, cz);
+        transpose(extent + i, ex, ey, ez);
+
+        __m256 visible = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (size_t j = 0; j < 6; j++) {
+            const __m256 px = _mm256_set1_ps(planes[j].x);
+            const __m256 py = _mm256_set1_ps(planes[j].y);
+            const __m256 pz = _mm256_set1_ps(planes[j].z);
+            __m256 dot = _mm256_set1_ps(planes[j].w);
+            dot = _mm256_fmadd_ps(px, cx, dot);
+            dot = _mm256_fnmadd_ps(_mm256_andnot_ps(signMask, px), ex, dot);
+            dot = _mm256_fmadd_ps(py, cy, dot);
+            dot = _mm256_fnmadd_ps(_mm256_andnot_ps(signMask, py), ey, dot);
+            dot = _mm256_fmadd_ps(pz, cz, dot);
+            dot = _mm256_fnmadd_ps(_mm256_andnot_ps(signMask, pz), ez, dot);
+            visible = _mm256_and_ps(visible, dot);
+        }
+        storeSignBits(results + i, visible, bit, true);
+    }
+}
+
+#endif // FILAMENT_SIMD_USE_AVX2
+
+// ------------------------------------------------------------------------------------------------
+// Kernel dispatch
+// ------------------------------------------------------------------------------------------------
+
+static inline void intersects(Culler::Kernel kernel,
+        Culler::result_type* results, float4 const* planes,
+        float4 const* b, size_t count) noexcept {
+    switch (kernel) {
+#if defined(FILAMENT_SIMD_USE_NEON)
+        case Culler::Kernel::NEON:
+            intersectsNeon(results, planes, b, count);
+            break;
+#endif
+#if defined(FILAMENT_SIMD_USE_AVX2)
+        case Culler::Kernel::AVX2:
+            intersectsAvx2(results, planes, b, count);
+            break;
+#endif
+        default:
+            intersectsScalar(results, planes, b, count);
+            break;
+    }
+}
+
+static inline void intersects(Culler::Kernel kernel,
+        Culler::result_type* results, float4 const* planes,
+        float3 const* center, float3 const* extent, size_t count, size_t bit) noexcept {
+    switch (kernel) {
+#if defined(FILAMENT_SIMD_USE_NEON)
+        case Culler::Kernel::NEON:
+            intersectsNeon(results, planes, center, extent, count, bit);
+            break;
+#endif
+#if defined(FILAMENT_SIMD_USE_AVX2)
+        case Culler::Kernel::AVX2:
+            intersectsAvx2(results, planes, center, extent, count, bit);
+            break;
+#endif
+        default:
+            intersectsScalar(results, planes, center, extent, count, bit);
+            break;
+    }
+}
+
+// ------------------------------------------------------------------------------------------------
+
+void Culler::intersects(
+        result_type* UTILS_RESTRICT results,
+        Frustum const& UTILS_RESTRICT frustum,
+        float4 const* UTILS_RESTRICT b,
+        size_t count) noexcept {
+    count = round(count); // capacity guaranteed to be multiple of 8
+    filament::intersects(getKernel(), results, frustum.mPlanes, b, count);
+}
+
+void Culler::intersects(
+        result_type* UTILS_RESTRICT results,
+        Frustum const& UTILS_RESTRICT frustum,
+        float3 const* UTILS_RESTRICT center,
+        float3 const* UTILS_RESTRICT extent,
+        size_t count, size_t bit) noexcept {
+    count = round(count); // capacity guaranteed to be multiple of 8
+    filament::intersects(getKernel(), results, frustum.mPlanes, center, extent, count, bit);
+}
+
 /*
  * returns whether a box intersects with the frustum
  */
@@ -136,4 +373,22 @@ void Culler::Test::intersects(
     Culler::intersects(results, frustum, b, count);
 }
 
+void Culler::Test::intersects(
+        result_type* UTILS_RESTRICT results,
+        Frustum const& UTILS_RESTRICT frustum,
+        float3 const* UTILS_RESTRICT c,
+        float3 const* UTILS_RESTRICT e,
+        size_t count, Kernel kernel) noexcept {
+    assert(isKernelSupported(kernel));
+    filament::intersects(kernel, results, frustum.mPlanes, c, e, round(count), 0);
+}
+
+void Culler::Test::intersects(
+        result_type* UTILS_RESTRICT results,
+        Frustum const& UTILS_RESTRICT frustum,
+        float4 const* UTILS_RESTRICT b, size_t count, Kernel kernel) noexcept {
+    assert(isKernelSupported(kernel));
+    filament::intersects(kernel, results, frustum.mPlanes, b, round(count));
+}
+
 } // namespace filament
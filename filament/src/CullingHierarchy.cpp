@@ -0,0 +1,329 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "details/CullingHierarchy.h"
+
+#include <utils/JobSystem.h>
+#include <utils/Systrace.h>
+
+#include <math/vec4.h>
+
+#include <algorithm>
+#include <limits>
+
+using namespace filament::math;
+using namespace utils;
+
+namespace filament {
+
+// if refitting grows the root's surface area past this factor, the hierarchy is rebuilt
+static constexpr float REBUILD_SURFACE_AREA_RATIO = 2.0f;
+
+static constexpr uint8_t ALL_PLANES = 0x3F;
+
+CullingHierarchy::CullingHierarchy() noexcept = default;
+
+CullingHierarchy::~CullingHierarchy() noexcept = default;
+
+void CullingHierarchy::clear() noexcept {
+    // swap with empty vectors to actually release the memory
+    std::vector<Node>().swap(mNodes);
+    std::vector<uint32_t>().swap(mIndices);
+    std::vector<Instance>().swap(mInstances);
+    std::vector<float3>().swap(mCenters);
+    std::vector<float3>().swap(mExtents);
+    std::vector<uint8_t>().swap(mDirty);
+    mBuildSurfaceArea = 0.0f;
+}
+
+bool CullingHierarchy::update(Instance const* instances,
+        float3 const* centers, float3 const* extents, size_t count) noexcept {
+    SYSTRACE_CALL();
+
+    // The hierarchy references renderables by index, so it must be rebuilt if any index now
+    // refers to a different renderable.
+    const bool sameRenderables = count == mInstances.size() &&
+            std::equal(mInstances.begin(), mInstances.end(), instances);
+
+    if (UTILS_LIKELY(sameRenderables)) {
+        if (count == 0 || !refit(centers, extents)) {
+            return false;
+        }
+        // the hierarchy degrades as objects move, rebuild it when it gets too loose
+        if (surfaceArea(mNodes[0]) <= mBuildSurfaceArea * REBUILD_SURFACE_AREA_RATIO) {
+            return false;
+        }
+    }
+
+    mInstances.assign(instances, instances + count);
+    build(centers, extents, count);
+    return true;
+}
+
+void CullingHierarchy::build(float3 const* centers, float3 const* extents, size_t count) noexcept {
+    SYSTRACE_CALL();
+
+    mCenters.assign(centers, centers + count);
+    mExtents.assign(extents, extents + count);
+
+    mIndices.resize(count);
+    for (size_t i = 0; i < count; i++) {
+        mIndices[i] = uint32_t(i);
+    }
+
+    mNodes.clear();
+    if (count == 0) {
+        mBuildSurfaceArea = 0.0f;
+        return;
+    }
+
+    // a binary tree with leaves of at least LEAF_SIZE / 2 entries has less than this many nodes
+    mNodes.reserve(2 * ((count + LEAF_SIZE / 2 - 1) / (LEAF_SIZE / 2)));
+    buildRecursive(centers, extents, 0, uint32_t(count));
+    mDirty.resize(mNodes.size());
+    mBuildSurfaceArea = surfaceArea(mNodes[0]);
+}
+
+uint32_t CullingHierarchy::buildRecursive(float3 const* centers, float3 const* extents,
+        uint32_t first, uint32_t count) noexcept {
+    const uint32_t index = uint32_t(mNodes.size());
+    mNodes.push_back({ {}, first, {}, count, 0 });
+    computeLeafBounds(mNodes[index], centers, extents);
+
+    if (count <= LEAF_SIZE) {
+        return index;
+    }
+
+    // split at the median of the largest axis of the centers' bounds
+    float3 cmin(std::numeric_limits<float>::max());
+    float3 cmax(std::numeric_limits<float>::lowest());
+    for (uint32_t i = first, e = first + count; i < e; i++) {
+        cmin = min(cmin, centers[mIndices[i]]);
+        cmax = max(cmax, centers[mIndices[i]]);
+    }
+    const float3 d = cmax - cmin;
+    const size_t axis = (d.x >= d.y && d.x >= d.z) ? 0 : (d.y >= d.z ? 1 : 2);
+
+    const uint32_t half = count / 2;
+    auto const begin = mIndices.begin() + first;
+    std::nth_element(begin, begin + half, begin + count,
+            [centers, axis](uint32_t lhs, uint32_t rhs) {
+                return centers[lhs][axis] < centers[rhs][axis];
+            });
+
+    buildRecursive(centers, extents, first, half);
+    const uint32_t right = buildRecursive(centers, extents, first + half, count - half);
+    mNodes[index].right = right;
+    return index;
+}
+
+void CullingHierarchy::computeLeafBounds(Node& node,
+        float3 const* centers, float3 const* extents) const noexcept {
+    float3 bmin(std::numeric_limits<float>::max());
+    float3 bmax(std::numeric_limits<float>::lowest());
+    uint32_t const* const indices = mIndices.data();
+    for (uint32_t i = node.first, e = node.first + node.count; i < e; i++) {
+        const uint32_t j = indices[i];
+        bmin = min(bmin, centers[j] - extents[j]);
+        bmax = max(bmax, centers[j] + extents[j]);
+    }
+    node.min = bmin;
+    node.max = bmax;
+}
+
+bool CullingHierarchy::refit(float3 const* centers, float3 const* extents) noexcept {
+    SYSTRACE_CALL();
+
+    // find the leaves containing renderables that moved
+    Node* const nodes = mNodes.data();
+    uint8_t* const dirty = mDirty.data();
+    uint32_t const* const indices = mIndices.data();
+    float3* const cachedCenters = mCenters.data();
+    float3* const cachedExtents = mExtents.data();
+    bool changed = false;
+    for (size_t n = 0, c = mNodes.size(); n < c; n++) {
+        Node const& node = nodes[n];
+        bool d = false;
+        if (!node.right) {
+            for (uint32_t i = node.first, e = node.first + node.count; i < e; i++) {
+                const uint32_t j = indices[i];
+                if (cachedCenters[j] != centers[j] || cachedExtents[j] != extents[j]) {
+                    cachedCenters[j] = centers[j];
+                    cachedExtents[j] = extents[j];
+                    d = true;
+                }
+            }
+        }
+        dirty[n] = d;
+        changed = changed || d;
+    }
+
+    if (!changed) {
+        return false;
+    }
+
+    // Children are always stored after their parent, so walking the nodes backwards refits
+    // the hierarchy bottom-up.
+    for (size_t n = mNodes.size(); n-- > 0;) {
+        Node& node = nodes[n];
+        if (!node.right) {
+            if (dirty[n]) {
+                computeLeafBounds(node, centers, extents);
+            }
+        } else {
+            const size_t l = n + 1;
+            const size_t r = node.right;
+            if (dirty[l] || dirty[r]) {
+                node.min = min(nodes[l].min, nodes[r].min);
+                node.max = max(nodes[l].max, nodes[r].max);
+                dirty[n] = true;
+            }
+        }
+    }
+    return true;
+}
+
+float CullingHierarchy::surfaceArea(Node const& node) noexcept {
+    const float3 d = node.max - node.min;
+    return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+// Classifies the node against the planes in 'mask'. Returns 0xFF if the node is fully outside
+// the frustum, otherwise, returns the subset of 'mask' the node straddles.
+static inline uint8_t classify(float4 const* UTILS_RESTRICT planes,
+        float3 const& bmin, float3 const& bmax, uint8_t mask) noexcept {
+    const float3 c = (bmax + bmin) * 0.5f;
+    const float3 e = (bmax - bmin) * 0.5f;
+    uint8_t straddling = 0;
+    for (size_t j = 0; j < 6; j++) {
+        if (mask & (1u << j)) {
+            const float3 n = planes[j].xyz;
+            const float d = dot(n, c) + planes[j].w;
+            const float r = dot(abs(n), e);
+            if (d - r > 0.0f) {
+                return 0xFF;
+            }
+            if (d + r >= 0.0f) {
+                straddling |= uint8_t(1u << j);
+            }
+        }
+    }
+    return straddling;
+}
+
+void CullingHierarchy::gatherTasks(std::vector<Task>& tasks, float4 const* planes,
+        uint32_t index, uint8_t mask) const noexcept {
+    Node const& node = mNodes[index];
+    if (mask) {
+        mask = classify(planes, node.min, node.max, mask);
+        if (mask == 0xFF) {
+            return;
+        }
+    }
+    if (!node.right || node.count <= JOB_SIZE) {
+        tasks.push_back({ index, mask });
+        return;
+    }
+    gatherTasks(tasks, planes, index + 1, mask);
+    gatherTasks(tasks, planes, node.right, mask);
+}
+
+void CullingHierarchy::cullNode(float4 const* UTILS_RESTRICT planes,
+        Culler::result_type* UTILS_RESTRICT results,
+        float3 const* UTILS_RESTRICT centers, float3 const* UTILS_RESTRICT extents,
+        uint32_t index, uint8_t mask, uint8_t bit) const noexcept {
+    Node const& node = mNodes[index];
+    uint32_t const* const UTILS_RESTRICT indices = mIndices.data();
+    const Culler::result_type visible = Culler::result_type(1u << bit);
+
+    if (!mask) {
+        // the whole subtree is inside the frustum
+        for (uint32_t i = node.first, e = node.first + node.count; i < e; i++) {
+            results[indices[i]] |= visible;
+        }
+        return;
+    }
+
+    if (node.right) {
+        for (uint32_t child : { index + 1, node.right }) {
+            Node const& n = mNodes[child];
+            const uint8_t m = classify(planes, n.min, n.max, mask);
+            if (m != 0xFF) {
+                cullNode(planes, results, centers, extents, child, m, bit);
+            }
+        }
+        return;
+    }
+
+    // leaf straddling the frustum, test each renderable against the remaining planes, the same
+    // way Culler::intersects() does.
+    for (uint32_t i = node.first, e = node.first + node.count; i < e; i++) {
+        const uint32_t j = indices[i];
+        bool inside = true;
+        for (size_t p = 0; p < 6; p++) {
+            if (mask & (1u << p)) {
+                const float4 plane = planes[p];
+                const float dot =
+                        plane.x * centers[j].x - std::abs(plane.x) * extents[j].x +
+                        plane.y * centers[j].y - std::abs(plane.y) * extents[j].y +
+                        plane.z * centers[j].z - std::abs(plane.z) * extents[j].z +
+                        plane.w;
+                inside = inside && dot < 0.0f;
+            }
+        }
+        if (inside) {
+            results[j] |= visible;
+        }
+    }
+}
+
+void CullingHierarchy::cull(JobSystem& js, Frustum const& frustum,
+        Culler::result_type* results, float3 const* centers, float3 const* extents,
+        size_t bit) const noexcept {
+    SYSTRACE_CALL();
+
+    if (UTILS_UNLIKELY(mNodes.empty())) {
+        return;
+    }
+
+    float4 const* const planes = frustum.getNormalizedPlanes();
+
+    // Walk the top of the tree on this thread, then hand out the subtrees to the JobSystem.
+    // Subtrees are disjoint, so each renderable's result is written by a single job.
+    std::vector<Task> tasks;
+    tasks.reserve(2 * (mIndices.size() / JOB_SIZE + 1));
+    gatherTasks(tasks, planes, 0, ALL_PLANES);
+
+    Task const* const pTasks = tasks.data();
+    auto functor = [this, pTasks, planes, results, centers, extents, bit]
+            (uint32_t index, uint32_t c) {
+        for (uint32_t i = index, e = index + c; i < e; i++) {
+            cullNode(planes, results, centers, extents,
+                    pTasks[i].node, pTasks[i].planes, uint8_t(bit));
+        }
+    };
+
+    if (tasks.size() <= 1) {
+        functor(0, uint32_t(tasks.size()));
+        return;
+    }
+
+    auto* job = jobs::parallel_for(js, nullptr, 0, uint32_t(tasks.size()),
+            std::ref(functor), jobs::CountSplitter<1, 8>());
+    js.runAndWait(job);
+}
+
+} // namespace filament
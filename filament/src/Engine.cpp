@@ -167,10 +167,11 @@ FEngine::FEngine(Backend backend, Platform* platform, void* sharedGLContext) :
         mPostProcessManager(*this),
         mEntityManager(EntityManager::get()),
         mRenderableManager(*this),
-        mTransformManager(),
+        mTransformManager(&mJobSystem),
         mLightManager(*this),
         mCameraManager(*this),
-        mCommandBufferQueue(CONFIG_MIN_COMMAND_BUFFERS_SIZE, CONFIG_COMMAND_BUFFERS_SIZE),
+        mCommandBufferQueue(CONFIG_MIN_COMMAND_BUFFERS_SIZE, CONFIG_COMMAND_BUFFERS_SIZE,
+                CONFIG_MAX_MIN_COMMAND_BUFFERS_SIZE),
         mPerRenderPassAllocator("per-renderpass allocator", CONFIG_PER_RENDER_PASS_ARENA_SIZE),
         mEngineEpoch(std::chrono::steady_clock::now()),
         mDriverBarrier(1),
@@ -250,6 +251,7 @@ void FEngine::init() {
 
     mPostProcessManager.init();
     mLightManager.init(*this);
+    mRenderableManager.init();
     mDFG = std::make_unique<DFG>(*this);
 }
 
@@ -273,9 +275,13 @@ void FEngine::shutdown() {
 #ifndef NDEBUG
     // print out some statistics about this run
     size_t wm = mCommandBufferQueue.getHighWatermark();
-    size_t wmpct = wm / (CONFIG_COMMAND_BUFFERS_SIZE / 100);
+    size_t wmpct = wm / (mCommandBufferQueue.getSize() / 100);
     slog.d << "CircularBuffer: High watermark "
            << wm / 1024 << " KiB (" << wmpct << "%)" << io::endl;
+    slog.d << "CommandBufferQueue: " << mCommandBufferQueue.getStallCount() << " stalls ("
+           << mCommandBufferQueue.getStallDurationNs() / 1000000 << " ms), "
+           << mCommandBufferQueue.getWaitCount() << " waits ("
+           << mCommandBufferQueue.getWaitDurationNs() / 1000000 << " ms)" << io::endl;
 #endif
 
     DriverApi& driver = getDriverApi();
@@ -823,7 +829,9 @@ void* FEngine::streamAlloc(size_t size, size_t alignment) noexcept {
 bool FEngine::execute() {
 
     // wait until we get command buffers to be executed (or thread exit requested)
-    auto buffers = mCommandBufferQueue.waitForCommands();
+    auto& buffers = mCommandBuffersToExecute;
+    buffers.clear();
+    mCommandBufferQueue.waitForCommands(buffers);
     if (UTILS_UNLIKELY(buffers.empty())) {
         return false;
     }
@@ -1025,6 +1033,22 @@ DebugRegistry& Engine::getDebugRegistry() noexcept {
     return upcast(this)->getDebugRegistry();
 }
 
+size_t Engine::getCommandBufferSize() const noexcept {
+    return upcast(this)->getCommandBufferSize();
+}
+
+size_t Engine::getCommandBufferUsage() const noexcept {
+    return upcast(this)->getCommandBufferUsage();
+}
+
+size_t Engine::getCommandBufferPeakUsage() const noexcept {
+    return upcast(this)->getCommandBufferPeakUsage();
+}
+
+Engine::CommandBufferStats Engine::getCommandBufferStats() const noexcept {
+    return upcast(this)->getCommandBufferStats();
+}
+
 Camera* Engine::createCamera() noexcept {
     return createCamera(upcast(this)->getEntityManager().create());
 }
@@ -69,6 +69,12 @@ void FrameInfoManager::endFrame() {
     mIndex = (mIndex + 1) % POOL_COUNT;
 }
 
+void FrameInfoManager::addRenderPassStats(RenderPassStats const& stats) noexcept {
+    if (mRenderPassCount < mRenderPasses.size()) {
+        mRenderPasses[mRenderPassCount++] = stats;
+    }
+}
+
 void FrameInfoManager::update(Config const& config, FrameInfoManager::duration lastFrameTime) {
     // keep an history of frame times
     auto& history = mFrameTimeHistory;
@@ -77,6 +83,11 @@ void FrameInfoManager::update(Config const& config, FrameInfoManager::duration l
     filament::move_backward(history.begin(), history.end() - 1, history.end());
     history[0].frameTime = lastFrameTime;
 
+    // the render passes recorded since the last call are the ones from the previous frame
+    history[0].renderPasses = mRenderPasses;
+    history[0].renderPassCount = mRenderPassCount;
+    mRenderPassCount = 0;
+
     mFrameTimeHistorySize = std::min(++mFrameTimeHistorySize, uint32_t(MAX_FRAMETIME_HISTORY));
     if (UTILS_UNLIKELY(mFrameTimeHistorySize < 3)) {
         // not enough history to do anything useful
@@ -19,6 +19,8 @@
 
 #include "details/Engine.h"
 
+#include <filament/Renderer.h>
+
 #include "backend/Handle.h"
 
 #include <array>
@@ -30,7 +32,12 @@
 namespace filament {
 class FEngine;
 
+// Driver commands recorded by a RenderPass, see RenderPass::recordDriverCommands()
+using RenderPassStats = Renderer::RenderPassStats;
+
 struct FrameInfo {
+    static constexpr size_t MAX_RENDER_PASS_STATS = 16;
+
     using duration = std::chrono::duration<float>;
     duration frameTime{};            // frame period
     duration denoisedFrameTime{};    // frame period (median filter)
@@ -40,6 +47,10 @@ struct FrameInfo {
         float integral{};
         float error{};
     } pid;
+
+    // render passes of the previous frame, in execution order
+    std::array<RenderPassStats, MAX_RENDER_PASS_STATS> renderPasses{};
+    uint32_t renderPassCount = 0;
 };
 
 class FrameInfoManager {
@@ -70,6 +81,11 @@ public:
         return getLastFrameInfo().frameTime;
     }
 
+    // Records the statistics of a render pass executed during the current frame, they become
+    // visible in getLastFrameInfo() after the next beginFrame(). Passes beyond
+    // FrameInfo::MAX_RENDER_PASS_STATS are ignored.
+    void addRenderPassStats(RenderPassStats const& stats) noexcept;
+
 
 private:
     void update(Config const& config, duration lastFrameTime);
@@ -81,6 +97,10 @@ private:
 
     std::array<FrameInfo, MAX_FRAMETIME_HISTORY> mFrameTimeHistory;
     uint32_t mFrameTimeHistorySize = 0;
+
+    // render passes of the frame being recorded
+    std::array<RenderPassStats, FrameInfo::MAX_RENDER_PASS_STATS> mRenderPasses{};
+    uint32_t mRenderPassCount = 0;
 };
 
 
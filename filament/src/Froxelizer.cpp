@@ -33,6 +33,7 @@
 #include <algorithm>
 
 #include <stddef.h>
+#include <stdlib.h>
 
 using namespace filament::math;
 using namespace utils;
@@ -58,18 +59,26 @@ constexpr size_t FROXEL_BUFFER_WIDTH        = 1u << FROXEL_BUFFER_WIDTH_SHIFT;
 constexpr size_t FROXEL_BUFFER_WIDTH_MASK   = FROXEL_BUFFER_WIDTH - 1u;
 constexpr size_t FROXEL_BUFFER_HEIGHT       = (FROXEL_BUFFER_ENTRY_COUNT_MAX + FROXEL_BUFFER_WIDTH_MASK) / FROXEL_BUFFER_WIDTH;
 
-constexpr size_t RECORD_BUFFER_WIDTH_SHIFT  = 5u;
+// With the large light count, the lights past the light UBO follow the froxels
+constexpr size_t FROXEL_BUFFER_LIGHT_ROW    = FROXEL_BUFFER_LARGE_ENTRY_COUNT_MAX / FROXEL_BUFFER_WIDTH;
+constexpr size_t FROXEL_BUFFER_LARGE_HEIGHT = FROXEL_BUFFER_LIGHT_ROW +
+        (CONFIG_MAX_LARGE_LIGHT_COUNT - CONFIG_MAX_LIGHT_COUNT) / FROXEL_BUFFER_LIGHTS_PER_ROW;
+
+constexpr size_t RECORD_BUFFER_WIDTH_SHIFT  = 6u;
 constexpr size_t RECORD_BUFFER_WIDTH        = 1u << RECORD_BUFFER_WIDTH_SHIFT;
+constexpr size_t RECORD_BUFFER_WIDTH_MASK   = RECORD_BUFFER_WIDTH - 1u;
 
-constexpr size_t RECORD_BUFFER_HEIGHT       = 2048;
-constexpr size_t RECORD_BUFFER_ENTRY_COUNT  = RECORD_BUFFER_WIDTH * RECORD_BUFFER_HEIGHT; // 64K
+constexpr size_t RECORD_BUFFER_ENTRY_COUNT  = 65536;                                            // 64K
+constexpr size_t RECORD_BUFFER_HEIGHT       = RECORD_BUFFER_ENTRY_COUNT / RECORD_BUFFER_WIDTH;
+constexpr size_t RECORD_BUFFER_LARGE_HEIGHT = 2048;
+constexpr size_t RECORD_BUFFER_LARGE_ENTRY_COUNT = RECORD_BUFFER_WIDTH * RECORD_BUFFER_LARGE_HEIGHT; // 128K
 
-// Buffer needed for Froxelizer internal data structures (~256 KiB)
-constexpr size_t PER_FROXELDATA_ARENA_SIZE = sizeof(float4) *
-                                                 (FROXEL_BUFFER_ENTRY_COUNT_MAX +
-                                                  FROXEL_BUFFER_ENTRY_COUNT_MAX + 3 +
-                                                  FEngine::CONFIG_FROXEL_SLICE_COUNT / 4 + 1);
+// With the large light count, lights are assigned per tile of
+// FROXEL_TILE_SIZE x FROXEL_TILE_SIZE x (all slices) froxels.
+constexpr size_t FROXEL_TILE_SIZE = 8;
 
+// number of lights per job when computing the lights' froxel ranges
+constexpr size_t LIGHT_RANGE_JOB_SIZE = 64;
 
 // number of lights processed by one group (e.g. 32)
 static constexpr size_t LIGHT_PER_GROUP = sizeof(Froxelizer::LightGroupType) * 8;
@@ -78,23 +87,86 @@ static constexpr size_t LIGHT_PER_GROUP = sizeof(Froxelizer::LightGroupType) * 8
 static constexpr size_t GROUP_COUNT =
         (CONFIG_MAX_LIGHT_COUNT + LIGHT_PER_GROUP - 1) / LIGHT_PER_GROUP;
 
+// When at most this many lights changed since the last froxelization, only these lights are
+// froxelized again, otherwise all the lights are.
+static constexpr size_t PARTIAL_FROXELIZATION_MAX_LIGHTS = 16;
+
+// Buffer needed for Froxelizer internal data structures (~768 KiB)
+constexpr size_t PER_FROXELDATA_ARENA_SIZE = sizeof(float4) *
+                                                 (FROXEL_BUFFER_LARGE_ENTRY_COUNT_MAX +
+                                                  FROXEL_BUFFER_LARGE_ENTRY_COUNT_MAX + 3 +
+                                                  FEngine::CONFIG_FROXEL_SLICE_COUNT / 4 + 1) +
+                                             // froxel thread data
+                                             sizeof(Froxelizer::LightGroupType) *
+                                                 FROXEL_BUFFER_ENTRY_COUNT_MAX * GROUP_COUNT +
+                                             CACHELINE_SIZE;
+
 
 // record buffer cannot be larger than 65K entries because we're using uint16_t to store indices
 // so its maximum size is 128 KiB
 static_assert(RECORD_BUFFER_ENTRY_COUNT <= 65536,
         "RecordBuffer cannot be larger than 65536 entries");
 
+// with the large light count, offsets are stored on 24 bits
+static_assert(RECORD_BUFFER_LARGE_ENTRY_COUNT <= 65536 * 256,
+        "RecordBuffer cannot be larger than 16M entries");
+
+// the froxel index of the tiles' records is stored on 16 bits
+static_assert(FROXEL_BUFFER_LARGE_ENTRY_COUNT_MAX <= 65536,
+        "Froxel buffer cannot be larger than 65536 entries");
+
+// a row of the froxel buffer (RG_U16) holds a whole number of lights
+static_assert(FROXEL_BUFFER_WIDTH * 2 * sizeof(uint16_t) ==
+        FROXEL_BUFFER_LIGHTS_PER_ROW * sizeof(LightsUib),
+        "Froxel buffer rows must hold FROXEL_BUFFER_LIGHTS_PER_ROW lights");
+
+// textures are guaranteed to be at least 2048 texels high
+static_assert(FROXEL_BUFFER_LARGE_HEIGHT <= 2048 && RECORD_BUFFER_LARGE_HEIGHT <= 2048,
+        "Froxel and record buffers cannot be higher than 2048 rows");
+
 Froxelizer::Froxelizer(FEngine& engine)
         : mArena("froxel", PER_FROXELDATA_ARENA_SIZE) {
 
     DriverApi& driverApi = engine.getDriverApi();
 
-    // RecordBuffer cannot be larger than 65536 entries, because indices are uint16_t
+    // froxel thread data (~256 KiB), it's allocated first so it's not affected by rewind()
+    mFroxelShardedData = {
+            mArena.alloc<FroxelThreadData>(GROUP_COUNT, CACHELINE_SIZE),
+            uint32_t(GROUP_COUNT)
+    };
+    assert(mFroxelShardedData.begin());
+
+    // the buffers for the large light count are only created when it's enabled
+    createBuffers(driverApi);
+}
+
+void Froxelizer::createBuffers(DriverApi& driverApi) noexcept {
     GPUBuffer::ElementType type = std::is_same<RecordBufferType, uint8_t>::value
                                   ? GPUBuffer::ElementType::UINT8 : GPUBuffer::ElementType::UINT16;
-    mRecordsBuffer = GPUBuffer(driverApi, { type, 1 }, RECORD_BUFFER_WIDTH, RECORD_BUFFER_HEIGHT);
+    size_t recordBufferHeight = RECORD_BUFFER_HEIGHT;
+    size_t froxelBufferHeight = FROXEL_BUFFER_HEIGHT;
+    if (UTILS_UNLIKELY(mLargeLightCount)) {
+        type = std::is_same<LargeRecordBufferType, uint8_t>::value
+               ? GPUBuffer::ElementType::UINT8 : GPUBuffer::ElementType::UINT16;
+        recordBufferHeight = RECORD_BUFFER_LARGE_HEIGHT;
+        froxelBufferHeight = FROXEL_BUFFER_LARGE_HEIGHT;
+    }
+    mRecordsBuffer = GPUBuffer(driverApi, { type, 1 }, RECORD_BUFFER_WIDTH, recordBufferHeight);
     mFroxelBuffer  = GPUBuffer(driverApi, { GPUBuffer::ElementType::UINT16, 2 },
-            FROXEL_BUFFER_WIDTH, FROXEL_BUFFER_HEIGHT);
+            FROXEL_BUFFER_WIDTH, froxelBufferHeight);
+    mLargeBuffers = mLargeLightCount;
+}
+
+bool Froxelizer::updateBuffers(DriverApi& driverApi) noexcept {
+    if (UTILS_LIKELY(mLargeBuffers == mLargeLightCount)) {
+        return false;
+    }
+    mRecordsBuffer.terminate(driverApi);
+    mFroxelBuffer.terminate(driverApi);
+    createBuffers(driverApi);
+    // the new buffers must be uploaded
+    mFroxelDataValid = false;
+    return true;
 }
 
 Froxelizer::~Froxelizer() {
@@ -105,10 +177,13 @@ void Froxelizer::terminate(DriverApi& driverApi) noexcept {
     // call reset() on our LinearAllocator arenas
     mArena.reset();
 
+    freeUserBuffers();
+
     mBoundingSpheres = nullptr;
     mPlanesY = nullptr;
     mPlanesX = nullptr;
     mDistancesZ = nullptr;
+    mFroxelShardedData.clear();
 
     mRecordsBuffer.terminate(driverApi);
     mFroxelBuffer.terminate(driverApi);
@@ -122,6 +197,12 @@ void Froxelizer::setOptions(float zLightNear, float zLightFar) noexcept {
     }
 }
 
+void Froxelizer::setLargeLightCountEnabled(bool enabled) noexcept {
+    if (UTILS_UNLIKELY(mLargeLightCount != enabled)) {
+        mLargeLightCount = enabled;
+        mDirtyFlags |= VIEWPORT_CHANGED;
+    }
+}
 
 void Froxelizer::setViewport(filament::Viewport const& viewport) noexcept {
     if (UTILS_UNLIKELY(mViewport != viewport)) {
@@ -138,8 +219,7 @@ void Froxelizer::setProjection(const mat4f& projection, float near, float far) n
     }
 }
 
-bool Froxelizer::prepare(
-        FEngine::DriverApi& driverApi, ArenaScope& arena, filament::Viewport const& viewport,
+bool Froxelizer::prepare(ArenaScope& arena, filament::Viewport const& viewport,
         const mat4f& projection, float projectionNear, float projectionFar) noexcept {
     setViewport(viewport);
     setProjection(projection, projectionNear, projectionFar);
@@ -150,58 +230,81 @@ bool Froxelizer::prepare(
     }
 
     /*
-     * Allocations that need to persists until the driver consumes them are done from
-     * the command stream.
+     * The froxel and record buffers uploaded by commit() are only allocated by froxelizeLights()
+     * when the previous froxelization can't be reused.
      */
 
-    // froxel buffer (~32 KiB)
-    mFroxelBufferUser = {
-            driverApi.allocatePod<FroxelEntry>(FROXEL_BUFFER_ENTRY_COUNT_MAX),
-            FROXEL_BUFFER_ENTRY_COUNT_MAX };
+    if (UTILS_LIKELY(!mLargeLightCount)) {
+        /*
+         * Temporary allocations for processing all froxel data
+         */
 
-    // record buffer (~64 KiB)
-    mRecordBufferUser = {
-            driverApi.allocatePod<RecordBufferType>(RECORD_BUFFER_ENTRY_COUNT),
-            RECORD_BUFFER_ENTRY_COUNT };
+        // light records per froxel (~256 KiB), they're entirely written by
+        // froxelizeAssignRecordsCompress() so they don't need to be initialized
+        mLightRecords = {
+                arena.allocate<LightRecord>(FROXEL_BUFFER_ENTRY_COUNT_MAX, CACHELINE_SIZE),
+                FROXEL_BUFFER_ENTRY_COUNT_MAX };
 
-    /*
-     * Temporary allocations for processing all froxel data
-     */
+        assert(mLightRecords.begin());
+    } else {
+        // the tiles' data is kept from frame to frame instead
+        mLightRecords.clear();
+    }
 
-    // light records per froxel (~256 KiB)
-    mLightRecords = {
-            arena.allocate<LightRecord>(FROXEL_BUFFER_ENTRY_COUNT_MAX, CACHELINE_SIZE),
-            FROXEL_BUFFER_ENTRY_COUNT_MAX };
+    return uniformsNeedUpdating;
+}
 
-    // froxel thread data (~256 KiB)
-    mFroxelShardedData = {
-            arena.allocate<FroxelThreadData>(GROUP_COUNT, CACHELINE_SIZE),
-            uint32_t(GROUP_COUNT)
-    };
+void Froxelizer::allocateUserBuffers() noexcept {
+    // This is called from a job, so these buffers are not allocated in the command stream. They
+    // are freed once commit() has uploaded them.
+    freeUserBuffers();
 
-    assert(mFroxelBufferUser.begin());
-    assert(mRecordBufferUser.begin());
-    assert(mLightRecords.begin());
-    assert(mFroxelShardedData.begin());
+    // froxel buffer (~32 KiB, ~64 KiB w/ large count)
+    const size_t froxelCountMax = mLargeLightCount ?
+            FROXEL_BUFFER_LARGE_ENTRY_COUNT_MAX : FROXEL_BUFFER_ENTRY_COUNT_MAX;
+    mFroxelBufferUser = {
+            (FroxelEntry*)malloc(froxelCountMax * sizeof(FroxelEntry)),
+            froxelCountMax };
+
+    if (UTILS_LIKELY(!mLargeLightCount)) {
+        // record buffer (~64 KiB)
+        mRecordBufferUser = {
+                (RecordBufferType*)malloc(RECORD_BUFFER_ENTRY_COUNT * sizeof(RecordBufferType)),
+                RECORD_BUFFER_ENTRY_COUNT };
+    } else {
+        // record buffer (~256 KiB)
+        mLargeRecordBufferUser = {
+                (LargeRecordBufferType*)malloc(
+                        RECORD_BUFFER_LARGE_ENTRY_COUNT * sizeof(LargeRecordBufferType)),
+                RECORD_BUFFER_LARGE_ENTRY_COUNT };
+    }
 
-    // initialize buffers that need to be
-    memset(mLightRecords.data(), 0, mLightRecords.sizeInBytes());
+    assert(mFroxelBufferUser.begin());
+    assert(mRecordBufferUser.begin() || mLargeRecordBufferUser.begin());
+}
 
-    return uniformsNeedUpdating;
+void Froxelizer::freeUserBuffers() noexcept {
+    // free(nullptr) is a no-op
+    free(mFroxelBufferUser.data());
+    free(mRecordBufferUser.data());
+    free(mLargeRecordBufferUser.data());
+    mFroxelBufferUser.clear();
+    mRecordBufferUser.clear();
+    mLargeRecordBufferUser.clear();
 }
 
 void Froxelizer::computeFroxelLayout(
         uint2* dim, uint16_t* countX, uint16_t* countY, uint16_t* countZ,
-        filament::Viewport const& viewport) noexcept {
+        filament::Viewport const& viewport, size_t froxelCountMax) noexcept {
 
     if (USE_NON_SQUARE_FROXELS == false) {
         const uint32_t width  = std::max(16u, viewport.width);
         const uint32_t height = std::max(16u, viewport.height);
 
-        // calculate froxel dimension from FROXEL_BUFFER_ENTRY_COUNT_MAX and viewport
+        // calculate froxel dimension from froxelCountMax and viewport
         // - Start from the maximum number of froxels we can use in the x-y plane
         size_t froxelSliceCount = FEngine::CONFIG_FROXEL_SLICE_COUNT;
-        size_t froxelPlaneCount = FROXEL_BUFFER_ENTRY_COUNT_MAX / froxelSliceCount;
+        size_t froxelPlaneCount = froxelCountMax / froxelSliceCount;
         // - compute the number of square froxels we need in width and height, rounded down
         //   solving: |  froxelCountX * froxelCountY == froxelPlaneCount
         //            |  froxelCountX / froxelCountY == width / height
@@ -247,7 +350,10 @@ bool Froxelizer::update() noexcept {
 
         uint2 froxelDimension;
         uint16_t froxelCountX, froxelCountY, froxelCountZ;
-        computeFroxelLayout(&froxelDimension, &froxelCountX, &froxelCountY, &froxelCountZ, viewport);
+        const size_t froxelCountMax = mLargeLightCount ?
+                FROXEL_BUFFER_LARGE_ENTRY_COUNT_MAX : FROXEL_BUFFER_ENTRY_COUNT_MAX;
+        computeFroxelLayout(&froxelDimension, &froxelCountX, &froxelCountY, &froxelCountZ,
+                viewport, froxelCountMax);
 
         mFroxelDimension = froxelDimension;
         mClipToFroxelX = (0.5f * viewport.width)  / froxelDimension.x;
@@ -261,7 +367,7 @@ bool Froxelizer::update() noexcept {
                << froxelDimension.x << "x" << froxelDimension.y << io::endl
                << "Froxel: " << froxelCountX << "x" << froxelCountY << "x" << froxelCountZ
                << " = " << (froxelCountX * froxelCountY * froxelCountZ)
-               << " (" << FROXEL_BUFFER_ENTRY_COUNT_MAX - froxelCountX * froxelCountY * froxelCountZ << " lost)"
+               << " (" << froxelCountMax - froxelCountX * froxelCountY * froxelCountZ << " lost)"
                << io::endl;
 #endif
 
@@ -272,6 +378,11 @@ bool Froxelizer::update() noexcept {
         const uint16_t froxelCount = uint16_t(froxelCountX * froxelCountY * froxelCountZ);
         mFroxelCount = froxelCount;
 
+        // with the large light count, the light lists are built per tile
+        mTileCountX = uint16_t((froxelCountX + FROXEL_TILE_SIZE - 1) / FROXEL_TILE_SIZE);
+        mTileCountY = uint16_t((froxelCountY + FROXEL_TILE_SIZE - 1) / FROXEL_TILE_SIZE);
+        mTiles.resize(mLargeLightCount ? mTileCountX * mTileCountY : 0);
+
         if (mDistancesZ) {
             // this is a LinearAllocator arena, use rewind() instead of free (which is a no op).
             mArena.rewind(mDistancesZ);
@@ -463,6 +574,8 @@ bool Froxelizer::update() noexcept {
     }
     assert(mZLightNear >= mNear);
     mDirtyFlags = 0;
+    // the froxels changed, the previous froxelization can't be reused
+    mFroxelDataValid = false;
     return uniformsNeedUpdating;
 }
 
@@ -511,27 +624,82 @@ std::pair<size_t, size_t> Froxelizer::clipToIndices(float2 const& clip) const no
 
 
 void Froxelizer::commit(backend::DriverApi& driverApi) {
-    // send data to GPU
-    mFroxelBuffer.commit(driverApi, mFroxelBufferUser);
-    mRecordsBuffer.commit(driverApi, mRecordBufferUser);
-#ifndef NDEBUG
+    // updateBuffers() must have been called
+    assert(mLargeBuffers == mLargeLightCount);
+
+    if (mFroxelDataReused) {
+        // the GPU buffers are up-to-date, and nothing was allocated
+        return;
+    }
+
+    // send data to GPU, only the rows in use are uploaded
+    const size_t froxelCount = (mFroxelCount + FROXEL_BUFFER_WIDTH_MASK) & ~FROXEL_BUFFER_WIDTH_MASK;
+    const size_t recordCount = std::max(RECORD_BUFFER_WIDTH,
+            (mRecordCount + RECORD_BUFFER_WIDTH_MASK) & ~RECORD_BUFFER_WIDTH_MASK);
+    assert(froxelCount <= mFroxelBufferUser.size());
+
+    auto freeCallback = [](void* buffer, size_t, void*) { free(buffer); };
+    mFroxelBuffer.commit(driverApi,
+            mFroxelBufferUser.cbegin(), mFroxelBufferUser.cbegin() + froxelCount, freeCallback);
+    if (UTILS_LIKELY(!mLargeLightCount)) {
+        assert(recordCount <= mRecordBufferUser.size());
+        mRecordsBuffer.commit(driverApi,
+                mRecordBufferUser.cbegin(), mRecordBufferUser.cbegin() + recordCount,
+                freeCallback);
+    } else {
+        assert(recordCount <= mLargeRecordBufferUser.size());
+        mRecordsBuffer.commit(driverApi,
+                mLargeRecordBufferUser.cbegin(), mLargeRecordBufferUser.cbegin() + recordCount,
+                freeCallback);
+    }
+
+    // the buffers are now owned by the driver
     mFroxelBufferUser.clear();
     mRecordBufferUser.clear();
-    mFroxelShardedData.clear();
-#endif
+    mLargeRecordBufferUser.clear();
+}
+
+void Froxelizer::commitLights(backend::DriverApi& driverApi,
+        LightsUib const* begin, LightsUib const* end,
+        backend::BufferDescriptor::Callback callback) noexcept {
+    // updateBuffers() must have been called
+    assert(mLargeBuffers && mLargeLightCount);
+    assert(size_t(end - begin) % FROXEL_BUFFER_LIGHTS_PER_ROW == 0);
+    mFroxelBuffer.commit(driverApi, FROXEL_BUFFER_LIGHT_ROW, begin, end, callback);
 }
 
 void Froxelizer::froxelizeLights(FEngine& engine,
         CameraInfo const& UTILS_RESTRICT camera,
         const FScene::LightSoa& UTILS_RESTRICT lightData) noexcept {
     // note: this is called asynchronously
-    froxelizeLoop(engine, camera, lightData);
-    froxelizeAssignRecordsCompress();
+    computeLightParams(engine, camera, lightData);
+
+    // when neither the froxels nor the lights changed, the GPU buffers are still valid
+    mFroxelDataReused = mFroxelDataValid && mChangedLights.empty();
+    if (mFroxelDataReused) {
+        return;
+    }
+
+    allocateUserBuffers();
+
+    if (UTILS_LIKELY(!mLargeLightCount)) {
+        if (mFroxelDataValid && mChangedLights.size() <= PARTIAL_FROXELIZATION_MAX_LIGHTS) {
+            froxelizeChangedLights();
+        } else {
+            froxelizeLoop(engine);
+        }
+        froxelizeAssignRecordsCompress();
+        mDroppedTileCount = 0;
+    } else {
+        froxelizeTiles(engine);
+    }
+    mFroxelDataValid = true;
 
 #ifndef NDEBUG
     if (lightData.size()) {
         // go through every froxel
         auto const& recordBufferUser(mRecordBufferUser);
+        auto const& largeRecordBufferUser(mLargeRecordBufferUser);
         auto gpuFroxelEntries(mFroxelBufferUser);
         gpuFroxelEntries.set(gpuFroxelEntries.begin(),
                 mFroxelCountX * mFroxelCountY * mFroxelCountZ);
@@ -539,10 +707,12 @@ void Froxelizer::froxelizeLights(FEngine& engine,
             // go through every lights for that froxel
             for (size_t i = 0; i < entry.count; i++) {
                 // get the light index
-                assert(entry.offset + i < RECORD_BUFFER_ENTRY_COUNT);
+                assert(entry.getOffset() + i < mRecordCount);
 
-                size_t lightIndex = recordBufferUser[entry.offset + i];
-                assert(lightIndex <= CONFIG_MAX_LIGHT_INDEX);
+                size_t lightIndex = mLargeLightCount ?
+                        largeRecordBufferUser[entry.getOffset() + i] :
+                        recordBufferUser[entry.getOffset() + i];
+                assert(lightIndex <= CONFIG_MAX_LARGE_LIGHT_INDEX);
 
                 // make sure it corresponds to an existing light
                 assert(lightIndex < lightData.size() - FScene::DIRECTIONAL_LIGHTS_COUNT);
@@ -552,43 +722,87 @@ void Froxelizer::froxelizeLights(FEngine& engine,
 #endif
 }
 
-void Froxelizer::froxelizeLoop(FEngine& engine,
+void Froxelizer::computeLightParams(FEngine& engine,
         const CameraInfo& UTILS_RESTRICT camera,
         const FScene::LightSoa& UTILS_RESTRICT lightData) noexcept {
     SYSTRACE_CALL();
 
-    Slice<FroxelThreadData> froxelThreadData = mFroxelShardedData;
-    memset(froxelThreadData.data(), 0, froxelThreadData.sizeInBytes());
-
     auto& lcm = engine.getLightManager();
     auto const* UTILS_RESTRICT spheres      = lightData.data<FScene::POSITION_RADIUS>();
     auto const* UTILS_RESTRICT directions   = lightData.data<FScene::DIRECTION>();
     auto const* UTILS_RESTRICT instances    = lightData.data<FScene::LIGHT_INSTANCE>();
+    const size_t lightCount = lightData.size() - FScene::DIRECTIONAL_LIGHTS_COUNT;
+    const size_t previousLightCount = mLightParams.size();
 
-    auto process = [ this, &froxelThreadData,
-                     spheres, directions, instances, &camera, &lcm ]
-            (size_t count, size_t offset, size_t stride) {
+    // Lights are compared in view-space, which takes the camera into account. The lights that
+    // were removed count as changed too.
+    mChangedLights.clear();
+    mLightParams.resize(std::max(lightCount, previousLightCount));
+    mLightChanged.resize(lightCount);
 
-        const mat4f& projection = mProjection;
+    auto compute = [ this, &lcm, &camera, spheres, directions, instances, previousLightCount ]
+            (uint32_t first, uint32_t count) {
         const mat3f& vn = camera.view.upperLeft();
-
-        for (size_t i = offset; i < count; i += stride) {
+        for (size_t i = first; i < first + count; i++) {
             const size_t j = i + FScene::DIRECTIONAL_LIGHTS_COUNT;
             FLightManager::Instance li = instances[j];
-            LightParams light = {
+            const LightParams light = {
                     .position = (camera.view * float4{ spheres[j].xyz, 1 }).xyz, // to view-space
                     .cosSqr = lcm.getCosOuterSquared(li),   // spot only
                     .axis = vn * directions[j],             // spot only
                     .invSin = lcm.getSinInverse(li),        // spot only
                     .radius = spheres[j].w,
             };
+            const bool changed = i >= previousLightCount ||
+                    memcmp(&mLightParams[i], &light, sizeof(light)) != 0;
+            if (changed) {
+                mLightParams[i] = light;
+            }
+            mLightChanged[i] = changed;
+        }
+    };
+
+    if (UTILS_LIKELY(!mLargeLightCount)) {
+        compute(0, uint32_t(lightCount));
+    } else {
+        // there can be thousands of lights
+        JobSystem& js = engine.getJobSystem();
+        auto* job = jobs::parallel_for(js, nullptr, 0, uint32_t(lightCount),
+                std::cref(compute), jobs::CountSplitter<LIGHT_RANGE_JOB_SIZE, 8>());
+        js.runAndWait(job);
+    }
+
+    for (size_t i = 0; i < lightCount; i++) {
+        if (mLightChanged[i]) {
+            mChangedLights.push_back(uint16_t(i));
+        }
+    }
+    for (size_t i = lightCount; i < previousLightCount; i++) {
+        mChangedLights.push_back(uint16_t(i));
+    }
+
+    mLightParams.resize(lightCount);
+}
+
+void Froxelizer::froxelizeLoop(FEngine& engine) noexcept {
+    SYSTRACE_CALL();
 
+    Slice<FroxelThreadData> froxelThreadData = mFroxelShardedData;
+    memset(froxelThreadData.data(), 0, froxelThreadData.sizeInBytes());
+
+    auto process = [ this, &froxelThreadData ]
+            (size_t count, size_t offset, size_t stride) {
+
+        const mat4f& projection = mProjection;
+        LightParams const* const UTILS_RESTRICT lights = mLightParams.data();
+
+        for (size_t i = offset; i < count; i += stride) {
             const size_t group = i % GROUP_COUNT;
             const size_t bit   = i / GROUP_COUNT;
             assert(bit < LIGHT_PER_GROUP);
 
             FroxelThreadData& threadData = froxelThreadData[group];
-            froxelizePointAndSpotLight(threadData, bit, projection, light);
+            froxelizePointAndSpotLight(threadData, bit, projection, lights[i]);
         }
     };
 
@@ -600,16 +814,39 @@ void Froxelizer::froxelizeLoop(FEngine& engine,
         auto *parent = js.createJob();
         for (size_t i = 0; i < GROUP_COUNT; i++) {
             js.run(jobs::createJob(js, parent, std::cref(process),
-                    lightData.size() - FScene::DIRECTIONAL_LIGHTS_COUNT, i, GROUP_COUNT));
+                    mLightParams.size(), i, GROUP_COUNT));
         }
         js.runAndWait(parent);
     } else {
         js.runAndWait(jobs::createJob(js, nullptr, std::cref(process),
-                lightData.size() - FScene::DIRECTIONAL_LIGHTS_COUNT, 0, 1)
+                mLightParams.size(), 0, 1)
         );
     }
 }
 
+void Froxelizer::froxelizeChangedLights() noexcept {
+    SYSTRACE_CALL();
+
+    // The froxel thread data still holds the previous froxelization, each light that changed is
+    // removed from all the froxels, and added back to the ones it now intersects.
+    Slice<FroxelThreadData> froxelThreadData = mFroxelShardedData;
+    const mat4f& projection = mProjection;
+    for (uint16_t i : mChangedLights) {
+        const size_t group = i % GROUP_COUNT;
+        const size_t bit   = i / GROUP_COUNT;
+        assert(bit < LIGHT_PER_GROUP);
+
+        FroxelThreadData& threadData = froxelThreadData[group];
+        const LightGroupType mask = ~(LightGroupType(1) << bit);
+        for (LightGroupType& froxel : threadData) { // this gets vectorized
+            froxel &= mask;
+        }
+        if (i < mLightParams.size()) {
+            froxelizePointAndSpotLight(threadData, bit, projection, mLightParams[i]);
+        }
+    }
+}
+
 void Froxelizer::froxelizeAssignRecordsCompress() noexcept {
 
     SYSTRACE_CALL();
@@ -705,7 +942,7 @@ void Froxelizer::froxelizeAssignRecordsCompress() noexcept {
         } while(records[i].lights == b.lights);
     }
 out_of_memory:
-    ;
+    mRecordCount = offset;
 }
 
 static inline float2 project(mat4f const& p, float3 const& v) noexcept {
@@ -730,8 +967,7 @@ static inline float2 project(mat4f const& p, float3 const& v) noexcept {
     return float2{ x, y } * (1 / w);
 }
 
-void Froxelizer::froxelizePointAndSpotLight(
-        FroxelThreadData& froxelThread, size_t bit,
+bool Froxelizer::computeFroxelRange(FroxelRange* range,
         mat4f const& UTILS_RESTRICT p,
         const Froxelizer::LightParams& UTILS_RESTRICT light) const noexcept {
 
@@ -739,15 +975,12 @@ void Froxelizer::froxelizePointAndSpotLight(
         // This light is fully behind LightFar, it doesn't light anything
         // (we could avoid this check if we culled lights using LightFar instead of the
         // culling camera's far plane)
-        return;
+        return false;
     }
 
-    // the code below works with radius^2
-    const float4 s = { light.position, light.radius * light.radius };
-
 #ifdef DEBUG_FROXEL
     const size_t x0 = 0;
-    const size_t x1 = mFroxelCountX;
+    const size_t x1 = mFroxelCountX - 1;
     const size_t y0 = 0;
     const size_t y1 = mFroxelCountY - 1;
     const size_t z0 = 0;
@@ -776,15 +1009,34 @@ void Froxelizer::froxelizePointAndSpotLight(
     const size_t z0 = findSliceZ(znear);
 
     const auto imax = clipToIndices(max(xyRightNear, xyRightFar));
-    const size_t x1 = imax.first  + 1;  // x1 points to 1 past the last value (like end() does
-    const size_t y1 = imax.second;      // y1 points to the last value
-    const size_t z1 = findSliceZ(zfar); // z1 points to the last value
+    const size_t x1 = imax.first;
+    const size_t y1 = imax.second;
+    const size_t z1 = findSliceZ(zfar);
 
-    assert(x0 < x1);
+    assert(x0 <= x1);
     assert(y0 <= y1);
     assert(z0 <= z1);
 #endif
 
+    *range = { uint16_t(x0), uint16_t(x1), uint16_t(y0), uint16_t(y1), uint16_t(z0), uint16_t(z1) };
+    return true;
+}
+
+template<typename Emitter>
+void Froxelizer::froxelizeRange(Emitter& emit, FroxelRange const& range,
+        mat4f const& UTILS_RESTRICT p,
+        const Froxelizer::LightParams& UTILS_RESTRICT light) const noexcept {
+
+    // the code below works with radius^2
+    const float4 s = { light.position, light.radius * light.radius };
+
+    const size_t x0 = range.x0;
+    const size_t x1 = range.x1 + 1u;    // x1 points to 1 past the last value (like end() does)
+    const size_t y0 = range.y0;
+    const size_t y1 = range.y1;         // y1 points to the last value
+    const size_t z0 = range.z0;
+    const size_t z1 = range.z1;         // z1 points to the last value
+
     const size_t zcenter = findSliceZ(s.z);
     float4 const * const UTILS_RESTRICT planesX = mPlanesX;
     float4 const * const UTILS_RESTRICT planesY = mPlanesY;
@@ -858,12 +1110,12 @@ void Froxelizer::froxelizePointAndSpotLight(
                             // see if this froxel intersects the cone
                             bool intersect = sphereConeIntersectionFast(boundingSpheres[fi],
                                     light.position, light.axis, light.invSin, light.cosSqr);
-                            froxelThread[fi++] |= LightGroupType(intersect) << bit;
+                            emit(fi++, intersect);
                         }
                     } else {
                         // this loops gets vectorized (on arm64) w/ clang
                         while (bx++ != ex) {
-                            froxelThread[fi++] |= LightGroupType(1) << bit;
+                            emit(fi++, true);
                         }
                     }
                 }
@@ -872,6 +1124,185 @@ void Froxelizer::froxelizePointAndSpotLight(
     }
 }
 
+void Froxelizer::froxelizePointAndSpotLight(
+        FroxelThreadData& froxelThread, size_t bit,
+        mat4f const& UTILS_RESTRICT p,
+        const Froxelizer::LightParams& UTILS_RESTRICT light) const noexcept {
+
+    FroxelRange range;
+    if (UTILS_UNLIKELY(!computeFroxelRange(&range, p, light))) {
+        return;
+    }
+
+    struct {
+        FroxelThreadData& froxelThread;
+        size_t bit;
+        void operator()(size_t fi, bool intersect) noexcept {
+            froxelThread[fi] |= LightGroupType(intersect) << bit;
+        }
+    } emit{ froxelThread, bit };
+
+    froxelizeRange(emit, range, p, light);
+}
+
+void Froxelizer::froxelizeTiles(FEngine& engine) noexcept {
+    SYSTRACE_CALL();
+
+    // The light assignment is hierarchical: lights are first binned into tiles of froxels with
+    // their froxel-space bounding box, and then only tested against the froxels of the tiles
+    // they overlap. The cost is proportional to the number of overlaps, instead of the number
+    // of lights times the number of froxels. The light lists are built per tile, which doesn't
+    // require a bit per light and per froxel.
+
+    JobSystem& js = engine.getJobSystem();
+    const size_t lightCount = mLightParams.size();
+    assert(lightCount <= CONFIG_MAX_LARGE_LIGHT_COUNT);
+
+    mLightRanges.resize(lightCount);
+
+    // 1. compute the froxel-space bounding-box of each light
+
+    auto computeRanges = [ this ](uint32_t first, uint32_t count) {
+        const mat4f& projection = mProjection;
+        for (size_t i = first; i < first + count; i++) {
+            if (!computeFroxelRange(&mLightRanges[i], projection, mLightParams[i])) {
+                // empty range, this light doesn't light anything
+                mLightRanges[i] = { 1, 0, 1, 0, 1, 0 };
+            }
+        }
+    };
+
+    auto* job = jobs::parallel_for(js, nullptr, 0, uint32_t(lightCount),
+            std::ref(computeRanges), jobs::CountSplitter<LIGHT_RANGE_JOB_SIZE, 8>());
+    js.runAndWait(job);
+
+    // 2. bin the lights into tiles, the lights stay sorted by distance to the camera
+
+    TileData* const tiles = mTiles.data();
+    for (TileData& tile : mTiles) {
+        tile.lights.clear();
+    }
+
+    const size_t tileCountX = mTileCountX;
+    for (size_t i = 0; i < lightCount; i++) {
+        FroxelRange const& range = mLightRanges[i];
+        if (UTILS_UNLIKELY(range.x0 > range.x1)) {
+            continue;
+        }
+        for (size_t ty = range.y0 / FROXEL_TILE_SIZE; ty <= range.y1 / FROXEL_TILE_SIZE; ty++) {
+            for (size_t tx = range.x0 / FROXEL_TILE_SIZE; tx <= range.x1 / FROXEL_TILE_SIZE; tx++) {
+                tiles[tx + ty * tileCountX].lights.push_back(uint16_t(i));
+            }
+        }
+    }
+
+    // 3. find the froxels of each tile that its lights intersect
+
+    auto intersect = [ this, tiles, tileCountX ](uint32_t first, uint32_t count) {
+        const mat4f& projection = mProjection;
+
+        struct Emitter {
+            std::vector<uint32_t>& records;
+            uint32_t light;
+            void operator()(size_t fi, bool intersect) noexcept {
+                // records are sorted by froxel first, then by light
+                if (intersect) {
+                    records.push_back(uint32_t(fi << 16u) | light);
+                }
+            }
+        };
+
+        for (size_t t = first; t < first + count; t++) {
+            TileData& tile = tiles[t];
+            const size_t tx0 = (t % tileCountX) * FROXEL_TILE_SIZE;
+            const size_t ty0 = (t / tileCountX) * FROXEL_TILE_SIZE;
+            const size_t tx1 = std::min(tx0 + FROXEL_TILE_SIZE, size_t(mFroxelCountX)) - 1;
+            const size_t ty1 = std::min(ty0 + FROXEL_TILE_SIZE, size_t(mFroxelCountY)) - 1;
+
+            tile.records.clear();
+            Emitter emit{ tile.records, 0 };
+            for (uint16_t l : tile.lights) {
+                FroxelRange range = mLightRanges[l];
+                range.x0 = uint16_t(std::max(size_t(range.x0), tx0));
+                range.x1 = uint16_t(std::min(size_t(range.x1), tx1));
+                range.y0 = uint16_t(std::max(size_t(range.y0), ty0));
+                range.y1 = uint16_t(std::min(size_t(range.y1), ty1));
+                emit.light = l;
+                froxelizeRange(emit, range, projection, mLightParams[l]);
+            }
+
+            std::sort(tile.records.begin(), tile.records.end());
+        }
+    };
+
+    job = jobs::parallel_for(js, nullptr, 0, uint32_t(mTiles.size()),
+            std::ref(intersect), jobs::CountSplitter<1, 8>());
+    js.runAndWait(job);
+
+    // 4. allocate the records of the tiles in order, so the froxels left empty when the record
+    //    buffer is full are always the same (i.e. the ones of the last tiles)
+
+    uint32_t recordCount = 0;
+    uint32_t droppedTileCount = 0;
+    for (TileData& tile : mTiles) {
+        const size_t size = tile.records.size();
+        if (UTILS_UNLIKELY(droppedTileCount || recordCount + size > RECORD_BUFFER_LARGE_ENTRY_COUNT)) {
+            // the froxels of this tile are left empty
+            droppedTileCount += size ? 1 : 0;
+            tile.records.clear();
+            continue;
+        }
+        tile.offset = recordCount;
+        recordCount += uint32_t(size);
+    }
+
+#ifndef NDEBUG
+    if (droppedTileCount) {
+        slog.d << "out of space: " << droppedTileCount << " tiles dropped" << io::endl;
+    }
+#endif
+    SYSTRACE_VALUE32("froxelDroppedTiles", droppedTileCount);
+
+    // 5. write the records and the froxels of each tile, froxels without lights stay empty
+
+    FroxelEntry* const UTILS_RESTRICT froxels = mFroxelBufferUser.data();
+    memset(froxels, 0, mFroxelCount * sizeof(FroxelEntry));
+
+    auto assign = [ this, tiles, froxels ](uint32_t first, uint32_t count) {
+        LargeRecordBufferType* const UTILS_RESTRICT froxelRecords = mLargeRecordBufferUser.data();
+        for (size_t t = first; t < first + count; t++) {
+            TileData const& tile = tiles[t];
+            const size_t size = tile.records.size();
+            const uint32_t offset = tile.offset;
+            uint32_t const* const UTILS_RESTRICT records = tile.records.data();
+            LargeRecordBufferType* const UTILS_RESTRICT lights = froxelRecords + offset;
+            for (size_t i = 0, w = 0; i < size;) {
+                const uint32_t fi = records[i] >> 16u;
+                const size_t begin = w;
+                do {
+                    // We have a limitation of 255 lights per froxel.
+                    lights[w] = LargeRecordBufferType(records[i] & 0xFFFFu);
+                    w += (w - begin < 255) ? 1 : 0;
+                    i++;
+                } while (i < size && (records[i] >> 16u) == fi);
+
+                FroxelEntry entry;
+                entry.offset = uint16_t(offset + begin);
+                entry.count = uint8_t(w - begin);
+                entry.offsetHigh = uint8_t((offset + begin) >> 16u);
+                froxels[fi].u32 = entry.u32;
+            }
+        }
+    };
+
+    job = jobs::parallel_for(js, nullptr, 0, uint32_t(mTiles.size()),
+            std::ref(assign), jobs::CountSplitter<1, 8>());
+    js.runAndWait(job);
+
+    mRecordCount = recordCount;
+    mDroppedTileCount = droppedTileCount;
+}
+
 /*
  *
  * lightTree            output the light tree structure there (must be large enough to hold a complete tree)
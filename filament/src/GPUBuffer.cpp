@@ -117,11 +117,15 @@ void GPUBuffer::terminate(backend::DriverApi& driverApi) noexcept {
     driverApi.destroyTexture(mTexture);
 }
 
-void GPUBuffer::commitSlow(backend::DriverApi& driverApi, void const* begin, void const* end) noexcept {
+void GPUBuffer::commitSlow(backend::DriverApi& driverApi, size_t firstRow,
+        void const* begin, void const* end,
+        backend::BufferDescriptor::Callback callback) noexcept {
     const uintptr_t sizeInBytes = uintptr_t(end) - uintptr_t(begin);
-    assert(sizeInBytes <= mRowSizeInBytes * mHeight);
-    driverApi.update2DImage(mTexture, 0, 0, 0, mWidth, mHeight,
-            { begin, sizeInBytes, mFormat, mType });
+    assert(sizeInBytes % mRowSizeInBytes == 0);
+    const uint32_t rowCount = uint32_t(sizeInBytes / mRowSizeInBytes);
+    assert(firstRow + rowCount <= mHeight);
+    driverApi.update2DImage(mTexture, 0, 0, uint32_t(firstRow), mWidth, rowCount,
+            { begin, sizeInBytes, mFormat, mType, callback });
 }
 
 } // namespace filament
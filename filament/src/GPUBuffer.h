@@ -17,6 +17,7 @@
 #ifndef TNT_FILAMENT_DETAILS_GPUBUFFER_H
 #define TNT_FILAMENT_DETAILS_GPUBUFFER_H
 
+#include <backend/BufferDescriptor.h>
 #include <backend/DriverEnums.h>
 #include <backend/Handle.h>
 
@@ -61,9 +62,24 @@ public:
 
     size_t getSize() const noexcept { return mSize; }
 
-    // source data isn't copied and must stay valid until the command-buffer is executed
+    size_t getRowSizeInBytes() const noexcept { return mRowSizeInBytes; }
+
+    // Source data isn't copied and must stay valid until the command-buffer is executed.
+    // Only the rows covered by the source data are updated, the last one must be complete.
     void commit(backend::DriverApi& driverApi, void const* begin, void const* end) noexcept {
-        commitSlow(driverApi, begin, end);
+        commitSlow(driverApi, 0, begin, end, nullptr);
+    }
+
+    // same as above, but the source data is released by the callback once it has been consumed
+    void commit(backend::DriverApi& driverApi, void const* begin, void const* end,
+            backend::BufferDescriptor::Callback callback) noexcept {
+        commitSlow(driverApi, 0, begin, end, callback);
+    }
+
+    // same as above, but the rows starting at firstRow are updated
+    void commit(backend::DriverApi& driverApi, size_t firstRow, void const* begin, void const* end,
+            backend::BufferDescriptor::Callback callback) noexcept {
+        commitSlow(driverApi, firstRow, begin, end, callback);
     }
 
     template<typename T>
@@ -85,7 +101,9 @@ private:
     backend::SamplerParams getSamplerParams() const noexcept { return backend::SamplerParams{}; }
 
 private:
-    void commitSlow(backend::DriverApi& driverApi, void const* begin, void const* end) noexcept;
+    void commitSlow(backend::DriverApi& driverApi, size_t firstRow,
+            void const* begin, void const* end,
+            backend::BufferDescriptor::Callback callback) noexcept;
 
     backend::Handle<backend::HwTexture> mTexture;
     uint32_t mSize = 0;
@@ -376,6 +376,12 @@ Handle<HwProgram> FMaterial::getSurfaceProgramSlow(uint8_t variantKey)
     if (Variant(variantKey).hasSkinningOrMorphing()) {
         pb.setUniformBlock(BindingPoints::PER_RENDERABLE_BONES,
                 UibGenerator::getPerRenderableBonesUib().getName());
+        pb.setUniformBlock(BindingPoints::PER_RENDERABLE_MORPHING,
+                UibGenerator::getPerRenderableMorphingUib().getName());
+        if (mSamplerBindings.hasMorphTargets()) {
+            addSamplerGroup(pb, BindingPoints::PER_RENDERABLE_MORPHING,
+                    SibGenerator::getPerRenderableMorphingSib(variantKey), mSamplerBindings);
+        }
     }
 
     addSamplerGroup(pb, BindingPoints::PER_VIEW, SibGenerator::getPerViewSib(variantKey), mSamplerBindings);
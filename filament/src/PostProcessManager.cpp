@@ -263,7 +263,7 @@ void PostProcessManager::commitAndRender(FrameGraphRenderTarget const& out,
     mi->commit(driver);
     mi->use(driver);
     driver.beginRenderPass(out.target, out.params);
-    driver.draw(material.getPipelineState(variant), mEngine.getFullScreenRenderPrimitive());
+    driver.draw(material.getPipelineState(variant), mEngine.getFullScreenRenderPrimitive(), 1);
     driver.endRenderPass();
 }
 
@@ -553,7 +553,7 @@ FrameGraphId<FrameGraphTexture> PostProcessManager::screenSpaceAmbientOcclusion(
                 pipeline.rasterState.depthFunc = RasterState::DepthFunc::L;
 
                 driver.beginRenderPass(ssao.target, ssao.params);
-                driver.draw(pipeline, fullScreenRenderPrimitive);
+                driver.draw(pipeline, fullScreenRenderPrimitive, 1);
                 driver.endRenderPass();
             });
 
@@ -653,7 +653,7 @@ FrameGraphId<FrameGraphTexture> PostProcessManager::bilateralBlurPass(
                 pipeline.rasterState.depthFunc = RasterState::DepthFunc::L;
 
                 driver.beginRenderPass(blurred.target, blurred.params);
-                driver.draw(pipeline, fullScreenRenderPrimitive);
+                driver.draw(pipeline, fullScreenRenderPrimitive, 1);
                 driver.endRenderPass();
             });
 
@@ -807,7 +807,7 @@ FrameGraphId<FrameGraphTexture> PostProcessManager::gaussianBlurPass(FrameGraph&
                 // we don't need to call use() here, since it's the same material
 
                 driver.beginRenderPass(hwOutRT.target, hwOutRT.params);
-                driver.draw(separableGaussianBlur.getPipelineState(), fullScreenRenderPrimitive);
+                driver.draw(separableGaussianBlur.getPipelineState(), fullScreenRenderPrimitive, 1);
                 driver.endRenderPass();
             });
 
@@ -987,7 +987,7 @@ FrameGraphId<FrameGraphTexture> PostProcessManager::dof(FrameGraph& fg,
                     mi->setParameter("weightScale", 0.5f / float(1u<<level));
                     mi->commit(driver);
                     driver.beginRenderPass(out.target, out.params);
-                    driver.draw(pipeline, fullScreenRenderPrimitive);
+                    driver.draw(pipeline, fullScreenRenderPrimitive, 1);
                     driver.endRenderPass();
                 }
             });
@@ -1370,7 +1370,7 @@ FrameGraphId<FrameGraphTexture> PostProcessManager::bloomPass(FrameGraph& fg,
                     hwOutRT.params.flags.discardStart = TargetBufferFlags::COLOR;
                     hwOutRT.params.flags.discardEnd = TargetBufferFlags::NONE;
                     driver.beginRenderPass(hwOutRT.target, hwOutRT.params);
-                    driver.draw(pipeline, fullScreenRenderPrimitive);
+                    driver.draw(pipeline, fullScreenRenderPrimitive, 1);
                     driver.endRenderPass();
 
                     // prepare the next level
@@ -1427,7 +1427,7 @@ FrameGraphId<FrameGraphTexture> PostProcessManager::bloomPass(FrameGraph& fg,
                     mi->commit(driver);
 
                     driver.beginRenderPass(hwDstRT.target, hwDstRT.params);
-                    driver.draw(pipeline, fullScreenRenderPrimitive);
+                    driver.draw(pipeline, fullScreenRenderPrimitive, 1);
                     driver.endRenderPass();
                 }
 
@@ -1544,7 +1544,7 @@ FrameGraphId<FrameGraphTexture> PostProcessManager::bloomPassPingPong(FrameGraph
                     hwDstRT.params.flags.discardStart = TargetBufferFlags::COLOR;
                     hwDstRT.params.flags.discardEnd = TargetBufferFlags::NONE;
                     driver.beginRenderPass(hwDstRT.target, hwDstRT.params);
-                    driver.draw(pipeline, fullScreenRenderPrimitive);
+                    driver.draw(pipeline, fullScreenRenderPrimitive, 1);
                     driver.endRenderPass();
 
                     // prepare the next level
@@ -1604,7 +1604,7 @@ FrameGraphId<FrameGraphTexture> PostProcessManager::bloomPassPingPong(FrameGraph
                     mi->commit(driver);
 
                     driver.beginRenderPass(hwDstRT.target, hwDstRT.params);
-                    driver.draw(pipeline, fullScreenRenderPrimitive);
+                    driver.draw(pipeline, fullScreenRenderPrimitive, 1);
                     driver.endRenderPass();
                 }
 
@@ -1685,7 +1685,7 @@ void PostProcessManager::colorGradingSubpass(DriverApi& driver,  bool translucen
             PostProcessVariant::TRANSLUCENT : PostProcessVariant::OPAQUE);
 
     driver.nextSubpass();
-    driver.draw(material.getPipelineState(variant), fullScreenRenderPrimitive);
+    driver.draw(material.getPipelineState(variant), fullScreenRenderPrimitive, 1);
 }
 
 FrameGraphId<FrameGraphTexture> PostProcessManager::colorGrading(FrameGraph& fg,
@@ -1976,7 +1976,7 @@ FrameGraphId<FrameGraphTexture> PostProcessManager::taa(FrameGraph& fg,
                     out.params.subpassMask = 1;
                 }
                 driver.beginRenderPass(out.target, out.params);
-                driver.draw(material.getPipelineState(variant), mEngine.getFullScreenRenderPrimitive());
+                driver.draw(material.getPipelineState(variant), mEngine.getFullScreenRenderPrimitive(), 1);
                 if (colorGradingConfig.asSubpass) {
                     colorGradingSubpass(driver, colorGradingConfig.translucent);
                 }
@@ -2089,7 +2089,7 @@ FrameGraphId<FrameGraphTexture> PostProcessManager::blendBlit(
                     pipeline.rasterState.blendFunctionDstAlpha = BlendFunction::ONE_MINUS_SRC_ALPHA;
                 }
                 driver.beginRenderPass(out.target, out.params);
-                driver.draw(pipeline, fullScreenRenderPrimitive);
+                driver.draw(pipeline, fullScreenRenderPrimitive, 1);
                 driver.endRenderPass();
             });
 
@@ -22,6 +22,8 @@
 #include "details/ShadowMap.h"
 #include "details/View.h"
 
+#include "components/RenderableManager.h"
+
 // NOTE: We only need Renderer.h here because the definition of some FRenderer methods are here
 #include "details/Renderer.h"
 
@@ -30,6 +32,7 @@
 #include <utils/JobSystem.h>
 #include <utils/Systrace.h>
 
+#include <algorithm>
 #include <utility>
 
 using namespace utils;
@@ -52,9 +55,16 @@ RenderPass::~RenderPass() noexcept = default;
 
 void RenderPass::setGeometry(FScene::RenderableSoa const& soa, Range<uint32_t> vr,
         backend::Handle<backend::HwUniformBuffer> uboHandle) noexcept {
+    setGeometry(soa, vr, uboHandle, {});
+}
+
+void RenderPass::setGeometry(FScene::RenderableSoa const& soa, Range<uint32_t> vr,
+        backend::Handle<backend::HwUniformBuffer> uboHandle,
+        GeometryColumns const& columns) noexcept {
     mRenderableSoa = &soa;
     mVisibleRenderables = vr;
     mUboHandle = uboHandle;
+    mColumns = columns;
 }
 
 void RenderPass::setCamera(const CameraInfo& camera) noexcept {
@@ -77,6 +87,14 @@ RenderPass::Command* RenderPass::newCommandBuffer() noexcept {
     return commands.begin();
 }
 
+GrowingSlice<RenderPass::Command> RenderPass::allocateCommandBuffer(size_t count) noexcept {
+    // sortCommands() uses the space after the commands as the radix sort's scratch buffer
+    const size_t size = count >= RADIX_SORT_MIN_COMMAND_COUNT ? count * 2 : count;
+    newCommandBuffer();
+    Command* const commands = mCommands.grow(size);
+    return { commands, size };
+}
+
 RenderPass::Command* RenderPass::appendCommands(CommandTypeFlags const commandTypeFlags) noexcept {
     SYSTRACE_CONTEXT();
 
@@ -95,12 +113,24 @@ RenderPass::Command* RenderPass::appendCommands(CommandTypeFlags const commandTy
     // trace the number of visible renderables
     SYSTRACE_VALUE32("visibleRenderables", vr.size());
 
-    // up-to-date summed primitive counts needed for generateCommands()
     FScene::RenderableSoa const& soa = *mRenderableSoa;
-    updateSummedPrimitiveCounts(const_cast<FScene::RenderableSoa&>(soa), vr);
+    GeometryColumns columns = mColumns;
+    if (!columns.primitives) {
+        columns.primitives = soa.data<FScene::PRIMITIVES>();
+    }
+    if (!columns.summedPrimitiveCounts) {
+        columns.summedPrimitiveCounts =
+                const_cast<FScene::RenderableSoa&>(soa).data<FScene::SUMMED_PRIMITIVE_COUNT>();
+    }
+    if (!columns.visibleMasks) {
+        columns.visibleMasks = soa.data<FScene::VISIBLE_MASK>();
+    }
+
+    // up-to-date summed primitive counts needed for generateCommands()
+    updateSummedPrimitiveCounts(columns, vr);
 
     // compute how much maximum storage we need for this pass
-    uint32_t growBy = FScene::getPrimitiveCount(soa, vr.last);
+    uint32_t growBy = columns.summedPrimitiveCounts[vr.last];
     // double the color pass for transparent objects that need to render twice
     const bool colorPass  = bool(commandTypeFlags & CommandTypeFlags::COLOR);
     const bool depthPass  = bool(commandTypeFlags & CommandTypeFlags::DEPTH);
@@ -110,12 +140,12 @@ RenderPass::Command* RenderPass::appendCommands(CommandTypeFlags const commandTy
     // we extract camera position/forward outside of the loop, because these are not cheap.
     const float3 cameraPosition(camera.getPosition());
     const float3 cameraForwardVector(camera.getForwardVector());
-    auto work = [commandTypeFlags, curr, &soa, renderFlags, visibilityMask, cameraPosition,
-                 cameraForwardVector]
+    auto work = [commandTypeFlags, curr, &soa, &columns, renderFlags, visibilityMask,
+                 cameraPosition, cameraForwardVector]
             (uint32_t startIndex, uint32_t indexCount) {
         RenderPass::generateCommands(commandTypeFlags, curr,
-                soa, { startIndex, startIndex + indexCount }, renderFlags, visibilityMask,
-                cameraPosition, cameraForwardVector);
+                soa, columns, { startIndex, startIndex + indexCount }, renderFlags,
+                visibilityMask, cameraPosition, cameraForwardVector);
     };
 
     auto *jobCommandsParallel = jobs::parallel_for(js, nullptr, vr.first, (uint32_t)vr.size(),
@@ -159,7 +189,14 @@ RenderPass::Command* RenderPass::sortCommands() noexcept {
 
     GrowingSlice<Command>& commands = mCommands;
 
-    std::sort(commands.begin(), commands.end());
+    const size_t count = commands.size();
+    if (count >= RADIX_SORT_MIN_COMMAND_COUNT && commands.remain() >= count) {
+        // the space after our commands isn't used until the next newCommandBuffer(), so we can
+        // use it as the radix sort's scratch buffer.
+        radixSortCommands(mEngine.getJobSystem(), commands.begin(), commands.end(), count);
+    } else {
+        std::sort(commands.begin(), commands.end());
+    }
 
     // find the last command
     Command const* const last = std::partition_point(commands.begin(), commands.end(),
@@ -172,6 +209,114 @@ RenderPass::Command* RenderPass::sortCommands() noexcept {
     return commands.end();
 }
 
+void RenderPass::radixSortCommands(JobSystem& js,
+        Command* const UTILS_RESTRICT commands, Command* const UTILS_RESTRICT scratch,
+        size_t const count) noexcept {
+    SYSTRACE_CALL();
+
+    constexpr size_t RADIX_BITS = 8;
+    constexpr size_t RADIX_SIZE = 1u << RADIX_BITS;
+    constexpr size_t RADIX_MASK = RADIX_SIZE - 1;
+
+    struct alignas(CACHELINE_SIZE) Chunk {
+        uint32_t offsets[RADIX_SIZE];   // histogram, then scatter offsets of this chunk
+        CommandKey keysAnd;
+        CommandKey keysOr;
+        uint32_t begin;
+        uint32_t end;
+    };
+
+    const size_t chunkCount = std::max(size_t(1),
+            std::min(RADIX_SORT_MAX_CHUNK_COUNT, count / RADIX_SORT_MIN_CHUNK_SIZE));
+    const size_t chunkSize = (count + chunkCount - 1) / chunkCount;
+
+    Chunk chunks[RADIX_SORT_MAX_CHUNK_COUNT];
+    for (size_t c = 0; c < chunkCount; c++) {
+        chunks[c].begin = uint32_t(std::min(count, c * chunkSize));
+        chunks[c].end   = uint32_t(std::min(count, (c + 1) * chunkSize));
+    }
+
+    // runs work(chunk) for all chunks, in parallel
+    auto forEachChunk = [&js, &chunks, chunkCount](auto&& work) {
+        auto functor = [&work, &chunks](uint32_t first, uint32_t n) {
+            for (uint32_t c = first; c < first + n; c++) {
+                work(chunks[c]);
+            }
+        };
+        if (chunkCount == 1) {
+            functor(0, 1);
+            return;
+        }
+        auto* job = jobs::parallel_for(js, nullptr, 0, uint32_t(chunkCount),
+                std::cref(functor), jobs::CountSplitter<1, 4>());
+        js.runAndWait(job);
+    };
+
+    // find which bytes of the key are not the same in all commands
+    forEachChunk([commands](Chunk& chunk) {
+        CommandKey keysAnd = ~CommandKey(0);
+        CommandKey keysOr = 0;
+        for (size_t i = chunk.begin; i < chunk.end; i++) {
+            keysAnd &= commands[i].key;
+            keysOr  |= commands[i].key;
+        }
+        chunk.keysAnd = keysAnd;
+        chunk.keysOr = keysOr;
+    });
+    CommandKey keysAnd = ~CommandKey(0);
+    CommandKey keysOr = 0;
+    for (size_t c = 0; c < chunkCount; c++) {
+        keysAnd &= chunks[c].keysAnd;
+        keysOr  |= chunks[c].keysOr;
+    }
+    const CommandKey varyingBits = keysAnd ^ keysOr;
+
+    Command* UTILS_RESTRICT src = commands;
+    Command* UTILS_RESTRICT dst = scratch;
+    for (size_t shift = 0; shift < sizeof(CommandKey) * 8; shift += RADIX_BITS) {
+        if (!((varyingBits >> shift) & RADIX_MASK)) {
+            // this byte is the same for all commands, this pass wouldn't change anything
+            continue;
+        }
+
+        // histogram of this byte, per chunk
+        forEachChunk([src, shift](Chunk& chunk) {
+            uint32_t* const UTILS_RESTRICT offsets = chunk.offsets;
+            std::fill_n(offsets, RADIX_SIZE, 0);
+            for (size_t i = chunk.begin; i < chunk.end; i++) {
+                offsets[(src[i].key >> shift) & RADIX_MASK]++;
+            }
+        });
+
+        // Turn the histograms into scatter offsets. Buckets are laid out in order, and within a
+        // bucket, chunks are laid out in order, which keeps the sort stable.
+        uint32_t offset = 0;
+        for (size_t r = 0; r < RADIX_SIZE; r++) {
+            for (size_t c = 0; c < chunkCount; c++) {
+                const uint32_t n = chunks[c].offsets[r];
+                chunks[c].offsets[r] = offset;
+                offset += n;
+            }
+        }
+
+        forEachChunk([src, dst, shift](Chunk& chunk) {
+            uint32_t* const UTILS_RESTRICT offsets = chunk.offsets;
+            for (size_t i = chunk.begin; i < chunk.end; i++) {
+                dst[offsets[(src[i].key >> shift) & RADIX_MASK]++] = src[i];
+            }
+        });
+
+        std::swap(src, dst);
+    }
+
+    if (src != commands) {
+        // we did an odd number of passes, the result is in the scratch buffer
+        forEachChunk([src, commands](Chunk const& chunk) {
+            std::copy(src + chunk.begin, src + chunk.end, commands + chunk.begin);
+        });
+    }
+}
+
 void RenderPass::execute(const char* name,
         backend::Handle<backend::HwRenderTarget> renderTarget,
         backend::RenderPassParams params) const noexcept {
@@ -184,12 +329,120 @@ void RenderPass::execute(const char* name,
 
 void RenderPass::executeCommands(const char* name) const noexcept {
     DriverApi& driver = mEngine.getDriverApi();
-    RenderPass::recordDriverCommands(driver, mCommands.begin(), mCommands.end());
+    RenderPassStats stats{ .name = name };
+    Command const* const first = mCommands.begin();
+    Command const* const last = mCommands.end();
+    // custom commands record into the engine's stream, so they must run on this thread
+    if (mCustomCommands.empty() && size_t(last - first) >= RECORD_PARALLEL_MIN_COMMAND_COUNT) {
+        RenderPass::recordDriverCommandsParallel(driver, first, last, stats);
+    } else {
+        RenderPass::recordDriverCommands(driver, first, last, stats);
+    }
+    mCustomCommands.clear();
+    if (mFrameInfoManager) {
+        mFrameInfoManager->addRenderPassStats(stats);
+    }
+}
+
+// Upper bound of the command stream space used by recordDriverCommands() per Command, these are
+// the commands it records for a draw below. recordDriverCommandsParallel() reserves this much per
+// Command, endSegment() panics if a range overflows its segment and debug builds assert each draw.
+static constexpr size_t MAX_DRIVER_COMMANDS_SIZE_PER_DRAW =
+        FMaterialInstance::USE_COMMANDS_SIZE +                              // material instance
+        CommandBase::align(sizeof(COMMAND_TYPE(bindUniformBufferRange))) +  // per-renderable
+        CommandBase::align(sizeof(COMMAND_TYPE(bindUniformBufferRange))) +  // bones
+        CommandBase::align(sizeof(COMMAND_TYPE(bindUniformBuffer))) +       // morph weights
+        CommandBase::align(sizeof(COMMAND_TYPE(bindSamplers))) +            // morph targets
+        CommandBase::align(sizeof(COMMAND_TYPE(draw)));
+
+void RenderPass::recordDriverCommandsParallel(FEngine::DriverApi& driver, const Command* first,
+        const Command* last, RenderPassStats& stats) const noexcept {
+    SYSTRACE_CALL();
+
+    FEngine& engine = mEngine;
+    JobSystem& js = engine.getJobSystem();
+
+    // Programs are created lazily, which records commands in the engine's stream. Make sure they
+    // all exist before recording on other threads.
+    FMaterialInstance const* mi = nullptr;
+    uint8_t variant = 0;
+    for (Command const* c = first; c != last; c++) {
+        if (UTILS_UNLIKELY((c->key & CUSTOM_MASK) != uint64_t(CustomCommand::PASS))) {
+            continue;
+        }
+        PrimitiveInfo const& info = c->primitive;
+        FMaterialInstance const* const cmi = info.renderPrimitive->getMaterialInstance();
+        if (mi != cmi || variant != info.materialVariant.key) {
+            mi = cmi;
+            variant = info.materialVariant.key;
+            mi->getMaterial()->getProgram(variant);
+        }
+    }
+
+    struct Range {
+        Command const* first;
+        Command const* last;
+        CommandStream::Segment segment;
+        RenderPassStats stats;
+    };
+
+    // Worst case, a batch uses half of the space guaranteed after a flush. Before reserving a
+    // batch, we flush the stream if what's already been recorded since the last flush plus the
+    // batch could exceed that half, so the other half stays available to the commands that
+    // follow.
+    constexpr size_t BATCH_COMMAND_COUNT =
+            FEngine::CONFIG_MIN_COMMAND_BUFFERS_SIZE / 2 / MAX_DRIVER_COMMANDS_SIZE_PER_DRAW;
+    static_assert(BATCH_COMMAND_COUNT >= RECORD_MIN_RANGE_SIZE,
+            "the command buffer is too small to record a range of commands in parallel");
+
+    while (first != last) {
+        const size_t count = std::min(size_t(last - first), BATCH_COMMAND_COUNT);
+        if (engine.getCommandBufferPendingSize() + count * MAX_DRIVER_COMMANDS_SIZE_PER_DRAW >
+                FEngine::CONFIG_MIN_COMMAND_BUFFERS_SIZE / 2) {
+            engine.flush();
+        }
+        const size_t rangeCount = std::max(size_t(1),
+                std::min(RECORD_MAX_RANGE_COUNT, count / RECORD_MIN_RANGE_SIZE));
+        const size_t rangeSize = (count + rangeCount - 1) / rangeCount;
+
+        // reserve a segment of the stream for each range, in order
+        Range ranges[RECORD_MAX_RANGE_COUNT];
+        for (size_t i = 0; i < rangeCount; i++) {
+            Command const* const f = first + std::min(count, i * rangeSize);
+            Command const* const l = first + std::min(count, (i + 1) * rangeSize);
+            ranges[i] = { f, l,
+                    driver.reserveSegment(size_t(l - f) * MAX_DRIVER_COMMANDS_SIZE_PER_DRAW),
+                    {} };
+        }
+
+        auto work = [this, &driver, &ranges](uint32_t start, uint32_t n) {
+            for (uint32_t i = start; i < start + n; i++) {
+                Range& range = ranges[i];
+                CircularBuffer buffer(range.segment.begin, range.segment.size);
+                DriverApi stream(driver, buffer);
+                recordDriverCommands(stream, range.first, range.last, range.stats);
+                stream.endSegment(range.segment);
+            }
+        };
+
+        auto* job = jobs::parallel_for(js, nullptr, 0, uint32_t(rangeCount),
+                std::cref(work), jobs::CountSplitter<1, 4>());
+        js.runAndWait(job);
+
+        for (size_t i = 0; i < rangeCount; i++) {
+            stats.drawCount += ranges[i].stats.drawCount;
+            stats.stateEmitted += ranges[i].stats.stateEmitted;
+            stats.stateSuppressed += ranges[i].stats.stateSuppressed;
+            stats.materialInstanceReused += ranges[i].stats.materialInstanceReused;
+        }
+
+        first += count;
+    }
 }
 
 UTILS_NOINLINE // no need to be inlined
 void RenderPass::recordDriverCommands(FEngine::DriverApi& driver, const Command* first,
-        const Command* last) const noexcept {
+        const Command* last, RenderPassStats& stats) const noexcept {
     SYSTRACE_CALL();
 
     if (first != last) {
@@ -201,10 +454,25 @@ void RenderPass::recordDriverCommands(FEngine::DriverApi& driver, const Command*
                 mPolygonOffsetOverride ? &dummyPolyOffset : &pipeline.polygonOffset;
 
         Handle<HwUniformBuffer> uboHandle = mUboHandle;
+        Handle<HwUniformBuffer> bonesHandle = mEngine.getRenderableManager().getBonesUbh();
         FMaterialInstance const* UTILS_RESTRICT mi = nullptr;
         FMaterial const* UTILS_RESTRICT ma = nullptr;
         auto const& customCommands = mCustomCommands;
 
+        // The per-renderable bindings currently set on the driver. Consecutive commands often
+        // come from the same renderable (e.g. several primitives, or a two-pass transparent
+        // object), in which case we don't need to bind its uniforms again.
+        constexpr uint32_t INVALID_INDEX = std::numeric_limits<uint32_t>::max();
+        uint32_t boundIndex = INVALID_INDEX;
+        uint32_t boundBones = INVALID_INDEX;
+        Handle<HwUniformBuffer> boundMorphWeights;
+        Handle<HwSamplerGroup> boundMorphTargets;
+
+        uint32_t drawCount = 0;
+        uint32_t stateEmitted = 0;
+        uint32_t stateSuppressed = 0;
+        uint32_t materialInstanceReused = 0;
+
         first--;
         while (++first != last) {
             /*
@@ -214,32 +482,88 @@ void RenderPass::recordDriverCommands(FEngine::DriverApi& driver, const Command*
             if (UTILS_UNLIKELY((first->key & CUSTOM_MASK) != uint64_t(CustomCommand::PASS))) {
                 uint32_t index = (first->key & CUSTOM_INDEX_MASK) >> CUSTOM_INDEX_SHIFT;
                 customCommands[index]();
+                // we don't know what the custom command did, so forget what's bound
+                boundIndex = INVALID_INDEX;
+                boundBones = INVALID_INDEX;
+                boundMorphWeights.clear();
+                boundMorphTargets.clear();
                 continue;
             }
 
+#ifndef NDEBUG
+            char const* const drawBegin = static_cast<char const*>(driver.debugGetHead());
+#endif
+
+            // Each command recorded below (and by FMaterialInstance::use()) must be accounted for
+            // by MAX_DRIVER_COMMANDS_SIZE_PER_DRAW.
+
             // per-renderable uniform
             const PrimitiveInfo info = first->primitive;
+            FRenderPrimitive const* const UTILS_RESTRICT rp = info.renderPrimitive;
             pipeline.rasterState = info.rasterState;
-            if (UTILS_UNLIKELY(mi != info.mi)) {
+            if (UTILS_UNLIKELY(mi != rp->getMaterialInstance())) {
                 // this is always taken the first time
-                mi = info.mi;
+                mi = rp->getMaterialInstance();
                 ma = mi->getMaterial();
                 pipeline.scissor = mi->getScissor();
                 *pPipelinePolygonOffset = mi->getPolygonOffset();
                 mi->use(driver);
+                stateEmitted++;
+            } else {
+                materialInstanceReused++;
             }
 
             pipeline.program = ma->getProgram(info.materialVariant.key);
-            size_t offset = info.index * sizeof(PerRenderableUib);
-            driver.bindUniformBufferRange(BindingPoints::PER_RENDERABLE,
-                    uboHandle, offset, sizeof(PerRenderableUib));
-            if (UTILS_UNLIKELY(info.perRenderableBones)) {
-                driver.bindUniformBuffer(BindingPoints::PER_RENDERABLE_BONES,
-                        info.perRenderableBones);
+            if (boundIndex != info.index) {
+                boundIndex = info.index;
+                size_t offset = info.index * sizeof(PerRenderableUib);
+                driver.bindUniformBufferRange(BindingPoints::PER_RENDERABLE,
+                        uboHandle, offset, sizeof(PerRenderableUib));
+                stateEmitted++;
+            } else {
+                stateSuppressed++;
             }
-            driver.draw(pipeline, info.primitiveHandle);
+            if (UTILS_UNLIKELY(info.materialVariant.hasSkinningOrMorphing())) {
+                // all the bones are in the same buffer, only the range changes
+                if (boundBones != info.bonesOffset) {
+                    boundBones = info.bonesOffset;
+                    driver.bindUniformBufferRange(BindingPoints::PER_RENDERABLE_BONES,
+                            bonesHandle, info.bonesOffset, BonePool::RANGE_SIZE);
+                    stateEmitted++;
+                } else {
+                    stateSuppressed++;
+                }
+                // the skinning variant also reads the morph targets, renderables without any
+                // use empty ones
+                if (boundMorphWeights != rp->getMorphWeightsUbh()) {
+                    boundMorphWeights = rp->getMorphWeightsUbh();
+                    driver.bindUniformBuffer(BindingPoints::PER_RENDERABLE_MORPHING,
+                            boundMorphWeights);
+                    stateEmitted++;
+                } else {
+                    stateSuppressed++;
+                }
+                if (boundMorphTargets != rp->getMorphTargetsSgh()) {
+                    boundMorphTargets = rp->getMorphTargetsSgh();
+                    driver.bindSamplers(BindingPoints::PER_RENDERABLE_MORPHING,
+                            boundMorphTargets);
+                    stateEmitted++;
+                } else {
+                    stateSuppressed++;
+                }
+            }
+            driver.draw(pipeline, rp->getHwHandle(), info.instanceCount);
+            drawCount++;
+
+            // the parallel recording reserves MAX_DRIVER_COMMANDS_SIZE_PER_DRAW bytes per draw
+            assert(size_t(static_cast<char const*>(driver.debugGetHead()) - drawBegin) <=
+                    MAX_DRIVER_COMMANDS_SIZE_PER_DRAW);
         }
-        mCustomCommands.clear();
+
+        stats.drawCount += drawCount;
+        stats.stateEmitted += stateEmitted;
+        stats.stateSuppressed += stateSuppressed;
+        stats.materialInstanceReused += materialInstanceReused;
     }
 }
 
@@ -280,7 +604,6 @@ void RenderPass::setupColorCommand(Command& cmdDraw,
     cmdDraw.primitive.rasterState.colorWrite = mi->getColorWrite();
     cmdDraw.primitive.rasterState.depthWrite = mi->getDepthWrite();
     cmdDraw.primitive.rasterState.depthFunc = mi->getDepthFunc();
-    cmdDraw.primitive.mi = mi;
     cmdDraw.primitive.materialVariant.key = variant;
     // we keep "RasterState::colorWrite" to the value set by material (could be disabled)
 }
@@ -288,7 +611,8 @@ void RenderPass::setupColorCommand(Command& cmdDraw,
 /* static */
 UTILS_NOINLINE
 void RenderPass::generateCommands(uint32_t commandTypeFlags, Command* const commands,
-        FScene::RenderableSoa const& soa, Range<uint32_t> range, RenderFlags renderFlags,
+        FScene::RenderableSoa const& soa, GeometryColumns const& columns,
+        Range<uint32_t> range, RenderFlags renderFlags,
         FScene::VisibleMaskType visibilityMask, float3 cameraPosition, float3 cameraForward) noexcept {
 
     // generateCommands() writes both the draw and depth commands simultaneously such that
@@ -297,7 +621,7 @@ void RenderPass::generateCommands(uint32_t commandTypeFlags, Command* const comm
     // the list twice)
 
     // compute how much maximum storage we need
-    uint32_t offset = FScene::getPrimitiveCount(soa, range.first);
+    uint32_t offset = columns.summedPrimitiveCounts[range.first];
     // double the color pass for transparent objects that need to render twice
     const bool colorPass  = bool(commandTypeFlags & CommandTypeFlags::COLOR);
     const bool depthPass  = bool(commandTypeFlags & CommandTypeFlags::DEPTH);
@@ -316,11 +640,13 @@ void RenderPass::generateCommands(uint32_t commandTypeFlags, Command* const comm
     switch (commandTypeFlags & (CommandTypeFlags::COLOR | CommandTypeFlags::DEPTH)) {
         case CommandTypeFlags::COLOR:
             generateCommandsImpl<CommandTypeFlags::COLOR>(commandTypeFlags, curr,
-                    soa, range, renderFlags, visibilityMask, cameraPosition, cameraForward);
+                    soa, columns, range, renderFlags, visibilityMask,
+                    cameraPosition, cameraForward);
             break;
         case CommandTypeFlags::DEPTH:
             generateCommandsImpl<CommandTypeFlags::DEPTH>(commandTypeFlags, curr,
-                    soa, range, renderFlags, visibilityMask, cameraPosition, cameraForward);
+                    soa, columns, range, renderFlags, visibilityMask,
+                    cameraPosition, cameraForward);
             break;
         default:
             // we should never end-up here
@@ -333,7 +659,8 @@ template<uint32_t commandTypeFlags>
 UTILS_NOINLINE
 void RenderPass::generateCommandsImpl(uint32_t extraFlags,
         Command* UTILS_RESTRICT curr,
-        FScene::RenderableSoa const& UTILS_RESTRICT soa, Range<uint32_t> range,
+        FScene::RenderableSoa const& UTILS_RESTRICT soa, GeometryColumns const& columns,
+        Range<uint32_t> range,
         RenderFlags renderFlags, FScene::VisibleMaskType visibilityMask,
         float3 cameraPosition, float3 cameraForward) noexcept {
 
@@ -354,9 +681,11 @@ void RenderPass::generateCommandsImpl(uint32_t extraFlags,
     auto const* const UTILS_RESTRICT soaWorldAABBCenter = soa.data<FScene::WORLD_AABB_CENTER>();
     auto const* const UTILS_RESTRICT soaReversedWinding = soa.data<FScene::REVERSED_WINDING_ORDER>();
     auto const* const UTILS_RESTRICT soaVisibility      = soa.data<FScene::VISIBILITY_STATE>();
-    auto const* const UTILS_RESTRICT soaPrimitives      = soa.data<FScene::PRIMITIVES>();
-    auto const* const UTILS_RESTRICT soaBonesUbh        = soa.data<FScene::BONES_UBH>();
-    auto const* const UTILS_RESTRICT soaVisibilityMask  = soa.data<FScene::VISIBLE_MASK>();
+    auto const* const UTILS_RESTRICT soaPrimitives      = columns.primitives;
+    auto const* const UTILS_RESTRICT soaBonesOffset     = soa.data<FScene::BONES_OFFSET>();
+    auto const* const UTILS_RESTRICT soaVisibilityMask  = columns.visibleMasks;
+    auto const* const UTILS_RESTRICT soaUboSlot         = soa.data<FScene::UBO_SLOT>();
+    auto const* const UTILS_RESTRICT soaInstanceCount   = soa.data<FScene::INSTANCE_COUNT>();
 
     const bool hasShadowing = renderFlags & HAS_SHADOWING;
     const bool viewInverseFrontFaces = renderFlags & HAS_INVERSE_FRONT_FACES;
@@ -427,11 +756,16 @@ void RenderPass::generateCommandsImpl(uint32_t extraFlags,
         // calculate the per-primitive face winding order inversion
         const bool inverseFrontFaces = viewInverseFrontFaces ^ soaReversedWinding[i];
 
+        // FScene::usesCachedUBOs() guarantees the slot fits
+        assert(soaUboSlot[i] <= std::numeric_limits<uint16_t>::max());
+
         cmdColor.key = makeField(soaVisibility[i].priority, PRIORITY_MASK, PRIORITY_SHIFT);
-        cmdColor.primitive.index = (uint16_t)i;
-        cmdColor.primitive.perRenderableBones = soaBonesUbh[i];
+        cmdColor.primitive.index = (uint16_t)soaUboSlot[i];
+        cmdColor.primitive.bonesOffset = soaBonesOffset[i];
+        cmdColor.primitive.instanceCount = soaInstanceCount[i];
         materialVariant.setShadowReceiver(soaVisibility[i].receiveShadows & hasShadowing);
-        materialVariant.setSkinning(soaVisibility[i].skinning || soaVisibility[i].morphing);
+        materialVariant.setSkinning(soaVisibility[i].skinning || soaVisibility[i].morphing ||
+                soaVisibility[i].instancing || soaVisibility[i].morphTargets);
 
         // we're assuming we're always doing the depth (either way, it's correct)
         // this will generate front to back rendering
@@ -439,9 +773,12 @@ void RenderPass::generateCommandsImpl(uint32_t extraFlags,
         cmdDepth.key |= uint64_t(CustomCommand::PASS);
         cmdDepth.key |= makeField(soaVisibility[i].priority, PRIORITY_MASK, PRIORITY_SHIFT);
         cmdDepth.key |= makeField(distanceBits, DISTANCE_BITS_MASK, DISTANCE_BITS_SHIFT);
-        cmdDepth.primitive.index = (uint16_t)i;
-        cmdDepth.primitive.perRenderableBones = soaBonesUbh[i];
-        cmdDepth.primitive.materialVariant.setSkinning(soaVisibility[i].skinning || soaVisibility[i].morphing);
+        cmdDepth.primitive.index = (uint16_t)soaUboSlot[i];
+        cmdDepth.primitive.bonesOffset = soaBonesOffset[i];
+        cmdDepth.primitive.instanceCount = soaInstanceCount[i];
+        cmdDepth.primitive.materialVariant.setSkinning(soaVisibility[i].skinning ||
+                soaVisibility[i].morphing || soaVisibility[i].instancing ||
+                soaVisibility[i].morphTargets);
         cmdDepth.primitive.rasterState.inverseFrontFaces = inverseFrontFaces;
 
         const bool shadowCaster = soaVisibility[i].castShadows & hasShadowing;
@@ -456,7 +793,7 @@ void RenderPass::generateCommandsImpl(uint32_t extraFlags,
         for (auto const& primitive : primitives) {
             FMaterialInstance const* const mi = primitive.getMaterialInstance();
             if (isColorPass) {
-                cmdColor.primitive.primitiveHandle = primitive.getHwHandle();
+                cmdColor.primitive.renderPrimitive = &primitive;
                 cmdColor.primitive.materialVariant = materialVariant;
                 RenderPass::setupColorCommand(cmdColor, mi, inverseFrontFaces);
 
@@ -540,8 +877,7 @@ void RenderPass::generateCommandsImpl(uint32_t extraFlags,
                 RasterState rs = ma->getRasterState();
 
                 // unconditionally write the command
-                cmdDepth.primitive.primitiveHandle = primitive.getHwHandle();
-                cmdDepth.primitive.mi = mi;
+                cmdDepth.primitive.renderPrimitive = &primitive;
                 cmdDepth.primitive.rasterState.culling = mi->getCullingMode();
                 *curr = cmdDepth;
 
@@ -565,9 +901,9 @@ void RenderPass::generateCommandsImpl(uint32_t extraFlags,
 }
 
 void RenderPass::updateSummedPrimitiveCounts(
-        FScene::RenderableSoa& renderableData, Range<uint32_t> vr) noexcept {
-    auto const* const UTILS_RESTRICT primitives = renderableData.data<FScene::PRIMITIVES>();
-    uint32_t* const UTILS_RESTRICT summedPrimitiveCount = renderableData.data<FScene::SUMMED_PRIMITIVE_COUNT>();
+        GeometryColumns const& columns, Range<uint32_t> vr) noexcept {
+    auto const* const UTILS_RESTRICT primitives = columns.primitives;
+    uint32_t* const UTILS_RESTRICT summedPrimitiveCount = columns.summedPrimitiveCounts;
     uint32_t count = 0;
     for (uint32_t i : vr) {
         summedPrimitiveCount[i] = count;
@@ -19,6 +19,8 @@
 
 #include <filament/Viewport.h>
 
+#include "FrameInfo.h"
+
 #include "details/Camera.h"
 #include "details/Material.h"
 #include "details/Scene.h"
@@ -209,14 +211,15 @@ public:
         return boolish ? -1llu : 0llu;
     }
 
+    // The material instance, the hardware primitive and the morph targets are read from the
+    // FRenderPrimitive, which stays valid until the commands are executed.
     struct PrimitiveInfo { // 24 bytes
-        FMaterialInstance const* mi = nullptr;                          // 8 bytes (4)
-        backend::Handle<backend::HwRenderPrimitive> primitiveHandle;    // 4 bytes
-        backend::Handle<backend::HwUniformBuffer> perRenderableBones;   // 4 bytes
+        FRenderPrimitive const* renderPrimitive = nullptr;              // 8 bytes (4)
+        uint32_t bonesOffset = 0;                                       // 4 bytes
         backend::RasterState rasterState;                               // 4 bytes
         uint16_t index = 0;                                             // 2 bytes
         Variant materialVariant;                                        // 1 byte
-        uint8_t reserved = {};                                          // 1 byte
+        uint8_t instanceCount = 1;                                      // 1 byte
     };
 
     struct alignas(8) Command {     // 32 bytes
@@ -241,6 +244,16 @@ public:
     static constexpr RenderFlags HAS_VSM                 = 0x20;
 
 
+    // Replacements for the PRIMITIVES, SUMMED_PRIMITIVE_COUNT and VISIBLE_MASK columns of the
+    // SoA, indexed like the SoA. They let several passes over the same renderables (e.g. the
+    // shadow maps) pick their own levels of detail and visibility, and generate their commands
+    // concurrently. A null column means the SoA's column is used.
+    struct GeometryColumns {
+        utils::Slice<FRenderPrimitive> const* primitives = nullptr;
+        uint32_t* summedPrimitiveCounts = nullptr;  // must have room for the range's last index
+        FScene::VisibleMaskType const* visibleMasks = nullptr;
+    };
+
     RenderPass(FEngine& engine, utils::GrowingSlice<Command> commands) noexcept;
     RenderPass(RenderPass const& rhs);
     ~RenderPass() noexcept;
@@ -248,9 +261,18 @@ public:
     void overridePolygonOffset(backend::PolygonOffset* polygonOffset) noexcept;
     void setGeometry(FScene::RenderableSoa const& soa, utils::Range<uint32_t> vr,
             backend::Handle<backend::HwUniformBuffer> uboHandle) noexcept;
+    void setGeometry(FScene::RenderableSoa const& soa, utils::Range<uint32_t> vr,
+            backend::Handle<backend::HwUniformBuffer> uboHandle,
+            GeometryColumns const& columns) noexcept;
     void setCamera(const CameraInfo& camera) noexcept;
     void setRenderFlags(RenderFlags flags) noexcept;
 
+    // Statistics of the passes executed by this RenderPass (or its copies) are reported to this
+    // FrameInfoManager, if not null.
+    void setFrameInfoManager(FrameInfoManager* frameInfoManager) noexcept {
+        mFrameInfoManager = frameInfoManager;
+    }
+
     // Sets the visibility mask, which is AND-ed against each Renderable's VISIBLE_MASK to determine
     // if the renderable is visible for this pass.
     // Defaults to all 1's, which means all renderables in this render pass will be rendered.
@@ -269,6 +291,16 @@ public:
 
     Command* newCommandBuffer() noexcept;
 
+    // Carves a command buffer with room for 'count' commands (including the sentinel), and for
+    // the scratch space sortCommands() needs, out of the space after this pass's commands.
+    // Unlike the buffers of newCommandBuffer(), these buffers don't overlap, so copies of this
+    // pass using them (see setCommandBuffer()) can generate their commands concurrently.
+    utils::GrowingSlice<Command> allocateCommandBuffer(size_t count) noexcept;
+
+    void setCommandBuffer(utils::GrowingSlice<Command> commands) noexcept {
+        mCommands = commands;
+    }
+
     // returns mCommands.end()
     Command* appendCommands(CommandTypeFlags commandTypeFlags) noexcept;
 
@@ -280,6 +312,13 @@ public:
     // the new mCommands.end()
     Command* sortCommands() noexcept;
 
+    // Sorts commands by key using a stable LSD radix sort, with the histogram and scatter
+    // phases split across the JobSystem. Passes over bytes of the key that are identical in all
+    // commands are skipped, which is typically the case of most of the 'correctness' bits.
+    // 'scratch' must have room for 'count' commands and must not overlap 'commands'.
+    static void radixSortCommands(utils::JobSystem& js,
+            Command* commands, Command* scratch, size_t count) noexcept;
+
     void execute(const char* name,
             backend::Handle<backend::HwRenderTarget> renderTarget,
             backend::RenderPassParams params) const noexcept;
@@ -305,24 +344,49 @@ private:
     static_assert(JOBS_PARALLEL_FOR_COMMANDS_SIZE % utils::CACHELINE_SIZE == 0,
             "Size of Commands jobs must be multiple of a cache-line size");
 
+    // below this many commands, sortCommands() uses std::sort instead of radixSortCommands()
+    static constexpr size_t RADIX_SORT_MIN_COMMAND_COUNT = 1024;
+
+    // executeCommands() records the driver commands on several threads when there are at least
+    // RECORD_PARALLEL_MIN_COMMAND_COUNT commands, in at most RECORD_MAX_RANGE_COUNT ranges of at
+    // least RECORD_MIN_RANGE_SIZE commands.
+    static constexpr size_t RECORD_PARALLEL_MIN_COMMAND_COUNT = 1024;
+    static constexpr size_t RECORD_MIN_RANGE_SIZE = 256;
+    static constexpr size_t RECORD_MAX_RANGE_COUNT = 16;
+
+    // radixSortCommands() splits the commands in at most RADIX_SORT_MAX_CHUNK_COUNT chunks of at
+    // least RADIX_SORT_MIN_CHUNK_SIZE commands, each chunk is processed by a single job.
+    static constexpr size_t RADIX_SORT_MIN_CHUNK_SIZE = 1024;
+    static constexpr size_t RADIX_SORT_MAX_CHUNK_COUNT = 16;
+
+    // 'columns' must not have null columns
     static inline void generateCommands(uint32_t commandTypeFlags, Command* commands,
-            FScene::RenderableSoa const& soa, utils::Range<uint32_t> range, RenderFlags renderFlags,
+            FScene::RenderableSoa const& soa, GeometryColumns const& columns,
+            utils::Range<uint32_t> range, RenderFlags renderFlags,
             FScene::VisibleMaskType visibilityMask, math::float3 cameraPosition, math::float3 cameraForward) noexcept;
 
     template<uint32_t commandTypeFlags>
     static inline void generateCommandsImpl(uint32_t, Command* commands,
-            FScene::RenderableSoa const& soa, utils::Range<uint32_t> range,
+            FScene::RenderableSoa const& soa, GeometryColumns const& columns,
+            utils::Range<uint32_t> range,
             RenderFlags renderFlags, FScene::VisibleMaskType visibilityMask,
             math::float3 cameraPosition, math::float3 cameraForward) noexcept;
 
     static void setupColorCommand(Command& cmdDraw,
             FMaterialInstance const* mi, bool inverseFrontFaces) noexcept;
 
+    // Records the driver commands, skipping the state commands that wouldn't change the state
+    // set by the previous command. Accumulates the number of commands in 'stats'.
     void recordDriverCommands(FEngine::DriverApi& driver, const Command* first,
-            const Command* last) const noexcept;
+            const Command* last, RenderPassStats& stats) const noexcept;
+
+    // Same as recordDriverCommands(), but splits the commands in ranges recorded concurrently by
+    // the JobSystem, each into its own segment of 'driver'. Can't be used with custom commands.
+    void recordDriverCommandsParallel(FEngine::DriverApi& driver, const Command* first,
+            const Command* last, RenderPassStats& stats) const noexcept;
 
     static void updateSummedPrimitiveCounts(
-            FScene::RenderableSoa& renderableData, utils::Range<uint32_t> vr) noexcept;
+            GeometryColumns const& columns, utils::Range<uint32_t> vr) noexcept;
 
     using CustomCommandFn = std::function<void()>;
     using CustomCommandVector = std::vector<CustomCommandFn,
@@ -339,6 +403,8 @@ private:
     utils::Range<uint32_t> mVisibleRenderables{};
     // the UBO containing the data for the renderables
     backend::Handle<backend::HwUniformBuffer> mUboHandle;
+    // the columns replacing those of the SOA, if any
+    GeometryColumns mColumns;
 
     // info about the camera
     CameraInfo mCamera;
@@ -353,6 +419,9 @@ private:
     // a vector for our custom commands
     mutable CustomCommandVector mCustomCommands;
 
+    // where to report the statistics of executed passes
+    FrameInfoManager* mFrameInfoManager = nullptr;
+
     // high watermark for debugging
     size_t mCommandsHighWatermark = 0;
 };
@@ -252,6 +252,7 @@ void FRenderer::renderJob(ArenaScope& arena, FView& view) {
             arena.allocate<Command>(commandsCount, CACHELINE_SIZE), commandsCount);
 
     RenderPass pass(engine, commands);
+    pass.setFrameInfoManager(&mFrameInfoManager);
     RenderPass::RenderFlags renderFlags = 0;
     if (view.hasShadowing())               renderFlags |= RenderPass::HAS_SHADOWING;
     if (view.hasDirectionalLight())        renderFlags |= RenderPass::HAS_DIRECTIONAL_LIGHT;
@@ -1163,6 +1164,14 @@ void Renderer::resetUserTime() {
     upcast(this)->resetUserTime();
 }
 
+size_t Renderer::getRenderPassStatsCount() const noexcept {
+    return upcast(this)->getRenderPassStatsCount();
+}
+
+Renderer::RenderPassStats Renderer::getRenderPassStats(size_t index) const noexcept {
+    return upcast(this)->getRenderPassStats(index);
+}
+
 void Renderer::setDisplayInfo(const DisplayInfo& info) noexcept {
     upcast(this)->setDisplayInfo(info);
 }
@@ -19,6 +19,8 @@
 #include "components/LightManager.h"
 #include "components/RenderableManager.h"
 
+#include "details/Froxelizer.h"
+
 #include <private/filament/UibGenerator.h>
 
 #include "details/Engine.h"
@@ -27,10 +29,18 @@
 
 #include <utils/compiler.h>
 #include <utils/EntityManager.h>
+#include <utils/JobSystem.h>
 #include <utils/Range.h>
+#include <utils/Systrace.h>
 #include <utils/Zip2Iterator.h>
 
 #include <algorithm>
+#include <atomic>
+#include <utility>
+#include <vector>
+
+#include <stdlib.h>
+#include <string.h>
 
 using namespace filament::math;
 using namespace utils;
@@ -45,26 +55,32 @@ FScene::FScene(FEngine& engine) :
 
 FScene::~FScene() noexcept = default;
 
+// copies the first 'count' renderables of src into dst, array by array
+template<size_t ... Is>
+static void copyRenderables(FScene::RenderableSoa& UTILS_RESTRICT dst,
+        FScene::RenderableSoa const& UTILS_RESTRICT src, size_t count,
+        std::index_sequence<Is...>) noexcept {
+    int UTILS_UNUSED dummy[] = {
+            (std::copy_n(src.data<Is>(), count, dst.data<Is>()), 0)... };
+}
+
 
 void FScene::prepare(const mat4f& worldOriginTransform) {
-    // TODO: can we skip this in most cases? Since we rely on indices staying the same,
-    //       we could only skip, if nothing changed in the RCM.
+    SYSTRACE_CALL();
 
     FEngine& engine = mEngine;
-    EntityManager& em = engine.getEntityManager();
-    FRenderableManager& rcm = engine.getRenderableManager();
     FTransformManager& tcm = engine.getTransformManager();
     FLightManager& lcm = engine.getLightManager();
-    // go through the list of entities, and gather the data of those that are renderables
     auto& sceneData = mRenderableData;
     auto& lightData = mLightData;
-    auto const& entities = mEntities;
 
+    // bring the cache up-to-date, this only gathers the data of renderables that changed
+    updateCache(worldOriginTransform);
 
-    // NOTE: we can't know in advance how many entities are renderable or lights because the corresponding
-    // component can be added after the entity is added to the scene.
+    auto const& renderableCache = mRenderableCache;
+    auto const& lightSources = mLightSources;
 
-    size_t renderableDataCapacity = entities.size();
+    size_t renderableDataCapacity = renderableCache.size();
     // we need the capacity to be multiple of 16 for SIMD loops
     renderableDataCapacity = (renderableDataCapacity + 0xFu) & ~0xFu;
     // we need 1 extra entry at the end for the summed primitive count
@@ -75,9 +91,21 @@ void FScene::prepare(const mat4f& worldOriginTransform) {
         sceneData.setCapacity(renderableDataCapacity);
     }
 
+    // the View reorders sceneData, so it's copied from the cache each time
+    sceneData.resize(renderableCache.size());
+    copyRenderables(sceneData, renderableCache, renderableCache.size(),
+            std::make_index_sequence<RenderableSoa::getArrayCount()>());
+
+    // the UBO slot of a renderable is its index in the cache, updateUBOs() overrides it when
+    // UBO caching is disabled.
+    uint32_t* const uboSlots = sceneData.data<UBO_SLOT>();
+    for (size_t i = 0, c = sceneData.size(); i < c; i++) {
+        uboSlots[i] = uint32_t(i);
+    }
+
     // The light data list will always contain at least one entry for the
     // dominating directional light, even if there are no entities.
-    size_t lightDataCapacity = std::max<size_t>(1, entities.size());
+    size_t lightDataCapacity = DIRECTIONAL_LIGHTS_COUNT + lightSources.size();
     // we need the capacity to be multiple of 16 for SIMD loops
     lightDataCapacity = (lightDataCapacity + 0xFu) & ~0xFu;
 
@@ -88,76 +116,37 @@ void FScene::prepare(const mat4f& worldOriginTransform) {
     // the first entries are reserved for the directional lights (currently only one)
     lightData.resize(DIRECTIONAL_LIGHTS_COUNT);
 
-
     // find the max intensity directional light index in our local array
     float maxIntensity = 0.0f;
 
-    for (Entity e : entities) {
-        if (!em.isAlive(e)) {
-            continue;
-        }
-
-        // getInstance() always returns null if the entity is the Null entity
-        // so we don't need to check for that, but we need to check it's alive
-        auto ri = rcm.getInstance(e);
-        auto li = lcm.getInstance(e);
-        if (!ri & !li) {
-            continue;
-        }
-
-        // get the world transform
-        auto ti = tcm.getInstance(e);
-        const mat4f worldTransform = worldOriginTransform * tcm.getWorldTransform(ti);
-        const bool reversedWindingOrder = det(worldTransform.upperLeft()) < 0;
-
-        // don't even draw this object if it doesn't have a transform (which shouldn't happen
-        // because one is always created when creating a Renderable component).
-        if (ri && ti) {
-            // compute the world AABB so we can perform culling
-            const Box worldAABB = rigidTransform(rcm.getAABB(ri), worldTransform);
-
-            // we know there is enough space in the array
-            sceneData.push_back_unsafe(
-                    ri,                       // RENDERABLE_INSTANCE
-                    worldTransform,           // WORLD_TRANSFORM
-                    reversedWindingOrder,     // REVERSED_WINDING_ORDER
-                    rcm.getVisibility(ri),    // VISIBILITY_STATE
-                    rcm.getBonesUbh(ri),      // BONES_UBH
-                    worldAABB.center,         // WORLD_AABB_CENTER
-                    0,                        // VISIBLE_MASK
-                    rcm.getMorphWeights(ri),  // MORPH_WEIGHTS
-                    rcm.getLayerMask(ri),     // LAYERS
-                    worldAABB.halfExtent,     // WORLD_AABB_EXTENT
-                    {},                       // PRIMITIVES
-                    0                         // SUMMED_PRIMITIVE_COUNT
-            );
-        }
-
-        if (li) {
-            // find the dominant directional light
-            if (UTILS_UNLIKELY(lcm.isDirectionalLight(li))) {
-                // we don't store the directional lights, because we only have a single one
-                if (lcm.getIntensity(li) >= maxIntensity) {
-                    maxIntensity = lcm.getIntensity(li);
-                    float3 d = lcm.getLocalDirection(li);
-                    // using mat3f::getTransformForNormals handles non-uniform scaling
-                    d = normalize(mat3f::getTransformForNormals(worldTransform.upperLeft()) * d);
-                    lightData.elementAt<FScene::POSITION_RADIUS>(0) =
-                            float4{ 0, 0, 0, std::numeric_limits<float>::infinity() };
-                    lightData.elementAt<FScene::DIRECTION>(0)       = d;
-                    lightData.elementAt<FScene::LIGHT_INSTANCE>(0)  = li;
-                }
-            } else {
-                const float4 p = worldTransform * float4{ lcm.getLocalPosition(li), 1 };
-                float3 d = 0;
-                if (!lcm.isPointLight(li) || lcm.isIESLight(li)) {
-                    d = lcm.getLocalDirection(li);
-                    // using mat3f::getTransformForNormals handles non-uniform scaling
-                    d = normalize(mat3f::getTransformForNormals(worldTransform.upperLeft()) * d);
-                }
-                lightData.push_back_unsafe(
-                        float4{ p.xyz, lcm.getRadius(li) }, d, li, {}, {}, {});
+    // lights are few and are always gathered, we only cache their instances
+    for (LightSource const& source : lightSources) {
+        const auto li = source.li;
+        const mat4f worldTransform = worldOriginTransform * tcm.getWorldTransform(source.ti);
+
+        // find the dominant directional light
+        if (UTILS_UNLIKELY(lcm.isDirectionalLight(li))) {
+            // we don't store the directional lights, because we only have a single one
+            if (lcm.getIntensity(li) >= maxIntensity) {
+                maxIntensity = lcm.getIntensity(li);
+                float3 d = lcm.getLocalDirection(li);
+                // using mat3f::getTransformForNormals handles non-uniform scaling
+                d = normalize(mat3f::getTransformForNormals(worldTransform.upperLeft()) * d);
+                lightData.elementAt<FScene::POSITION_RADIUS>(0) =
+                        float4{ 0, 0, 0, std::numeric_limits<float>::infinity() };
+                lightData.elementAt<FScene::DIRECTION>(0)       = d;
+                lightData.elementAt<FScene::LIGHT_INSTANCE>(0)  = li;
             }
+        } else {
+            const float4 p = worldTransform * float4{ lcm.getLocalPosition(li), 1 };
+            float3 d = 0;
+            if (!lcm.isPointLight(li) || lcm.isIESLight(li)) {
+                d = lcm.getLocalDirection(li);
+                // using mat3f::getTransformForNormals handles non-uniform scaling
+                d = normalize(mat3f::getTransformForNormals(worldTransform.upperLeft()) * d);
+            }
+            lightData.push_back_unsafe(
+                    float4{ p.xyz, lcm.getRadius(li) }, d, li, {}, {}, {});
         }
     }
 
@@ -167,93 +156,386 @@ void FScene::prepare(const mat4f& worldOriginTransform) {
     for (size_t i = lightData.size(), e = (lightData.size() + 3u) & ~3u; i < e; i++) {
         new(lightData.data<POSITION_RADIUS>() + i) float4{ 0, 0, 0, 1 };
     }
+
+    if (mCullingHierarchyEnabled) {
+        // this is a no-op for static scenes, and a refit for those where only transforms changed
+        mCullingHierarchy.update(sceneData.data<RENDERABLE_INSTANCE>(),
+                sceneData.data<WORLD_AABB_CENTER>(), sceneData.data<WORLD_AABB_EXTENT>(),
+                sceneData.size());
+    }
 }
 
-void FScene::updateUBOs(utils::Range<uint32_t> visibleRenderables, backend::Handle<backend::HwUniformBuffer> renderableUbh) noexcept {
-    FEngine::DriverApi& driver = mEngine.getDriverApi();
-    const size_t size = visibleRenderables.size() * sizeof(PerRenderableUib);
+void FScene::updateCache(const mat4f& worldOriginTransform) {
+    FEngine& engine = mEngine;
+    FRenderableManager& rcm = engine.getRenderableManager();
+    FTransformManager& tcm = engine.getTransformManager();
+    FLightManager& lcm = engine.getLightManager();
 
-    // allocate space into the command stream directly
-    void* const buffer = driver.allocate(size);
+    // The cached instances are only valid as long as no components were added, removed or
+    // moved. When that happens, or when entities are added to or removed from the scene
+    // we start over. Note that components can be added after the entity is added to the scene.
+    const bool valid = mCacheValid &&
+            mCacheTransformLayoutVersion == tcm.getLayoutVersion() &&
+            mCacheRenderableLayoutVersion == rcm.getLayoutVersion() &&
+            mCacheLightLayoutVersion == lcm.getLayoutVersion() &&
+            mCacheWorldOriginTransform == worldOriginTransform;
+
+    if (!valid || !refreshCache(worldOriginTransform)) {
+        rebuildCache(worldOriginTransform);
+    }
 
-    bool hasContactShadows = false;
-    auto& sceneData = mRenderableData;
-    for (uint32_t i : visibleRenderables) {
-        mat4f const& model = sceneData.elementAt<WORLD_TRANSFORM>(i);
-        const size_t offset = i * sizeof(PerRenderableUib);
-
-        UniformBuffer::setUniform(buffer,
-                offset + offsetof(PerRenderableUib, worldFromModelMatrix), model);
-
-        // Using mat3f::getTransformForNormals handles non-uniform scaling, but DOESN'T guarantee that
-        // the transformed normals will have unit-length, therefore they need to be normalized
-        // in the shader (that's already the case anyways, since normalization is needed after
-        // interpolation).
-        //
-        // We pre-scale normals by the inverse of the largest scale factor to avoid
-        // large post-transform magnitudes in the shader, especially in the fragment shader, where
-        // we use medium precision.
-        //
-        // Note: if the model matrix is known to be a rigid-transform, we could just use it directly.
-
-        mat3f m = mat3f::getTransformForNormals(model.upperLeft());
-        m *= mat3f(1.0f / std::sqrt(max(float3{length2(m[0]), length2(m[1]), length2(m[2])})));
-
-        // The shading normal must be flipped for mirror transformations.
-        // Basically we're shading the other side of the polygon and therefore need to negate the
-        // normal, similar to what we already do to support double-sided lighting.
-        if (sceneData.elementAt<REVERSED_WINDING_ORDER>(i)) {
-            m = -m;
+    mCacheTransformLayoutVersion = tcm.getLayoutVersion();
+    mCacheRenderableLayoutVersion = rcm.getLayoutVersion();
+    mCacheLightLayoutVersion = lcm.getLayoutVersion();
+    mCacheWorldOriginTransform = worldOriginTransform;
+    mCacheValid = true;
+}
+
+void FScene::rebuildCache(const mat4f& worldOriginTransform) {
+    SYSTRACE_CALL();
+
+    FEngine& engine = mEngine;
+    JobSystem& js = engine.getJobSystem();
+    EntityManager& em = engine.getEntityManager();
+    FRenderableManager& rcm = engine.getRenderableManager();
+    FTransformManager& tcm = engine.getTransformManager();
+    FLightManager& lcm = engine.getLightManager();
+    auto& renderableSources = mRenderableSources;
+    auto& lightSources = mLightSources;
+    auto& cache = mRenderableCache;
+
+    // We don't know in advance which entities are renderables, so we first gather all of them,
+    // each in its own slot, and compact the result afterwards.
+    const size_t count = mEntities.size();
+    renderableSources.resize(count);
+    lightSources.clear();
+    cache.clear();
+    cache.resize(count);
+    std::vector<FLightManager::Instance> lightInstances(count);
+
+    RenderableSource* const sources = renderableSources.data();
+    {
+        size_t i = 0;
+        for (Entity e : mEntities) {
+            sources[i++].entity = e;
         }
+    }
 
-        UniformBuffer::setUniform(buffer,
-                offset + offsetof(PerRenderableUib, worldFromModelNormalMatrix), m);
+    auto gather = [&](uint32_t first, uint32_t c) {
+        auto* const UTILS_RESTRICT instances = cache.data<RENDERABLE_INSTANCE>();
+        for (size_t i = first, last = first + c; i < last; i++) {
+            const Entity e = sources[i].entity;
+            // getInstance() always returns null if the entity is the Null entity
+            // so we don't need to check for that, but we need to check it's alive
+            const bool alive = em.isAlive(e);
+            const auto ri = alive ? rcm.getInstance(e) : FRenderableManager::Instance{};
+            const auto li = alive ? lcm.getInstance(e) : FLightManager::Instance{};
+            const auto ti = (ri || li) ? tcm.getInstance(e) : FTransformManager::Instance{};
+
+            // don't even draw this object if it doesn't have a transform (which shouldn't happen
+            // because one is always created when creating a Renderable component).
+            instances[i] = ti ? ri : FRenderableManager::Instance{};
+            sources[i].ti = ti;
+            lightInstances[i] = li;
+        }
+        // this also gathers the empty slots, which is harmless and keeps the loops simple
+        gatherRenderables(first, first + c, worldOriginTransform);
+    };
+
+    if (count <= GATHER_JOB_SIZE) {
+        gather(0, uint32_t(count));
+    } else {
+        auto* job = jobs::parallel_for(js, nullptr, 0, uint32_t(count),
+                std::ref(gather), jobs::CountSplitter<GATHER_JOB_SIZE, 8>());
+        js.runAndWait(job);
+    }
 
-        // Note that we cast bool to uint32_t. Booleans are byte-sized in C++, but we need to
-        // initialize all 32 bits in the UBO field.
+    // compaction
+    SYSTRACE_NAME("compaction");
+    auto const* const instances = cache.data<RENDERABLE_INSTANCE>();
+    auto soa = cache.begin();
+    size_t renderableCount = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (lightInstances[i]) {
+            lightSources.push_back({ sources[i].entity, lightInstances[i], sources[i].ti });
+        }
+        if (instances[i]) {
+            if (renderableCount != i) {
+                soa[renderableCount] = soa[i];
+                sources[renderableCount] = sources[i];
+            }
+            renderableCount++;
+        }
+    }
+    cache.resize(renderableCount);
+    renderableSources.resize(renderableCount);
+}
 
-        FRenderableManager::Visibility visibility = sceneData.elementAt<VISIBILITY_STATE>(i);
-        hasContactShadows = hasContactShadows || visibility.screenSpaceContactShadows;
-        UniformBuffer::setUniform(buffer,
-                offset + offsetof(PerRenderableUib, skinningEnabled),
-                uint32_t(visibility.skinning));
+bool FScene::refreshCache(const mat4f& worldOriginTransform) noexcept {
+    SYSTRACE_CALL();
 
-        UniformBuffer::setUniform(buffer,
-                offset + offsetof(PerRenderableUib, morphingEnabled),
-                uint32_t(visibility.morphing));
+    FEngine& engine = mEngine;
+    JobSystem& js = engine.getJobSystem();
+    EntityManager& em = engine.getEntityManager();
+    FRenderableManager& rcm = engine.getRenderableManager();
+    FTransformManager& tcm = engine.getTransformManager();
+    RenderableSource const* const sources = mRenderableSources.data();
+    auto const* const instances = mRenderableCache.data<RENDERABLE_INSTANCE>();
+    const size_t count = mRenderableSources.size();
+
+    std::atomic_bool valid = { true };
+    auto refresh = [&](uint32_t first, uint32_t c) {
+        for (size_t i = first, last = first + c; i < last; i++) {
+            RenderableSource const& source = sources[i];
+            if (UTILS_UNLIKELY(!em.isAlive(source.entity))) {
+                // the components of a destroyed entity linger until they're garbage collected
+                valid.store(false, std::memory_order_relaxed);
+                return;
+            }
+            if (source.transformVersion != tcm.getWorldTransformVersion(source.ti) ||
+                source.renderableVersion != rcm.getVersion(instances[i])) {
+                gatherRenderables(i, i + 1, worldOriginTransform);
+            }
+        }
+    };
+
+    if (count <= GATHER_JOB_SIZE) {
+        refresh(0, uint32_t(count));
+    } else {
+        auto* job = jobs::parallel_for(js, nullptr, 0, uint32_t(count),
+                std::ref(refresh), jobs::CountSplitter<GATHER_JOB_SIZE, 8>());
+        js.runAndWait(job);
+    }
 
-        UniformBuffer::setUniform(buffer,
-                offset + offsetof(PerRenderableUib, screenSpaceContactShadows),
-                uint32_t(visibility.screenSpaceContactShadows));
+    for (LightSource const& source : mLightSources) {
+        if (UTILS_UNLIKELY(!em.isAlive(source.entity))) {
+            return false;
+        }
+    }
+    return valid.load(std::memory_order_relaxed);
+}
 
-        UniformBuffer::setUniform(buffer,
-                offset + offsetof(PerRenderableUib, morphWeights),
-                sceneData.elementAt<MORPH_WEIGHTS>(i));
+void FScene::gatherRenderables(size_t first, size_t last,
+        const mat4f& worldOriginTransform) noexcept {
+    FEngine& engine = mEngine;
+    FRenderableManager& rcm = engine.getRenderableManager();
+    FTransformManager& tcm = engine.getTransformManager();
+    RenderableSource* const UTILS_RESTRICT sources = mRenderableSources.data();
+    auto& cache = mRenderableCache;
+
+    auto const* const UTILS_RESTRICT instances      = cache.data<RENDERABLE_INSTANCE>();
+    AffineTransform* const UTILS_RESTRICT worldTransforms = cache.data<WORLD_TRANSFORM>();
+    float3*     const UTILS_RESTRICT centers        = cache.data<WORLD_AABB_CENTER>();
+    float3*     const UTILS_RESTRICT extents        = cache.data<WORLD_AABB_EXTENT>();
+
+    // the world origin is almost always the identity
+    const bool hasWorldOrigin = worldOriginTransform != mat4f{};
+    const AffineTransform worldOrigin(worldOriginTransform);
+
+    // fetch everything we need from the component managers, this can't be vectorized
+    for (size_t i = first; i < last; i++) {
+        const auto ri = instances[i];
+        const auto ti = sources[i].ti;
+        const AffineTransform worldTransform(tcm.getWorldTransform(ti));
+        worldTransforms[i] = UTILS_UNLIKELY(hasWorldOrigin) ?
+                worldOrigin * worldTransform : worldTransform;
+        Box const& aabb = rcm.getCullingAABB(ri);
+        centers[i] = aabb.center;
+        extents[i] = aabb.halfExtent;
+        cache.elementAt<VISIBILITY_STATE>(i)        = rcm.getVisibility(ri);
+        cache.elementAt<BONES_OFFSET>(i)            = rcm.getBonesOffset(ri);
+        cache.elementAt<VISIBLE_MASK>(i)            = 0;
+        cache.elementAt<ATLAS_SHADOW_MASK>(i)       = 0;
+        cache.elementAt<MORPH_WEIGHTS>(i)           = rcm.getMorphWeights(ri);
+        cache.elementAt<LAYERS>(i)                  = rcm.getLayerMask(ri);
+        cache.elementAt<PRIMITIVES>(i)              = {};
+        cache.elementAt<SUMMED_PRIMITIVE_COUNT>(i)  = 0;
+        // instanced renderables draw all their instances, unless the View culls some of them
+        cache.elementAt<INSTANCE_COUNT>(i) = uint8_t(std::max(rcm.getInstanceCount(ri), size_t(1)));
+        sources[i].transformVersion = tcm.getWorldTransformVersion(ti);
+        sources[i].renderableVersion = rcm.getVersion(ri);
+    }
+
+    // compute the world AABBs so we can perform culling
+    computeWorldAABBs(centers + first, extents + first,
+            cache.data<REVERSED_WINDING_ORDER>() + first, worldTransforms + first, last - first);
+}
+
+// writes the PerRenderableUib of renderable i at 'offset' in 'buffer'
+// see PerRenderableUib::skinningEnabled
+static inline uint32_t getSkinningMode(FRenderableManager::Visibility visibility) noexcept {
+    return visibility.skinning ? (visibility.matrixBones ? 2u : 1u) : 0u;
+}
+
+static void writeRenderableUib(void* buffer, size_t offset,
+        FScene::RenderableSoa const& sceneData, size_t i) noexcept {
+    AffineTransform const& model = sceneData.elementAt<FScene::WORLD_TRANSFORM>(i);
+
+    UniformBuffer::setUniform(buffer,
+            offset + offsetof(PerRenderableUib, worldFromModelMatrix), model.asMat4());
+
+    // Using mat3f::getTransformForNormals handles non-uniform scaling, but DOESN'T guarantee that
+    // the transformed normals will have unit-length, therefore they need to be normalized
+    // in the shader (that's already the case anyways, since normalization is needed after
+    // interpolation).
+    //
+    // We pre-scale normals by the inverse of the largest scale factor to avoid
+    // large post-transform magnitudes in the shader, especially in the fragment shader, where
+    // we use medium precision.
+    //
+    // Note: if the model matrix is known to be a rigid-transform, we could just use it directly.
+
+    mat3f m = mat3f::getTransformForNormals(model.linear);
+    m *= mat3f(1.0f / std::sqrt(max(float3{length2(m[0]), length2(m[1]), length2(m[2])})));
+
+    // The shading normal must be flipped for mirror transformations.
+    // Basically we're shading the other side of the polygon and therefore need to negate the
+    // normal, similar to what we already do to support double-sided lighting.
+    if (sceneData.elementAt<FScene::REVERSED_WINDING_ORDER>(i)) {
+        m = -m;
+    }
+
+    UniformBuffer::setUniform(buffer,
+            offset + offsetof(PerRenderableUib, worldFromModelNormalMatrix), m);
+
+    // Note that we cast bool to uint32_t. Booleans are byte-sized in C++, but we need to
+    // initialize all 32 bits in the UBO field.
+
+    FRenderableManager::Visibility visibility = sceneData.elementAt<FScene::VISIBILITY_STATE>(i);
+    UniformBuffer::setUniform(buffer,
+            offset + offsetof(PerRenderableUib, skinningEnabled),
+            getSkinningMode(visibility));
+
+    UniformBuffer::setUniform(buffer,
+            offset + offsetof(PerRenderableUib, morphingEnabled),
+            uint32_t(visibility.morphing));
+
+    UniformBuffer::setUniform(buffer,
+            offset + offsetof(PerRenderableUib, screenSpaceContactShadows),
+            uint32_t(visibility.screenSpaceContactShadows));
+
+    UniformBuffer::setUniform(buffer,
+            offset + offsetof(PerRenderableUib, instancingEnabled),
+            uint32_t(visibility.instancing));
+
+    UniformBuffer::setUniform(buffer,
+            offset + offsetof(PerRenderableUib, morphWeights),
+            sceneData.elementAt<FScene::MORPH_WEIGHTS>(i));
+}
+
+void FScene::updateUBOs(utils::Range<uint32_t> visibleRenderables,
+        backend::Handle<backend::HwUniformBuffer> renderableUbh, bool created) noexcept {
+    FEngine::DriverApi& driver = mEngine.getDriverApi();
+
+    bool hasContactShadows = false;
+    auto& sceneData = mRenderableData;
+    auto const* const visibility = sceneData.data<VISIBILITY_STATE>();
+    for (uint32_t i : visibleRenderables) {
+        hasContactShadows = hasContactShadows || visibility[i].screenSpaceContactShadows;
+    }
+
+    if (usesCachedUBOs()) {
+        updateCachedUBOs(visibleRenderables, renderableUbh, created);
+    } else {
+        const size_t size = visibleRenderables.size() * sizeof(PerRenderableUib);
+
+        // allocate space into the command stream directly
+        void* const buffer = driver.allocate(size);
+
+        uint32_t* const uboSlots = sceneData.data<UBO_SLOT>();
+        for (uint32_t i : visibleRenderables) {
+            writeRenderableUib(buffer, i * sizeof(PerRenderableUib), sceneData, i);
+            uboSlots[i] = i;
+        }
+        driver.loadUniformBuffer(renderableUbh, { buffer, size });
     }
 
-    // TODO: handle static objects separately
     mHasContactShadows = hasContactShadows;
     mRenderableViewUbh = renderableUbh;
-    driver.loadUniformBuffer(renderableUbh, { buffer, size });
 
     if (mSkybox) {
         mSkybox->commit(driver);
     }
 }
 
+void FScene::updateCachedUBOs(utils::Range<uint32_t> visibleRenderables,
+        backend::Handle<backend::HwUniformBuffer> renderableUbh, bool created) noexcept {
+    SYSTRACE_CALL();
+
+    FEngine::DriverApi& driver = mEngine.getDriverApi();
+    auto const& sceneData = mRenderableData;
+    auto& shadow = mUboShadow;
+    auto& written = mUboSlotWritten;
+    auto& dirty = mDirtyUboSlots;
+
+    // The shadow copy is only valid for the UBO it was last uploaded to (e.g. it's not when the
+    // scene is rendered in several views), and only as long as the slots don't change.
+    const size_t slotCount = mRenderableCache.size();
+    if (created || renderableUbh != mUboCacheUbh || shadow.size() != slotCount) {
+        shadow.resize(slotCount);
+        written.assign(slotCount, false);
+        mUboCacheUbh = renderableUbh;
+    }
+
+    // Only the slots whose content changed need to be written, the normal matrix can't change
+    // unless the world transform does.
+    uint32_t const* const uboSlots = sceneData.data<UBO_SLOT>();
+    auto const* const worldTransforms = sceneData.data<WORLD_TRANSFORM>();
+    auto const* const visibility = sceneData.data<VISIBILITY_STATE>();
+    auto const* const morphWeights = sceneData.data<MORPH_WEIGHTS>();
+    dirty.clear();
+    for (uint32_t i : visibleRenderables) {
+        const uint32_t slot = uboSlots[i];
+        PerRenderableUib const& uib = shadow[slot];
+        if (!written[slot] ||
+                AffineTransform(uib.worldFromModelMatrix) != worldTransforms[i] ||
+                uib.morphWeights != morphWeights[i] ||
+                uib.skinningEnabled != int32_t(getSkinningMode(visibility[i])) ||
+                uib.morphingEnabled != int32_t(visibility[i].morphing) ||
+                uib.screenSpaceContactShadows != uint32_t(visibility[i].screenSpaceContactShadows) ||
+                uib.instancingEnabled != int32_t(visibility[i].instancing)) {
+            writeRenderableUib(&shadow[slot], 0, sceneData, i);
+            written[slot] = true;
+            dirty.push_back(slot);
+        }
+    }
+
+    if (dirty.empty()) {
+        return;
+    }
+
+    // Upload the dirty slots in as few ranges as possible. Small gaps of clean slots are uploaded
+    // along with their neighbors, which is cheaper than issuing more updates.
+    std::sort(dirty.begin(), dirty.end());
+    for (size_t i = 0, c = dirty.size(); i < c;) {
+        const uint32_t first = dirty[i];
+        uint32_t last = first + 1;
+        for (i++; i < c && dirty[i] - last <= UBO_SLOT_MAX_GAP; i++) {
+            last = dirty[i] + 1;
+        }
+        const size_t size = (last - first) * sizeof(PerRenderableUib);
+        void* const buffer = driver.allocate(size);
+        memcpy(buffer, shadow.data() + first, size);
+        driver.updateUniformBuffer(renderableUbh, { buffer, size },
+                uint32_t(first * sizeof(PerRenderableUib)));
+    }
+}
+
 void FScene::terminate(FEngine& engine) {
     // DO NOT destroy this UBO, it's owned by the View
     mRenderableViewUbh.clear();
+    mUboCacheUbh.clear();
 }
 
-void FScene::prepareDynamicLights(const CameraInfo& camera, ArenaScope& rootArena, backend::Handle<backend::HwUniformBuffer> lightUbh) noexcept {
+void FScene::prepareDynamicLights(const CameraInfo& camera, ArenaScope& rootArena,
+        backend::Handle<backend::HwUniformBuffer> lightUbh, Froxelizer& froxelizer) noexcept {
     FEngine::DriverApi& driver = mEngine.getDriverApi();
     FLightManager& lcm = mEngine.getLightManager();
     FScene::LightSoa& lightData = getLightData();
 
     /*
      * Here we copy our lights data into the GPU buffer, some lights might be left out if there
-     * are more than the GPU buffer allows (i.e. 256).
+     * are more than the GPU buffer allows (i.e. 256, or 4096 with the large light count).
      *
      * We always sort lights by distance to the camera plane so that:
      * - we can build light trees
@@ -265,7 +547,7 @@ void FScene::prepareDynamicLights(const CameraInfo& camera, ArenaScope& rootAren
     size_t const size = lightData.size();
 
     // always allocate at least 4 entries, because the vectorized loops below rely on that
-    float* const UTILS_RESTRICT distances = arena.allocate<float>((size + 3u) & 3u, CACHELINE_SIZE);
+    float* const UTILS_RESTRICT distances = arena.allocate<float>((size + 3u) & ~3u, CACHELINE_SIZE);
 
     // pre-compute the lights' distance to the camera plane, for sorting below
     // - we don't skip the directional light, because we don't care, it's ignored during sorting
@@ -278,32 +560,72 @@ void FScene::prepareDynamicLights(const CameraInfo& camera, ArenaScope& rootAren
             [](auto const& lhs, auto const& rhs) { return lhs.second < rhs.second; });
 
     // drop excess lights
-    lightData.resize(std::min(size, CONFIG_MAX_LIGHT_COUNT + DIRECTIONAL_LIGHTS_COUNT));
+    const size_t maxLightCount = froxelizer.isLargeLightCountEnabled() ?
+            CONFIG_MAX_LARGE_LIGHT_COUNT : CONFIG_MAX_LIGHT_COUNT;
+    lightData.resize(std::min(size, maxLightCount + DIRECTIONAL_LIGHTS_COUNT));
 
     // number of point/spot lights
-    size_t positionalLightCount = size - DIRECTIONAL_LIGHTS_COUNT;
+    const size_t positionalLightCount = lightData.size() - DIRECTIONAL_LIGHTS_COUNT;
 
     // compute the light ranges (needed when building light trees)
     float2* const zrange = lightData.data<FScene::SCREEN_SPACE_Z_RANGE>();
     computeLightRanges(zrange, camera, spheres + DIRECTIONAL_LIGHTS_COUNT, positionalLightCount);
 
-    LightsUib* const lp = driver.allocatePod<LightsUib>(positionalLightCount);
+    // the first lights go in the UBO, the others in the froxel buffer, which is uploaded by
+    // whole rows
+    constexpr size_t lightsPerRow = FROXEL_BUFFER_LIGHTS_PER_ROW;
+    const size_t uniformLightCount = std::min(positionalLightCount, CONFIG_MAX_LIGHT_COUNT);
+    const size_t bufferLightCount = ((positionalLightCount - uniformLightCount +
+            lightsPerRow - 1) / lightsPerRow) * lightsPerRow;
+
+    LightsUib* const lp = driver.allocatePod<LightsUib>(uniformLightCount);
+
+    // these lights can be many, so they're not allocated in the command stream
+    LightsUib* const lb = bufferLightCount ?
+            (LightsUib*)malloc(bufferLightCount * sizeof(LightsUib)) : nullptr;
 
     auto const* UTILS_RESTRICT directions       = lightData.data<FScene::DIRECTION>();
     auto const* UTILS_RESTRICT instances        = lightData.data<FScene::LIGHT_INSTANCE>();
     auto const* UTILS_RESTRICT shadowInfo       = lightData.data<FScene::SHADOW_INFO>();
-    for (size_t i = DIRECTIONAL_LIGHTS_COUNT, c = size; i < c; ++i) {
+    for (size_t i = DIRECTIONAL_LIGHTS_COUNT, c = lightData.size(); i < c; ++i) {
         const size_t gpuIndex = i - DIRECTIONAL_LIGHTS_COUNT;
+        LightsUib& light = gpuIndex < CONFIG_MAX_LIGHT_COUNT ?
+                lp[gpuIndex] : lb[gpuIndex - CONFIG_MAX_LIGHT_COUNT];
         auto li = instances[i];
-        lp[gpuIndex].positionFalloff      = { spheres[i].xyz, lcm.getSquaredFalloffInv(li) };
-        lp[gpuIndex].colorIntensity       = { lcm.getColor(li), lcm.getIntensity(li) };
-        lp[gpuIndex].directionIES         = { directions[i], 0.0f };
-        lp[gpuIndex].spotScaleOffset      = lcm.getSpotParams(li).scaleOffset;
-        lp[gpuIndex].shadow               = { shadowInfo[i].pack() };
-        lp[gpuIndex].type                 = lcm.isPointLight(li) ? 0u : 1u;
+        light.positionFalloff      = { spheres[i].xyz, lcm.getSquaredFalloffInv(li) };
+        light.colorIntensity       = { lcm.getColor(li), lcm.getIntensity(li) };
+        light.directionIES         = { directions[i], 0.0f };
+        light.spotScaleOffset      = lcm.getSpotParams(li).scaleOffset;
+        light.shadow               = { shadowInfo[i].pack() };
+        light.type                 = lcm.isPointLight(li) ? 0u : 1u;
     }
 
-    driver.loadUniformBuffer(lightUbh, { lp, positionalLightCount * sizeof(LightsUib) });
+    driver.loadUniformBuffer(lightUbh, { lp, uniformLightCount * sizeof(LightsUib) });
+
+    if (UTILS_UNLIKELY(lb)) {
+        froxelizer.commitLights(driver, lb, lb + bufferLightCount,
+                [](void* buffer, size_t, void*) { free(buffer); });
+    }
+}
+
+// These methods need to exist so clang honors the __restrict__ keyword, which in turn
+// produces much better vectorization. The ALWAYS_INLINE keyword makes sure we actually don't
+// pay the price of the call!
+UTILS_ALWAYS_INLINE
+inline void FScene::computeWorldAABBs(
+        float3* UTILS_RESTRICT const centers,
+        float3* UTILS_RESTRICT const extents,
+        bool* UTILS_RESTRICT const reversedWindingOrder,
+        AffineTransform const* UTILS_RESTRICT const transforms, size_t count) noexcept {
+    // this is the same as rigidTransform(), but over a batch of boxes
+    for (size_t i = 0; i < count; i++) {
+        mat3f const& m = transforms[i].linear;
+        const float3 c = centers[i];
+        const float3 e = extents[i];
+        centers[i] = m[0] * c.x + m[1] * c.y + m[2] * c.z + transforms[i].translation;
+        extents[i] = abs(m[0]) * e.x + abs(m[1]) * e.y + abs(m[2]) * e.z;
+        reversedWindingOrder[i] = det(m) < 0;
+    }
 }
 
 // These methods need to exist so clang honors the __restrict__ keyword, which in turn
@@ -360,14 +682,17 @@ inline void FScene::computeLightRanges(
 
 void FScene::addEntity(Entity entity) {
     mEntities.insert(entity);
+    mCacheValid = false;
 }
 
 void FScene::addEntities(const Entity* entities, size_t count) {
     mEntities.insert(entities, entities + count);
+    mCacheValid = false;
 }
 
 void FScene::remove(Entity entity) {
     mEntities.erase(entity);
+    mCacheValid = false;
 }
 
 void FScene::removeEntities(const Entity* entities, size_t count) {
@@ -404,6 +729,24 @@ bool FScene::hasEntity(Entity entity) const noexcept {
     return mEntities.find(entity) != mEntities.end();
 }
 
+void FScene::setCullingHierarchyEnabled(bool enabled) noexcept {
+    mCullingHierarchyEnabled = enabled;
+    if (!enabled) {
+        mCullingHierarchy.clear();
+    }
+}
+
+void FScene::setUniformBufferCachingEnabled(bool enabled) noexcept {
+    mUniformBufferCachingEnabled = enabled;
+    if (!enabled) {
+        // swap with empty vectors to actually release the memory
+        std::vector<PerRenderableUib>().swap(mUboShadow);
+        std::vector<bool>().swap(mUboSlotWritten);
+        std::vector<uint32_t>().swap(mDirtyUboSlots);
+        mUboCacheUbh.clear();
+    }
+}
+
 void FScene::setSkybox(FSkybox* skybox) noexcept {
     std::swap(mSkybox, skybox);
     if (skybox) {
@@ -482,4 +825,20 @@ bool Scene::hasEntity(Entity entity) const noexcept {
     return upcast(this)->hasEntity(entity);
 }
 
+void Scene::setCullingHierarchyEnabled(bool enabled) noexcept {
+    upcast(this)->setCullingHierarchyEnabled(enabled);
+}
+
+bool Scene::isCullingHierarchyEnabled() const noexcept {
+    return upcast(this)->isCullingHierarchyEnabled();
+}
+
+void Scene::setUniformBufferCachingEnabled(bool enabled) noexcept {
+    upcast(this)->setUniformBufferCachingEnabled(enabled);
+}
+
+bool Scene::isUniformBufferCachingEnabled() const noexcept {
+    return upcast(this)->isUniformBufferCachingEnabled();
+}
+
 } // namespace filament
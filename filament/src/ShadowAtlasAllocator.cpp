@@ -0,0 +1,210 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ShadowAtlasAllocator.h"
+
+#include <algorithm>
+
+#include <assert.h>
+
+namespace filament {
+
+ShadowAtlasAllocator::ShadowAtlasAllocator() noexcept {
+    clear();
+}
+
+void ShadowAtlasAllocator::clear() noexcept {
+    for (auto& nodes : mNodes) {
+        nodes.fill(Node::FREE);
+    }
+    mSlots.fill({});
+}
+
+size_t ShadowAtlasAllocator::getUsedLayerCount() const noexcept {
+    // the freed tiles are merged, so the root of an empty layer is free
+    size_t count = mLayerCount;
+    while (count > 0 && mNodes[count - 1][0] == Node::FREE) {
+        count--;
+    }
+    return count;
+}
+
+void ShadowAtlasAllocator::allocate(Request* requests, size_t count, size_t layerCount) noexcept {
+    assert(count <= MAX_REQUEST_COUNT);
+    layerCount = std::min(layerCount, size_t(CONFIG_MAX_SHADOW_ATLAS_LAYERS));
+    if (layerCount != mLayerCount) {
+        // the layers past mLayerCount are always free
+        if (layerCount < getUsedLayerCount()) {
+            clear();
+        }
+        mLayerCount = layerCount;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        requests[i].tile = {};
+        requests[i].slot = INVALID_SLOT;
+    }
+
+    // the requests that had a tile in the previous call keep it, the other tiles are freed
+    for (size_t s = 0; s < MAX_REQUEST_COUNT; s++) {
+        Slot& slot = mSlots[s];
+        if (!slot.used) {
+            continue;
+        }
+        Request* const last = requests + count;
+        Request* const request = std::find_if(requests, last, [&slot](Request const& r) {
+            return r.key == slot.key && r.level == slot.level && r.slot == INVALID_SLOT;
+        });
+        if (request != last) {
+            request->tile = slot.tile;
+            request->slot = uint8_t(s);
+        } else {
+            freeTile(slot.tile);
+            slot.used = false;
+        }
+    }
+
+    // areas are counted in tiles of MAX_LEVEL
+    auto getArea = [](size_t level) -> size_t { return 1u << (2u * (MAX_LEVEL - level)); };
+    size_t freeArea = mLayerCount * getArea(0);
+    for (size_t i = 0; i < count; i++) {
+        if (requests[i].slot != INVALID_SLOT) {
+            freeArea -= getArea(requests[i].tile.level);
+        }
+    }
+
+    // allocate the new tiles, largest first, so the small tiles don't fragment the atlas
+    std::array<uint8_t, MAX_REQUEST_COUNT> order;
+    std::array<uint8_t, MAX_REQUEST_COUNT> levels;
+    size_t orderCount = 0;
+    size_t area = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (requests[i].slot == INVALID_SLOT) {
+            assert(requests[i].level <= MAX_LEVEL);
+            levels[i] = requests[i].level;
+            area += getArea(levels[i]);
+            order[orderCount++] = uint8_t(i);
+        }
+    }
+    auto byLevel = [&levels](uint8_t lhs, uint8_t rhs) { return levels[lhs] < levels[rhs]; };
+    std::stable_sort(order.begin(), order.begin() + orderCount, byLevel);
+
+    // when the new tiles don't fit, the largest ones are made smaller first
+    for (size_t i = 0; area > freeArea && i < orderCount;) {
+        uint8_t& level = levels[order[i]];
+        if (level < MAX_LEVEL && (i + 1 == orderCount || level <= levels[order[i + 1]])) {
+            area -= getArea(level) - getArea(level + 1);
+            level++;
+        } else {
+            i++;
+        }
+    }
+    std::stable_sort(order.begin(), order.begin() + orderCount, byLevel);
+
+    size_t freeSlot = 0;
+    for (size_t i = 0; i < orderCount; i++) {
+        Request& request = requests[order[i]];
+        Tile tile;
+        for (size_t level = levels[order[i]]; level <= MAX_LEVEL; level++) {
+            if (allocateTile(tile, level)) {
+                break;
+            }
+        }
+        if (!tile.isValid()) {
+            // the atlas is full
+            continue;
+        }
+        while (mSlots[freeSlot].used) {
+            freeSlot++;
+        }
+        assert(freeSlot < MAX_REQUEST_COUNT);
+        mSlots[freeSlot] = { request.key, request.level, true, tile };
+        request.tile = tile;
+        request.slot = uint8_t(freeSlot);
+    }
+}
+
+bool ShadowAtlasAllocator::isReachable(Tile const& tile) const noexcept {
+    size_t x = tile.x;
+    size_t y = tile.y;
+    for (size_t level = tile.level; level > 0; level--) {
+        x >>= 1u;
+        y >>= 1u;
+        if (mNodes[tile.layer][getNodeIndex(level - 1, x, y)] != Node::SPLIT) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ShadowAtlasAllocator::findFreeTile(Tile& tile, size_t level) const noexcept {
+    const size_t dim = 1u << level;
+    for (size_t layer = 0; layer < mLayerCount; layer++) {
+        for (size_t y = 0; y < dim; y++) {
+            for (size_t x = 0; x < dim; x++) {
+                const Tile candidate{ uint8_t(layer), uint8_t(level), uint8_t(x), uint8_t(y) };
+                if (mNodes[layer][getNodeIndex(level, x, y)] == Node::FREE &&
+                        isReachable(candidate)) {
+                    tile = candidate;
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+bool ShadowAtlasAllocator::allocateTile(Tile& tile, size_t level) noexcept {
+    // use a free tile of the right size if there is one, otherwise split the smallest free
+    // tile that is larger
+    for (size_t l = level + 1; l-- > 0;) {
+        Tile t;
+        if (findFreeTile(t, l)) {
+            while (t.level < level) {
+                getNode(t) = Node::SPLIT;
+                t = { t.layer, uint8_t(t.level + 1), uint8_t(t.x * 2), uint8_t(t.y * 2) };
+                for (size_t i = 0; i < 4; i++) {
+                    mNodes[t.layer][getNodeIndex(t.level, t.x + (i & 1u), t.y + (i >> 1u))] =
+                            Node::FREE;
+                }
+            }
+            getNode(t) = Node::USED;
+            tile = t;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ShadowAtlasAllocator::freeTile(Tile tile) noexcept {
+    assert(getNode(tile) == Node::USED);
+    getNode(tile) = Node::FREE;
+    // merge the tile with its buddies
+    while (tile.level > 0) {
+        const size_t x = tile.x & ~1u;
+        const size_t y = tile.y & ~1u;
+        for (size_t i = 0; i < 4; i++) {
+            if (mNodes[tile.layer][getNodeIndex(tile.level, x + (i & 1u), y + (i >> 1u))] !=
+                    Node::FREE) {
+                return;
+            }
+        }
+        tile = { tile.layer, uint8_t(tile.level - 1), uint8_t(tile.x / 2), uint8_t(tile.y / 2) };
+        getNode(tile) = Node::FREE;
+    }
+}
+
+} // namespace filament
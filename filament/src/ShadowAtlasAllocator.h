@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TNT_FILAMENT_SHADOWATLASALLOCATOR_H
+#define TNT_FILAMENT_SHADOWATLASALLOCATOR_H
+
+#include <private/filament/EngineEnums.h>
+
+#include <array>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace filament {
+
+/*
+ * Allocates square tiles in the layers of the shadow atlas.
+ *
+ * Each layer is a quadtree: a tile of level n is 1/2^n of the layer's dimension, and is split in
+ * four tiles of level n+1 when smaller tiles are needed (buddy allocation). Freed tiles are
+ * merged with their buddies.
+ *
+ * Tiles are kept from one call of allocate() to the next, as long as the same requests are made,
+ * so that the shadow maps of stable lights don't move in the atlas.
+ */
+class ShadowAtlasAllocator {
+public:
+    // the smallest tiles are 1/16th of the atlas dimension
+    static constexpr size_t MAX_LEVEL = 4;
+    static constexpr size_t MAX_REQUEST_COUNT = CONFIG_MAX_SHADOW_ATLAS_SPOTS;
+    static constexpr uint8_t INVALID_LEVEL = 0xFF;
+    static constexpr uint8_t INVALID_SLOT = 0xFF;
+
+    struct Tile {
+        uint8_t layer = 0;
+        uint8_t level = INVALID_LEVEL;  // the tile's dimension is the atlas dimension >> level
+        uint8_t x = 0;                  // position, in tiles of this level
+        uint8_t y = 0;
+        bool isValid() const noexcept { return level != INVALID_LEVEL; }
+    };
+
+    struct Request {
+        uint32_t key = 0;               // identifies the request from frame to frame
+        uint8_t level = 0;              // the level of the tile wanted, at most MAX_LEVEL
+
+        // set by allocate()
+        Tile tile;                      // may be smaller than requested, or invalid if full
+        uint8_t slot = INVALID_SLOT;    // doesn't change as long as the tile is kept
+    };
+
+    ShadowAtlasAllocator() noexcept;
+
+    // Allocates a tile in the first layerCount layers for each of the requests. The requests
+    // that got a tile in the previous call with the same key and level keep it, the other tiles
+    // are freed. New tiles are allocated largest first, and are made smaller when the atlas is
+    // full. Layers can be added, or removed when they're empty, without moving the tiles,
+    // otherwise changing the layer count frees all the tiles.
+    void allocate(Request* requests, size_t count, size_t layerCount) noexcept;
+
+    // frees all the tiles
+    void clear() noexcept;
+
+    size_t getLayerCount() const noexcept { return mLayerCount; }
+
+    // the number of layers up to the last one holding a tile
+    size_t getUsedLayerCount() const noexcept;
+
+private:
+    static constexpr size_t NODE_COUNT = ((1u << (2u * (MAX_LEVEL + 1u))) - 1u) / 3u;
+
+    enum class Node : uint8_t {
+        FREE,       // the whole tile is free
+        SPLIT,      // the tile is split in four tiles of the next level
+        USED        // the tile is allocated
+    };
+
+    struct Slot {
+        uint32_t key = 0;
+        uint8_t level = 0;              // requested level
+        bool used = false;
+        Tile tile;
+    };
+
+    // nodes are stored level by level, rows first
+    static constexpr size_t getNodeIndex(size_t level, size_t x, size_t y) noexcept {
+        return ((1u << (2u * level)) - 1u) / 3u + (y << level) + x;
+    }
+
+    Node& getNode(Tile const& tile) noexcept {
+        return mNodes[tile.layer][getNodeIndex(tile.level, tile.x, tile.y)];
+    }
+
+    // whether all the ancestors of the tile are split, i.e. the tile's node is meaningful
+    bool isReachable(Tile const& tile) const noexcept;
+
+    bool findFreeTile(Tile& tile, size_t level) const noexcept;
+    bool allocateTile(Tile& tile, size_t level) noexcept;
+    void freeTile(Tile tile) noexcept;
+
+    std::array<std::array<Node, NODE_COUNT>, CONFIG_MAX_SHADOW_ATLAS_LAYERS> mNodes;
+    std::array<Slot, MAX_REQUEST_COUNT> mSlots;
+    size_t mLayerCount = 0;
+};
+
+} // namespace filament
+
+#endif // TNT_FILAMENT_SHADOWATLASALLOCATOR_H
@@ -67,22 +67,46 @@ ShadowMap::~ShadowMap() {
     engine.getEntityManager().destroy(sizeof(entities) / sizeof(Entity), entities);
 }
 
-void ShadowMap::render(DriverApi& driver, FView::Range const& range, RenderPass& pass,
-        FView& view) noexcept {
-    FEngine& engine = mEngine;
+void ShadowMap::prepareGeometry(FScene::RenderableSoa const& soa, utils::Range<uint32_t> casters,
+        int atlasIndex) noexcept {
+    mCasters = casters;
+    if (mPrimitives.size() < casters.last) {
+        mPrimitives.resize(casters.last);
+    }
+    if (mSummedPrimitiveCounts.size() < casters.last + 1) {
+        mSummedPrimitiveCounts.resize(casters.last + 1);
+    }
 
-    FScene& scene = *view.getScene();
+    filament::CameraInfo cameraInfo(getCamera());
+    mPrimitiveCount = FView::updatePrimitivesLod(mEngine, cameraInfo, soa, casters, mLodHistory,
+            mPrimitives.data());
 
+    // The shadow maps of the atlas share a single VISIBLE_MASK bit, each keeps its own
+    // visibility instead.
+    mAtlasVisibility = atlasIndex >= 0;
+    if (mAtlasVisibility) {
+        if (mVisibleMasks.size() < casters.last) {
+            mVisibleMasks.resize(casters.last);
+        }
+        auto const* const UTILS_RESTRICT atlasMasks = soa.data<FScene::ATLAS_SHADOW_MASK>();
+        FScene::VisibleMaskType* const UTILS_RESTRICT visibleMasks = mVisibleMasks.data();
+        for (uint32_t i : casters) {
+            visibleMasks[i] = ((atlasMasks[i] >> atlasIndex) & 1u) ?
+                    VISIBLE_ATLAS_SHADOW_RENDERABLE : 0u;
+        }
+    }
+}
+
+void ShadowMap::render(FScene const& scene, RenderPass& pass) noexcept {
     FCamera const& camera = getCamera();
     filament::CameraInfo cameraInfo(camera);
 
     pass.setCamera(cameraInfo);
-    pass.setGeometry(scene.getRenderableData(), range, scene.getRenderableUBO());
-
-    // updatePrimitivesLod must be run before appendCommands.
-    view.updatePrimitivesLod(engine, cameraInfo, scene.getRenderableData(), range);
+    pass.setGeometry(scene.getRenderableData(), mCasters, scene.getRenderableUBO(), {
+            .primitives = mPrimitives.data(),
+            .summedPrimitiveCounts = mSummedPrimitiveCounts.data(),
+            .visibleMasks = getVisibleMasks() });
 
-    pass.newCommandBuffer();
     pass.appendCommands(RenderPass::SHADOW);
     pass.sortCommands();
 }
@@ -600,12 +624,12 @@ mat4f ShadowMap::getTextureCoordsMapping() const noexcept {
             0.0f, 0.0f, 0.0f, 1.0f
     });
 
-    // apply the 1-texel border viewport transform
-    const float o = 1.0f / mShadowMapLayout.atlasDimension;
+    // apply the 1-texel border viewport transform, and the position of the texture in the atlas
+    const float2 o = float2(mShadowMapLayout.offset + 1u) / float(mShadowMapLayout.atlasDimension);
     const float s = 1.0f - 2.0f * (1.0f / mShadowMapLayout.textureDimension);
     const mat4f Mb(mat4f::row_major_init{
-             s,    0.0f, 0.0f, o,
-             0.0f, s,    0.0f, o,
+             s,    0.0f, 0.0f, o.x,
+             0.0f, s,    0.0f, o.y,
              0.0f, 0.0f, 1.0f, 0.0f,
              0.0f, 0.0f, 0.0f, 1.0f
     });
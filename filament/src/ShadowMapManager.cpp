@@ -14,15 +14,19 @@
  * limitations under the License.
  */
 
+#include "details/Culler.h"
 #include "details/ShadowMap.h"
 #include "details/ShadowMapManager.h"
 #include "details/Texture.h"
 #include "details/View.h"
 
 #include "RenderPass.h"
+#include "ResourceAllocator.h"
 
 #include <private/filament/SibGenerator.h>
 
+#include <utils/JobSystem.h>
+
 namespace filament {
 
 using namespace backend;
@@ -44,20 +48,31 @@ ShadowMapManager::ShadowMapManager(FEngine& engine) {
 
 ShadowMapManager::~ShadowMapManager() = default;
 
+void ShadowMapManager::terminate(FEngine& engine) noexcept {
+    mCachedShadows.destroy(engine.getResourceAllocator());
+    mCachedShadows = {};
+}
+
 ShadowMapManager::ShadowTechnique ShadowMapManager::update(
         FEngine& engine, FView& view, UniformBuffer& perViewUb,
         UniformBuffer& shadowUb, FScene::RenderableSoa& renderableData,
         FScene::LightSoa& lightData) noexcept {
     calculateTextureRequirements(engine, view, lightData);
+    mCullingRequests.clear();
     ShadowTechnique shadowTechnique = {};
-    shadowTechnique |= updateCascadeShadowMaps(engine, view, perViewUb, renderableData, lightData);
-    shadowTechnique |= updateSpotShadowMaps(engine, view, shadowUb, renderableData, lightData);
+    shadowTechnique |= updateCascadeShadowMaps(engine, view, perViewUb, lightData);
+    shadowTechnique |= updateSpotShadowMaps(engine, view, shadowUb, lightData);
+    if (!mAtlasShadowMaps.empty()) {
+        shadowTechnique |= updateAtlasShadowMaps(engine, view, shadowUb, lightData);
+    }
+    cullShadowCasters(engine, view, renderableData);
     return shadowTechnique;
 }
 
 void ShadowMapManager::reset() noexcept {
     mCascadeShadowMaps.clear();
     mSpotShadowMaps.clear();
+    mAtlasShadowMaps.clear();
 }
 
 void ShadowMapManager::setShadowCascades(size_t lightIndex, size_t cascades) noexcept {
@@ -73,10 +88,17 @@ void ShadowMapManager::addSpotShadowMap(size_t lightIndex) noexcept {
     mSpotShadowMaps.emplace_back(mSpotShadowMapCache[maps].get(), lightIndex);
 }
 
+void ShadowMapManager::addAtlasShadowMap(FEngine& engine, size_t lightIndex) noexcept {
+    const size_t maps = mAtlasShadowMaps.size();
+    assert(maps < CONFIG_MAX_SHADOW_ATLAS_SPOTS);
+    if (maps == mAtlasShadowMapCache.size()) {
+        mAtlasShadowMapCache.push_back(std::make_unique<ShadowMap>(engine));
+    }
+    mAtlasShadowMaps.emplace_back(mAtlasShadowMapCache[maps].get(), lightIndex);
+}
+
 void ShadowMapManager::render(FrameGraph& fg, FEngine& engine, FView& view,
         backend::DriverApi& driver, RenderPass& pass) noexcept {
-    constexpr size_t MAX_SHADOW_LAYERS =
-        CONFIG_MAX_SHADOW_CASCADES + CONFIG_MAX_SHADOW_CASTING_SPOTS;
     struct ShadowPassData {
         FrameGraphId<FrameGraphTexture> shadows;
         FrameGraphId<FrameGraphTexture> tempDepth;
@@ -85,68 +107,176 @@ void ShadowMapManager::render(FrameGraph& fg, FEngine& engine, FView& view,
 
     using ShadowPass = std::pair<const ShadowMapEntry*, RenderPass>;
     std::vector<ShadowPass> passes;
-    passes.reserve(MAX_SHADOW_LAYERS);
+    passes.reserve(mCascadeShadowMaps.size() + mSpotShadowMaps.size() + mAtlasShadowMaps.size());
     uint8_t layerSampleCount[MAX_SHADOW_LAYERS] = {};
 
     assert(mTextureRequirements.layers <= MAX_SHADOW_LAYERS);
 
-    // These loops fill render passes with appropriate rendering commands for each shadow map.
-    // The actual render pass execution is deferred to the frame graph.
+    const bool fillWithCheckerboard = engine.debug.shadowmap.checkerboard && !view.hasVsm();
+
+    FrameGraphTexture::Descriptor shadowTextureDesc {
+        .width = mTextureRequirements.size, .height = mTextureRequirements.size,
+        .depth = mTextureRequirements.layers,
+        .levels = mTextureRequirements.levels,
+        .type = SamplerType::SAMPLER_2D_ARRAY,
+        .format = mTextureFormat,
+        .usage = TextureUsage::DEPTH_ATTACHMENT | TextureUsage::SAMPLEABLE
+            | (fillWithCheckerboard ? TextureUsage::UPLOADABLE : (TextureUsage) 0)
+    };
+
+    if (view.hasVsm()) {
+        // TODO: support 16-bit VSM depth textures.
+        shadowTextureDesc.format = TextureFormat::RG32F;
+        shadowTextureDesc.usage = TextureUsage::COLOR_ATTACHMENT |
+                TextureUsage::SAMPLEABLE;
+    }
+
+    // With shadow map caching, the shadow texture is kept from frame to frame, and only the
+    // shadow maps that changed are rendered again. The cache is dropped when the layout of the
+    // shadow texture changes.
+    const bool cacheShadowMaps = view.isShadowMapCachingEnabled() && !fillWithCheckerboard;
+    if (mCachedShadows.texture) {
+        FrameGraphTexture::Descriptor const& desc = mCachedShadowsDesc;
+        if (!cacheShadowMaps ||
+                desc.width != shadowTextureDesc.width || desc.height != shadowTextureDesc.height ||
+                desc.depth != shadowTextureDesc.depth || desc.levels != shadowTextureDesc.levels ||
+                desc.format != shadowTextureDesc.format || desc.usage != shadowTextureDesc.usage) {
+            mCachedShadows.destroy(engine.getResourceAllocator());
+            mCachedShadows = {};
+        }
+    }
+    if (!cacheShadowMaps) {
+        for (auto& state : mShadowMapStates) {
+            state.valid = false;
+        }
+        for (auto& state : mAtlasShadowMapStates) {
+            state.valid = false;
+        }
+    }
+
+    // The render passes of the shadow maps are filled in three steps. First, the levels of
+    // detail and the visibility of each shadow map's casters are picked concurrently. Then, the
+    // cached shadow maps are skipped, and a command buffer is carved for each of the others.
+    // Last, the commands of each shadow map are generated and sorted concurrently. The steps are
+    // chained with a continuation, so this thread only waits once. The actual render pass
+    // execution is deferred to the frame graph, which records them in order.
+    struct ShadowMapInfo {
+        ShadowMapEntry const* entry;
+        ShadowMapState* state;
+        utils::Range<uint32_t> casters;
+        FScene::VisibleMaskType visibilityMask;
+        int atlasIndex;
+        bool changed;
+    };
+    std::vector<ShadowMapInfo> maps;
+    maps.reserve(passes.capacity());
+
     for (const auto& map : mCascadeShadowMaps) {
         if (!map.hasVisibleShadows()) {
+            mShadowMapStates[map.getLayout().layer].valid = false;
             continue;
         }
-
-        map.getShadowMap()->render(driver, view.getVisibleDirectionalShadowCasters(), pass, view);
-
-        assert(map.getLayout().layer < mTextureRequirements.layers);
-        passes.emplace_back(&map, pass);
-
-        const uint8_t layer = map.getLayout().layer;
-        assert(layer < MAX_SHADOW_LAYERS);
-        layerSampleCount[layer] = map.getLayout().vsmSamples;
+        maps.push_back({ &map, &mShadowMapStates[map.getLayout().layer],
+                view.getVisibleDirectionalShadowCasters(), VISIBLE_DIR_SHADOW_RENDERABLE,
+                -1, false });
     }
     for (size_t i = 0; i < mSpotShadowMaps.size(); i++) {
         const auto& map = mSpotShadowMaps[i];
         if (!map.hasVisibleShadows()) {
+            mShadowMapStates[map.getLayout().layer].valid = false;
             continue;
         }
+        maps.push_back({ &map, &mShadowMapStates[map.getLayout().layer],
+                view.getVisibleSpotShadowCasters(), VISIBLE_SPOT_SHADOW_RENDERABLE_N(i),
+                -1, false });
+    }
+    for (size_t i = 0; i < mAtlasShadowMaps.size(); i++) {
+        const auto& map = mAtlasShadowMaps[i];
+        if (!map.hasVisibleShadows()) {
+            if (map.getLayout().size) {
+                mAtlasShadowMapStates[map.getAtlasSlot()].valid = false;
+            }
+            continue;
+        }
+        maps.push_back({ &map, &mAtlasShadowMapStates[map.getAtlasSlot()],
+                view.getVisibleSpotShadowCasters(), VISIBLE_ATLAS_SHADOW_RENDERABLE,
+                int(i), false });
+    }
 
-        pass.setVisibilityMask(VISIBLE_SPOT_SHADOW_RENDERABLE_N(i));
-        map.getShadowMap()->render(driver, view.getVisibleSpotShadowCasters(), pass, view);
-        pass.clearVisibilityMask();
+    utils::JobSystem& js = engine.getJobSystem();
+    FScene const& scene = *view.getScene();
+    FScene::RenderableSoa const& renderableData = scene.getRenderableData();
 
-        assert(map.getLayout().layer < mTextureRequirements.layers);
-        passes.emplace_back(&map, pass);
+    ShadowMapInfo const* const pMaps = maps.data();
+    auto prepareGeometry = [pMaps, &renderableData](uint32_t first, uint32_t count) {
+        for (uint32_t i = first; i < first + count; i++) {
+            pMaps[i].entry->getShadowMap()->prepareGeometry(renderableData, pMaps[i].casters,
+                    pMaps[i].atlasIndex);
+        }
+    };
 
-        const uint8_t layer = map.getLayout().layer;
-        assert(layer < MAX_SHADOW_LAYERS);
-        layerSampleCount[layer] = map.getLayout().vsmSamples;
-    }
-    assert(passes.size() <= mTextureRequirements.layers);
+    auto generateCommands = [&passes, &scene](uint32_t first, uint32_t count) {
+        ShadowPass* const pPasses = passes.data();
+        for (uint32_t i = first; i < first + count; i++) {
+            pPasses[i].first->getShadowMap()->render(scene, pPasses[i].second);
+        }
+    };
 
-    const bool fillWithCheckerboard = engine.debug.shadowmap.checkerboard && !view.hasVsm();
+    auto selectPasses = [&](utils::JobSystem& js, utils::JobSystem::Job* parent) {
+        // The shadow maps of the atlas share layers, and a layer is cleared before it's rendered,
+        // so all the shadow maps of a layer are rendered again when one of them changes.
+        uint32_t changedAtlasLayers = 0;
+        for (auto& info : maps) {
+            info.changed = !cacheShadowMaps ||
+                    !isShadowMapCached(engine, view, *info.entry, *info.state, info.visibilityMask);
+            if (info.changed && info.atlasIndex >= 0) {
+                changedAtlasLayers |= 1u << info.entry->getLayout().layer;
+            }
+        }
+
+        for (auto const& info : maps) {
+            const uint8_t layer = info.entry->getLayout().layer;
+            if (!info.changed && !(info.atlasIndex >= 0 && (changedAtlasLayers & (1u << layer)))) {
+                continue;
+            }
+
+            assert(layer < mTextureRequirements.layers);
+            passes.emplace_back(info.entry, pass);
+            RenderPass& shadowPass = passes.back().second;
+            shadowPass.setCommandBuffer(pass.allocateCommandBuffer(
+                    info.entry->getShadowMap()->getPrimitiveCount() + 1));
+            shadowPass.setVisibilityMask(info.visibilityMask);
+
+            assert(layer < MAX_SHADOW_LAYERS);
+            layerSampleCount[layer] = info.entry->getLayout().vsmSamples;
+        }
+
+        // the commands are generated by children of this job, which completes after them
+        js.run(utils::jobs::parallel_for(js, parent, 0, uint32_t(passes.size()),
+                std::cref(generateCommands), utils::jobs::CountSplitter<1, 8>()));
+    };
+
+    auto* selectPassesJob = js.createJob(nullptr, std::cref(selectPasses));
+    js.setContinuation(selectPassesJob);
+    js.run(utils::jobs::parallel_for(js, selectPassesJob, 0, uint32_t(maps.size()),
+            std::cref(prepareGeometry), utils::jobs::CountSplitter<1, 8>()));
+    js.runAndWait(selectPassesJob);
+
+    if (mCachedShadows.texture && passes.empty()) {
+        // all the shadow maps are cached, there is nothing to render
+        fg.getBlackboard().put("shadows",
+                fg.import("Shadow Texture", mCachedShadowsDesc, mCachedShadows));
+        return;
+    }
 
     auto& shadowPass = fg.addPass<ShadowPassData>("Shadow Pass",
             [&](FrameGraph::Builder& builder, auto& data) {
-                FrameGraphTexture::Descriptor shadowTextureDesc {
-                    .width = mTextureRequirements.size, .height = mTextureRequirements.size,
-                    .depth = mTextureRequirements.layers,
-                    .levels = mTextureRequirements.levels,
-                    .type = SamplerType::SAMPLER_2D_ARRAY,
-                    .format = mTextureFormat,
-                    .usage = TextureUsage::DEPTH_ATTACHMENT | TextureUsage::SAMPLEABLE
-                        | (fillWithCheckerboard ? TextureUsage::UPLOADABLE : (TextureUsage) 0)
-                };
-
-                if (view.hasVsm()) {
-                    // TODO: support 16-bit VSM depth textures.
-                    shadowTextureDesc.format = TextureFormat::RG32F;
-                    shadowTextureDesc.usage = TextureUsage::COLOR_ATTACHMENT |
-                            TextureUsage::SAMPLEABLE;
+                if (mCachedShadows.texture) {
+                    // only the shadow maps that changed are rendered, the other layers are kept
+                    data.shadows = fg.import("Shadow Texture", mCachedShadowsDesc, mCachedShadows);
+                } else {
+                    data.shadows = builder.createTexture("Shadow Texture", shadowTextureDesc);
                 }
-
-                data.shadows = builder.createTexture("Shadow Texture", shadowTextureDesc);
                 data.shadows = builder.write(data.shadows);
 
                 if (view.hasVsm()) {
@@ -187,6 +317,7 @@ void ShadowMapManager::render(FrameGraph& fg, FEngine& engine, FView& view,
             },
             [=, passes = std::move(passes), &view, &engine](FrameGraphPassResources const& resources,
                     auto const& data, DriverApi& driver) mutable {
+                uint32_t renderedLayers = 0;
                 for (auto& [map, pass] : passes) {
                     FCamera const& camera = map->getShadowMap()->getCamera();
                     filament::CameraInfo cameraInfo(camera);
@@ -202,7 +333,9 @@ void ShadowMapManager::render(FrameGraph& fg, FEngine& engine, FView& view,
                     // attachments to anything greater than 1.0, so we'd need a way to do this other
                     // than clearing.
                     const uint32_t dim = map->getLayout().size;
-                    filament::Viewport viewport { 1, 1, dim - 2, dim - 2 };
+                    const uint2 offset = map->getLayout().offset;
+                    filament::Viewport viewport {
+                            int32_t(offset.x + 1), int32_t(offset.y + 1), dim - 2, dim - 2 };
                     view.prepareViewport(viewport);
 
                     view.commitUniforms(driver);
@@ -210,6 +343,14 @@ void ShadowMapManager::render(FrameGraph& fg, FEngine& engine, FView& view,
                     const auto layer = map->getLayout().layer;
                     auto rt = resources.get(data.rt[layer]);
                     rt.params.viewport = viewport;
+                    if (renderedLayers & (1u << layer)) {
+                        // the layer is shared with other shadow maps of the atlas, and was
+                        // already cleared, only the VSM depth buffer is cleared again
+                        rt.params.flags.clear &= view.hasVsm() ?
+                                TargetBufferFlags::DEPTH : TargetBufferFlags::NONE;
+                        rt.params.flags.discardStart &= rt.params.flags.clear;
+                    }
+                    renderedLayers |= 1u << layer;
 
                     auto polygonOffset = map->getShadowMap()->getPolygonOffset();
                     pass.overridePolygonOffset(&polygonOffset);
@@ -217,6 +358,11 @@ void ShadowMapManager::render(FrameGraph& fg, FEngine& engine, FView& view,
                     pass.execute("Shadow Pass", rt.target, rt.params);
                 }
 
+                if (cacheShadowMaps && !mCachedShadows.texture) {
+                    // keep the shadow texture for the next frames
+                    resources.detach(data.shadows, &mCachedShadows, &mCachedShadowsDesc);
+                }
+
                 engine.flush(); // Wake-up the driver thread
             });
 
@@ -256,6 +402,58 @@ void ShadowMapManager::render(FrameGraph& fg, FEngine& engine, FView& view,
     fg.getBlackboard().put("shadows", shadows);
 }
 
+bool ShadowMapManager::isShadowMapCached(FEngine& engine, FView const& view,
+        ShadowMapEntry const& entry, ShadowMapState& state, uint8_t visibilityMask) noexcept {
+    ShadowMap const& shadowMap = *entry.getShadowMap();
+    FCamera const& camera = shadowMap.getCamera();
+    const mat4f projection(camera.getProjectionMatrix());
+    const mat4f model(camera.getModelMatrix());
+    const PolygonOffset polygonOffset = shadowMap.getPolygonOffset();
+    ShadowLayout const& layout = entry.getLayout();
+
+    // gather the shadow casters seen by this shadow map. Casters skinned or morphed on the GPU can
+    // change without notice, so the shadow map is always rendered again when there are some.
+    // Morph weights and targets, and the deformation on the CPU, change the renderable's version.
+    FRenderableManager const& rcm = engine.getRenderableManager();
+    FScene::RenderableSoa const& renderableData = view.getScene()->getRenderableData();
+    auto const* UTILS_RESTRICT instances   = renderableData.data<FScene::RENDERABLE_INSTANCE>();
+    auto const* UTILS_RESTRICT transforms  = renderableData.data<FScene::WORLD_TRANSFORM>();
+    auto const* UTILS_RESTRICT visibility  = renderableData.data<FScene::VISIBILITY_STATE>();
+    auto const* UTILS_RESTRICT masks       = shadowMap.getVisibleMasks();
+    auto const* UTILS_RESTRICT primitives  = shadowMap.getPrimitives();
+    if (!masks) {
+        masks = renderableData.data<FScene::VISIBLE_MASK>();
+    }
+    bool deforming = false;
+    auto& shadowCasters = mShadowCasters;
+    shadowCasters.clear();
+    for (uint32_t i : shadowMap.getCasters()) {
+        if (masks[i] & visibilityMask) {
+            deforming |= visibility[i].skinning || visibility[i].morphing;
+            shadowCasters.push_back({ transforms[i], primitives[i].data(),
+                    instances[i].asValue(), rcm.getVersion(instances[i]) });
+        }
+    }
+
+    const bool cached = mCachedShadows.texture && state.valid && !deforming &&
+            state.projection == projection && state.model == model &&
+            state.polygonOffset.slope == polygonOffset.slope &&
+            state.polygonOffset.constant == polygonOffset.constant &&
+            state.layout.layer == layout.layer && state.layout.size == layout.size &&
+            state.layout.vsmSamples == layout.vsmSamples && state.layout.offset == layout.offset &&
+            state.casters == shadowCasters;
+
+    if (!cached) {
+        state.projection = projection;
+        state.model = model;
+        state.polygonOffset = polygonOffset;
+        state.layout = layout;
+        std::swap(state.casters, shadowCasters);
+        state.valid = !deforming;
+    }
+    return cached;
+}
+
 void ShadowMapManager::prepareShadow(backend::Handle<backend::HwTexture> texture,
         FView const& view) const noexcept {
     uint8_t anisotropy = 0;
@@ -278,8 +476,7 @@ void ShadowMapManager::prepareShadow(backend::Handle<backend::HwTexture> texture
 
 ShadowMapManager::ShadowTechnique ShadowMapManager::updateCascadeShadowMaps(
         FEngine& engine, FView& view,
-        UniformBuffer& perViewUb, FScene::RenderableSoa& renderableData,
-        FScene::LightSoa& lightData) noexcept {
+        UniformBuffer& perViewUb, FScene::LightSoa& lightData) noexcept {
     FScene* scene = view.getScene();
     const CameraInfo& viewingCameraInfo = view.getCameraInfo();
     uint8_t visibleLayers = view.getVisibleLayers();
@@ -308,9 +505,8 @@ ShadowMapManager::ShadowTechnique ShadowMapManager::updateCascadeShadowMaps(
         };
         map.update(lightData, 0, scene, viewingCameraInfo, visibleLayers,
                 layout, cascadeParams);
-        Frustum const& frustum = map.getCamera().getFrustum();
-        FView::cullRenderables(engine.getJobSystem(), renderableData, frustum,
-                VISIBLE_DIR_SHADOW_RENDERABLE_BIT);
+        mCullingRequests.push_back({ map.getCamera().getFrustum(),
+                VISIBLE_DIR_SHADOW_RENDERABLE_BIT });
 
         // Set shadowBias, using the first directional cascade.
         const float texelSizeWorldSpace = map.getTexelSizeWorldSpace();
@@ -434,7 +630,7 @@ ShadowMapManager::ShadowTechnique ShadowMapManager::updateCascadeShadowMaps(
 
 ShadowMapManager::ShadowTechnique ShadowMapManager::updateSpotShadowMaps(
         FEngine& engine, FView& view, UniformBuffer& shadowUb,
-        FScene::RenderableSoa& renderableData, FScene::LightSoa& lightData) noexcept {
+        FScene::LightSoa& lightData) noexcept {
 
     ShadowTechnique shadowTechnique{};
     FScene* scene = view.getScene();
@@ -467,9 +663,8 @@ ShadowMapManager::ShadowTechnique ShadowMapManager::updateSpotShadowMaps(
 
             // Cull shadow casters
             UniformBuffer& u = shadowUb;
-            Frustum const& frustum = shadowMap.getCamera().getFrustum();
-            FView::cullRenderables(engine.getJobSystem(), renderableData, frustum,
-                    VISIBLE_SPOT_SHADOW_RENDERABLE_N_BIT(i));
+            mCullingRequests.push_back({ shadowMap.getCamera().getFrustum(),
+                    uint8_t(VISIBLE_SPOT_SHADOW_RENDERABLE_N_BIT(i)) });
 
             mat4f const& lightFromWorldMatrix =
                 view.hasVsm() ? shadowMap.getLightSpaceMatrixVsm() : shadowMap.getLightSpaceMatrix();
@@ -505,6 +700,143 @@ ShadowMapManager::ShadowTechnique ShadowMapManager::updateSpotShadowMaps(
     return shadowTechnique;
 }
 
+ShadowMapManager::ShadowTechnique ShadowMapManager::updateAtlasShadowMaps(
+        FEngine& engine, FView& view, UniformBuffer& shadowUb,
+        FScene::LightSoa& lightData) noexcept {
+
+    ShadowTechnique shadowTechnique{};
+    FScene* scene = view.getScene();
+    const CameraInfo& viewingCameraInfo = view.getCameraInfo();
+    uint8_t visibleLayers = view.getVisibleLayers();
+    const uint16_t textureSize = mTextureRequirements.size;
+    auto& lcm = engine.getLightManager();
+    FScene::ShadowInfo* const shadowInfo = lightData.data<FScene::SHADOW_INFO>();
+
+    for (size_t i = 0, c = mAtlasShadowMaps.size(); i < c; i++) {
+        auto& entry = mAtlasShadowMaps[i];
+        if (!entry.getLayout().size) {
+            // there was no room left in the atlas, this light doesn't cast shadows
+            continue;
+        }
+
+        // compute the frustum for this light
+        ShadowMap& shadowMap = *entry.getShadowMap();
+        size_t l = entry.getLightIndex();
+
+        const size_t textureDimension = entry.getLayout().size;
+        const ShadowMap::ShadowMapLayout layout{
+                .zResolution = mTextureZResolution,
+                .atlasDimension = textureSize,
+                .textureDimension = textureDimension,
+                .shadowDimension = textureDimension - 2,
+                .offset = entry.getLayout().offset
+        };
+        shadowMap.update(lightData, l, scene, viewingCameraInfo, visibleLayers, layout, {});
+
+        FLightManager::Instance light = lightData.elementAt<FScene::LIGHT_INSTANCE>(l);
+        if (shadowMap.hasVisibleShadows()) {
+            entry.setHasVisibleShadows(true);
+
+            // Cull shadow casters. There is only one VISIBLE_MASK bit for all the atlas shadow
+            // maps, the visibility in each of them is gathered in ATLAS_SHADOW_MASK.
+            mCullingRequests.push_back({ shadowMap.getCamera().getFrustum(),
+                    VISIBLE_ATLAS_SHADOW_RENDERABLE_BIT, int8_t(i) });
+
+            UniformBuffer& u = shadowUb;
+            mat4f const& lightFromWorldMatrix =
+                view.hasVsm() ? shadowMap.getLightSpaceMatrixVsm() : shadowMap.getLightSpaceMatrix();
+            u.setUniform(offsetof(ShadowUib, atlasSpotLightFromWorldMatrix) +
+                    sizeof(mat4f) * i, lightFromWorldMatrix);
+
+            shadowInfo[l].castsShadows = true;
+            shadowInfo[l].index = FScene::ShadowInfo::ATLAS_INDEX_OFFSET + i;
+            shadowInfo[l].layer = entry.getLayout().layer;
+
+            const float3 dir = lightData.elementAt<FScene::DIRECTION>(l);
+            const float texelSizeWorldSpace = shadowMap.getTexelSizeWorldSpace();
+            const float normalBias = lcm.getShadowNormalBias(light);
+            u.setUniform(offsetof(ShadowUib, atlasDirectionShadowBias) + sizeof(float4) * i,
+                    float4{ dir.x, dir.y, dir.z, normalBias * texelSizeWorldSpace });
+
+            shadowTechnique |= ShadowTechnique::SHADOW_MAP;
+        }
+    }
+
+    return shadowTechnique;
+}
+
+void ShadowMapManager::cullShadowCasters(FEngine& engine, FView const& view,
+        FScene::RenderableSoa& renderableData) noexcept {
+    const size_t requestCount = mCullingRequests.size();
+    if (!requestCount) {
+        return;
+    }
+
+    utils::JobSystem& js = engine.getJobSystem();
+    CullingHierarchy const* const hierarchy = view.getScene()->getCullingHierarchy();
+    const size_t renderableCount = renderableData.size();
+    // the culler writes its results in groups of Culler::MODULO
+    const size_t stride = Culler::round(renderableCount);
+    if (mCullingResults.size() < requestCount * stride) {
+        mCullingResults.resize(requestCount * stride);
+    }
+
+    CullingRequest const* const requests = mCullingRequests.data();
+    FScene::VisibleMaskType* const results = mCullingResults.data();
+
+    // each shadow map is culled by its own job (which can split the culling further), the
+    // culler only sets the bits of the visible renderables, so each row is cleared first
+    auto cull = [&js, &renderableData, hierarchy, requests, results, stride]
+            (uint32_t first, uint32_t count) {
+        for (uint32_t r = first; r < first + count; r++) {
+            FScene::VisibleMaskType* const row = results + r * stride;
+            std::fill_n(row, stride, 0);
+            FView::cullRenderables(js, renderableData, requests[r].frustum, requests[r].bit,
+                    hierarchy, row);
+        }
+    };
+    auto* job = utils::jobs::parallel_for(js, nullptr, 0, uint32_t(requestCount),
+            std::cref(cull), utils::jobs::CountSplitter<1, 8>());
+    js.runAndWait(job);
+
+    // gather the rows, from now on VISIBLE_ATLAS_SHADOW_RENDERABLE means visible in any of the
+    // atlas shadow maps
+    auto* const UTILS_RESTRICT visibleMasks = renderableData.data<FScene::VISIBLE_MASK>();
+    auto* const UTILS_RESTRICT atlasMasks = renderableData.data<FScene::ATLAS_SHADOW_MASK>();
+    auto gather = [requests, requestCount, results, stride, visibleMasks, atlasMasks]
+            (uint32_t first, uint32_t count) {
+        for (size_t r = 0; r < requestCount; r++) {
+            FScene::VisibleMaskType const* const UTILS_RESTRICT row = results + r * stride;
+            for (uint32_t i = first, e = first + count; i < e; i++) {
+                visibleMasks[i] |= row[i];
+            }
+            const int atlasIndex = requests[r].atlasIndex;
+            if (atlasIndex >= 0) {
+                for (uint32_t i = first, e = first + count; i < e; i++) {
+                    atlasMasks[i] |= FScene::AtlasShadowMaskType(
+                            row[i] >> VISIBLE_ATLAS_SHADOW_RENDERABLE_BIT) << atlasIndex;
+                }
+            }
+        }
+    };
+    job = utils::jobs::parallel_for(js, nullptr, 0, uint32_t(renderableCount),
+            std::cref(gather),
+            utils::jobs::CountSplitter<Culler::MODULO * Culler::MIN_LOOP_COUNT_HINT, 8>());
+    js.runAndWait(job);
+}
+
+void ShadowMapManager::getShadowCasterFrusta(FScene::VisibleMaskType visibleMask,
+        FScene::AtlasShadowMaskType atlasMask, std::vector<Frustum>& out) const noexcept {
+    for (CullingRequest const& request : mCullingRequests) {
+        const bool visible = request.atlasIndex >= 0 ?
+                bool((atlasMask >> request.atlasIndex) & 1u) :
+                bool((visibleMask >> request.bit) & 1u);
+        if (visible) {
+            out.push_back(request.frustum);
+        }
+    }
+}
+
 UTILS_NOINLINE
 void ShadowMapManager::fillWithDebugPattern(backend::DriverApi& driverApi,
         Handle<HwTexture> texture, size_t dim) noexcept {
@@ -567,6 +899,20 @@ void ShadowMapManager::calculateTextureRequirements(FEngine& engine, FView& view
         });
     }
 
+    for (auto& atlasShadowMap : mAtlasShadowMaps) {
+        const size_t lightIndex = atlasShadowMap.getLightIndex();
+        maxDimension = std::max(maxDimension, uint16_t(getShadowMapSize(lightIndex)));
+    }
+
+    // The atlas shadow maps follow, in tiles of the texture's dimension and smaller.
+    if (!mAtlasShadowMaps.empty()) {
+        calculateAtlasLayout(engine, view, lightData, maxDimension, layer);
+        layer += mAtlasLayerCount;
+    } else {
+        mAtlasLayerCount = 0;
+        mAtlasEmptyLayersFrameCount = 0;
+    }
+
     const uint8_t layersNeeded = layer;
 
     // Only generate mipmaps for VSM when anisotropy is enabled.
@@ -587,6 +933,76 @@ void ShadowMapManager::calculateTextureRequirements(FEngine& engine, FView& view
     };
 }
 
+void ShadowMapManager::calculateAtlasLayout(FEngine& engine, FView const& view,
+        FScene::LightSoa& lightData, uint16_t dimension, uint8_t firstLayer) noexcept {
+    using Allocator = ShadowAtlasAllocator;
+    auto& lcm = engine.getLightManager();
+    const CameraInfo& camera = view.getCameraInfo();
+    const float viewportHeight = float(view.getViewport().height);
+
+    // A light gets a tile about as large as the number of pixels its sphere of influence covers
+    // on screen, up to its shadow map size.
+    Allocator::Request requests[CONFIG_MAX_SHADOW_ATLAS_SPOTS];
+    const size_t count = mAtlasShadowMaps.size();
+    size_t area = 0;    // in tiles of Allocator::MAX_LEVEL
+    for (size_t i = 0; i < count; i++) {
+        const size_t l = mAtlasShadowMaps[i].getLightIndex();
+        FLightManager::Instance light = lightData.elementAt<FScene::LIGHT_INSTANCE>(l);
+        const float4 sphere = lightData.elementAt<FScene::POSITION_RADIUS>(l);
+        const float distance = std::max(length(sphere.xyz - camera.getPosition()), sphere.w);
+        const float coverage = camera.projection[1][1] * sphere.w / distance * viewportHeight;
+        const float size = std::max(3.0f,
+                std::min(coverage, float(lcm.getShadowMapSize(light))));
+        uint8_t level = 0;
+        while (level < Allocator::MAX_LEVEL && float(dimension >> (level + 1u)) >= size) {
+            level++;
+        }
+        requests[i].key = light.asValue();
+        requests[i].level = level;
+        area += 1u << (2u * (Allocator::MAX_LEVEL - level));
+    }
+
+    // use as many layers as needed for all the tiles to have the requested size
+    const size_t layerArea = 1u << (2u * Allocator::MAX_LEVEL);
+    const size_t layersNeeded = std::min((area + layerArea - 1u) / layerArea,
+            CONFIG_MAX_SHADOW_ATLAS_LAYERS);
+    if (layersNeeded >= mAtlasLayerCount) {
+        mAtlasLayerCount = uint8_t(layersNeeded);
+        mAtlasEmptyLayersFrameCount = 0;
+    }
+
+    mAtlasAllocator.allocate(requests, count, mAtlasLayerCount);
+
+    // the layers that aren't needed anymore are removed once they've been empty for a while, the
+    // tiles of the other layers don't move
+    const size_t layersUsed = std::max(layersNeeded, mAtlasAllocator.getUsedLayerCount());
+    if (layersUsed < mAtlasLayerCount) {
+        if (++mAtlasEmptyLayersFrameCount >= ATLAS_EMPTY_LAYERS_FRAME_COUNT) {
+            mAtlasLayerCount = uint8_t(layersUsed);
+            mAtlasEmptyLayersFrameCount = 0;
+            mAtlasAllocator.allocate(requests, count, mAtlasLayerCount);
+        }
+    } else {
+        mAtlasEmptyLayersFrameCount = 0;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        auto& entry = mAtlasShadowMaps[i];
+        Allocator::Tile const& tile = requests[i].tile;
+        if (!tile.isValid()) {
+            entry.setLayout({});
+            continue;
+        }
+        const uint32_t size = dimension >> tile.level;
+        entry.setLayout({
+            .layer = uint8_t(firstLayer + tile.layer),
+            .size = size,
+            .vsmSamples = 1,    // the layer is shared with other lights
+            .offset = { tile.x * size, tile.y * size }
+        });
+        entry.setAtlasSlot(requests[i].slot);
+    }
+}
 
 ShadowMapManager::CascadeSplits::CascadeSplits(Params p) : mSplitCount(p.cascadeCount + 1) {
     for (size_t s = 0; s < mSplitCount; s++) {
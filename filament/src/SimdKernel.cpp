@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "SimdKernel.h"
+
+namespace filament {
+
+bool isSimdKernelSupported(SimdKernel kernel) noexcept {
+    switch (kernel) {
+        case SimdKernel::SCALAR:
+            return true;
+        case SimdKernel::AVX2:
+#if defined(FILAMENT_SIMD_USE_AVX2)
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+            return false;
+#endif
+        case SimdKernel::NEON:
+#if defined(FILAMENT_SIMD_USE_NEON)
+            return true;
+#else
+            return false;
+#endif
+    }
+    return false;
+}
+
+SimdKernel getSimdKernel() noexcept {
+    // this is evaluated only once, the first time we get here
+    static const SimdKernel kernel = []() {
+        if (isSimdKernelSupported(SimdKernel::NEON)) {
+            return SimdKernel::NEON;
+        }
+        if (isSimdKernelSupported(SimdKernel::AVX2)) {
+            return SimdKernel::AVX2;
+        }
+        return SimdKernel::SCALAR;
+    }();
+    return kernel;
+}
+
+} // namespace filament
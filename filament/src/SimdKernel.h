@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2021 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TNT_FILAMENT_SIMDKERNEL_H
+#define TNT_FILAMENT_SIMDKERNEL_H
+
+#include <stdint.h>
+
+/*
+ * Instruction sets the explicitly vectorized kernels are compiled for.
+ *
+ * NEON kernels are compiled when FILAMENT_SIMD_USE_NEON is defined and can always run.
+ * AVX2 kernels are compiled when FILAMENT_SIMD_USE_AVX2 is defined, each function must be
+ * annotated with FILAMENT_SIMD_AVX2 and only called if the CPU supports SimdKernel::AVX2.
+ */
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#   include <arm_neon.h>
+#   define FILAMENT_SIMD_USE_NEON 1
+#elif (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) || defined(__GNUC__))
+#   include <immintrin.h>
+#   define FILAMENT_SIMD_USE_AVX2 1
+#   define FILAMENT_SIMD_AVX2 __attribute__((target("avx2,fma")))
+#endif
+
+namespace filament {
+
+// Implementations of a SIMD kernel. SCALAR is the reference implementation.
+enum class SimdKernel : uint8_t {
+    SCALAR,     // portable, relies on compiler auto-vectorization
+    AVX2,       // x86-64, selected at runtime if the CPU supports AVX2 and FMA
+    NEON        // ARMv8, always available on aarch64
+};
+
+/*
+ * returns whether a kernel can run on this CPU
+ */
+bool isSimdKernelSupported(SimdKernel kernel) noexcept;
+
+/*
+ * returns the fastest kernel supported by this CPU
+ */
+SimdKernel getSimdKernel() noexcept;
+
+} // namespace filament
+
+#endif // TNT_FILAMENT_SIMDKERNEL_H
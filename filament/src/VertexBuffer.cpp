@@ -26,6 +26,8 @@
 
 #include <utils/Panic.h>
 
+#include <algorithm>
+
 namespace filament {
 
 using namespace backend;
@@ -186,6 +188,34 @@ size_t FVertexBuffer::getVertexCount() const noexcept {
     return mVertexCount;
 }
 
+size_t FVertexBuffer::getBufferSize(uint8_t bufferIndex) const noexcept {
+    size_t size = 0;
+    for (size_t i = 0, n = mAttributes.size(); i < n; ++i) {
+        AttributeData const& attribute = mAttributes[i];
+        if (mDeclaredAttributes[i] && attribute.buffer == bufferIndex) {
+            const size_t end = attribute.offset + size_t(attribute.stride) * (mVertexCount - 1) +
+                    Driver::getElementTypeSize(attribute.type);
+            size = std::max(size, end);
+        }
+    }
+    return size;
+}
+
+VertexBuffer::Builder FVertexBuffer::getLayout() const noexcept {
+    VertexBuffer::Builder builder;
+    builder.vertexCount(mVertexCount).bufferCount(mBufferCount);
+    for (size_t i = 0, n = mAttributes.size(); i < n; ++i) {
+        AttributeData const& attribute = mAttributes[i];
+        if (mDeclaredAttributes[i]) {
+            builder.attribute(VertexAttribute(i), attribute.buffer, attribute.type,
+                    attribute.offset, attribute.stride);
+            builder.normalized(VertexAttribute(i),
+                    (attribute.flags & Attribute::FLAG_NORMALIZED) != 0);
+        }
+    }
+    return builder;
+}
+
 void FVertexBuffer::setBufferAt(FEngine& engine, uint8_t bufferIndex,
         backend::BufferDescriptor&& buffer, uint32_t byteOffset) {
     if (bufferIndex < mBufferCount) {
@@ -41,6 +41,7 @@
 #include <math/scalar.h>
 #include <math/fast.h>
 
+#include <limits>
 #include <memory>
 #include <filament/View.h>
 
@@ -98,6 +99,7 @@ void FView::terminate(FEngine& engine) {
     driver.destroySamplerGroup(mPerViewSbh);
     driver.destroyUniformBuffer(mRenderableUbh);
     drainFrameHistory(engine);
+    mShadowMapManager.terminate(engine);
     mFroxelizer.terminate(driver);
 }
 
@@ -235,8 +237,11 @@ void FView::prepareShadowing(FEngine& engine, backend::DriverApi& driver,
     // Find all shadow-casting spot lights.
     size_t shadowCastingSpotCount = 0;
 
-    // We allow a max of CONFIG_MAX_SHADOW_CASTING_SPOTS spot light shadows. Any additional
-    // shadow-casting spot lights are ignored.
+    // We allow a max of CONFIG_MAX_SHADOW_CASTING_SPOTS spot light shadows, or of
+    // CONFIG_MAX_SHADOW_ATLAS_SPOTS with the shadow atlas. Any additional shadow-casting spot
+    // lights are ignored.
+    const size_t maxShadowCastingSpots = mShadowAtlas ?
+            CONFIG_MAX_SHADOW_ATLAS_SPOTS : CONFIG_MAX_SHADOW_CASTING_SPOTS;
     for (size_t l = 1; l < lightData.size(); l++) {
         FLightManager::Instance light = lightData.elementAt<FScene::LIGHT_INSTANCE>(l);
 
@@ -248,10 +253,14 @@ void FView::prepareShadowing(FEngine& engine, backend::DriverApi& driver,
             continue;
         }
 
-        mShadowMapManager.addSpotShadowMap(l);
+        if (mShadowAtlas) {
+            mShadowMapManager.addAtlasShadowMap(engine, l);
+        } else {
+            mShadowMapManager.addSpotShadowMap(l);
+        }
 
         shadowCastingSpotCount++;
-        if (shadowCastingSpotCount > CONFIG_MAX_SHADOW_CASTING_SPOTS - 1) {
+        if (shadowCastingSpotCount > maxShadowCastingSpots - 1) {
             break;
         }
     }
@@ -270,9 +279,16 @@ void FView::prepareLighting(FEngine& engine, FEngine::DriverApi& driver, ArenaSc
     const CameraInfo& camera = mViewingCameraInfo;
     FScene* const scene = mScene;
 
-    scene->prepareDynamicLights(camera, arena, mLightUbh);
+    // the froxelizer's buffers are larger with the large light count
+    if (UTILS_UNLIKELY(mFroxelizer.updateBuffers(driver))) {
+        mFroxelizer.getRecordBuffer().setSampler(PerViewSib::RECORDS, mPerViewSb);
+        mFroxelizer.getFroxelBuffer().setSampler(PerViewSib::FROXELS, mPerViewSb);
+    }
+
+    scene->prepareDynamicLights(camera, arena, mLightUbh, mFroxelizer);
 
     // here the array of visible lights has been shrunk to CONFIG_MAX_LIGHT_COUNT
+    // (or CONFIG_MAX_LARGE_LIGHT_COUNT)
     auto const& lightData = scene->getLightData();
 
     // trace the number of visible lights
@@ -349,7 +365,7 @@ void FView::prepareLighting(FEngine& engine, FEngine::DriverApi& driver, ArenaSc
     mHasDynamicLighting = scene->getLightData().size() > FScene::DIRECTIONAL_LIGHTS_COUNT;
     if (mHasDynamicLighting) {
         Froxelizer& froxelizer = mFroxelizer;
-        if (froxelizer.prepare(driver, arena, viewport, camera.projection, camera.zn, camera.zf)) {
+        if (froxelizer.prepare(arena, viewport, camera.projection, camera.zn, camera.zf)) {
             froxelizer.updateUniforms(u); // update our uniform buffer if needed
         }
     }
@@ -431,7 +447,8 @@ void FView::prepare(FEngine& engine, backend::DriverApi& driver, ArenaScope& are
          * (this will set the VISIBLE_RENDERABLE bit)
          */
 
-        prepareVisibleRenderables(js, mCullingFrustum, renderableData);
+        prepareVisibleRenderables(js, mCullingFrustum, renderableData,
+                scene->getCullingHierarchy());
 
 
         /*
@@ -468,6 +485,18 @@ void FView::prepare(FEngine& engine, backend::DriverApi& driver, ArenaScope& are
         computeVisibilityMasks(getVisibleLayers(), layers, visibility, cullingMask.begin(),
                 renderableData.size(), hasVsm());
 
+        if (UTILS_UNLIKELY(mShadowAtlas)) {
+            // keep the visibility in each atlas shadow map consistent with the masks above
+            auto* const atlasMasks = renderableData.data<FScene::ATLAS_SHADOW_MASK>();
+            for (size_t i = 0, c = renderableData.size(); i < c; i++) {
+                if (!(cullingMask[i] & VISIBLE_ATLAS_SHADOW_RENDERABLE)) {
+                    atlasMasks[i] = 0;
+                } else if (!visibility[i].culling) {
+                    atlasMasks[i] = ~FScene::AtlasShadowMaskType(0);
+                }
+            }
+        }
+
         auto const beginRenderables = renderableData.begin();
         auto beginCasters = partition(beginRenderables, renderableData.end(), VISIBLE_RENDERABLE);
         auto beginCastersOnly = partition(beginCasters, renderableData.end(),
@@ -476,7 +505,8 @@ void FView::prepare(FEngine& engine, backend::DriverApi& driver, ArenaScope& are
                 VISIBLE_DIR_SHADOW_RENDERABLE);
         auto endSpotLightCastersOnly = std::partition(beginSpotLightCastersOnly,
                 renderableData.end(), [](auto it) {
-                    return (it.template get<FScene::VISIBLE_MASK>() & VISIBLE_SPOT_SHADOW_RENDERABLE);
+                    return (it.template get<FScene::VISIBLE_MASK>() &
+                            (VISIBLE_SPOT_SHADOW_RENDERABLE | VISIBLE_ATLAS_SHADOW_RENDERABLE));
                 });
 
         // convert to indices
@@ -488,20 +518,28 @@ void FView::prepare(FEngine& engine, backend::DriverApi& driver, ArenaScope& are
         merged = Range{ 0, iSpotLightCastersEnd };
 
         // update those UBOs
-        const size_t size = merged.size() * sizeof(PerRenderableUib);
-        if (size) {
-            if (mRenderableUBOSize < size) {
+        if (merged.size()) {
+            // with UBO caching, every renderable of the scene owns a slot in the UBO, which
+            // must then persist from frame to frame.
+            const bool cacheUniforms = scene->usesCachedUBOs();
+            const size_t renderableCount = cacheUniforms ? renderableData.size() : merged.size();
+            const size_t size = renderableCount * sizeof(PerRenderableUib);
+            const backend::BufferUsage usage = cacheUniforms ?
+                    backend::BufferUsage::DYNAMIC : backend::BufferUsage::STREAM;
+            bool created = false;
+            if (mRenderableUBOSize < size || mRenderableUBOUsage != usage) {
                 // allocate 1/3 extra, with a minimum of 16 objects
-                const size_t count = std::max(size_t(16u), (4u * merged.size() + 2u) / 3u);
+                const size_t count = std::max(size_t(16u), (4u * renderableCount + 2u) / 3u);
                 mRenderableUBOSize = uint32_t(count * sizeof(PerRenderableUib));
+                mRenderableUBOUsage = usage;
                 driver.destroyUniformBuffer(mRenderableUbh);
-                mRenderableUbh = driver.createUniformBuffer(mRenderableUBOSize,
-                        backend::BufferUsage::STREAM);
+                mRenderableUbh = driver.createUniformBuffer(mRenderableUBOSize, usage);
+                created = true;
             } else {
                 // TODO: should we shrink the underlying UBO at some point?
             }
             assert(mRenderableUbh);
-            scene->updateUBOs(merged, mRenderableUbh);
+            scene->updateUBOs(merged, mRenderableUbh, created);
         }
     }
 
@@ -546,6 +584,9 @@ void FView::prepare(FEngine& engine, backend::DriverApi& driver, ArenaScope& are
     u.setUniform(offsetof(PerViewUib, fogInscatteringSize),  fogOptions.inScatteringSize);
     u.setUniform(offsetof(PerViewUib, fogColorFromIbl),      fogOptions.fogColorFromIbl ? 1.0f : 0.0f);
 
+    // the instances are stored in the bone pool, this must happen before it's uploaded below
+    prepareVisibleInstances(engine, renderableData, merged);
+
     // upload the renderables's dirty UBOs
     engine.getRenderableManager().prepare(driver,
             renderableData.data<FScene::RENDERABLE_INSTANCE>(), merged);
@@ -598,6 +639,11 @@ void FView::computeVisibilityMasks(
             visibleMask[i] |=
                 Culler::result_type(visSpotShadowRenderable << VISIBLE_SPOT_SHADOW_RENDERABLE_N_BIT(j));
         }
+        const bool visAtlasShadowRenderable =
+            (!v.culling || (mask & VISIBLE_ATLAS_SHADOW_RENDERABLE)) &&
+                    inVisibleLayer && visShadowParticipant;
+        visibleMask[i] |=
+            Culler::result_type(visAtlasShadowRenderable << VISIBLE_ATLAS_SHADOW_RENDERABLE_BIT);
     }
 }
 
@@ -720,23 +766,82 @@ void FView::commitFroxels(backend::DriverApi& driverApi) const noexcept {
 }
 
 UTILS_NOINLINE
-void FView::prepareVisibleRenderables(JobSystem& js,
-        Frustum const& frustum, FScene::RenderableSoa& renderableData) const noexcept {
+void FView::prepareVisibleRenderables(JobSystem& js, Frustum const& frustum,
+        FScene::RenderableSoa& renderableData,
+        CullingHierarchy const* hierarchy) const noexcept {
     SYSTRACE_CALL();
     if (UTILS_LIKELY(isFrustumCullingEnabled())) {
-        FView::cullRenderables(js, renderableData, frustum, VISIBLE_RENDERABLE_BIT);
+        FView::cullRenderables(js, renderableData, frustum, VISIBLE_RENDERABLE_BIT, hierarchy);
     } else {
         std::uninitialized_fill(renderableData.begin<FScene::VISIBLE_MASK>(),
                   renderableData.end<FScene::VISIBLE_MASK>(), VISIBLE_RENDERABLE);
     }
 }
 
+void FView::prepareVisibleInstances(FEngine& engine,
+        FScene::RenderableSoa& renderableData, Range range) const noexcept {
+    SYSTRACE_CALL();
+
+    FRenderableManager& rcm = engine.getRenderableManager();
+    auto const* const instances = renderableData.data<FScene::RENDERABLE_INSTANCE>();
+    auto const* const worldTransforms = renderableData.data<FScene::WORLD_TRANSFORM>();
+    auto const* const visibility = renderableData.data<FScene::VISIBILITY_STATE>();
+    FScene::VisibleMaskType* const visibleMask = renderableData.data<FScene::VISIBLE_MASK>();
+    auto const* const atlasMasks = renderableData.data<FScene::ATLAS_SHADOW_MASK>();
+    uint8_t* const instanceCounts = renderableData.data<FScene::INSTANCE_COUNT>();
+    const bool frustumCulling = isFrustumCullingEnabled();
+
+    // frusta of the passes drawing the current renderable
+    std::vector<Frustum> frusta;
+
+    for (uint32_t i : range) {
+        if (UTILS_LIKELY(!visibility[i].instancing) || !visibleMask[i]) {
+            continue;
+        }
+
+        // The color pass and the shadow passes draw the same instances, so an instance is kept
+        // if it's visible in any of the passes drawing the renderable.
+        const bool cullInstances = frustumCulling && visibility[i].culling;
+        frusta.clear();
+        if (cullInstances) {
+            if (visibleMask[i] & VISIBLE_RENDERABLE) {
+                frusta.push_back(mCullingFrustum);
+            }
+            mShadowMapManager.getShadowCasterFrusta(visibleMask[i], atlasMasks[i], frusta);
+        }
+
+        // the instances are written in the bone pool, they're all uploaded at once with the bones
+        const size_t visibleCount = rcm.updateVisibleInstances(instances[i], worldTransforms[i],
+                frusta.empty() ? nullptr : frusta.data(), frusta.size());
+
+        instanceCounts[i] = uint8_t(visibleCount);
+        if (!visibleCount) {
+            // no instance is visible, this generates no commands
+            visibleMask[i] = 0;
+        }
+    }
+}
+
 void FView::cullRenderables(JobSystem& js,
-        FScene::RenderableSoa& renderableData, Frustum const& frustum, size_t bit) noexcept {
+        FScene::RenderableSoa& renderableData, Frustum const& frustum, size_t bit,
+        CullingHierarchy const* hierarchy) noexcept {
+    cullRenderables(js, renderableData, frustum, bit, hierarchy,
+            renderableData.data<FScene::VISIBLE_MASK>());
+}
+
+void FView::cullRenderables(JobSystem& js,
+        FScene::RenderableSoa const& renderableData, Frustum const& frustum, size_t bit,
+        CullingHierarchy const* hierarchy, FScene::VisibleMaskType* visibleArray) noexcept {
 
     float3 const* worldAABBCenter = renderableData.data<FScene::WORLD_AABB_CENTER>();
     float3 const* worldAABBExtent = renderableData.data<FScene::WORLD_AABB_EXTENT>();
-    FScene::VisibleMaskType* visibleArray = renderableData.data<FScene::VISIBLE_MASK>();
+
+    if (hierarchy) {
+        // the hierarchy skips whole groups of renderables inside or outside the frustum
+        assert(hierarchy->size() == renderableData.size());
+        hierarchy->cull(js, frustum, visibleArray, worldAABBCenter, worldAABBExtent, bit);
+        return;
+    }
 
     // culling job (this runs on multiple threads)
     auto functor = [&frustum, worldAABBCenter, worldAABBExtent, visibleArray, bit]
@@ -811,14 +916,55 @@ void FView::prepareVisibleLights(FLightManager const& lcm, utils::JobSystem&,
     lightData.resize(visibleLightCount);
 }
 
-void FView::updatePrimitivesLod(FEngine& engine, const CameraInfo&,
+void FView::updatePrimitivesLod(FEngine& engine, const CameraInfo& camera,
         FScene::RenderableSoa& renderableData, Range visible) noexcept {
+    updatePrimitivesLod(engine, camera, renderableData, visible, mLodHistory,
+            renderableData.data<FScene::PRIMITIVES>());
+}
+
+size_t FView::updatePrimitivesLod(FEngine& engine, const CameraInfo& camera,
+        FScene::RenderableSoa const& renderableData, Range visible,
+        std::vector<uint8_t>& lodHistory, Slice<FRenderPrimitive>* primitives) noexcept {
+    SYSTRACE_CALL();
+
     FRenderableManager const& rcm = engine.getRenderableManager();
+
+    // The screen size is the projected diameter of the bounding sphere divided by the viewport
+    // height, i.e. its radius scaled by the length of the clip-space y row, over clip-space w.
+    const mat4f clipFromWorld(transpose(camera.projection * camera.view));
+    const float4 clipY = clipFromWorld[1];
+    const float4 clipW = clipFromWorld[3];
+    const float yScale = length(clipY.xyz);
+    const float wScale = length(clipW.xyz);
+
+    auto const* const UTILS_RESTRICT instances = renderableData.data<FScene::RENDERABLE_INSTANCE>();
+    auto const* const UTILS_RESTRICT centers = renderableData.data<FScene::WORLD_AABB_CENTER>();
+    auto const* const UTILS_RESTRICT extents = renderableData.data<FScene::WORLD_AABB_EXTENT>();
+
+    size_t primitiveCount = 0;
     for (uint32_t index : visible) {
-        uint8_t level = 0; // TODO: pick the proper level of detail
-        auto ri = renderableData.elementAt<FScene::RENDERABLE_INSTANCE>(index);
-        renderableData.elementAt<FScene::PRIMITIVES>(index) = rcm.getRenderPrimitives(ri, level);
+        const FRenderableManager::Instance ri = instances[index];
+        uint8_t level = 0;
+        if (UTILS_UNLIKELY(rcm.getLevelCount(ri) > 1)) {
+            const float radius = length(extents[index]);
+            const float w = dot(clipW, float4{ centers[index], 1.0f });
+            // if the camera is within the bounding sphere, the renderable covers the screen
+            const float screenSize = w > radius * wScale ?
+                    radius * yScale / w : std::numeric_limits<float>::infinity();
+
+            // the history is indexed by renderable instance and only needs to survive between
+            // consecutive frames, so it's fine if it's stale after a renderable is destroyed.
+            const size_t i = ri.asValue();
+            if (UTILS_UNLIKELY(i >= lodHistory.size())) {
+                lodHistory.resize(i + 1);
+            }
+            level = rcm.selectLevel(ri, screenSize, lodHistory[i]);
+            lodHistory[i] = level;
+        }
+        primitives[index] = rcm.getRenderPrimitives(ri, level);
+        primitiveCount += primitives[index].size();
     }
+    return primitiveCount;
 }
 
 void FView::renderShadowMaps(FrameGraph& fg, FEngine& engine, FEngine::DriverApi& driver,
@@ -996,6 +1142,14 @@ void View::setDynamicLightingOptions(float zLightNear, float zLightFar) noexcept
     upcast(this)->setDynamicLightingOptions(zLightNear, zLightFar);
 }
 
+void View::setLargeLightCountEnabled(bool enabled) noexcept {
+    upcast(this)->setLargeLightCountEnabled(enabled);
+}
+
+bool View::isLargeLightCountEnabled() const noexcept {
+    return upcast(this)->isLargeLightCountEnabled();
+}
+
 void View::setShadowType(View::ShadowType shadow) noexcept {
     upcast(this)->setShadowType(shadow);
 }
@@ -1008,6 +1162,22 @@ View::VsmShadowOptions View::getVsmShadowOptions() const noexcept {
     return upcast(this)->getVsmShadowOptions();
 }
 
+void View::setShadowMapCachingEnabled(bool enabled) noexcept {
+    upcast(this)->setShadowMapCachingEnabled(enabled);
+}
+
+bool View::isShadowMapCachingEnabled() const noexcept {
+    return upcast(this)->isShadowMapCachingEnabled();
+}
+
+void View::setShadowAtlasEnabled(bool enabled) noexcept {
+    upcast(this)->setShadowAtlasEnabled(enabled);
+}
+
+bool View::isShadowAtlasEnabled() const noexcept {
+    return upcast(this)->isShadowAtlasEnabled();
+}
+
 void View::setAmbientOcclusion(View::AmbientOcclusion ambientOcclusion) noexcept {
     upcast(this)->setAmbientOcclusion(ambientOcclusion);
 }
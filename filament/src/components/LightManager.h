@@ -60,6 +60,11 @@ public:
         return mManager.getInstance(e);
     }
 
+    // see SingleInstanceComponentManager::getLayoutVersion()
+    uint32_t getLayoutVersion() const noexcept {
+        return mManager.getLayoutVersion();
+    }
+
     void create(const FLightManager::Builder& builder, utils::Entity entity);
 
     void destroy(utils::Entity e) noexcept;
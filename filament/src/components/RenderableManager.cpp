@@ -15,9 +15,11 @@
  */
 
 #include "FilamentAPI-impl.h"
+#include "SimdKernel.h"
 
 #include "components/RenderableManager.h"
 
+#include "details/Culler.h"
 #include "details/Engine.h"
 #include "details/VertexBuffer.h"
 #include "details/IndexBuffer.h"
@@ -26,8 +28,18 @@
 
 #include <backend/DriverEnums.h>
 
+#include <private/backend/SamplerGroup.h>
+#include <private/filament/SibGenerator.h>
+
+#include <utils/JobSystem.h>
 #include <utils/Log.h>
 #include <utils/Panic.h>
+#include <utils/Systrace.h>
+
+#include <algorithm>
+
+#include <stdlib.h>
+#include <string.h>
 
 using namespace filament::math;
 using namespace utils;
@@ -48,6 +60,15 @@ struct RenderableManager::BuilderDetails {
     size_t mSkinningBoneCount = 0;
     Bone const* mUserBones = nullptr;
     mat4f const* mUserBoneMatrices = nullptr;
+    BoneFormat mBoneFormat = BoneFormat::QUATERNION;
+    size_t mInstanceCount = 0;
+    mat4f const* mUserInstanceTransforms = nullptr;
+    size_t mMorphTargetCount = 0;
+    std::vector<CpuDeformation> mCpuDeformations;   // empty, or one per entry
+    size_t mLevelCount = 1;
+    size_t mLevelPrimitiveCounts[FRenderableManager::MAX_LEVEL_COUNT] = {};
+    float mLevelScreenSizes[FRenderableManager::MAX_LEVEL_COUNT - 1] = {};
+    float mLevelHysteresis = 0.0f;
 
     explicit BuilderDetails(size_t count)
             : mEntries(count), mCulling(true), mCastShadows(false), mReceiveShadows(true),
@@ -158,11 +179,56 @@ RenderableManager::Builder& RenderableManager::Builder::skinning(
     return *this;
 }
 
+RenderableManager::Builder& RenderableManager::Builder::boneFormat(BoneFormat format) noexcept {
+    mImpl->mBoneFormat = format;
+    return *this;
+}
+
 RenderableManager::Builder& RenderableManager::Builder::morphing(bool enable) noexcept {
     mImpl->mMorphingEnabled = enable;
     return *this;
 }
 
+RenderableManager::Builder& RenderableManager::Builder::cpuDeformation(size_t index,
+        CpuDeformation const& deformation) noexcept {
+    std::vector<CpuDeformation>& deformations = mImpl->mCpuDeformations;
+    if (index < mImpl->mEntries.size()) {
+        deformations.resize(mImpl->mEntries.size());
+        deformations[index] = deformation;
+    }
+    return *this;
+}
+
+RenderableManager::Builder& RenderableManager::Builder::morphTargets(size_t targetCount) noexcept {
+    mImpl->mMorphTargetCount = targetCount;
+    return *this;
+}
+
+RenderableManager::Builder& RenderableManager::Builder::instances(size_t instanceCount) noexcept {
+    mImpl->mInstanceCount = instanceCount;
+    return *this;
+}
+
+RenderableManager::Builder& RenderableManager::Builder::instances(
+        size_t instanceCount, mat4f const* transforms) noexcept {
+    mImpl->mInstanceCount = instanceCount;
+    mImpl->mUserInstanceTransforms = transforms;
+    return *this;
+}
+
+RenderableManager::Builder& RenderableManager::Builder::levels(size_t levelCount,
+        size_t const* primitiveCounts, float const* screenSizes, float hysteresis) noexcept {
+    // too many levels are caught by build(), a single level holds all the primitives and
+    // doesn't need the arrays, which may be null.
+    mImpl->mLevelCount = levelCount;
+    if (levelCount > 1 && levelCount <= FRenderableManager::MAX_LEVEL_COUNT) {
+        std::copy_n(primitiveCounts, levelCount, mImpl->mLevelPrimitiveCounts);
+        std::copy_n(screenSizes, levelCount - 1, mImpl->mLevelScreenSizes);
+    }
+    mImpl->mLevelHysteresis = hysteresis;
+    return *this;
+}
+
 RenderableManager::Builder& RenderableManager::Builder::blendOrder(size_t index, uint16_t blendOrder) noexcept {
     if (index < mImpl->mEntries.size()) {
         mImpl->mEntries[index].blendOrder = blendOrder;
@@ -178,6 +244,67 @@ RenderableManager::Builder::Result RenderableManager::Builder::build(Engine& eng
         return Error;
     }
 
+    if (!ASSERT_PRECONDITION_NON_FATAL(mImpl->mInstanceCount <= CONFIG_MAX_INSTANCE_COUNT,
+            "instance count > %u", CONFIG_MAX_INSTANCE_COUNT)) {
+        return Error;
+    }
+
+    // instances are stored in the bones UBO, after the bones
+    if (!ASSERT_PRECONDITION_NON_FATAL(!mImpl->mInstanceCount ||
+            mImpl->mSkinningBoneCount <= CONFIG_FIRST_INSTANCE_BONE,
+            "bone count > %u for an instanced renderable", CONFIG_FIRST_INSTANCE_BONE)) {
+        return Error;
+    }
+
+    if (!ASSERT_PRECONDITION_NON_FATAL(mImpl->mMorphTargetCount <= CONFIG_MAX_MORPH_TARGET_COUNT,
+            "morph target count > %u", CONFIG_MAX_MORPH_TARGET_COUNT)) {
+        return Error;
+    }
+
+    // the morphing attributes can only be read by the vertex shader
+    if (!ASSERT_PRECONDITION_NON_FATAL(mImpl->mCpuDeformations.empty() || !mImpl->mMorphingEnabled,
+            "[entity=%u] morphing(true) can't be used with a CPU deformation", entity.getId())) {
+        return Error;
+    }
+
+    for (size_t i = 0, c = mImpl->mCpuDeformations.size(); i < c; i++) {
+        CpuDeformation const& deformation = mImpl->mCpuDeformations[i];
+        if (!deformation.positions) {
+            continue;
+        }
+        if (!ASSERT_PRECONDITION_NON_FATAL(!mImpl->mSkinningBoneCount ||
+                (deformation.boneIndices && deformation.boneWeights),
+                "[entity=%u, primitive @ %u] the CPU deformation of a skinned primitive needs "
+                "bone indices and weights", entity.getId(), i)) {
+            return Error;
+        }
+    }
+
+    if (!ASSERT_PRECONDITION_NON_FATAL(mImpl->mLevelCount >= 1 &&
+            mImpl->mLevelCount <= FRenderableManager::MAX_LEVEL_COUNT,
+            "level count must be between 1 and %u", FRenderableManager::MAX_LEVEL_COUNT)) {
+        return Error;
+    }
+
+    if (mImpl->mLevelCount > 1) {
+        size_t primitiveCount = 0;
+        for (size_t i = 0; i < mImpl->mLevelCount; i++) {
+            primitiveCount += mImpl->mLevelPrimitiveCounts[i];
+        }
+        if (!ASSERT_PRECONDITION_NON_FATAL(primitiveCount == mImpl->mEntries.size(),
+                "[entity=%u] the levels have %u primitives, the renderable has %u",
+                entity.getId(), primitiveCount, mImpl->mEntries.size())) {
+            return Error;
+        }
+        for (size_t i = 1; i < mImpl->mLevelCount - 1; i++) {
+            if (!ASSERT_PRECONDITION_NON_FATAL(
+                    mImpl->mLevelScreenSizes[i] < mImpl->mLevelScreenSizes[i - 1],
+                    "[entity=%u] level screen sizes must be decreasing", entity.getId())) {
+                return Error;
+            }
+        }
+    }
+
     for (size_t i = 0, c = mImpl->mEntries.size(); i < c; i++) {
         auto& entry = mImpl->mEntries[i];
 
@@ -247,6 +374,33 @@ FRenderableManager::FRenderableManager(FEngine& engine) noexcept : mEngine(engin
     // DON'T use engine here in the ctor, because it's not fully constructed yet.
 }
 
+void FRenderableManager::init() noexcept {
+    FEngine::DriverApi& driver = mEngine.getDriverApi();
+
+    // A single target whose deltas are all zero, although it's never read since the weights
+    // UBO doesn't reference any target.
+    mDummyMorphTexture = driver.createTexture(backend::SamplerType::SAMPLER_2D_ARRAY, 1,
+            backend::TextureFormat::RGBA32F, 1, 1, 1, 2, backend::TextureUsage::DEFAULT);
+    driver.update3DImage(mDummyMorphTexture, 0, 0, 0, 0, 1, 1, 2, {
+            calloc(2, sizeof(float4)), 2 * sizeof(float4),
+            backend::PixelDataFormat::RGBA, backend::PixelDataType::FLOAT,
+            [](void* buffer, size_t, void*) { free(buffer); }
+    });
+
+    backend::SamplerGroup samplers(PerRenderableMorphingSib::SAMPLER_COUNT);
+    samplers.setSampler(PerRenderableMorphingSib::TARGETS, { mDummyMorphTexture, {} });
+    mDummyMorphTargets = driver.createSamplerGroup(samplers.getSize());
+    driver.updateSamplerGroup(mDummyMorphTargets, std::move(samplers.toCommandStream()));
+
+    UniformBuffer weights(sizeof(PerRenderableMorphingUib));
+    mDummyMorphWeights = driver.createUniformBuffer(weights.getSize(), backend::BufferUsage::STATIC);
+    driver.loadUniformBuffer(mDummyMorphWeights, weights.toBufferDescriptor(driver));
+
+    // Create the pool's UBO right away, renderables that are only morphed bind the range at
+    // offset 0 (which may belong to another renderable) but don't read it.
+    mBonePool.commit(driver);
+}
+
 FRenderableManager::~FRenderableManager() {
     // all components should have been destroyed when we get here
     // (terminate should have been called from Engine's shutdown())
@@ -272,6 +426,7 @@ void FRenderableManager::create(
         FRenderPrimitive* rp = new FRenderPrimitive[builder->mEntries.size()];
         for (size_t i = 0, c = builder->mEntries.size(); i < c; ++i) {
             rp[i].init(driver, entries[i]);
+            rp[i].setMorphing(mDummyMorphTargets, mDummyMorphWeights);
         }
         setPrimitives(ci, { rp, size_type(builder->mEntries.size()) });
 
@@ -284,41 +439,164 @@ void FRenderableManager::create(
         setCulling(ci, builder->mCulling);
         setSkinning(ci, false);
         setMorphing(ci, builder->mMorphingEnabled);
+        setInstancing(ci, false);
+        setMorphTargets(ci, false);
+        setMatrixBones(ci, false);
         setMorphWeights(ci, {0, 0, 0, 0});
 
         const size_t count = builder->mSkinningBoneCount;
-        if (UTILS_UNLIKELY(count > 0 || builder->mMorphingEnabled)) {
+        const size_t instanceCount = builder->mInstanceCount;
+        const size_t targetCount = builder->mMorphTargetCount;
+        // the bones and morph targets of a renderable deformed on the CPU are only read by
+        // deform(), they're not enabled for the vertex shader
+        const bool cpuDeformation = !builder->mCpuDeformations.empty();
+        if (UTILS_UNLIKELY(count > 0 || builder->mMorphingEnabled || instanceCount > 0 ||
+                targetCount > 0)) {
             std::unique_ptr<Bones>& bones = manager[ci].bones;
-            // Note that we are sizing the bones UBO according to CONFIG_MAX_BONE_COUNT rather than
-            // mSkinningBoneCount. According to the OpenGL ES 3.2 specification in 7.6.3 Uniform
-            // Buffer Object Bindings:
-            //
-            //     the uniform block must be populated with a buffer object with a size no smaller
-            //     than the minimum required size of the uniform block (the value of
-            //     UNIFORM_BLOCK_DATA_SIZE).
-            //
-            // This unfortunately means that we are using a large memory footprint for skinned
-            // renderables. In the future we could try addressing this by implementing a paging
-            // system such that multiple skinned renderables will share regions within a single
-            // large block of bones.
+            // The bones live in a range of the bone pool which is shared by all the renderables.
+            // Instanced renderables store their instances after CONFIG_FIRST_INSTANCE_BONE bones,
+            // so they need a full range. The range bound for the others overlaps the next ranges
+            // of the pool, which is fine since they only read their own bones. Renderables that
+            // are only morphed don't read the bones at all.
+            const BoneFormat format = builder->mBoneFormat;
+            const size_t boneSize = format == BoneFormat::MATRIX_3X4 ?
+                    sizeof(PerRenderableUibBoneMatrix) : sizeof(PerRenderableUibBone);
+            const size_t size = instanceCount > 0 ? BonePool::RANGE_SIZE : count * boneSize;
             bones = std::unique_ptr<Bones>(new Bones{
-                    driver.createUniformBuffer(CONFIG_MAX_BONE_COUNT * sizeof(PerRenderableUibBone),
-                            backend::BufferUsage::DYNAMIC),
-                    UniformBuffer{ count * sizeof(PerRenderableUibBone) },
-                    count
+                    mBonePool.allocate(size), uint32_t(size), count, format
             });
             assert(bones);
             if (bones) {
-                setSkinning(ci, count > 0);
+                setSkinning(ci, count > 0 && !cpuDeformation);
+                setMatrixBones(ci, format == BoneFormat::MATRIX_3X4);
                 if (builder->mUserBones) {
                     setBones(ci, builder->mUserBones, count);
                 } else if (builder->mUserBoneMatrices) {
                     setBones(ci, builder->mUserBoneMatrices, count);
                 } else {
                     // initialize the bones to identity
-                    PerRenderableUibBone* out = (PerRenderableUibBone*)bones->bones.invalidate();
-                    std::uninitialized_fill_n(out, count, PerRenderableUibBone{});
+                    const mat4f identity;
+                    void* out = mBonePool.invalidate(bones->offset, count * boneSize);
+                    for (size_t i = 0; i < count; i++) {
+                        writeBones((char*)out + i * boneSize, format, &identity, 1);
+                    }
+                }
+            }
+        }
+
+        if (UTILS_UNLIKELY(targetCount > 0)) {
+            std::unique_ptr<MorphTargets>& morphTargets = manager[ci].morphTargets;
+            morphTargets = std::unique_ptr<MorphTargets>(new MorphTargets{
+                    driver.createUniformBuffer(sizeof(PerRenderableMorphingUib),
+                            backend::BufferUsage::DYNAMIC),
+                    UniformBuffer{ sizeof(PerRenderableMorphingUib) },
+                    std::vector<float>(targetCount),
+                    std::vector<MorphTargets::Buffer>(builder->mEntries.size())
+            });
+            setMorphTargets(ci, !cpuDeformation);
+
+            for (size_t i = 0, c = builder->mEntries.size(); i < c && !cpuDeformation; ++i) {
+                if (!entries[i].vertices) {
+                    continue;
+                }
+                // The vertices are laid out in rows, so that large meshes fit in the texture
+                // size limit guaranteed by ES 3.0. The deltas start at zero.
+                const uint32_t vertexCount = entries[i].vertices->getVertexCount();
+                const uint32_t width = std::min(vertexCount, MORPH_TARGET_TEXTURE_WIDTH);
+                const uint32_t height = (vertexCount + width - 1) / width;
+                const uint32_t depth = uint32_t(targetCount * 2);
+                const size_t size = size_t(width) * height * depth * sizeof(float4);
+                MorphTargets::Buffer& buffer = morphTargets->buffers[i];
+                buffer.width = width;
+                buffer.vertexCount = vertexCount;
+                buffer.texture = driver.createTexture(backend::SamplerType::SAMPLER_2D_ARRAY, 1,
+                        backend::TextureFormat::RGBA32F, 1, width, height, depth,
+                        backend::TextureUsage::DEFAULT);
+                driver.update3DImage(buffer.texture, 0, 0, 0, 0, width, height, depth, {
+                        calloc(size, 1), size,
+                        backend::PixelDataFormat::RGBA, backend::PixelDataType::FLOAT,
+                        [](void* buffer, size_t, void*) { free(buffer); }
+                });
+
+                backend::SamplerGroup samplers(PerRenderableMorphingSib::SAMPLER_COUNT);
+                samplers.setSampler(PerRenderableMorphingSib::TARGETS, { buffer.texture, {} });
+                buffer.sgh = driver.createSamplerGroup(samplers.getSize());
+                driver.updateSamplerGroup(buffer.sgh, std::move(samplers.toCommandStream()));
+
+                rp[i].setMorphing(buffer.sgh, morphTargets->handle);
+            }
+        }
+
+        if (UTILS_UNLIKELY(cpuDeformation)) {
+            // The rest poses are copied. The deformed primitives are drawn from vertex buffers
+            // of their own, other renderables may share the ones they were built with.
+            std::unique_ptr<Deformation>& deformation = manager[ci].deformation;
+            deformation = std::unique_ptr<Deformation>(new Deformation{
+                    std::vector<Deformation::Buffer>(builder->mEntries.size())
+            });
+            for (size_t i = 0, c = builder->mEntries.size(); i < c; ++i) {
+                CpuDeformation const& source = builder->mCpuDeformations[i];
+                if (!entries[i].vertices || !entries[i].indices || !source.positions) {
+                    continue;
                 }
+                FVertexBuffer const* const vertices = upcast(entries[i].vertices);
+                const size_t vertexCount = vertices->getVertexCount();
+                Deformation::Buffer& buffer = deformation->buffers[i];
+                buffer.vertices = engine.createVertexBuffer(vertices->getLayout());
+                for (uint8_t j = 0, n = vertices->getBufferCount(); j < n && source.buffers; j++) {
+                    if (source.buffers[j] && j != source.positionBufferIndex &&
+                            j != source.tangentBufferIndex) {
+                        const size_t size = vertices->getBufferSize(j);
+                        void* const data = malloc(size);
+                        memcpy(data, source.buffers[j], size);
+                        buffer.vertices->setBufferAt(engine, j, { data, size,
+                                [](void* buffer, size_t, void*) { free(buffer); } });
+                    }
+                }
+                rp[i].set(engine, entries[i].type, buffer.vertices, upcast(entries[i].indices),
+                        entries[i].offset, entries[i].minIndex, entries[i].maxIndex,
+                        entries[i].count);
+                buffer.positions.assign(source.positions, source.positions + vertexCount);
+                if (source.tangents) {
+                    buffer.tangents.assign(source.tangents, source.tangents + vertexCount);
+                }
+                if (count > 0) {
+                    buffer.boneIndices.assign(source.boneIndices, source.boneIndices + vertexCount);
+                    buffer.boneWeights.assign(source.boneWeights, source.boneWeights + vertexCount);
+                }
+                buffer.positionDeltas.resize(targetCount * vertexCount);
+                buffer.normalDeltas.resize(targetCount * vertexCount);
+                buffer.positionBufferIndex = source.positionBufferIndex;
+                buffer.tangentBufferIndex = source.tangentBufferIndex;
+            }
+        }
+
+        if (UTILS_UNLIKELY(builder->mLevelCount > 1)) {
+            // the level drawn by each pass is picked by FView::updatePrimitivesLod()
+            std::unique_ptr<LevelsOfDetail>& levels = manager[ci].levels;
+            levels = std::unique_ptr<LevelsOfDetail>(new LevelsOfDetail{});
+            levels->count = uint8_t(builder->mLevelCount);
+            levels->hysteresis = builder->mLevelHysteresis;
+            for (size_t i = 0, c = builder->mLevelCount; i < c; i++) {
+                levels->offsets[i + 1] = levels->offsets[i] +
+                        uint32_t(builder->mLevelPrimitiveCounts[i]);
+            }
+            std::copy_n(builder->mLevelScreenSizes, builder->mLevelCount - 1, levels->screenSizes);
+        }
+
+        if (UTILS_UNLIKELY(instanceCount > 0)) {
+            // the instances are culled and uploaded to the bones UBO each frame, see FView
+            std::unique_ptr<Instances>& instances = manager[ci].instances;
+            instances = std::unique_ptr<Instances>(new Instances{
+                    std::vector<mat4f>(instanceCount),
+                    std::vector<float4>(instanceCount),
+                    {}
+            });
+            setInstancing(ci, true);
+            if (builder->mUserInstanceTransforms) {
+                setInstanceTransforms(ci, builder->mUserInstanceTransforms, instanceCount);
+            } else {
+                updateInstanceBounds(ci);
             }
         }
     }
@@ -347,6 +625,12 @@ void FRenderableManager::terminate() noexcept {
             manager.removeComponent(manager.getEntity(ci));
         }
     }
+
+    FEngine::DriverApi& driver = mEngine.getDriverApi();
+    mBonePool.terminate(driver);
+    driver.destroyUniformBuffer(mDummyMorphWeights);
+    driver.destroySamplerGroup(mDummyMorphTargets);
+    driver.destroyTexture(mDummyMorphTexture);
 }
 
 // This is basically a Renderable's destructor.
@@ -359,10 +643,32 @@ void FRenderableManager::destroyComponent(Instance ci) noexcept {
     // See create(RenderableManager::Builder&, Entity)
     destroyComponentPrimitives(engine, manager[ci].primitives);
 
-    // destroy the bones structures if any
+    // give the bones back to the pool if any
     std::unique_ptr<Bones> const& bones = manager[ci].bones;
     if (bones) {
-        driver.destroyUniformBuffer(bones->handle);
+        mBonePool.free(bones->offset, bones->size);
+    }
+
+    // destroy the vertex buffers of the primitives deformed on the CPU if any
+    std::unique_ptr<Deformation> const& deformation = manager[ci].deformation;
+    if (deformation) {
+        for (Deformation::Buffer const& buffer : deformation->buffers) {
+            if (buffer.vertices) {
+                engine.destroy(buffer.vertices);
+            }
+        }
+    }
+
+    // destroy the morph targets if any
+    std::unique_ptr<MorphTargets> const& morphTargets = manager[ci].morphTargets;
+    if (morphTargets) {
+        driver.destroyUniformBuffer(morphTargets->handle);
+        for (MorphTargets::Buffer const& buffer : morphTargets->buffers) {
+            if (buffer.texture) {
+                driver.destroySamplerGroup(buffer.sgh);
+                driver.destroyTexture(buffer.texture);
+            }
+        }
     }
 }
 
@@ -378,27 +684,59 @@ void FRenderableManager::destroyComponentPrimitives(
 void FRenderableManager::prepare(
         backend::DriverApi& UTILS_RESTRICT driver,
         Instance const* UTILS_RESTRICT instances,
-        utils::Range<uint32_t> list) const noexcept {
+        utils::Range<uint32_t> list) noexcept {
     const auto& manager = mManager;
 
-    std::unique_ptr<Bones>  const * const UTILS_RESTRICT bones = manager.raw_array<BONES>();
+    // the bones of all the renderables are uploaded at once, visible or not
+    mBonePool.commit(driver);
+
+    std::unique_ptr<MorphTargets> const * const UTILS_RESTRICT morphTargets =
+            manager.raw_array<MORPH_TARGETS>();
+    std::unique_ptr<Deformation> const * const UTILS_RESTRICT deformations =
+            manager.raw_array<DEFORMATION>();
     for (uint32_t index : list) {
         size_t i = instances[index].asValue();
         assert(i);  // we should never get the null instance here
-        if (UTILS_UNLIKELY(bones[i])) {
-            if (bones[i]->bones.isDirty()) {
-                driver.loadUniformBuffer(bones[i]->handle, bones[i]->bones.toBufferDescriptor(driver));
+        if (UTILS_UNLIKELY(deformations[i])) {
+            // only the visible renderables are deformed, and only when their pose changed
+            if (deformations[i]->dirty) {
+                deform(instances[index]);
+                deformations[i]->dirty = false;
+            }
+        }
+        if (UTILS_UNLIKELY(morphTargets[i])) {
+            if (morphTargets[i]->weights.isDirty()) {
+                driver.loadUniformBuffer(morphTargets[i]->handle,
+                        morphTargets[i]->weights.toBufferDescriptor(driver));
             }
         }
     }
 }
 
+Slice<FRenderPrimitive> FRenderableManager::getRenderPrimitives(
+        Instance instance, uint8_t level) const noexcept {
+    return const_cast<FRenderableManager*>(this)->getRenderPrimitives(instance, level);
+}
+
+Slice<FRenderPrimitive> FRenderableManager::getRenderPrimitives(
+        Instance instance, uint8_t level) noexcept {
+    Slice<FRenderPrimitive> primitives = mManager[instance].primitives;
+    std::unique_ptr<LevelsOfDetail> const& levels = mManager[instance].levels;
+    if (UTILS_UNLIKELY(levels && level != ALL_LEVELS)) {
+        assert(level < levels->count);
+        uint32_t const* const offsets = levels->offsets;
+        primitives.set(primitives.begin() + offsets[level], offsets[level + 1] - offsets[level]);
+    }
+    return primitives;
+}
+
 void FRenderableManager::setMaterialInstanceAt(Instance instance, uint8_t level,
         size_t primitiveIndex, FMaterialInstance const* mi) noexcept {
     if (instance) {
-        Slice<FRenderPrimitive>& primitives = getRenderPrimitives(instance, level);
+        Slice<FRenderPrimitive> primitives = getRenderPrimitives(instance, level);
         if (primitiveIndex < primitives.size()) {
             primitives[primitiveIndex].setMaterialInstance(upcast(mi));
+            updateVersion(instance);
             AttributeBitset required = mi->getMaterial()->getRequiredAttributes();
             AttributeBitset declared = primitives[primitiveIndex].getEnabledAttributes();
             if (UTILS_UNLIKELY((declared & required) != required)) {
@@ -426,7 +764,7 @@ MaterialInstance* FRenderableManager::getMaterialInstanceAt(
 void FRenderableManager::setBlendOrderAt(Instance instance, uint8_t level,
         size_t primitiveIndex, uint16_t order) noexcept {
     if (instance) {
-        Slice<FRenderPrimitive>& primitives = getRenderPrimitives(instance, level);
+        Slice<FRenderPrimitive> primitives = getRenderPrimitives(instance, level);
         if (primitiveIndex < primitives.size()) {
             primitives[primitiveIndex].setBlendOrder(order);
         }
@@ -448,10 +786,11 @@ void FRenderableManager::setGeometryAt(Instance instance, uint8_t level, size_t
         PrimitiveType type, FVertexBuffer* vertices, FIndexBuffer* indices,
         size_t offset, size_t count) noexcept {
     if (instance) {
-        Slice<FRenderPrimitive>& primitives = getRenderPrimitives(instance, level);
+        Slice<FRenderPrimitive> primitives = getRenderPrimitives(instance, level);
         if (primitiveIndex < primitives.size()) {
             primitives[primitiveIndex].set(mEngine, type, vertices, indices, offset,
                     0, vertices->getVertexCount() - 1, count);
+            updateVersion(instance);
         }
     }
 }
@@ -459,13 +798,33 @@ void FRenderableManager::setGeometryAt(Instance instance, uint8_t level, size_t
 void FRenderableManager::setGeometryAt(Instance instance, uint8_t level, size_t primitiveIndex,
         PrimitiveType type, size_t offset, size_t count) noexcept {
     if (instance) {
-        Slice<FRenderPrimitive>& primitives = getRenderPrimitives(instance, level);
+        Slice<FRenderPrimitive> primitives = getRenderPrimitives(instance, level);
         if (primitiveIndex < primitives.size()) {
             primitives[primitiveIndex].set(mEngine, type, offset, 0, 0, count);
+            updateVersion(instance);
         }
     }
 }
 
+uint8_t FRenderableManager::selectLevel(
+        Instance instance, float screenSize, uint8_t previousLevel) const noexcept {
+    std::unique_ptr<LevelsOfDetail> const& levels = mManager[instance].levels;
+    if (!levels) {
+        return 0;
+    }
+    // The threshold between levels i and i + 1 is moved away from the level drawn last frame,
+    // so that the screen size has to cross it by the hysteresis margin to switch levels.
+    float const* const UTILS_RESTRICT screenSizes = levels->screenSizes;
+    const float finer = 1.0f + levels->hysteresis;
+    const float coarser = 1.0f - levels->hysteresis;
+    uint8_t level = 0;
+    for (size_t i = 0, c = levels->count - 1u; i < c; i++) {
+        const float threshold = screenSizes[i] * (previousLevel > i ? finer : coarser);
+        level += uint8_t(screenSize < threshold);
+    }
+    return level;
+}
+
 void FRenderableManager::setBones(Instance ci,
         Bone const* UTILS_RESTRICT transforms, size_t boneCount, size_t offset) noexcept {
     if (ci) {
@@ -473,14 +832,30 @@ void FRenderableManager::setBones(Instance ci,
         assert(bones && offset + boneCount <= bones->count);
         if (bones) {
             boneCount = std::min(boneCount, bones->count - offset);
-            PerRenderableUibBone* UTILS_RESTRICT out = (PerRenderableUibBone*)bones->bones.invalidateUniforms(
-                    offset * sizeof(PerRenderableUibBone),
-                    boneCount * sizeof(PerRenderableUibBone));
-            for (size_t i = 0, c = boneCount; i < c; ++i) {
-                out[i].q = transforms[i].unitQuaternion;
-                out[i].t.xyz = transforms[i].translation;
-                out[i].s = out[i].ns = { 1, 1, 1, 0 };
+            if (bones->format == BoneFormat::MATRIX_3X4) {
+                PerRenderableUibBoneMatrix* UTILS_RESTRICT out =
+                        (PerRenderableUibBoneMatrix*)mBonePool.invalidate(
+                                uint32_t(bones->offset + offset * sizeof(PerRenderableUibBoneMatrix)),
+                                boneCount * sizeof(PerRenderableUibBoneMatrix));
+                for (size_t i = 0, c = boneCount; i < c; ++i) {
+                    const mat3f r(transforms[i].unitQuaternion);
+                    const float3 t = transforms[i].translation;
+                    for (size_t j = 0; j < 3; j++) {
+                        out[i].rows[j] = { r[0][j], r[1][j], r[2][j], t[j] };
+                    }
+                }
+            } else {
+                PerRenderableUibBone* UTILS_RESTRICT out =
+                        (PerRenderableUibBone*)mBonePool.invalidate(
+                                uint32_t(bones->offset + offset * sizeof(PerRenderableUibBone)),
+                                boneCount * sizeof(PerRenderableUibBone));
+                for (size_t i = 0, c = boneCount; i < c; ++i) {
+                    out[i].q = transforms[i].unitQuaternion;
+                    out[i].t.xyz = transforms[i].translation;
+                    out[i].s = out[i].ns = { 1, 1, 1, 0 };
+                }
             }
+            invalidateDeformation(ci);
         }
     }
 }
@@ -492,22 +867,312 @@ void FRenderableManager::setBones(Instance ci,
         assert(bones && offset + boneCount <= bones->count);
         if (bones) {
             boneCount = std::min(boneCount, bones->count - offset);
-            PerRenderableUibBone* UTILS_RESTRICT out = (PerRenderableUibBone*)bones->bones.invalidateUniforms(
-                    offset * sizeof(PerRenderableUibBone),
-                    boneCount * sizeof(PerRenderableUibBone));
-            for (size_t i = 0, c = boneCount; i < c; ++i) {
-                makeBone(&out[i], transforms[i]);
-            }
+            const size_t boneSize = bones->format == BoneFormat::MATRIX_3X4 ?
+                    sizeof(PerRenderableUibBoneMatrix) : sizeof(PerRenderableUibBone);
+            void* out = mBonePool.invalidate(uint32_t(bones->offset + offset * boneSize),
+                    boneCount * boneSize);
+            writeBones(out, bones->format, transforms, boneCount);
+            invalidateDeformation(ci);
         }
     }
 }
 
+void FRenderableManager::setBones(BoneTransforms const* updates, size_t count) noexcept {
+    SYSTRACE_CALL();
+
+    // The ranges are invalidated first, since this updates the state of the pool, then the
+    // transforms are converted, which only writes to the (disjoint) ranges.
+    struct Update {
+        void* out;
+        BoneFormat format;
+        mat4f const* transforms;
+        size_t boneCount;
+    };
+    std::vector<Update> work;
+    work.reserve(count);
+    size_t totalBoneCount = 0;
+    for (size_t k = 0; k < count; k++) {
+        const Instance ci = updates[k].instance;
+        if (!ci) {
+            continue;
+        }
+        std::unique_ptr<Bones> const& bones = mManager[ci].bones;
+        const size_t offset = updates[k].offset;
+        assert(bones && offset + updates[k].boneCount <= bones->count);
+        if (bones && offset < bones->count) {
+            const size_t boneCount = std::min(updates[k].boneCount, bones->count - offset);
+            const size_t boneSize = bones->format == BoneFormat::MATRIX_3X4 ?
+                    sizeof(PerRenderableUibBoneMatrix) : sizeof(PerRenderableUibBone);
+            void* out = mBonePool.invalidate(uint32_t(bones->offset + offset * boneSize),
+                    boneCount * boneSize);
+            work.push_back({ out, bones->format, updates[k].transforms, boneCount });
+            totalBoneCount += boneCount;
+            invalidateDeformation(ci);
+        }
+    }
+
+    Update const* const UTILS_RESTRICT data = work.data();
+    auto convert = [data](uint32_t first, uint32_t count) {
+        for (uint32_t i = first, e = first + count; i < e; i++) {
+            writeBones(data[i].out, data[i].format, data[i].transforms, data[i].boneCount);
+        }
+    };
+
+    if (totalBoneCount <= BONES_JOB_SIZE) {
+        convert(0, uint32_t(work.size()));
+    } else {
+        JobSystem& js = mEngine.getJobSystem();
+        auto* job = jobs::parallel_for(js, nullptr, 0, uint32_t(work.size()),
+                std::ref(convert), jobs::CountSplitter<8, 8>());
+        js.runAndWait(job);
+    }
+}
+
 void FRenderableManager::setMorphWeights(Instance ci, const float4& weights) noexcept {
     if (ci) {
         mManager[ci].morphWeights = weights;
+        updateVersion(ci);
     }
 }
 
+void FRenderableManager::setMorphWeights(Instance ci,
+        float const* UTILS_RESTRICT weights, size_t count, size_t offset) noexcept {
+    if (ci) {
+        std::unique_ptr<MorphTargets> const& morphTargets = mManager[ci].morphTargets;
+        assert(morphTargets && offset + count <= morphTargets->userWeights.size());
+        if (morphTargets && offset < morphTargets->userWeights.size()) {
+            std::vector<float>& userWeights = morphTargets->userWeights;
+            count = std::min(count, userWeights.size() - offset);
+            std::copy_n(weights, count, userWeights.begin() + offset);
+            packMorphWeights(
+                    (PerRenderableMorphingUib*)morphTargets->weights.invalidate(),
+                    userWeights.data(), userWeights.size());
+            invalidateDeformation(ci);
+            updateVersion(ci);
+        }
+    }
+}
+
+void FRenderableManager::setMorphTargetsAt(Instance ci, uint8_t level,
+        size_t primitiveIndex, size_t targetIndex, float3 const* positions, float3 const* normals,
+        size_t vertexCount, size_t offset) noexcept {
+    if (ci) {
+        std::unique_ptr<MorphTargets> const& morphTargets = mManager[ci].morphTargets;
+        assert(morphTargets && targetIndex < morphTargets->userWeights.size());
+        if (!morphTargets || targetIndex >= morphTargets->userWeights.size()) {
+            return;
+        }
+
+        // the buffers are indexed like the primitives of all the levels
+        Slice<FRenderPrimitive> const primitives = getRenderPrimitives(ci, level);
+        if (primitiveIndex >= primitives.size()) {
+            return;
+        }
+        Slice<FRenderPrimitive> const all = getRenderPrimitives(ci, ALL_LEVELS);
+        const size_t index = &primitives[primitiveIndex] - all.begin();
+
+        // the deltas of a primitive deformed on the CPU are kept for deform()
+        std::unique_ptr<Deformation> const& deformation = mManager[ci].deformation;
+        if (UTILS_UNLIKELY(deformation)) {
+            Deformation::Buffer& buffer = deformation->buffers[index];
+            const size_t bufferVertexCount = buffer.positions.size();
+            assert(offset + vertexCount <= bufferVertexCount);
+            if (!buffer.vertices || offset >= bufferVertexCount) {
+                return;
+            }
+            vertexCount = std::min(vertexCount, bufferVertexCount - offset);
+            const size_t first = targetIndex * bufferVertexCount + offset;
+            if (positions) {
+                std::copy_n(positions, vertexCount, buffer.positionDeltas.begin() + first);
+            }
+            if (normals) {
+                std::copy_n(normals, vertexCount, buffer.normalDeltas.begin() + first);
+            }
+            invalidateDeformation(ci);
+            return;
+        }
+
+        MorphTargets::Buffer const& buffer = morphTargets->buffers[index];
+        assert(offset + vertexCount <= buffer.vertexCount);
+        if (!buffer.texture || offset >= buffer.vertexCount) {
+            return;
+        }
+        vertexCount = std::min(vertexCount, buffer.vertexCount - offset);
+
+        // A range of vertices spans a partial first row, full rows and a partial last row,
+        // each of which is uploaded as a rectangle.
+        FEngine::DriverApi& driver = mEngine.getDriverApi();
+        auto upload = [&](float3 const* deltas, uint32_t layer) {
+            const uint32_t width = buffer.width;
+            for (size_t first = offset, last = offset + vertexCount; first != last;) {
+                const uint32_t x = uint32_t(first % width);
+                const uint32_t y = uint32_t(first / width);
+                const uint32_t w = (x == 0 && last - first >= width) ? width :
+                        uint32_t(std::min(size_t(width - x), last - first));
+                const uint32_t h = (w == width) ? uint32_t((last - first) / width) : 1;
+                const size_t n = size_t(w) * h;
+                float4* const texels = (float4*)malloc(n * sizeof(float4));
+                for (size_t i = 0; i < n; i++) {
+                    texels[i] = float4{ deltas[first - offset + i], 0.0f };
+                }
+                driver.update3DImage(buffer.texture, 0, x, y, layer, w, h, 1, {
+                        texels, n * sizeof(float4),
+                        backend::PixelDataFormat::RGBA, backend::PixelDataType::FLOAT,
+                        [](void* buffer, size_t, void*) { free(buffer); }
+                });
+                first += n;
+            }
+        };
+
+        if (positions) {
+            upload(positions, uint32_t(targetIndex * 2));
+        }
+        if (normals) {
+            upload(normals, uint32_t(targetIndex * 2 + 1));
+        }
+        updateVersion(ci);
+    }
+}
+
+void FRenderableManager::deform(Instance ci) noexcept {
+    SYSTRACE_CALL();
+
+    // the bones are read from the bone pool, in the format the vertex shader would use
+    std::unique_ptr<Bones> const& bones = mManager[ci].bones;
+    std::unique_ptr<MorphTargets> const& morphTargets = mManager[ci].morphTargets;
+    std::unique_ptr<Deformation> const& deformation = mManager[ci].deformation;
+    DeformationParams params{};
+    params.kernel = getSimdKernel();
+    if (bones && bones->count) {
+        params.bones = mBonePool.getData(bones->offset);
+        params.boneFormat = bones->format;
+    }
+    if (morphTargets) {
+        params.weights = static_cast<PerRenderableMorphingUib const*>(
+                morphTargets->weights.getBuffer());
+    }
+
+    JobSystem& js = mEngine.getJobSystem();
+    for (Deformation::Buffer const& buffer : deformation->buffers) {
+        if (!buffer.vertices) {
+            continue;
+        }
+
+        // the deformed vertices are uploaded to a new buffer each time
+        const size_t vertexCount = buffer.positions.size();
+        params.buffer = &buffer;
+        params.positions = (float3*)malloc(vertexCount * sizeof(float3));
+        params.tangents = buffer.tangents.empty() ? nullptr :
+                (quatf*)malloc(vertexCount * sizeof(quatf));
+
+        auto work = [&params](uint32_t first, uint32_t count) {
+            deformVertices(params, first, count);
+        };
+        if (vertexCount <= DEFORMATION_JOB_SIZE) {
+            work(0, uint32_t(vertexCount));
+        } else {
+            auto* job = jobs::parallel_for(js, nullptr, 0, uint32_t(vertexCount),
+                    std::ref(work), jobs::CountSplitter<DEFORMATION_JOB_SIZE, 8>());
+            js.runAndWait(job);
+        }
+
+        auto callback = [](void* buffer, size_t, void*) { free(buffer); };
+        buffer.vertices->setBufferAt(mEngine, buffer.positionBufferIndex,
+                { params.positions, vertexCount * sizeof(float3), callback });
+        if (params.tangents) {
+            buffer.vertices->setBufferAt(mEngine, buffer.tangentBufferIndex,
+                    { params.tangents, vertexCount * sizeof(quatf), callback });
+        }
+    }
+}
+
+void FRenderableManager::setInstanceTransforms(Instance ci,
+        mat4f const* UTILS_RESTRICT transforms, size_t count, size_t offset) noexcept {
+    if (ci) {
+        std::unique_ptr<Instances> const& instances = mManager[ci].instances;
+        assert(instances && offset + count <= instances->transforms.size());
+        if (instances && offset < instances->transforms.size()) {
+            count = std::min(count, instances->transforms.size() - offset);
+            std::copy_n(transforms, count, instances->transforms.begin() + offset);
+            updateInstanceBounds(ci);
+            updateVersion(ci);
+        }
+    }
+}
+
+void FRenderableManager::setInstanceData(Instance ci,
+        float4 const* UTILS_RESTRICT data, size_t count, size_t offset) noexcept {
+    if (ci) {
+        std::unique_ptr<Instances> const& instances = mManager[ci].instances;
+        assert(instances && offset + count <= instances->data.size());
+        if (instances && offset < instances->data.size()) {
+            count = std::min(count, instances->data.size() - offset);
+            std::copy_n(data, count, instances->data.begin() + offset);
+            updateVersion(ci);
+        }
+    }
+}
+
+void FRenderableManager::updateInstanceBounds(Instance ci) noexcept {
+    std::unique_ptr<Instances> const& instances = mManager[ci].instances;
+    Box const& aabb = mManager[ci].aabb;
+    std::vector<mat4f> const& transforms = instances->transforms;
+    Box bounds = rigidTransform(aabb, transforms[0]);
+    for (size_t i = 1, c = transforms.size(); i < c; i++) {
+        bounds.unionSelf(rigidTransform(aabb, transforms[i]));
+    }
+    instances->bounds = bounds;
+}
+
+size_t FRenderableManager::writeVisibleInstances(Instance ci,
+        AffineTransform const& worldTransform, Frustum const* frusta, size_t frustumCount,
+        PerRenderableUibInstance* UTILS_RESTRICT out) const noexcept {
+    std::unique_ptr<Instances> const& instances = mManager[ci].instances;
+    assert(instances);
+    Box const& aabb = mManager[ci].aabb;
+    mat4f const* const UTILS_RESTRICT transforms = instances->transforms.data();
+    float4 const* const UTILS_RESTRICT data = instances->data.data();
+    size_t visibleCount = 0;
+    for (size_t i = 0, c = instances->transforms.size(); i < c; i++) {
+        const AffineTransform world = worldTransform * AffineTransform(transforms[i]);
+        if (frusta) {
+            // this is the same as rigidTransform(), see FScene::computeWorldAABBs()
+            mat3f const& m = world.linear;
+            const Box box{
+                    world.transformPoint(aabb.center),
+                    abs(m[0]) * aabb.halfExtent.x +
+                    abs(m[1]) * aabb.halfExtent.y +
+                    abs(m[2]) * aabb.halfExtent.z };
+            bool visible = false;
+            for (size_t f = 0; f < frustumCount && !visible; f++) {
+                visible = Culler::intersects(frusta[f], box);
+            }
+            if (!visible) {
+                continue;
+            }
+        }
+        PerRenderableUibInstance& instance = out[visibleCount++];
+        for (size_t r = 0; r < 3; r++) {
+            instance.worldFromModelRows[r] = { world.linear[0][r], world.linear[1][r],
+                    world.linear[2][r], world.translation[r] };
+        }
+        instance.data = data[i];
+    }
+    return visibleCount;
+}
+
+size_t FRenderableManager::updateVisibleInstances(Instance ci,
+        AffineTransform const& worldTransform,
+        Frustum const* frusta, size_t frustumCount) noexcept {
+    std::unique_ptr<Bones> const& bones = mManager[ci].bones;
+    assert(bones);
+    const size_t count = mManager[ci].instances->transforms.size();
+    auto* const out = static_cast<PerRenderableUibInstance*>(mBonePool.invalidate(
+            uint32_t(bones->offset + CONFIG_FIRST_INSTANCE_BONE * sizeof(PerRenderableUibBone)),
+            count * sizeof(PerRenderableUibInstance)));
+    return writeVisibleInstances(ci, worldTransform, frusta, frustumCount, out);
+}
+
 void FRenderableManager::makeBone(PerRenderableUibBone* UTILS_RESTRICT out, mat4f const& t) noexcept {
     mat4f m(t);
 
@@ -531,6 +1196,211 @@ void FRenderableManager::makeBone(PerRenderableUibBone* UTILS_RESTRICT out, mat4
     out->ns = is / max(abs(is));
 }
 
+void FRenderableManager::makeBone(PerRenderableUibBoneMatrix* UTILS_RESTRICT out,
+        mat4f const& t) noexcept {
+    for (size_t r = 0; r < 3; r++) {
+        out->rows[r] = { t[0][r], t[1][r], t[2][r], t[3][r] };
+    }
+}
+
+void FRenderableManager::writeBones(void* UTILS_RESTRICT out, BoneFormat format,
+        mat4f const* UTILS_RESTRICT transforms, size_t count) noexcept {
+    if (format == BoneFormat::MATRIX_3X4) {
+        PerRenderableUibBoneMatrix* const UTILS_RESTRICT bones = (PerRenderableUibBoneMatrix*)out;
+        for (size_t i = 0; i < count; i++) {
+            makeBone(&bones[i], transforms[i]);
+        }
+    } else {
+        PerRenderableUibBone* const UTILS_RESTRICT bones = (PerRenderableUibBone*)out;
+        for (size_t i = 0; i < count; i++) {
+            makeBone(&bones[i], transforms[i]);
+        }
+    }
+}
+
+// out[i] += w * in[i], for count floats. This accumulates the deltas of a morph target.
+static void accumulateScalar(float* UTILS_RESTRICT out, float const* UTILS_RESTRICT in,
+        float w, size_t count) noexcept {
+    for (size_t i = 0; i < count; i++) {
+        out[i] += w * in[i];
+    }
+}
+
+#if defined(FILAMENT_SIMD_USE_NEON)
+
+static void accumulateNeon(float* UTILS_RESTRICT out, float const* UTILS_RESTRICT in,
+        float w, size_t count) noexcept {
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        vst1q_f32(out + i, vmlaq_n_f32(vld1q_f32(out + i), vld1q_f32(in + i), w));
+    }
+    accumulateScalar(out + i, in + i, w, count - i);
+}
+
+#endif // FILAMENT_SIMD_USE_NEON
+
+#if defined(FILAMENT_SIMD_USE_AVX2)
+
+FILAMENT_SIMD_AVX2
+static void accumulateAvx2(float* UTILS_RESTRICT out, float const* UTILS_RESTRICT in,
+        float w, size_t count) noexcept {
+    const __m256 vw = _mm256_set1_ps(w);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        _mm256_storeu_ps(out + i,
+                _mm256_fmadd_ps(vw, _mm256_loadu_ps(in + i), _mm256_loadu_ps(out + i)));
+    }
+    accumulateScalar(out + i, in + i, w, count - i);
+}
+
+#endif // FILAMENT_SIMD_USE_AVX2
+
+static inline void accumulate(SimdKernel kernel,
+        float* out, float const* in, float w, size_t count) noexcept {
+    switch (kernel) {
+#if defined(FILAMENT_SIMD_USE_NEON)
+        case SimdKernel::NEON:
+            accumulateNeon(out, in, w, count);
+            break;
+#endif
+#if defined(FILAMENT_SIMD_USE_AVX2)
+        case SimdKernel::AVX2:
+            accumulateAvx2(out, in, w, count);
+            break;
+#endif
+        default:
+            accumulateScalar(out, in, w, count);
+            break;
+    }
+}
+
+void FRenderableManager::deformVertices(DeformationParams const& params,
+        size_t first, size_t count) noexcept {
+    Deformation::Buffer const& buffer = *params.buffer;
+    const size_t vertexCount = buffer.positions.size();
+    float3 const* const UTILS_RESTRICT positions = buffer.positions.data();
+    quatf const* const UTILS_RESTRICT tangents = params.tangents ? buffer.tangents.data() : nullptr;
+    float3 const* const UTILS_RESTRICT positionDeltas = buffer.positionDeltas.data();
+    float3 const* const UTILS_RESTRICT targetNormalDeltas = buffer.normalDeltas.data();
+    ushort4 const* const UTILS_RESTRICT boneIndices = buffer.boneIndices.data();
+    float4 const* const UTILS_RESTRICT boneWeights = buffer.boneWeights.data();
+    float3* const UTILS_RESTRICT outPositions = params.positions;
+    quatf* const UTILS_RESTRICT outTangents = params.tangents;
+    PerRenderableMorphingUib const* const UTILS_RESTRICT weights = params.weights;
+    const int32_t targetCount = weights ? weights->count : 0;
+
+    // The bones transform points and directions (normals and tangents) differently. This is
+    // the same math as mulBoneVertex(), mulBoneNormal() and their 3x4 matrix equivalents.
+    auto skin = [&](float3& p, float3* n, float3* t, size_t v) {
+        float3 sp{}, sn{}, st{};
+        for (size_t k = 0; k < 4; k++) {
+            const float w = boneWeights[v][k];
+            const size_t index = boneIndices[v][k];
+            if (params.boneFormat == BoneFormat::MATRIX_3X4) {
+                PerRenderableUibBoneMatrix const& bone =
+                        static_cast<PerRenderableUibBoneMatrix const*>(params.bones)[index];
+                const float4 h{ p, 1.0f };
+                sp += w * float3{
+                        dot(bone.rows[0], h), dot(bone.rows[1], h), dot(bone.rows[2], h) };
+                if (n) {
+                    const mat3f m = transpose(mat3f{
+                            bone.rows[0].xyz, bone.rows[1].xyz, bone.rows[2].xyz });
+                    const mat3f c{ cross(m[1], m[2]), cross(m[2], m[0]), cross(m[0], m[1]) };
+                    sn += w * normalize(c * *n);
+                    if (t) {
+                        st += w * normalize(c * *t);
+                    }
+                }
+            } else {
+                PerRenderableUibBone const& bone =
+                        static_cast<PerRenderableUibBone const*>(params.bones)[index];
+                const float3 q = bone.q.xyz;
+                auto rotate = [&](float3 d) {
+                    return d + 2.0f * cross(q, cross(q, d) + bone.q.w * d);
+                };
+                sp += w * (rotate(p * bone.s.xyz) + bone.t.xyz);
+                if (n) {
+                    sn += w * rotate(*n * bone.ns.xyz);
+                    if (t) {
+                        st += w * rotate(*t * bone.ns.xyz);
+                    }
+                }
+            }
+        }
+        p = sp;
+        if (n) {
+            *n = sn;
+            if (t) {
+                *t = st;
+            }
+        }
+    };
+
+    // The vertices are processed in blocks. The morph targets with a non-zero weight are
+    // accumulated one at a time over a whole block, the deltas of a target are contiguous so
+    // this is done with SIMD kernels. The vertices of the block are then skinned one by one.
+    constexpr size_t BLOCK_SIZE = 256;
+    float3 normalDeltas[BLOCK_SIZE];
+    for (size_t b = first, e = first + count; b < e; b += BLOCK_SIZE) {
+        const size_t size = std::min(BLOCK_SIZE, e - b);
+        std::copy_n(positions + b, size, outPositions + b);
+        if (targetCount > 0) {
+            std::fill_n(normalDeltas, size, float3{});
+            for (int32_t i = 0; i < targetCount; i++) {
+                const size_t target = size_t(weights->indices[i / 4][i % 4]);
+                const float w = weights->weights[i / 4][i % 4];
+                const size_t offset = target * vertexCount + b;
+                accumulate(params.kernel, &outPositions[b].x,
+                        &positionDeltas[offset].x, w, size * 3);
+                if (tangents) {
+                    accumulate(params.kernel, &normalDeltas[0].x,
+                            &targetNormalDeltas[offset].x, w, size * 3);
+                }
+            }
+        }
+
+        for (size_t v = b; v < b + size; v++) {
+            float3 p = outPositions[v];
+            float3 n{}, t{};
+            if (tangents) {
+                const mat3f frame(tangents[v]);
+                t = frame[0];
+                n = frame[2];
+                if (targetCount > 0) {
+                    n = normalize(n + normalDeltas[v - b]);
+                }
+            }
+
+            if (params.bones) {
+                skin(p, tangents ? &n : nullptr, tangents ? &t : nullptr, v);
+            }
+
+            outPositions[v] = p;
+            if (tangents) {
+                // rebuild an orthonormal frame, with the handedness of the rest pose
+                n = normalize(n);
+                t = normalize(t - n * dot(n, t));
+                const quatf q = mat3f::packTangentFrame(
+                        mat3f{ t, cross(t, n), n }, sizeof(int32_t));
+                outTangents[v] = tangents[v].w < 0 ? -q : q;
+            }
+        }
+    }
+}
+
+void FRenderableManager::packMorphWeights(PerRenderableMorphingUib* UTILS_RESTRICT out,
+        float const* UTILS_RESTRICT weights, size_t count) noexcept {
+    int32_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (weights[i] != 0.0f) {
+            out->indices[n / 4][n % 4] = int32_t(i);
+            out->weights[n / 4][n % 4] = weights[i];
+            n++;
+        }
+    }
+    out->count = n;
+}
+
 // ------------------------------------------------------------------------------------------------
 // Trampoline calling into private implementation
 // ------------------------------------------------------------------------------------------------
@@ -593,37 +1463,45 @@ uint8_t RenderableManager::getLayerMask(Instance instance) const noexcept {
 }
 
 size_t RenderableManager::getPrimitiveCount(Instance instance) const noexcept {
-    return upcast(this)->getPrimitiveCount(instance, 0);
+    return upcast(this)->getPrimitiveCount(instance, FRenderableManager::ALL_LEVELS);
+}
+
+size_t RenderableManager::getLevelCount(Instance instance) const noexcept {
+    return upcast(this)->getLevelCount(instance);
 }
 
 void RenderableManager::setMaterialInstanceAt(Instance instance,
         size_t primitiveIndex, MaterialInstance const* materialInstance) noexcept {
-    upcast(this)->setMaterialInstanceAt(instance, 0, primitiveIndex, upcast(materialInstance));
+    upcast(this)->setMaterialInstanceAt(instance, FRenderableManager::ALL_LEVELS,
+            primitiveIndex, upcast(materialInstance));
 }
 
 MaterialInstance* RenderableManager::getMaterialInstanceAt(
         Instance instance, size_t primitiveIndex) const noexcept {
-    return upcast(this)->getMaterialInstanceAt(instance, 0, primitiveIndex);
+    return upcast(this)->getMaterialInstanceAt(instance,
+            FRenderableManager::ALL_LEVELS, primitiveIndex);
 }
 
 void RenderableManager::setBlendOrderAt(Instance instance, size_t primitiveIndex, uint16_t order) noexcept {
-    upcast(this)->setBlendOrderAt(instance, 0, primitiveIndex, order);
+    upcast(this)->setBlendOrderAt(instance, FRenderableManager::ALL_LEVELS, primitiveIndex, order);
 }
 
 AttributeBitset RenderableManager::getEnabledAttributesAt(Instance instance, size_t primitiveIndex) const noexcept {
-    return upcast(this)->getEnabledAttributesAt(instance, 0, primitiveIndex);
+    return upcast(this)->getEnabledAttributesAt(instance,
+            FRenderableManager::ALL_LEVELS, primitiveIndex);
 }
 
 void RenderableManager::setGeometryAt(Instance instance, size_t primitiveIndex,
         PrimitiveType type, VertexBuffer* vertices, IndexBuffer* indices,
         size_t offset, size_t count) noexcept {
-    upcast(this)->setGeometryAt(instance, 0, primitiveIndex,
+    upcast(this)->setGeometryAt(instance, FRenderableManager::ALL_LEVELS, primitiveIndex,
             type, upcast(vertices), upcast(indices), offset, count);
 }
 
 void RenderableManager::setGeometryAt(RenderableManager::Instance instance, size_t primitiveIndex,
         RenderableManager::PrimitiveType type, size_t offset, size_t count) noexcept {
-    upcast(this)->setGeometryAt(instance, 0, primitiveIndex, type, offset, count);
+    upcast(this)->setGeometryAt(instance, FRenderableManager::ALL_LEVELS, primitiveIndex,
+            type, offset, count);
 }
 
 void RenderableManager::setBones(Instance instance,
@@ -636,8 +1514,42 @@ void RenderableManager::setBones(Instance instance,
     upcast(this)->setBones(instance, transforms, boneCount, offset);
 }
 
+void RenderableManager::setBones(BoneTransforms const* updates, size_t count) noexcept {
+    upcast(this)->setBones(updates, count);
+}
+
 void RenderableManager::setMorphWeights(Instance instance, float4 const& weights) noexcept {
     upcast(this)->setMorphWeights(instance, weights);
 }
 
+void RenderableManager::setMorphWeights(Instance instance,
+        float const* weights, size_t count, size_t offset) noexcept {
+    upcast(this)->setMorphWeights(instance, weights, count, offset);
+}
+
+void RenderableManager::setMorphTargetsAt(Instance instance, size_t primitiveIndex,
+        size_t targetIndex, float3 const* positions, float3 const* normals,
+        size_t vertexCount, size_t offset) noexcept {
+    upcast(this)->setMorphTargetsAt(instance, FRenderableManager::ALL_LEVELS, primitiveIndex,
+            targetIndex, positions, normals, vertexCount, offset);
+}
+
+size_t RenderableManager::getMorphTargetCount(Instance instance) const noexcept {
+    return upcast(this)->getMorphTargetCount(instance);
+}
+
+void RenderableManager::setInstanceTransforms(Instance instance,
+        mat4f const* transforms, size_t count, size_t offset) noexcept {
+    upcast(this)->setInstanceTransforms(instance, transforms, count, offset);
+}
+
+void RenderableManager::setInstanceData(Instance instance,
+        float4 const* data, size_t count, size_t offset) noexcept {
+    upcast(this)->setInstanceData(instance, data, count, offset);
+}
+
+size_t RenderableManager::getInstanceCount(Instance instance) const noexcept {
+    return upcast(this)->getInstanceCount(instance);
+}
+
 } // namespace filament
@@ -19,6 +19,9 @@
 
 #include "upcast.h"
 
+#include "AffineTransform.h"
+#include "BonePool.h"
+#include "SimdKernel.h"
 #include "UniformBuffer.h"
 
 #include "private/backend/DriverApiForward.h"
@@ -30,18 +33,27 @@
 
 #include <private/filament/UibGenerator.h>
 
+#include <math/quat.h>
+#include <math/vec3.h>
+#include <math/vec4.h>
+
 #include <utils/Entity.h>
 #include <utils/SingleInstanceComponentManager.h>
 #include <utils/Slice.h>
 #include <utils/Range.h>
 
+#include <vector>
+
 // for gtest
 class FilamentTest_Bones_Test;
+class FilamentTest_MorphWeights_Test;
+class FilamentTest_CpuDeformation_Test;
 
 namespace filament {
 
 class FMaterialInstance;
 class FRenderPrimitive;
+class Frustum;
 class FIndexBuffer;
 class FVertexBuffer;
 
@@ -58,6 +70,9 @@ public:
         bool skinning                   : 1;
         bool morphing                   : 1;
         bool screenSpaceContactShadows  : 1;
+        bool instancing                 : 1;
+        bool morphTargets               : 1;
+        bool matrixBones                : 1;
     };
 
     static_assert(sizeof(Visibility) == sizeof(uint16_t), "Visibility should be 16 bits");
@@ -65,6 +80,9 @@ public:
     explicit FRenderableManager(FEngine& engine) noexcept;
     ~FRenderableManager();
 
+    // creates the resources shared by all renderables, once the engine is constructed
+    void init() noexcept;
+
     // free-up all resources
     void terminate() noexcept;
 
@@ -88,7 +106,7 @@ public:
     // - list is a list of index in 'instances' (typically the visible ones)
     void prepare(backend::DriverApi& driver,
             RenderableManager::Instance const* instances,
-            utils::Range<uint32_t> list) const noexcept;
+            utils::Range<uint32_t> list) noexcept;
 
     void gc(utils::EntityManager& em) noexcept {
         mManager.gc(em);
@@ -109,11 +127,23 @@ public:
     inline void setCulling(Instance instance, bool enable) noexcept;
     inline void setSkinning(Instance instance, bool enable) noexcept;
     inline void setMorphing(Instance instance, bool enable) noexcept;
+    inline void setInstancing(Instance instance, bool enable) noexcept;
+    inline void setMorphTargets(Instance instance, bool enable) noexcept;
+    inline void setMatrixBones(Instance instance, bool enable) noexcept;
     inline void setPrimitives(Instance instance, utils::Slice<FRenderPrimitive> const& primitives) noexcept;
     inline void setBones(Instance instance, Bone const* transforms, size_t boneCount, size_t offset = 0) noexcept;
     inline void setBones(Instance instance, math::mat4f const* transforms, size_t boneCount, size_t offset = 0) noexcept;
+    void setBones(BoneTransforms const* updates, size_t count) noexcept;
     inline void setMorphWeights(Instance instance, const math::float4& weights) noexcept;
-
+    void setMorphWeights(Instance instance, float const* weights,
+            size_t count, size_t offset = 0) noexcept;
+    void setMorphTargetsAt(Instance instance, uint8_t level, size_t primitiveIndex,
+            size_t targetIndex, math::float3 const* positions, math::float3 const* normals,
+            size_t vertexCount, size_t offset = 0) noexcept;
+    void setInstanceTransforms(Instance instance, math::mat4f const* transforms,
+            size_t count, size_t offset = 0) noexcept;
+    void setInstanceData(Instance instance, math::float4 const* data,
+            size_t count, size_t offset = 0) noexcept;
 
     inline bool isShadowCaster(Instance instance) const noexcept;
     inline bool isShadowReceiver(Instance instance) const noexcept;
@@ -122,17 +152,59 @@ public:
 
     inline Box const& getAABB(Instance instance) const noexcept;
     inline Box const& getAxisAlignedBoundingBox(Instance instance) const noexcept { return getAABB(instance); }
+    // the bounds of all the instances for instanced renderables, the AABB otherwise
+    inline Box const& getCullingAABB(Instance instance) const noexcept;
     inline Visibility getVisibility(Instance instance) const noexcept;
     inline uint8_t getLayerMask(Instance instance) const noexcept;
     inline uint8_t getPriority(Instance instance) const noexcept;
     inline filament::math::float4 getMorphWeights(Instance instance) const noexcept;
 
-    inline backend::Handle<backend::HwUniformBuffer> getBonesUbh(Instance instance) const noexcept;
+    // the bones of all the renderables, each one uses the range starting at getBonesOffset()
+    backend::Handle<backend::HwUniformBuffer> getBonesUbh() const noexcept {
+        return mBonePool.getHandle();
+    }
+    BonePool const& getBonePool() const noexcept { return mBonePool; }
+    inline uint32_t getBonesOffset(Instance instance) const noexcept;
     inline uint32_t getBoneCount(Instance instance) const noexcept;
+    inline size_t getInstanceCount(Instance instance) const noexcept;
+    inline size_t getMorphTargetCount(Instance instance) const noexcept;
+
+    // Writes the instances whose bounds intersect any of the 'frustumCount' frusta (all of them
+    // if 'frusta' is null) to 'out', in world space, and returns how many were written.
+    size_t writeVisibleInstances(Instance instance, AffineTransform const& worldTransform,
+            Frustum const* frusta, size_t frustumCount,
+            PerRenderableUibInstance* out) const noexcept;
+
+    // Same as writeVisibleInstances(), to the renderable's range of the bone pool (after its
+    // bones), which is uploaded by the next prepare().
+    size_t updateVisibleInstances(Instance instance, AffineTransform const& worldTransform,
+            Frustum const* frusta, size_t frustumCount) noexcept;
+
+    // Changes each time the AABB, layers, morph weights or targets, visibility, geometry or
+    // material instances of this instance are set, and when the bones of an instance deformed
+    // on the CPU are set. This allows users to cache these values.
+    uint32_t getVersion(Instance instance) const noexcept {
+        return mManager[instance].version;
+    }
+
+    // see SingleInstanceComponentManager::getLayoutVersion()
+    uint32_t getLayoutVersion() const noexcept {
+        return mManager.getLayoutVersion();
+    }
+
 
+    // level to use with the APIs below to address the primitives of all the levels at once
+    static constexpr uint8_t ALL_LEVELS = 0xFF;
+    static constexpr size_t MAX_LEVEL_COUNT = 8;
 
-    inline size_t getLevelCount(Instance instance) const noexcept { return 1; }
+    inline size_t getLevelCount(Instance instance) const noexcept;
     inline size_t getPrimitiveCount(Instance instance, uint8_t level) const noexcept;
+
+    // Returns the level of detail to draw for the given screen size, i.e. the projected diameter
+    // of the renderable divided by the viewport height. previousLevel is the level drawn by the
+    // same pass last frame, which provides the hysteresis.
+    uint8_t selectLevel(Instance instance, float screenSize, uint8_t previousLevel) const noexcept;
+
     void setMaterialInstanceAt(Instance instance, uint8_t level,
             size_t primitiveIndex, FMaterialInstance const* materialInstance) noexcept;
     MaterialInstance* getMaterialInstanceAt(Instance instance, uint8_t level, size_t primitiveIndex) const noexcept;
@@ -143,23 +215,110 @@ public:
             PrimitiveType type, size_t offset, size_t count) noexcept;
     void setBlendOrderAt(Instance instance, uint8_t level, size_t primitiveIndex, uint16_t blendOrder) noexcept;
     AttributeBitset getEnabledAttributesAt(Instance instance, uint8_t level, size_t primitiveIndex) const noexcept;
-    inline utils::Slice<FRenderPrimitive> const& getRenderPrimitives(Instance instance, uint8_t level) const noexcept;
-    inline utils::Slice<FRenderPrimitive>& getRenderPrimitives(Instance instance, uint8_t level) noexcept;
+    utils::Slice<FRenderPrimitive> getRenderPrimitives(Instance instance, uint8_t level) const noexcept;
+    utils::Slice<FRenderPrimitive> getRenderPrimitives(Instance instance, uint8_t level) noexcept;
 
 private:
     void destroyComponent(Instance ci) noexcept;
+    inline void updateVersion(Instance ci) noexcept;
+    inline void invalidateDeformation(Instance ci) noexcept;
+    void deform(Instance ci) noexcept;
+    void updateInstanceBounds(Instance ci) noexcept;
     static void destroyComponentPrimitives(FEngine& engine,
             utils::Slice<FRenderPrimitive>& primitives) noexcept;
 
     struct Bones {
-        filament::backend::Handle<backend::HwUniformBuffer> handle;
-        UniformBuffer bones;
+        uint32_t offset;        // in the bone pool, in bytes
+        uint32_t size;          // in the bone pool, in bytes
         size_t count;
+        BoneFormat format;
+    };
+
+    struct Instances {
+        std::vector<math::mat4f> transforms;    // relative to the renderable's transform
+        std::vector<math::float4> data;         // user data
+        Box bounds;                             // bounds of all the instances, in model space
+    };
+
+    struct LevelsOfDetail {
+        // level i uses primitives [offsets[i], offsets[i + 1])
+        uint32_t offsets[MAX_LEVEL_COUNT + 1];
+        // level i + 1 is used below screenSizes[i]
+        float screenSizes[MAX_LEVEL_COUNT - 1];
+        float hysteresis;
+        uint8_t count;
+    };
+
+    // the maximum width of the morph target textures, larger meshes use several rows
+    static constexpr uint32_t MORPH_TARGET_TEXTURE_WIDTH = 2048;
+
+    struct MorphTargets {
+        struct Buffer {
+            // layer 2 * target holds the position deltas, layer 2 * target + 1 the normal deltas
+            backend::Handle<backend::HwTexture> texture;
+            backend::Handle<backend::HwSamplerGroup> sgh;
+            uint32_t width;         // in texels (i.e. vertices)
+            uint32_t vertexCount;
+        };
+        backend::Handle<backend::HwUniformBuffer> handle;
+        UniformBuffer weights;                  // PerRenderableMorphingUib
+        std::vector<float> userWeights;         // one per target, including the zero weights
+        std::vector<Buffer> buffers;            // one per primitive
+    };
+
+    struct Deformation {
+        struct Buffer {
+            FVertexBuffer* vertices = nullptr;          // owned, holds the deformed vertices
+            std::vector<math::float3> positions;        // rest pose
+            std::vector<math::quatf> tangents;          // rest pose, optional
+            std::vector<math::ushort4> boneIndices;
+            std::vector<math::float4> boneWeights;
+            std::vector<math::float3> positionDeltas;   // vertexCount deltas per morph target
+            std::vector<math::float3> normalDeltas;     // vertexCount deltas per morph target
+            uint8_t positionBufferIndex = 0;
+            uint8_t tangentBufferIndex = 0;
+        };
+        std::vector<Buffer> buffers;    // one per primitive, without vertices if not deformed
+        bool dirty = true;              // the bones or the morph weights changed
+    };
+
+    // what deformVertices() applies to the vertices of a Deformation::Buffer
+    struct DeformationParams {
+        Deformation::Buffer const* buffer;
+        void const* bones;                          // nullptr if not skinned
+        BoneFormat boneFormat;
+        PerRenderableMorphingUib const* weights;    // nullptr if no morph targets
+        math::float3* positions;                    // deformed positions
+        math::quatf* tangents;                      // deformed tangents, nullptr if none
+        SimdKernel kernel;                          // accumulates the morph targets
     };
 
+    // Applies the morph targets then the bones to count vertices, like getPosition() and
+    // skinNormal() do in the vertex shader.
+    static void deformVertices(DeformationParams const& params,
+            size_t first, size_t count) noexcept;
+
+    // deform() splits the vertices of a primitive in jobs of at least this many vertices
+    static constexpr size_t DEFORMATION_JOB_SIZE = 1024;
+
     friend class ::FilamentTest_Bones_Test;
+    friend class ::FilamentTest_MorphWeights_Test;
+    friend class ::FilamentTest_CpuDeformation_Test;
 
     static void makeBone(PerRenderableUibBone* out, math::mat4f const& transforms) noexcept;
+    static void makeBone(PerRenderableUibBoneMatrix* out, math::mat4f const& transforms) noexcept;
+
+    // converts transforms to bones of the given format, out points into the bone pool
+    static void writeBones(void* out, BoneFormat format,
+            math::mat4f const* transforms, size_t count) noexcept;
+
+    // the bulk setBones() uses the job system above this many bones
+    static constexpr size_t BONES_JOB_SIZE = 1024;
+
+    // Packs the non-zero weights and their target index, which lets the vertex shader skip the
+    // targets that don't contribute.
+    static void packMorphWeights(PerRenderableMorphingUib* out,
+            float const* weights, size_t count) noexcept;
 
     enum {
         AABB,               // user data
@@ -167,7 +326,12 @@ private:
         MORPH_WEIGHTS,      // user data
         VISIBILITY,         // user data
         PRIMITIVES,         // user data
-        BONES,              // filament data, UBO storing a pointer to the bones information
+        BONES,              // filament data, the range of the bone pool storing the bones
+        INSTANCES,          // user data, the instances of an instanced renderable
+        LEVELS,             // user data, the levels of detail if there are more than one
+        MORPH_TARGETS,      // filament data, the morph targets if any
+        DEFORMATION,        // user data, the rest pose of the primitives deformed on the CPU
+        VERSION,            // filament data, see getVersion()
     };
 
     using Base = utils::SingleInstanceComponentManager<
@@ -176,7 +340,12 @@ private:
             filament::math::float4,          // MORPH_WEIGHTS
             Visibility,                      // VISIBILITY
             utils::Slice<FRenderPrimitive>,  // PRIMITIVES
-            std::unique_ptr<Bones>           // BONES
+            std::unique_ptr<Bones>,          // BONES
+            std::unique_ptr<Instances>,      // INSTANCES
+            std::unique_ptr<LevelsOfDetail>, // LEVELS
+            std::unique_ptr<MorphTargets>,   // MORPH_TARGETS
+            std::unique_ptr<Deformation>,    // DEFORMATION
+            uint32_t                         // VERSION
     >;
 
     struct Sim : public Base {
@@ -197,6 +366,11 @@ private:
                 Field<VISIBILITY>   visibility;
                 Field<PRIMITIVES>   primitives;
                 Field<BONES>        bones;
+                Field<INSTANCES>    instances;
+                Field<LEVELS>       levels;
+                Field<MORPH_TARGETS> morphTargets;
+                Field<DEFORMATION>  deformation;
+                Field<VERSION>      version;
             };
         };
 
@@ -210,13 +384,41 @@ private:
 
     Sim mManager;
     FEngine& mEngine;
+    uint32_t mVersion = 0;
+
+    // the bones and instances of all the renderables
+    BonePool mBonePool;
+
+    // bound by the renderables without morph targets, which use the same program variant
+    backend::Handle<backend::HwTexture> mDummyMorphTexture;
+    backend::Handle<backend::HwSamplerGroup> mDummyMorphTargets;
+    backend::Handle<backend::HwUniformBuffer> mDummyMorphWeights;
 };
 
 FILAMENT_UPCAST(RenderableManager)
 
+void FRenderableManager::updateVersion(Instance ci) noexcept {
+    mManager[ci].version = ++mVersion;
+}
+
+void FRenderableManager::invalidateDeformation(Instance ci) noexcept {
+    std::unique_ptr<Deformation> const& deformation = mManager[ci].deformation;
+    if (UTILS_UNLIKELY(deformation)) {
+        deformation->dirty = true;
+        // the deformed vertices change, but not the skinning or morphing state, so this is the
+        // only way to notice it (e.g. for shadow map caching)
+        updateVersion(ci);
+    }
+}
+
 void FRenderableManager::setAxisAlignedBoundingBox(Instance instance, const Box& aabb) noexcept {
     if (instance) {
         mManager[instance].aabb = aabb;
+        std::unique_ptr<Instances> const& instances = mManager[instance].instances;
+        if (UTILS_UNLIKELY(instances)) {
+            updateInstanceBounds(instance);
+        }
+        updateVersion(instance);
     }
 }
 
@@ -225,12 +427,14 @@ void FRenderableManager::setLayerMask(Instance instance,
     if (instance) {
         uint8_t& layers = mManager[instance].layers;
         layers = (layers & ~select) | (values & select);
+        updateVersion(instance);
     }
 }
 
 void FRenderableManager::setLayerMask(Instance instance, uint8_t layerMask) noexcept {
     if (instance) {
         mManager[instance].layers = layerMask;
+        updateVersion(instance);
     }
 }
 
@@ -238,6 +442,7 @@ void FRenderableManager::setPriority(Instance instance, uint8_t priority) noexce
     if (instance) {
         Visibility& visibility = mManager[instance].visibility;
         visibility.priority = priority;
+        updateVersion(instance);
     }
 }
 
@@ -245,6 +450,7 @@ void FRenderableManager::setCastShadows(Instance instance, bool enable) noexcept
     if (instance) {
         Visibility& visibility = mManager[instance].visibility;
         visibility.castShadows = enable;
+        updateVersion(instance);
     }
 }
 
@@ -252,6 +458,7 @@ void FRenderableManager::setReceiveShadows(Instance instance, bool enable) noexc
     if (instance) {
         Visibility& visibility = mManager[instance].visibility;
         visibility.receiveShadows = enable;
+        updateVersion(instance);
     }
 }
 
@@ -259,6 +466,7 @@ void FRenderableManager::setScreenSpaceContactShadows(Instance instance, bool en
     if (instance) {
         Visibility& visibility = mManager[instance].visibility;
         visibility.screenSpaceContactShadows = enable;
+        updateVersion(instance);
     }
 }
 
@@ -266,6 +474,7 @@ void FRenderableManager::setCulling(Instance instance, bool enable) noexcept {
     if (instance) {
         Visibility& visibility = mManager[instance].visibility;
         visibility.culling = enable;
+        updateVersion(instance);
     }
 }
 
@@ -273,6 +482,7 @@ void FRenderableManager::setSkinning(Instance instance, bool enable) noexcept {
     if (instance) {
         Visibility& visibility = mManager[instance].visibility;
         visibility.skinning = enable;
+        updateVersion(instance);
     }
 }
 
@@ -280,6 +490,31 @@ void FRenderableManager::setMorphing(Instance instance, bool enable) noexcept {
     if (instance) {
         Visibility& visibility = mManager[instance].visibility;
         visibility.morphing = enable;
+        updateVersion(instance);
+    }
+}
+
+void FRenderableManager::setInstancing(Instance instance, bool enable) noexcept {
+    if (instance) {
+        Visibility& visibility = mManager[instance].visibility;
+        visibility.instancing = enable;
+        updateVersion(instance);
+    }
+}
+
+void FRenderableManager::setMorphTargets(Instance instance, bool enable) noexcept {
+    if (instance) {
+        Visibility& visibility = mManager[instance].visibility;
+        visibility.morphTargets = enable;
+        updateVersion(instance);
+    }
+}
+
+void FRenderableManager::setMatrixBones(Instance instance, bool enable) noexcept {
+    if (instance) {
+        Visibility& visibility = mManager[instance].visibility;
+        visibility.matrixBones = enable;
+        updateVersion(instance);
     }
 }
 
@@ -323,9 +558,14 @@ Box const& FRenderableManager::getAABB(Instance instance) const noexcept {
     return mManager[instance].aabb;
 }
 
-backend::Handle<backend::HwUniformBuffer> FRenderableManager::getBonesUbh(Instance instance) const noexcept {
+Box const& FRenderableManager::getCullingAABB(Instance instance) const noexcept {
+    std::unique_ptr<Instances> const& instances = mManager[instance].instances;
+    return UTILS_UNLIKELY(instances) ? instances->bounds : mManager[instance].aabb;
+}
+
+uint32_t FRenderableManager::getBonesOffset(Instance instance) const noexcept {
     std::unique_ptr<Bones> const& bones = mManager[instance].bones;
-    return bones ? bones->handle : backend::Handle<backend::HwUniformBuffer>{};
+    return bones ? bones->offset : 0;
 }
 
 inline uint32_t FRenderableManager::getBoneCount(Instance instance) const noexcept {
@@ -333,14 +573,19 @@ inline uint32_t FRenderableManager::getBoneCount(Instance instance) const noexce
     return bones ? bones->count : 0;
 }
 
-utils::Slice<FRenderPrimitive> const& FRenderableManager::getRenderPrimitives(
-        Instance instance, uint8_t level) const noexcept {
-    return mManager[instance].primitives;
+size_t FRenderableManager::getInstanceCount(Instance instance) const noexcept {
+    std::unique_ptr<Instances> const& instances = mManager[instance].instances;
+    return instances ? instances->transforms.size() : 0;
+}
+
+size_t FRenderableManager::getMorphTargetCount(Instance instance) const noexcept {
+    std::unique_ptr<MorphTargets> const& morphTargets = mManager[instance].morphTargets;
+    return morphTargets ? morphTargets->userWeights.size() : 0;
 }
 
-utils::Slice<FRenderPrimitive>& FRenderableManager::getRenderPrimitives(
-        Instance instance, uint8_t level) noexcept {
-    return mManager[instance].primitives;
+size_t FRenderableManager::getLevelCount(Instance instance) const noexcept {
+    std::unique_ptr<LevelsOfDetail> const& levels = mManager[instance].levels;
+    return levels ? levels->count : 1;
 }
 
 size_t FRenderableManager::getPrimitiveCount(Instance instance, uint8_t level) const noexcept {
@@ -16,6 +16,11 @@
 
 #include "components/TransformManager.h"
 
+#include "AffineTransform.h"
+
+#include <utils/JobSystem.h>
+#include <utils/Systrace.h>
+
 #include <math/mat4.h>
 
 using namespace utils;
@@ -23,7 +28,9 @@ using namespace filament::math;
 
 namespace filament {
 
-FTransformManager::FTransformManager() noexcept = default;
+FTransformManager::FTransformManager(JobSystem* js) noexcept
+        : mJobSystem(js) {
+}
 
 FTransformManager::~FTransformManager() noexcept = default;
 
@@ -114,10 +121,12 @@ void FTransformManager::destroy(Entity e) noexcept {
         // 1) remove the entry from the linked lists
         removeNode(i);
 
-        // our children don't have parents anymore
+        // our children don't have parents anymore, and their world transform is now their
+        // local transform
         Instance child = manager[i].firstChild;
         while (child) {
             manager[child].parent = 0;
+            updateNodeTransform(child);
             child = manager[child].next;
         }
 
@@ -141,14 +150,32 @@ void FTransformManager::setTransform(Instance ci, const mat4f& model) noexcept {
     }
 }
 
+void FTransformManager::setTransform(Instance const* instances, mat4f const* localTransforms,
+        size_t count) noexcept {
+    // This behaves as a transaction, so that each world transform is computed only once, even
+    // when several nodes of the same hierarchy are updated.
+    const bool transactionOpen = mLocalTransformTransactionOpen;
+    openLocalTransformTransaction();
+    for (size_t k = 0; k < count; k++) {
+        setTransform(instances[k], localTransforms[k]);
+    }
+    if (!transactionOpen) {
+        commitLocalTransformTransaction();
+    }
+}
+
 void FTransformManager::updateNodeTransform(Instance i) noexcept {
+    auto& manager = mManager;
     if (UTILS_UNLIKELY(mLocalTransformTransactionOpen)) {
+        // remember this node changed, commitLocalTransformTransaction() uses this to find
+        // the world transforms that changed.
+        manager[i].version = mVersion;
         return;
     }
 
     validateNode(i);
-    auto& manager = mManager;
     assert(i);
+    const uint32_t version = ++mVersion;
 
     // find our parent's world transform, if any
     // note: by using the raw_array() we don't need to check that parent is valid.
@@ -156,39 +183,126 @@ void FTransformManager::updateNodeTransform(Instance i) noexcept {
     mat4f const& pt = manager.raw_array<WORLD>()[parent];
 
     // compute our world transform
-    manager[i].world = pt * static_cast<mat4f const&>(manager[i].local);
+    manager[i].world = AffineTransform::multiply(pt, manager[i].local);
+    manager[i].version = version;
 
     // update our children's world transforms
     Instance child = manager[i].firstChild;
     if (UTILS_UNLIKELY(child)) { // assume we don't have a hierarchy in the common case
-        transformChildren(manager, child);
+        transformChildren(manager, child, version);
     }
 }
 
 void FTransformManager::openLocalTransformTransaction() noexcept {
+    if (!mLocalTransformTransactionOpen) {
+        // all the nodes updated during the transaction are stamped with this version
+        ++mVersion;
+    }
     mLocalTransformTransactionOpen = true;
 }
 
 void FTransformManager::commitLocalTransformTransaction() noexcept {
     if (mLocalTransformTransactionOpen) {
+        SYSTRACE_CALL();
+
         mLocalTransformTransactionOpen = false;
-        auto& manager = mManager;
+        if (UTILS_UNLIKELY(!mLevelsValid)) {
+            sortByLevel();
+        }
+
+        // The world transform changed if the local transform did, or if the parent's world
+        // transform did. The latter is always known by the time we get to a node, since
+        // parents are in the previous level. Nodes of the same level are independent from each
+        // other, so each level can be processed in parallel.
+        auto& soa = mManager.getSoA();
+        const uint32_t version = mVersion;
+        mat4f* const UTILS_RESTRICT world = soa.data<WORLD>();
+        mat4f const* const UTILS_RESTRICT local = soa.data<LOCAL>();
+        Instance const* const UTILS_RESTRICT parents = soa.data<PARENT>();
+        uint32_t* const UTILS_RESTRICT versions = soa.data<VERSION>();
+        auto update = [=](uint32_t first, uint32_t count) {
+            for (uint32_t i = first, e = first + count; i < e; i++) {
+                const Instance parent = parents[i];
+                if (parent && versions[parent] == version) {
+                    versions[i] = version;
+                }
+                if (versions[i] == version) {
+                    world[i] = AffineTransform::multiply(world[parent], local[i]);
+                }
+            }
+        };
+
+        JobSystem* const js = mJobSystem;
+        uint32_t const* const levels = mLevels.data();
+        for (size_t l = 0, c = mLevels.size() - 1; l < c; l++) {
+            const uint32_t first = levels[l] + 1;
+            const uint32_t count = levels[l + 1] - levels[l];
+            if (!js || count <= COMMIT_JOB_SIZE) {
+                update(first, count);
+            } else {
+                auto* job = jobs::parallel_for(*js, nullptr, first, count,
+                        std::ref(update), jobs::CountSplitter<COMMIT_JOB_SIZE, 8>());
+                js->runAndWait(job);
+            }
+        }
+    }
+}
 
-        // swapNode() below needs some temporary storage which we provide here
-        auto& soa = manager.getSoA();
-        soa.ensureCapacity(soa.size() + 1);
+// Reorders the nodes breadth-first, i.e. by depth in the hierarchy, so that parents are always
+// before their children and the nodes of a level are contiguous.
+void FTransformManager::sortByLevel() noexcept {
+    SYSTRACE_CALL();
 
-        mat4f const* const UTILS_RESTRICT world = manager.raw_array<WORLD>();
-        for (Instance i = manager.begin(), e = manager.end(); i != e; ++i) {
-            // Ensure that children are always sorted after their parent.
-            while (UTILS_UNLIKELY(Instance(manager[i].parent) > i)) {
-                swapNode(i, manager[i].parent);
+    auto& manager = mManager;
+    const size_t count = manager.getComponentCount();
+
+    // swapNode() below needs some temporary storage which we provide here
+    auto& soa = manager.getSoA();
+    soa.ensureCapacity(soa.size() + 1);
+
+    // order[k] is the node that goes to instance k + 1, roots first
+    std::vector<Instance> order;
+    order.reserve(count);
+    for (Instance i = manager.begin(), e = manager.end(); i != e; ++i) {
+        if (!Instance(manager[i].parent)) {
+            order.push_back(i);
+        }
+    }
+    mLevels.assign(1, 0);
+    for (size_t first = 0; first < order.size();) {
+        const size_t last = order.size();
+        for (size_t k = first; k < last; k++) {
+            for (Instance child = manager[order[k]].firstChild; child;
+                    child = manager[child].next) {
+                order.push_back(child);
             }
-            Instance parent = manager[i].parent;
-            assert(parent < i);
-            manager[i].world = world[parent] * static_cast<mat4f const&>(manager[i].local);
         }
+        mLevels.push_back(uint32_t(last));
+        first = last;
     }
+    assert(order.size() == count);
+
+    // apply the permutation, tracking where the nodes moved as we go
+    std::vector<Instance> where(count + 1);     // current instance of each original node
+    std::vector<Instance> which(count + 1);     // original node at each current instance
+    for (size_t k = 0; k <= count; k++) {
+        where[k] = which[k] = Instance(k);
+    }
+    for (size_t k = 0; k < count; k++) {
+        const Instance target = Instance(k + 1);
+        const Instance node = order[k];
+        const Instance current = where[node];
+        if (current != target) {
+            swapNode(target, current);
+            const Instance displaced = which[target];
+            which[target] = node;
+            which[current] = displaced;
+            where[node] = target;
+            where[displaced] = current;
+        }
+    }
+
+    mLevelsValid = true;
 }
 
 // Inserts a parentless node in the hierarchy
@@ -197,6 +311,9 @@ void FTransformManager::insertNode(Instance i, Instance parent) noexcept {
 
     assert(manager[i].parent == Instance{});
 
+    // the depth of this node (and its descendants) changed
+    mLevelsValid = false;
+
     manager[i].parent = parent;
     manager[i].prev = 0;
     manager[i].next = 0;
@@ -225,6 +342,7 @@ void FTransformManager::swapNode(Instance i, Instance j) noexcept {
     // swap the content of the nodes directly
     std::swap(manager.elementAt<LOCAL>(i), manager.elementAt<LOCAL>(j));
     std::swap(manager.elementAt<WORLD>(i), manager.elementAt<WORLD>(j));
+    std::swap(manager.elementAt<VERSION>(i), manager.elementAt<VERSION>(j));
     manager.swap(i, j); // this swaps the data relative to SingleInstanceComponentManager
 
     // now swap the linked-list references, to do that correctly we must use a temporary
@@ -258,6 +376,7 @@ void FTransformManager::swapNode(Instance i, Instance j) noexcept {
 // (making everybody orphaned).
 void FTransformManager::removeNode(Instance i) noexcept {
     auto& manager = mManager;
+    mLevelsValid = false;
     Instance parent = manager[i].parent;
     Instance prev = manager[i].prev;
     Instance next = manager[i].next;
@@ -311,18 +430,19 @@ void FTransformManager::updateNode(Instance i) noexcept {
     validateNode(next);
 }
 
-void FTransformManager::transformChildren(Sim& manager, Instance ci) noexcept {
+void FTransformManager::transformChildren(Sim& manager, Instance ci, uint32_t version) noexcept {
     while (ci) {
         // update child's world transform
         Instance parent = manager[ci].parent;
         mat4f const& pt = manager[parent].world;
         mat4f const& local = manager[ci].local;
-        manager[ci].world = pt * local;
+        manager[ci].world = AffineTransform::multiply(pt, local);
+        manager[ci].version = version;
 
         // assume we don't have a deep hierarchy
         Instance child = manager[ci].firstChild;
         if (UTILS_UNLIKELY(child)) {
-            transformChildren(manager, child);
+            transformChildren(manager, child, version);
         }
 
         // process our next child
@@ -413,6 +533,11 @@ void TransformManager::setTransform(Instance ci, const mat4f& model) noexcept {
     upcast(this)->setTransform(ci, model);
 }
 
+void TransformManager::setTransform(Instance const* instances, const mat4f* localTransforms,
+        size_t count) noexcept {
+    upcast(this)->setTransform(instances, localTransforms, count);
+}
+
 const mat4f& TransformManager::getTransform(Instance ci) const noexcept {
     return upcast(this)->getTransform(ci);
 }
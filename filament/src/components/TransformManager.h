@@ -28,13 +28,20 @@
 
 #include <math/mat4.h>
 
+#include <vector>
+
+namespace utils {
+class JobSystem;
+} // namespace utils
+
 namespace filament {
 
 class UTILS_PRIVATE FTransformManager : public TransformManager {
 public:
     using Instance = TransformManager::Instance;
 
-    FTransformManager() noexcept;
+    // when a JobSystem is provided, commitLocalTransformTransaction() uses it
+    explicit FTransformManager(utils::JobSystem* js = nullptr) noexcept;
     ~FTransformManager() noexcept;
 
     // free-up all resources
@@ -83,6 +90,9 @@ public:
 
     void setTransform(Instance ci, const math::mat4f& model) noexcept;
 
+    void setTransform(Instance const* instances, math::mat4f const* localTransforms,
+            size_t count) noexcept;
+
     const math::mat4f& getTransform(Instance ci) const noexcept {
         return mManager[ci].local;
     }
@@ -91,6 +101,18 @@ public:
         return mManager[ci].world;
     }
 
+    // Changes each time the world transform of this instance is updated, including when it's
+    // updated because of one of its ancestors. This allows users to cache data derived from
+    // the world transform.
+    uint32_t getWorldTransformVersion(Instance ci) const noexcept {
+        return mManager[ci].version;
+    }
+
+    // see SingleInstanceComponentManager::getLayoutVersion()
+    uint32_t getLayoutVersion() const noexcept {
+        return mManager.getLayoutVersion();
+    }
+
 private:
     struct Sim;
 
@@ -100,7 +122,8 @@ private:
     void updateNodeTransform(Instance i) noexcept;
     void insertNode(Instance i, Instance p) noexcept;
     void swapNode(Instance i, Instance j) noexcept;
-    static void transformChildren(Sim& manager, Instance firstChild) noexcept;
+    void sortByLevel() noexcept;
+    static void transformChildren(Sim& manager, Instance firstChild, uint32_t version) noexcept;
 
     friend class TransformManager::children_iterator;
 
@@ -111,6 +134,7 @@ private:
         FIRST_CHILD,    // instance to our first child
         NEXT,           // instance to our next sibling
         PREV,           // instance to our previous sibling
+        VERSION,        // version of the world transform
     };
 
     using Base = utils::SingleInstanceComponentManager<
@@ -119,7 +143,8 @@ private:
             Instance,
             Instance,
             Instance,
-            Instance
+            Instance,
+            uint32_t
     >;
 
     struct Sim : public Base {
@@ -142,6 +167,7 @@ private:
                 Field<FIRST_CHILD>  firstChild;
                 Field<NEXT>         next;
                 Field<PREV>         prev;
+                Field<VERSION>      version;
             };
         };
 
@@ -153,8 +179,19 @@ private:
         }
     };
 
+    // world transforms of a level are computed in jobs of this many nodes
+    static constexpr size_t COMMIT_JOB_SIZE = 256;
+
     Sim mManager;
+    utils::JobSystem* const mJobSystem;
+
+    // Instances sorted breadth-first by commitLocalTransformTransaction(), level l spans
+    // [mLevels[l], mLevels[l + 1]) (offset by 1, since instance 0 is not used).
+    std::vector<uint32_t> mLevels;
+    bool mLevelsValid = false;
+
     bool mLocalTransformTransactionOpen = false;
+    uint32_t mVersion = 0;
 };
 
 FILAMENT_UPCAST(TransformManager)
@@ -31,6 +31,10 @@
 #    define FILAMENT_MIN_COMMAND_BUFFERS_SIZE_IN_MB 1
 #endif 
 
+#ifndef FILAMENT_MAX_MIN_COMMAND_BUFFERS_SIZE_IN_MB
+#    define FILAMENT_MAX_MIN_COMMAND_BUFFERS_SIZE_IN_MB 16
+#endif
+
 namespace filament {
 
 // per render pass allocations
@@ -41,8 +45,13 @@ static constexpr size_t CONFIG_PER_RENDER_PASS_ARENA_SIZE  = FILAMENT_PER_RENDER
 static constexpr size_t CONFIG_PER_FRAME_COMMANDS_SIZE     = FILAMENT_PER_FRAME_COMMANDS_SIZE_IN_MB * 1024 * 1024;
 
 // size of a command-stream buffer (comes from mmap -- not the per-engine arena)
+// The buffer grows instead of blocking when it's short on space, so it doesn't need more than
+// twice the guaranteed size of headroom.
 static constexpr size_t CONFIG_MIN_COMMAND_BUFFERS_SIZE    = FILAMENT_MIN_COMMAND_BUFFERS_SIZE_IN_MB * 1024 * 1024;
-static constexpr size_t CONFIG_COMMAND_BUFFERS_SIZE        = 3 * CONFIG_MIN_COMMAND_BUFFERS_SIZE;
+static constexpr size_t CONFIG_COMMAND_BUFFERS_SIZE        = 2 * CONFIG_MIN_COMMAND_BUFFERS_SIZE;
+
+// the command-stream buffer grows when the commands need more than its minimum size, up to this
+static constexpr size_t CONFIG_MAX_MIN_COMMAND_BUFFERS_SIZE = FILAMENT_MAX_MIN_COMMAND_BUFFERS_SIZE_IN_MB * 1024 * 1024;
 
 #ifndef NDEBUG
 
@@ -17,6 +17,8 @@
 #ifndef TNT_FILAMENT_DETAILS_CULLER_H
 #define TNT_FILAMENT_DETAILS_CULLER_H
 
+#include "SimdKernel.h"
+
 #include <filament/Frustum.h>
 
 #include <utils/compiler.h>
@@ -47,6 +49,20 @@ public:
 
     using result_type = uint8_t;
 
+    // Implementations of the intersection loops. SCALAR is the reference implementation, the
+    // others are explicitly vectorized and process 8 boxes or spheres at a time.
+    using Kernel = SimdKernel;
+
+    /*
+     * returns the kernel used by intersects(), i.e. the fastest one supported by this CPU
+     */
+    static Kernel getKernel() noexcept { return getSimdKernel(); }
+
+    /*
+     * returns whether a kernel can run on this CPU
+     */
+    static bool isKernelSupported(Kernel kernel) noexcept { return isSimdKernelSupported(kernel); }
+
     /*
      * returns whether each AABB in an array intersects with the frustum
      */
@@ -91,6 +107,18 @@ public:
                 Frustum const& frustum,
                 math::float4 const* b,
                 size_t count) noexcept;
+
+        // same as above with a specific kernel, which must be supported
+        static void intersects(result_type* results,
+                Frustum const& frustum,
+                math::float3 const* c,
+                math::float3 const* e,
+                size_t count, Kernel kernel) noexcept;
+
+        static void intersects(result_type* results,
+                Frustum const& frustum,
+                math::float4 const* b,
+                size_t count, Kernel kernel) noexcept;
     };
 };
 
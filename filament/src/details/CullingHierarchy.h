@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TNT_FILAMENT_DETAILS_CULLINGHIERARCHY_H
+#define TNT_FILAMENT_DETAILS_CULLINGHIERARCHY_H
+
+#include "details/Culler.h"
+
+#include <filament/Frustum.h>
+#include <filament/RenderableManager.h>
+
+#include <utils/compiler.h>
+#include <utils/EntityInstance.h>
+
+#include <math/vec3.h>
+
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace utils {
+class JobSystem;
+} // namespace utils
+
+namespace filament {
+
+/*
+ * A bounding volume hierarchy over the world-space AABBs of a scene's renderables.
+ *
+ * The hierarchy doesn't own the AABBs, it references them by their index in the scene's
+ * RenderableSoa, which is stable from frame to frame as long as the set of renderables doesn't
+ * change. When it does, the hierarchy is rebuilt from scratch, otherwise it is only refitted
+ * around the AABBs that moved.
+ *
+ * cull() produces the same result as Culler::intersects() over the whole array, but skips entire
+ * subtrees that are fully inside or fully outside the frustum.
+ */
+class CullingHierarchy {
+public:
+    using Instance = utils::EntityInstance<RenderableManager>;
+
+    // maximum number of renderables in a leaf
+    static constexpr size_t LEAF_SIZE = 32;
+
+    // subtrees with fewer renderables than this are culled in a single job
+    static constexpr size_t JOB_SIZE = Culler::MODULO * Culler::MIN_LOOP_COUNT_HINT * 8;
+
+    CullingHierarchy() noexcept;
+    ~CullingHierarchy() noexcept;
+
+    CullingHierarchy(CullingHierarchy const& rhs) = delete;
+    CullingHierarchy& operator=(CullingHierarchy const& rhs) = delete;
+
+    // updates the hierarchy for this frame's renderables. Returns true if the hierarchy was
+    // rebuilt, false if it was only refitted (or nothing changed).
+    bool update(Instance const* instances,
+            math::float3 const* centers, math::float3 const* extents, size_t count) noexcept;
+
+    // frees all the memory used by the hierarchy
+    void clear() noexcept;
+
+    bool empty() const noexcept { return mNodes.empty(); }
+    size_t size() const noexcept { return mIndices.size(); }
+
+    // Sets bit 'bit' of results[i] for every renderable that intersects the frustum. The bit of
+    // renderables outside the frustum is left untouched. centers and extents must be the same
+    // arrays that were last passed to update().
+    void cull(utils::JobSystem& js, Frustum const& frustum, Culler::result_type* results,
+            math::float3 const* centers, math::float3 const* extents, size_t bit) const noexcept;
+
+private:
+    struct Node {
+        math::float3 min;
+        uint32_t first;     // first entry in mIndices covered by this node
+        math::float3 max;
+        uint32_t count;     // number of entries in mIndices covered by this node
+        uint32_t right;     // index of the right child (left child is always next), 0 for leaves
+    };
+
+    struct Task {
+        uint32_t node;
+        uint8_t planes;     // bitmask of the planes the node is still straddling
+    };
+
+    void build(math::float3 const* centers, math::float3 const* extents, size_t count) noexcept;
+    uint32_t buildRecursive(math::float3 const* centers, math::float3 const* extents,
+            uint32_t first, uint32_t count) noexcept;
+    bool refit(math::float3 const* centers, math::float3 const* extents) noexcept;
+    void computeLeafBounds(Node& node,
+            math::float3 const* centers, math::float3 const* extents) const noexcept;
+
+    void gatherTasks(std::vector<Task>& tasks, math::float4 const* planes,
+            uint32_t node, uint8_t mask) const noexcept;
+    void cullNode(math::float4 const* planes, Culler::result_type* results,
+            math::float3 const* centers, math::float3 const* extents,
+            uint32_t node, uint8_t mask, uint8_t bit) const noexcept;
+
+    static float surfaceArea(Node const& node) noexcept;
+
+    std::vector<Node> mNodes;
+    std::vector<uint32_t> mIndices;         // renderable indices, ordered by leaves
+    std::vector<Instance> mInstances;       // renderables the hierarchy was built for
+    std::vector<math::float3> mCenters;     // AABBs the hierarchy was last fitted to
+    std::vector<math::float3> mExtents;
+    std::vector<uint8_t> mDirty;            // per-node scratch for refitting
+    float mBuildSurfaceArea = 0.0f;         // surface area of the root at build time
+};
+
+} // namespace filament
+
+#endif // TNT_FILAMENT_DETAILS_CULLINGHIERARCHY_H
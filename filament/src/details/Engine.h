@@ -74,6 +74,7 @@ class DebugServer;
 #include <memory>
 #include <random>
 #include <unordered_map>
+#include <vector>
 
 namespace filament {
 
@@ -125,6 +126,7 @@ public:
     static constexpr size_t CONFIG_PER_FRAME_COMMANDS_SIZE      = filament::CONFIG_PER_FRAME_COMMANDS_SIZE;
     static constexpr size_t CONFIG_MIN_COMMAND_BUFFERS_SIZE     = filament::CONFIG_MIN_COMMAND_BUFFERS_SIZE;
     static constexpr size_t CONFIG_COMMAND_BUFFERS_SIZE         = filament::CONFIG_COMMAND_BUFFERS_SIZE;
+    static constexpr size_t CONFIG_MAX_MIN_COMMAND_BUFFERS_SIZE = filament::CONFIG_MAX_MIN_COMMAND_BUFFERS_SIZE;
 
 public:
     static FEngine* create(Backend backend = Backend::DEFAULT,
@@ -273,6 +275,31 @@ public:
     // flush the current buffer
     void flush();
 
+    size_t getCommandBufferSize() const noexcept {
+        return mCommandBufferQueue.getSize();
+    }
+
+    size_t getCommandBufferUsage() const noexcept {
+        return mCommandBufferQueue.getUsage();
+    }
+
+    size_t getCommandBufferPendingSize() const noexcept {
+        return mCommandBufferQueue.getPendingSize();
+    }
+
+    size_t getCommandBufferPeakUsage() const noexcept {
+        return mCommandBufferQueue.getHighWatermark();
+    }
+
+    CommandBufferStats getCommandBufferStats() const noexcept {
+        return {
+                .stallCount = mCommandBufferQueue.getStallCount(),
+                .stallDurationNs = mCommandBufferQueue.getStallDurationNs(),
+                .waitCount = mCommandBufferQueue.getWaitCount(),
+                .waitDurationNs = mCommandBufferQueue.getWaitDurationNs()
+        };
+    }
+
     /**
      * Processes the platform's event queue when called from the platform's event-handling thread.
      * Returns false when called from any other thread.
@@ -364,6 +391,8 @@ private:
 
     std::thread mDriverThread;
     backend::CommandBufferQueue mCommandBufferQueue;
+    // only accessed by the driver thread, kept around to avoid an allocation per execute()
+    std::vector<backend::CommandBufferQueue::Slice> mCommandBuffersToExecute;
     DriverApi mCommandStream;
 
     LinearAllocatorArena mPerRenderPassAllocator;
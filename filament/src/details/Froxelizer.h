@@ -56,8 +56,9 @@ public:
 
 //
 // Light UBO           Froxel Record Buffer     per-froxel light list texture
-// {4 x float4}         R_U8  {index into        RG_U16 {offset, point-count, spot-count}
+// {4 x float4}         R_U8  {index into        RG_U16 {offset, count, offset-high}
 // (spot/point            light texture}
+// (R_U16 w/ large count)
 //
 //  +----+                     +-+                     +----+
 // 0|....| <------------+     0| |         +-----------|0230| (e.g. offset=02, 3-lights)
@@ -70,10 +71,11 @@ public:
 //  :    :                     | |                     |    |
 //  :    :                     +-+                     |    |
 //  :    :                  65536 max                  +----+
-//  |....|                                          h = num froxels
+//  |....|              (131072 w/ large count)     h = num froxels
 //  |....|
 //  +----+
-// 256 lights max
+// 256 lights max, the next ones (up to 4096) are stored in the froxel buffer with the large
+// light count
 //
 
 // Max number of froxels limited by:
@@ -86,6 +88,16 @@ public:
 // froxels are not used, so we can store more.
 static constexpr size_t FROXEL_BUFFER_ENTRY_COUNT_MAX = 8192;
 
+// With the large light count, there are more (smaller) froxels, and light records are assigned
+// per tile of froxels (see froxelizeTiles()). The froxel entries store the high bits of the
+// record offsets, which allows a larger record buffer.
+static constexpr size_t FROXEL_BUFFER_LARGE_ENTRY_COUNT_MAX = 16384;
+
+// With the large light count, the lights past the light UBO are stored in the froxel buffer,
+// after FROXEL_BUFFER_LARGE_ENTRY_COUNT_MAX entries. Each light takes 16 texels, which hold the
+// 32-bit words of its LightsUib split in two 16-bit halves, so there are 4 lights per row.
+static constexpr size_t FROXEL_BUFFER_LIGHTS_PER_ROW = 4;
+
 class Froxelizer {
 public:
     explicit Froxelizer(FEngine& engine);
@@ -99,12 +111,20 @@ public:
     // gpu buffer containing froxels. valid after construction.
     GPUBuffer const& getFroxelBuffer() const noexcept { return mFroxelBuffer; }
 
+    // Recreates the gpu buffers above if the large light count was toggled, returns true if they
+    // changed (i.e. their samplers need to be set again).
+    bool updateBuffers(backend::DriverApi& driverApi) noexcept;
+
     void setOptions(float zLightNear, float zLightFar) noexcept;
 
+    // Enables support for up to CONFIG_MAX_LARGE_LIGHT_COUNT lights, this changes the
+    // froxel layout.
+    void setLargeLightCountEnabled(bool enabled) noexcept;
+    bool isLargeLightCountEnabled() const noexcept { return mLargeLightCount; }
+
     /*
      * Allocate per-frame data structures for froxelization.
      *
-     * driverApi         used to allocate memory in the stream
      * arena             use to allocate per-frame memory
      * viewport          viewport used to calculate froxel dimensions
      * projection        camera projection matrix
@@ -113,7 +133,7 @@ public:
      *
      * return true if updateUniforms() needs to be called
      */
-    bool prepare(backend::DriverApi& driverApi, ArenaScope& arena, Viewport const& viewport,
+    bool prepare(ArenaScope& arena, Viewport const& viewport,
             const math::mat4f& projection, float projectionNear, float projectionFar) noexcept;
 
     Froxel getFroxelAt(size_t x, size_t y, size_t z) const noexcept;
@@ -122,7 +142,9 @@ public:
     size_t getFroxelCountZ() const noexcept { return mFroxelCountZ; }
     size_t getFroxelCount() const noexcept { return mFroxelCount; }
 
-    // update Records and Froxels texture with lights data. this is thread-safe.
+    // Update Records and Froxels texture with lights data. this is thread-safe.
+    // The previous froxelization is reused if the projection and the lights (in view space)
+    // didn't change, and only the lights that changed are froxelized again when possible.
     void froxelizeLights(FEngine& engine, CameraInfo const& camera,
             const FScene::LightSoa& lightData) noexcept;
 
@@ -134,9 +156,18 @@ public:
         u.setUniform(offsetof(PerViewUib, oneOverFroxelDimensionY), mOneOverDimension.y);
     }
 
-    // send froxel data to GPU
+    // send froxel data to GPU, unless the previous froxelization was reused
     void commit(backend::DriverApi& driverApi);
 
+    // Send the lights past the light UBO to the GPU (large light count only), the data must
+    // cover whole rows (see FROXEL_BUFFER_LIGHTS_PER_ROW) and is released by the callback.
+    void commitLights(backend::DriverApi& driverApi, LightsUib const* begin, LightsUib const* end,
+            backend::BufferDescriptor::Callback callback) noexcept;
+
+    // number of tiles whose froxels were left empty because the record buffer was full, in the
+    // last froxelization (large light count only)
+    size_t getDroppedTileCount() const noexcept { return mDroppedTileCount; }
+
 
     /*
      * Only for testing/debugging...
@@ -148,15 +179,24 @@ public:
             struct {
                 uint16_t offset;
                 uint8_t count;
-                uint8_t reserved;
+                uint8_t offsetHigh; // only used with the large light count
             };
         };
+        uint32_t getOffset() const noexcept { return offset | (uint32_t(offsetHigh) << 16u); }
     };
     // This depends on the maximum number of lights (currently 255),and can't be more than 16 bits.
     static_assert(CONFIG_MAX_LIGHT_INDEX <= std::numeric_limits<uint16_t>::max(), "can't have more than 65536 lights");
     using RecordBufferType = std::conditional_t<CONFIG_MAX_LIGHT_INDEX <= std::numeric_limits<uint8_t>::max(), uint8_t, uint16_t>;
+    // Same with the large light count (currently 4095).
+    static_assert(CONFIG_MAX_LARGE_LIGHT_INDEX <= std::numeric_limits<uint16_t>::max(), "can't have more than 65536 lights");
+    using LargeRecordBufferType = std::conditional_t<CONFIG_MAX_LARGE_LIGHT_INDEX <= std::numeric_limits<uint8_t>::max(), uint8_t, uint16_t>;
     const utils::Slice<FroxelEntry>& getFroxelBufferUser() const { return mFroxelBufferUser; }
     const utils::Slice<RecordBufferType>& getRecordBufferUser() const { return mRecordBufferUser; }
+    const utils::Slice<LargeRecordBufferType>& getLargeRecordBufferUser() const { return mLargeRecordBufferUser; }
+
+    // true if the last froxelizeLights() reused the previous froxelization, in which case the
+    // user buffers above are not updated
+    bool isFroxelDataReused() const noexcept { return mFroxelDataReused; }
 
     // this is chosen so froxelizePointAndSpotLight() vectorizes 4 froxel tests / spotlight
     // with 256 lights this implies 8 jobs (256 / 32) for froxelization.
@@ -190,20 +230,51 @@ private:
         uint16_t reserved;
     };
 
+    // range of froxels covered by a light, all the bounds are inclusive
+    struct FroxelRange {
+        uint16_t x0, x1;
+        uint16_t y0, y1;
+        uint16_t z0, z1;
+    };
+
+    // light records of a tile of froxels, with the large light count
+    struct TileData {
+        std::vector<uint16_t> lights;       // lights overlapping the tile
+        std::vector<uint32_t> records;      // {froxel in tile, light} pairs
+        uint32_t offset = 0;                // offset of the tile's records in the record buffer
+    };
+
     using FroxelThreadData = std::array<LightGroupType, FROXEL_BUFFER_ENTRY_COUNT_MAX>;
 
+    void createBuffers(backend::DriverApi& driverApi) noexcept;
     void setViewport(Viewport const& viewport) noexcept;
     void setProjection(const math::mat4f& projection, float near, float far) noexcept;
     bool update() noexcept;
 
-    void froxelizeLoop(FEngine& engine,
+    void computeLightParams(FEngine& engine,
             const CameraInfo& camera, const FScene::LightSoa& lightData) noexcept;
 
+    void allocateUserBuffers() noexcept;
+    void freeUserBuffers() noexcept;
+
+    void froxelizeLoop(FEngine& engine) noexcept;
+
+    void froxelizeChangedLights() noexcept;
+
     void froxelizeAssignRecordsCompress() noexcept;
 
+    void froxelizeTiles(FEngine& engine) noexcept;
+
     void froxelizePointAndSpotLight(FroxelThreadData& froxelThread, size_t bit,
             math::mat4f const& projection, const LightParams& light) const noexcept;
 
+    bool computeFroxelRange(FroxelRange* range,
+            math::mat4f const& projection, const LightParams& light) const noexcept;
+
+    template<typename Emitter>
+    void froxelizeRange(Emitter& emit, FroxelRange const& range,
+            math::mat4f const& projection, const LightParams& light) const noexcept;
+
     static void computeLightTree(LightTreeNode* lightTree,
             utils::Slice<RecordBufferType> const& lightList,
             const FScene::LightSoa& lightData, size_t lightRecordsOffset) noexcept;
@@ -218,7 +289,7 @@ private:
 
     static void computeFroxelLayout(
             math::uint2* dim, uint16_t* countX, uint16_t* countY, uint16_t* countZ,
-            Viewport const& viewport) noexcept;
+            Viewport const& viewport, size_t froxelCountMax) noexcept;
 
     // internal state dependant on the viewport and needed for froxelizing
     LinearAllocatorArena mArena;                    // ~256 KiB
@@ -228,13 +299,27 @@ private:
     math::float4* mPlanesY = nullptr;
     math::float4* mBoundingSpheres = nullptr;
 
+    // kept from frame to frame, to only froxelize the lights that changed
     utils::Slice<FroxelThreadData> mFroxelShardedData;  // 256 KiB w/  256 lights
-    utils::Slice<FroxelEntry> mFroxelBufferUser;        //  32 KiB w/ 8192 froxels
 
-    // max 32 KiB  (actual: resolution dependant)
-    utils::Slice<RecordBufferType> mRecordBufferUser;   //  64 KiB
+    // heap-allocated, only when the froxelization changed, and freed once uploaded
+    utils::Slice<FroxelEntry> mFroxelBufferUser;        //  32 KiB w/ 8192 froxels
+    utils::Slice<RecordBufferType> mRecordBufferUser;           //  64 KiB
+    utils::Slice<LargeRecordBufferType> mLargeRecordBufferUser; // 256 KiB w/ large count
     utils::Slice<LightRecord> mLightRecords;            // 256 KiB w/ 256 lights
 
+    // lights of the last froxelization, in view space, and the ones that changed since the
+    // previous one
+    std::vector<LightParams> mLightParams;
+    std::vector<uint16_t> mChangedLights;
+    std::vector<uint8_t> mLightChanged;     // per light, written concurrently
+
+    // with the large light count only, kept from frame to frame to avoid allocations
+    std::vector<FroxelRange> mLightRanges;
+    std::vector<TileData> mTiles;
+    uint16_t mTileCountX = 0;
+    uint16_t mTileCountY = 0;
+
     uint16_t mFroxelCountX = 0;
     uint16_t mFroxelCountY = 0;
     uint16_t mFroxelCountZ = 0;
@@ -257,6 +342,12 @@ private:
     float mNear = 0.0f;        // camera near
     float mZLightFar = FEngine::CONFIG_Z_LIGHT_FAR;
     float mZLightNear = FEngine::CONFIG_Z_LIGHT_NEAR;  // light near (first slice)
+    uint32_t mRecordCount = 0;      // number of records used in the last froxelization
+    uint32_t mDroppedTileCount = 0; // number of tiles left empty in the last froxelization
+    bool mLargeLightCount = false;
+    bool mLargeBuffers = false;     // the gpu buffers are sized for the large light count
+    bool mFroxelDataValid = false;  // the last froxelization can be reused (layout unchanged)
+    bool mFroxelDataReused = false; // the last froxelization was reused, nothing to upload
 
     // track if we need to update our internal state before froxelizing
     uint8_t mDirtyFlags = 0;
@@ -51,6 +51,16 @@ public:
         }
     }
 
+    // Upper bound of the command stream space used by use(), these are the commands it records.
+    // (COMMAND_TYPE() can't be used here, it needs the backend namespace)
+    static constexpr size_t USE_COMMANDS_SIZE =
+            backend::CommandBase::align(sizeof(backend::CommandType<
+                    decltype(&backend::Driver::bindUniformBuffer)>::Command<
+                            &backend::Driver::bindUniformBuffer>)) +
+            backend::CommandBase::align(sizeof(backend::CommandType<
+                    decltype(&backend::Driver::bindSamplers)>::Command<
+                            &backend::Driver::bindSamplers>));
+
     void use(FEngine::DriverApi& driver) const {
         if (mUbHandle) {
             driver.bindUniformBuffer(BindingPoints::PER_MATERIAL_INSTANCE, mUbHandle);
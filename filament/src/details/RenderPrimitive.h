@@ -54,14 +54,30 @@ public:
     AttributeBitset getEnabledAttributes() const noexcept { return mEnabledAttributes; }
     uint16_t getBlendOrder() const noexcept { return mBlendOrder; }
 
+    // the morph targets of this primitive and the weights of its renderable, these are owned
+    // by FRenderableManager
+    backend::Handle<backend::HwSamplerGroup> getMorphTargetsSgh() const noexcept {
+        return mMorphTargetsSgh;
+    }
+    backend::Handle<backend::HwUniformBuffer> getMorphWeightsUbh() const noexcept {
+        return mMorphWeightsUbh;
+    }
+
     void setMaterialInstance(FMaterialInstance const* mi) noexcept { mMaterialInstance = mi; }
     void setBlendOrder(uint16_t order) noexcept {
         mBlendOrder = static_cast<uint16_t>(order & 0x7FFF);
     }
+    void setMorphing(backend::Handle<backend::HwSamplerGroup> targets,
+            backend::Handle<backend::HwUniformBuffer> weights) noexcept {
+        mMorphTargetsSgh = targets;
+        mMorphWeightsUbh = weights;
+    }
 
 private:
     FMaterialInstance const* mMaterialInstance = nullptr;
     backend::Handle<backend::HwRenderPrimitive> mHandle;
+    backend::Handle<backend::HwSamplerGroup> mMorphTargetsSgh;
+    backend::Handle<backend::HwUniformBuffer> mMorphWeightsUbh;
     backend::PrimitiveType mPrimitiveType = backend::PrimitiveType::NONE;
     AttributeBitset mEnabledAttributes;
     uint16_t mBlendOrder = 0;
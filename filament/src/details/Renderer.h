@@ -170,6 +170,15 @@ private:
     using Epoch = clock::time_point;
     using duration = clock::duration;
 
+    size_t getRenderPassStatsCount() const noexcept {
+        return mFrameInfoManager.getLastFrameInfo().renderPassCount;
+    }
+
+    RenderPassStats getRenderPassStats(size_t index) const noexcept {
+        assert(index < getRenderPassStatsCount());
+        return mFrameInfoManager.getLastFrameInfo().renderPasses[index];
+    }
+
     Epoch getUserEpoch() const { return mUserEpoch; }
     duration getUserTime() const noexcept {
         return clock::now() - getUserEpoch();
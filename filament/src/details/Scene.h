@@ -23,12 +23,16 @@
 #include "components/TransformManager.h"
 
 #include "details/Culler.h"
+#include "details/CullingHierarchy.h"
 
+#include "AffineTransform.h"
 #include "Allocators.h"
 
 #include <filament/Box.h>
 #include <filament/Scene.h>
 
+#include <private/filament/UibGenerator.h>
+
 #include <utils/compiler.h>
 #include <utils/Entity.h>
 #include <utils/Slice.h>
@@ -36,13 +40,20 @@
 #include <utils/Range.h>
 
 #include <cstddef>
+#include <limits>
+#include <vector>
+
 #include <tsl/robin_set.h>
 
+// for gtest
+class FilamentTest_SceneCache_Test;
+
 namespace filament {
 
 struct CameraInfo;
 class FEngine;
 class FIndirectLight;
+class Froxelizer;
 class FRenderer;
 class FSkybox;
 
@@ -70,6 +81,19 @@ public:
     size_t getLightCount() const noexcept;
     bool hasEntity(utils::Entity entity) const noexcept;
 
+    void setCullingHierarchyEnabled(bool enabled) noexcept;
+    bool isCullingHierarchyEnabled() const noexcept { return mCullingHierarchyEnabled; }
+
+    void setUniformBufferCachingEnabled(bool enabled) noexcept;
+    bool isUniformBufferCachingEnabled() const noexcept { return mUniformBufferCachingEnabled; }
+
+    // UBO caching gives each renderable of the scene a slot, but a command can only address
+    // MAX_CACHED_UBO_SLOT_COUNT slots; larger scenes fall back to per-frame slots.
+    bool usesCachedUBOs() const noexcept {
+        return mUniformBufferCachingEnabled &&
+                mRenderableData.size() <= MAX_CACHED_UBO_SLOT_COUNT;
+    }
+
 public:
     /*
      * Filaments-scope Public API
@@ -84,7 +108,10 @@ public:
     void terminate(FEngine& engine);
 
     void prepare(const math::mat4f& worldOriginTransform);
-    void prepareDynamicLights(const CameraInfo& camera, ArenaScope& arena, backend::Handle<backend::HwUniformBuffer> lightUbh) noexcept;
+    // with the large light count, lights past the CONFIG_MAX_LIGHT_COUNT first ones go in the
+    // froxelizer's buffer
+    void prepareDynamicLights(const CameraInfo& camera, ArenaScope& arena,
+            backend::Handle<backend::HwUniformBuffer> lightUbh, Froxelizer& froxelizer) noexcept;
 
 
     filament::backend::Handle<backend::HwUniformBuffer> getRenderableUBO() const noexcept {
@@ -97,15 +124,23 @@ public:
 
     using VisibleMaskType = Culler::result_type;
 
+    // one bit per spot light shadow of the shadow atlas
+    using AtlasShadowMaskType = uint64_t;
+    static_assert(CONFIG_MAX_SHADOW_ATLAS_SPOTS <= sizeof(AtlasShadowMaskType) * 8,
+            "CONFIG_MAX_SHADOW_ATLAS_SPOTS doesn't fit in AtlasShadowMaskType");
+
     enum {
         RENDERABLE_INSTANCE,    //  4 | instance of the Renderable component
-        WORLD_TRANSFORM,        // 16 | instance of the Transform component
+        WORLD_TRANSFORM,        // 48 | world transform of the renderable, always affine
         REVERSED_WINDING_ORDER, //  1 | det(WORLD_TRANSFORM)<0
         VISIBILITY_STATE,       //  1 | visibility data of the component
-        BONES_UBH,              //  4 | bones uniform buffer handle
+        BONES_OFFSET,           //  4 | offset of the bones in the bone pool
         WORLD_AABB_CENTER,      // 12 | world-space bounding box center of the renderable
         VISIBLE_MASK,           //  1 | each bit represents a visibility in a pass
         MORPH_WEIGHTS,          //  4 | floats for morphing
+        UBO_SLOT,               //  4 | index of the renderable's PerRenderableUib in the UBO
+        INSTANCE_COUNT,         //  1 | number of instances to draw, 1 unless instanced
+        ATLAS_SHADOW_MASK,      //  8 | each bit represents a visibility in a shadow atlas pass
 
         // These are not needed anymore after culling
         LAYERS,                 //  1 | layers
@@ -118,13 +153,16 @@ public:
 
     using RenderableSoa = utils::StructureOfArrays<
             utils::EntityInstance<RenderableManager>,   // RENDERABLE_INSTANCE
-            math::mat4f,                                // WORLD_TRANSFORM
+            AffineTransform,                            // WORLD_TRANSFORM
             bool,                                       // REVERSED_WINDING_ORDER
             FRenderableManager::Visibility,             // VISIBILITY_STATE
-            backend::Handle<backend::HwUniformBuffer>,  // BONES_UBH
+            uint32_t,                                   // BONES_OFFSET
             math::float3,                               // WORLD_AABB_CENTER
             VisibleMaskType,                            // VISIBLE_MASK
             math::float4,                               // MORPH_WEIGHTS
+            uint32_t,                                   // UBO_SLOT
+            uint8_t,                                    // INSTANCE_COUNT
+            AtlasShadowMaskType,                        // ATLAS_SHADOW_MASK
             uint8_t,                                    // LAYERS
             math::float3,                               // WORLD_AABB_EXTENT
             utils::Slice<FRenderPrimitive>,             // PRIMITIVES
@@ -134,6 +172,13 @@ public:
     RenderableSoa const& getRenderableData() const noexcept { return mRenderableData; }
     RenderableSoa& getRenderableData() noexcept { return mRenderableData; }
 
+    // The culling hierarchy indexes mRenderableData as it is after prepare(), it is only valid
+    // until mRenderableData is reordered (i.e. until the View partitions it after culling).
+    // Returns nullptr if the culling hierarchy is disabled.
+    CullingHierarchy const* getCullingHierarchy() const noexcept {
+        return mCullingHierarchyEnabled ? &mCullingHierarchy : nullptr;
+    }
+
     static inline uint32_t getPrimitiveCount(RenderableSoa const& soa,
             uint32_t first, uint32_t last) noexcept {
         // the caller must guarantee that last is dereferenceable
@@ -159,19 +204,22 @@ public:
         uint8_t index = 0;              // an index into the arrays in the Shadows uniform buffer
         uint8_t layer = 0;              // which layer of the shadow texture array to sample from
 
+        // Indices past CONFIG_MAX_SHADOW_CASTING_SPOTS are the shadows of the shadow atlas.
+        static constexpr size_t ATLAS_INDEX_OFFSET = CONFIG_MAX_SHADOW_CASTING_SPOTS;
+
         //  -- LSB -------------
         //  castsShadows     : 1
         //  contactShadows   : 1
-        //  index            : 4
+        //  index            : 7
         //  layer            : 4
         //  -- MSB -------------
         uint32_t pack() const {
-            assert(index < 16);
+            assert(index < 128);
             assert(layer < 16);
             return uint8_t(castsShadows)   << 0u    |
                    uint8_t(contactShadows) << 1u    |
                    index                   << 2u    |
-                   layer                   << 6u;
+                   layer                   << 9u;
         }
     };
 
@@ -196,11 +244,36 @@ public:
     LightSoa const& getLightData() const noexcept { return mLightData; }
     LightSoa& getLightData() noexcept { return mLightData; }
 
-    void updateUBOs(utils::Range<uint32_t> visibleRenderables, backend::Handle<backend::HwUniformBuffer> renderableUbh) noexcept;
+    // Writes the PerRenderableUib of the visible renderables into renderableUbh, and sets their
+    // UBO_SLOT. 'created' must be true if renderableUbh was created since the last call.
+    void updateUBOs(utils::Range<uint32_t> visibleRenderables,
+            backend::Handle<backend::HwUniformBuffer> renderableUbh, bool created) noexcept;
 
     bool hasContactShadows() const noexcept;
 
 private:
+    void updateCache(const math::mat4f& worldOriginTransform);
+    void rebuildCache(const math::mat4f& worldOriginTransform);
+    bool refreshCache(const math::mat4f& worldOriginTransform) noexcept;
+    void updateCachedUBOs(utils::Range<uint32_t> visibleRenderables,
+            backend::Handle<backend::HwUniformBuffer> renderableUbh, bool created) noexcept;
+    void gatherRenderables(size_t first, size_t last,
+            const math::mat4f& worldOriginTransform) noexcept;
+
+    // renderables are gathered in jobs of this many entities
+    static constexpr size_t GATHER_JOB_SIZE = 512;
+
+    // dirty UBO slots separated by at most this many clean slots are uploaded together
+    static constexpr size_t UBO_SLOT_MAX_GAP = 4;
+
+    // RenderPass::PrimitiveInfo::index is 16 bits
+    static constexpr size_t MAX_CACHED_UBO_SLOT_COUNT = std::numeric_limits<uint16_t>::max() + 1;
+
+    friend class ::FilamentTest_SceneCache_Test;
+
+    static inline void computeWorldAABBs(math::float3* centers, math::float3* extents,
+            bool* reversedWindingOrder, const AffineTransform* transforms, size_t count) noexcept;
+
     static inline void computeLightRanges(math::float2* zrange,
             CameraInfo const& camera, const math::float4* spheres, size_t count) noexcept;
 
@@ -218,6 +291,34 @@ private:
      */
     tsl::robin_set<utils::Entity> mEntities;
 
+    /*
+     * Persistent copy of the data prepare() gathers from the component managers, in the order
+     * of mEntities. Only the renderables whose transform or renderable component changed since
+     * the last prepare() are gathered again, the cache is rebuilt from scratch only when the
+     * list of entities or the layout of one of the managers changes.
+     */
+    struct RenderableSource {
+        utils::Entity entity;
+        FTransformManager::Instance ti;
+        uint32_t transformVersion;
+        uint32_t renderableVersion;
+    };
+
+    struct LightSource {
+        utils::Entity entity;
+        FLightManager::Instance li;
+        FTransformManager::Instance ti;
+    };
+
+    RenderableSoa mRenderableCache;
+    std::vector<RenderableSource> mRenderableSources;
+    std::vector<LightSource> mLightSources;
+    math::mat4f mCacheWorldOriginTransform;
+    uint32_t mCacheTransformLayoutVersion = 0;
+    uint32_t mCacheRenderableLayoutVersion = 0;
+    uint32_t mCacheLightLayoutVersion = 0;
+    bool mCacheValid = false;
+
 
     /*
      * The data below is valid only during a view pass. i.e. if a scene is used in multiple
@@ -229,6 +330,24 @@ private:
     LightSoa mLightData;
     backend::Handle<backend::HwUniformBuffer> mRenderableViewUbh; // This is actually owned by the view.
     bool mHasContactShadows = false;
+
+    /*
+     * Optional bounding volume hierarchy over mRenderableData's world-space AABBs, it's
+     * persistent across frames and only refitted when renderables move.
+     */
+    CullingHierarchy mCullingHierarchy;
+    bool mCullingHierarchyEnabled = false;
+
+    /*
+     * With UBO caching, each renderable of mRenderableCache owns the UBO slot matching its index
+     * in the cache, and only the slots whose content changed are uploaded. mUboShadow mirrors
+     * the content of mUboCacheUbh.
+     */
+    std::vector<PerRenderableUib> mUboShadow;
+    std::vector<bool> mUboSlotWritten;
+    std::vector<uint32_t> mDirtyUboSlots;
+    backend::Handle<backend::HwUniformBuffer> mUboCacheUbh;
+    bool mUniformBufferCachingEnabled = false;
 };
 
 FILAMENT_UPCAST(Scene)
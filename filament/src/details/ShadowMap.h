@@ -30,6 +30,11 @@
 #include <math/mat4.h>
 #include <math/vec4.h>
 
+#include <vector>
+
+// for gtest
+class FilamentTest_ShadowMapCache_Test;
+
 namespace filament {
 
 class FView;
@@ -55,6 +60,9 @@ public:
         // the dimension of the actual shadow map, taking into account the 1 texel border
         // e.g., for a texture dimension of 512, shadowDimension would be 510
         size_t shadowDimension = 0;
+
+        // the position of the shadow map texture within the atlas, in texels
+        math::uint2 offset = {};
     };
 
     struct CascadeParameters {
@@ -88,8 +96,29 @@ public:
             filament::CameraInfo const& camera, uint8_t visibleLayers,
             ShadowMapLayout layout, const CascadeParameters& cascadeParams) noexcept;
 
-    void render(backend::DriverApi& driver, utils::Range<uint32_t> const& range, RenderPass& pass,
-            FView& view) noexcept;
+    // Picks the level of detail of the shadow casters in 'casters' for this shadow map's camera.
+    // When atlasIndex isn't negative, the visibility of the casters is taken from that bit of
+    // their ATLAS_SHADOW_MASK instead of their VISIBLE_MASK.
+    // This only writes to this shadow map, so shadow maps can be prepared concurrently.
+    // Valid after calling update().
+    void prepareGeometry(FScene::RenderableSoa const& soa, utils::Range<uint32_t> casters,
+            int atlasIndex) noexcept;
+
+    // Generates and sorts the shadow map's commands in 'pass', which must have a command buffer
+    // of its own with room for getPrimitiveCount() + 1 commands. This can run concurrently for
+    // different shadow maps. Valid after calling prepareGeometry().
+    void render(FScene const& scene, RenderPass& pass) noexcept;
+
+    // The geometry picked by prepareGeometry(), indexed like the SoA.
+    utils::Range<uint32_t> getCasters() const noexcept { return mCasters; }
+    size_t getPrimitiveCount() const noexcept { return mPrimitiveCount; }
+    utils::Slice<FRenderPrimitive> const* getPrimitives() const noexcept {
+        return mPrimitives.data();
+    }
+    // returns nullptr when the visibility is given by VISIBLE_MASK
+    FScene::VisibleMaskType const* getVisibleMasks() const noexcept {
+        return mAtlasVisibility ? mVisibleMasks.data() : nullptr;
+    }
 
     // Do we have visible shadows. Valid after calling update().
     bool hasVisibleShadows() const noexcept { return mHasVisibleShadows; }
@@ -229,6 +258,8 @@ private:
             { 2, 6, 7, 3 },  // top
     };
 
+    friend class ::FilamentTest_ShadowMapCache_Test;
+
     FCamera* mCamera = nullptr;
     FCamera* mDebugCamera = nullptr;
     math::mat4f mLightSpace;
@@ -240,6 +271,17 @@ private:
     bool mHasVisibleShadows = false;
     backend::PolygonOffset mPolygonOffset{};
 
+    // level of detail picked last frame by this shadow map, see FView::updatePrimitivesLod()
+    std::vector<uint8_t> mLodHistory;
+
+    // set-up in prepareGeometry()
+    utils::Range<uint32_t> mCasters{};
+    size_t mPrimitiveCount = 0;
+    bool mAtlasVisibility = false;
+    std::vector<utils::Slice<FRenderPrimitive>> mPrimitives;
+    std::vector<uint32_t> mSummedPrimitiveCounts;
+    std::vector<FScene::VisibleMaskType> mVisibleMasks;
+
     // use a member here (instead of stack) because we don't want to pay the
     // initialization of the float3 each time
     FrustumBoxIntersection mWsClippedShadowReceiverVolume;
@@ -17,6 +17,7 @@
 #ifndef TNT_FILAMENT_DETAILS_SHADOWMAPMANAGER_H
 #define TNT_FILAMENT_DETAILS_SHADOWMAPMANAGER_H
 
+#include <filament/Frustum.h>
 #include <filament/Viewport.h>
 
 #include <private/backend/DriverApi.h>
@@ -32,14 +33,25 @@
 #include "fg/FrameGraph.h"
 #include "fg/FrameGraphPassResources.h"
 
+#include "AffineTransform.h"
+#include "ShadowAtlasAllocator.h"
+
+#include <math/mat4.h>
+#include <math/vec2.h>
 #include <math/vec3.h>
 
+#include <utils/Range.h>
+
 #include <array>
 #include <memory>
 #include <vector>
 
+// for gtest
+class FilamentTest_ShadowMapCache_Test;
+
 namespace filament {
 
+class FRenderPrimitive;
 class FView;
 
 class ShadowMap;
@@ -58,12 +70,18 @@ public:
     explicit ShadowMapManager(FEngine& engine);
     ~ShadowMapManager();
 
+    // frees the cached shadow texture
+    void terminate(FEngine& engine) noexcept;
+
     // Reset shadow map layout.
     void reset() noexcept;
 
     void setShadowCascades(size_t lightIndex, size_t cascades) noexcept;
     void addSpotShadowMap(size_t lightIndex) noexcept;
 
+    // adds a spot light shadow to the shadow atlas (see View::setShadowAtlasEnabled())
+    void addAtlasShadowMap(FEngine& engine, size_t lightIndex) noexcept;
+
     // Updates all of the shadow maps and performs culling.
     // Returns true if any of the shadow maps have visible shadows.
     ShadowTechnique update(FEngine& engine, FView& view, UniformBuffer& perViewUb, UniformBuffer& shadowUb,
@@ -77,16 +95,27 @@ public:
     void prepareShadow(backend::Handle<backend::HwTexture> texture, FView const& view)
         const noexcept;
 
+    // Appends to 'out' the frusta of the shadow maps a renderable with the given VISIBLE_MASK and
+    // ATLAS_SHADOW_MASK is visible in, i.e. its shadow passes. Valid after update().
+    void getShadowCasterFrusta(FScene::VisibleMaskType visibleMask,
+            FScene::AtlasShadowMaskType atlasMask, std::vector<Frustum>& out) const noexcept;
+
     const ShadowMap* getCascadeShadowMap(size_t c) const noexcept {
         return mCascadeShadowMapCache[c].get();
     }
 
 private:
+    static constexpr size_t MAX_SHADOW_LAYERS = CONFIG_MAX_SHADOW_CASCADES +
+            CONFIG_MAX_SHADOW_CASTING_SPOTS + CONFIG_MAX_SHADOW_ATLAS_LAYERS;
+
+    // number of frames the extra layers of the atlas stay empty before they're removed
+    static constexpr uint32_t ATLAS_EMPTY_LAYERS_FRAME_COUNT = 60;
 
     struct ShadowLayout {
         uint8_t layer = 0;
-        uint32_t size = 0;
+        uint32_t size = 0;              // zero if the shadow map didn't get a tile in the atlas
         uint8_t vsmSamples = 1;
+        math::uint2 offset = {};        // position in the layer, for the shadow atlas
     };
 
     struct TextureRequirements {
@@ -95,15 +124,34 @@ private:
         uint8_t levels = 0;
     } mTextureRequirements;
 
+    // these update the shadow maps and their uniforms, and add their culling requests
     ShadowTechnique updateCascadeShadowMaps(FEngine& engine, FView& view, UniformBuffer& perViewUb,
-            FScene::RenderableSoa& renderableData, FScene::LightSoa& lightData) noexcept;
+            FScene::LightSoa& lightData) noexcept;
     ShadowTechnique updateSpotShadowMaps(FEngine& engine, FView& view, UniformBuffer& shadowUb,
-            FScene::RenderableSoa& renderableData, FScene::LightSoa& lightData) noexcept;
+            FScene::LightSoa& lightData) noexcept;
+    ShadowTechnique updateAtlasShadowMaps(FEngine& engine, FView& view, UniformBuffer& shadowUb,
+            FScene::LightSoa& lightData) noexcept;
     static void fillWithDebugPattern(backend::DriverApi& driverApi,
             backend::Handle<backend::HwTexture> texture, size_t dimensions) noexcept;
 
     void calculateTextureRequirements(FEngine& engine, FView& view, FScene::LightSoa& lightData) noexcept;
 
+    // allocates the tiles of the atlas shadow maps, in layers starting at firstLayer
+    void calculateAtlasLayout(FEngine& engine, FView const& view, FScene::LightSoa& lightData,
+            uint16_t dimension, uint8_t firstLayer) noexcept;
+
+    // The shadow casters of the shadow maps are culled concurrently, each shadow map into its
+    // own row of mCullingResults, the rows are then gathered in VISIBLE_MASK and
+    // ATLAS_SHADOW_MASK.
+    struct CullingRequest {
+        Frustum frustum;
+        uint8_t bit = 0;            // VISIBLE_MASK bit of the shadow map
+        int8_t atlasIndex = -1;     // ATLAS_SHADOW_MASK bit of the shadow map, if any
+    };
+
+    void cullShadowCasters(FEngine& engine, FView const& view,
+            FScene::RenderableSoa& renderableData) noexcept;
+
     class ShadowMapEntry {
     public:
         ShadowMapEntry() = default;
@@ -118,17 +166,30 @@ private:
         size_t getLightIndex() const { return mLightIndex; }
         const ShadowLayout& getLayout() const { return mLayout; }
         bool hasVisibleShadows() const { return mHasVisibleShadows; }
+        uint8_t getAtlasSlot() const { return mAtlasSlot; }
 
         void setHasVisibleShadows(bool hasVisibleShadows) { mHasVisibleShadows = hasVisibleShadows; }
         void setLayout(const ShadowLayout& layout) { mLayout = layout; }
+        void setAtlasSlot(uint8_t slot) { mAtlasSlot = slot; }
 
     private:
         ShadowMap* mShadowMap = nullptr;
         size_t mLightIndex = 0;
         ShadowLayout mLayout = {};
         bool mHasVisibleShadows = false;
+        uint8_t mAtlasSlot = 0;     // see ShadowAtlasAllocator::Request::slot
     };
 
+    struct ShadowMapState;
+
+    friend class ::FilamentTest_ShadowMapCache_Test;
+
+    // Returns true if the cached shadow texture already holds this shadow map, and records the
+    // state of the shadow map otherwise, so it can be reused in the next frame.
+    // Valid after ShadowMap::prepareGeometry().
+    bool isShadowMapCached(FEngine& engine, FView const& view, ShadowMapEntry const& entry,
+            ShadowMapState& state, uint8_t visibilityMask) noexcept;
+
     class CascadeSplits {
     public:
         constexpr static size_t SPLIT_COUNT = CONFIG_MAX_SHADOW_CASCADES + 1;
@@ -176,10 +237,52 @@ private:
 
     std::vector<ShadowMapEntry> mCascadeShadowMaps;
     std::vector<ShadowMapEntry> mSpotShadowMaps;
+    std::vector<ShadowMapEntry> mAtlasShadowMaps;
     backend::RenderPassParams mRenderPassParams;
 
     std::array<std::unique_ptr<ShadowMap>, CONFIG_MAX_SHADOW_CASCADES> mCascadeShadowMapCache;
     std::array<std::unique_ptr<ShadowMap>, CONFIG_MAX_SHADOW_CASTING_SPOTS> mSpotShadowMapCache;
+    std::vector<std::unique_ptr<ShadowMap>> mAtlasShadowMapCache;   // grows as needed
+
+    // The atlas shadow maps are tiles of the last layers of the shadow texture. The layers that
+    // aren't needed anymore are only removed after being empty for ATLAS_EMPTY_LAYERS_FRAME_COUNT
+    // frames, so that the texture isn't reallocated each time a light comes and goes.
+    ShadowAtlasAllocator mAtlasAllocator;
+    uint8_t mAtlasLayerCount = 0;
+    uint32_t mAtlasEmptyLayersFrameCount = 0;
+
+    // With shadow map caching (see View::setShadowMapCachingEnabled()), the shadow texture
+    // persists from frame to frame, and a layer is only rendered again when the state it was
+    // rendered with changes.
+    struct ShadowCaster {
+        AffineTransform transform;
+        FRenderPrimitive const* primitives = nullptr;   // changes with the level of detail
+        uint32_t renderable = 0;                        // RenderableManager instance
+        uint32_t version = 0;                           // see FRenderableManager::getVersion()
+
+        bool operator==(ShadowCaster const& rhs) const noexcept {
+            return transform == rhs.transform && primitives == rhs.primitives &&
+                   renderable == rhs.renderable && version == rhs.version;
+        }
+    };
+
+    struct ShadowMapState {
+        math::mat4f projection;
+        math::mat4f model;
+        backend::PolygonOffset polygonOffset;
+        ShadowLayout layout;
+        std::vector<ShadowCaster> casters;
+        bool valid = false;
+    };
+
+    std::array<ShadowMapState, MAX_SHADOW_LAYERS> mShadowMapStates;
+    std::array<ShadowMapState, CONFIG_MAX_SHADOW_ATLAS_SPOTS> mAtlasShadowMapStates; // per slot
+    std::vector<ShadowCaster> mShadowCasters;   // scratch, to avoid allocations
+
+    std::vector<CullingRequest> mCullingRequests;
+    std::vector<FScene::VisibleMaskType> mCullingResults;
+    FrameGraphTexture mCachedShadows;
+    FrameGraphTexture::Descriptor mCachedShadowsDesc;
 };
 
 } // namespace filament
@@ -45,6 +45,14 @@ public:
 
     size_t getVertexCount() const noexcept;
 
+    uint8_t getBufferCount() const noexcept { return mBufferCount; }
+
+    // size in bytes of the buffer at bufferIndex, as needed by the attributes it holds
+    size_t getBufferSize(uint8_t bufferIndex) const noexcept;
+
+    // a builder of VertexBuffers with the same layout as this one
+    VertexBuffer::Builder getLayout() const noexcept;
+
     AttributeBitset getDeclaredAttributes() const noexcept {
         return mDeclaredAttributes;
     }
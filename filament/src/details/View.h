@@ -48,6 +48,8 @@
 
 #include <math/scalar.h>
 
+#include <vector>
+
 namespace utils {
 class JobSystem;
 } // namespace utils;
@@ -78,6 +80,10 @@ class FScene;
 // VISIBLE_SPOT_SHADOW_RENDERABLE_0             X
 // VISIBLE_SPOT_SHADOW_RENDERABLE_1           X
 // ...
+// VISIBLE_ATLAS_SHADOW_RENDERABLE      X
+//
+// VISIBLE_ATLAS_SHADOW_RENDERABLE is set if the renderable is visible in any of the spot light
+// shadows of the shadow atlas, the visibility in each of them is stored in ATLAS_SHADOW_MASK.
 
 // A "shadow renderable" is a renderable rendered to the shadow map during a shadow pass:
 // PCF shadows: only shadow casters
@@ -86,21 +92,24 @@ class FScene;
 static constexpr size_t VISIBLE_RENDERABLE_BIT = 0u;
 static constexpr size_t VISIBLE_DIR_SHADOW_RENDERABLE_BIT = 1u;
 static constexpr size_t VISIBLE_SPOT_SHADOW_RENDERABLE_N_BIT(size_t n) { return n + 2; }
+static constexpr size_t VISIBLE_ATLAS_SHADOW_RENDERABLE_BIT = 7u;
 
 static constexpr uint8_t VISIBLE_RENDERABLE = 1u << VISIBLE_RENDERABLE_BIT;
 static constexpr uint8_t VISIBLE_DIR_SHADOW_RENDERABLE = 1u << VISIBLE_DIR_SHADOW_RENDERABLE_BIT;
 static constexpr uint8_t VISIBLE_SPOT_SHADOW_RENDERABLE_N(size_t n) {
     return 1u << VISIBLE_SPOT_SHADOW_RENDERABLE_N_BIT(n);
 }
+static constexpr uint8_t VISIBLE_ATLAS_SHADOW_RENDERABLE = 1u << VISIBLE_ATLAS_SHADOW_RENDERABLE_BIT;
 
 // ORing of all the VISIBLE_SPOT_SHADOW_RENDERABLE bits
 static constexpr uint8_t VISIBLE_SPOT_SHADOW_RENDERABLE =
         (0xFFu >> (sizeof(uint8_t) * 8u - CONFIG_MAX_SHADOW_CASTING_SPOTS)) << 2u;
 
-// Because we're using a uint8_t for the visibility mask, we're limited to 6 spot light shadows.
-// (2 of the bits are used for visible renderables + directional light shadow casters).
-static_assert(CONFIG_MAX_SHADOW_CASTING_SPOTS <= 6,
-        "CONFIG_MAX_SHADOW_CASTING_SPOTS cannot be higher than 6.");
+// Because we're using a uint8_t for the visibility mask, we're limited to 5 spot light shadows.
+// (3 of the bits are used for visible renderables + directional light shadow casters + shadow
+// atlas).
+static_assert(CONFIG_MAX_SHADOW_CASTING_SPOTS <= 5,
+        "CONFIG_MAX_SHADOW_CASTING_SPOTS cannot be higher than 5.");
 
 // ------------------------------------------------------------------------------------------------
 
@@ -182,10 +191,22 @@ public:
     void renderShadowMaps(FrameGraph& fg, FEngine& engine, FEngine::DriverApi& driver,
             RenderPass& pass) noexcept;
 
+    // Picks the level of detail of each renderable in the range for the given camera, and sets
+    // its PRIMITIVES accordingly, using the view's own level of detail history.
     void updatePrimitivesLod(
             FEngine& engine, const CameraInfo& camera,
             FScene::RenderableSoa& renderableData, Range visible) noexcept;
 
+    // Same as above, but the primitives are stored in 'primitives' (indexed like the SoA) and
+    // lodHistory holds the levels picked by the previous frame for the same pass. This only
+    // writes to 'primitives' and lodHistory, so it can run concurrently for different passes.
+    // Returns the number of primitives of the range.
+    static size_t updatePrimitivesLod(
+            FEngine& engine, const CameraInfo& camera,
+            FScene::RenderableSoa const& renderableData, Range visible,
+            std::vector<uint8_t>& lodHistory,
+            utils::Slice<FRenderPrimitive>* primitives) noexcept;
+
     void setShadowingEnabled(bool enabled) noexcept { mShadowingEnabled = enabled; }
 
     bool isShadowingEnabled() const noexcept { return mShadowingEnabled; }
@@ -278,6 +299,14 @@ public:
 
     void setDynamicLightingOptions(float zLightNear, float zLightFar) noexcept;
 
+    void setLargeLightCountEnabled(bool enabled) noexcept {
+        mFroxelizer.setLargeLightCountEnabled(enabled);
+    }
+
+    bool isLargeLightCountEnabled() const noexcept {
+        return mFroxelizer.isLargeLightCountEnabled();
+    }
+
     void setPostProcessingEnabled(bool enabled) noexcept {
         mHasPostProcessPass = enabled;
     }
@@ -327,6 +356,22 @@ public:
         return mVsmShadowOptions;
     }
 
+    void setShadowMapCachingEnabled(bool enabled) noexcept {
+        mShadowMapCaching = enabled;
+    }
+
+    bool isShadowMapCachingEnabled() const noexcept {
+        return mShadowMapCaching;
+    }
+
+    void setShadowAtlasEnabled(bool enabled) noexcept {
+        mShadowAtlas = enabled;
+    }
+
+    bool isShadowAtlasEnabled() const noexcept {
+        return mShadowAtlas;
+    }
+
     AmbientOcclusionOptions const& getAmbientOcclusionOptions() const noexcept {
         return mAmbientOcclusionOptions;
     }
@@ -407,8 +452,16 @@ public:
         return mRenderTarget == nullptr ? kEmptyHandle : mRenderTarget->getHwHandle();
     }
 
+    // When a culling hierarchy is provided, it must have been built for renderableData.
     static void cullRenderables(utils::JobSystem& js, FScene::RenderableSoa& renderableData,
-            Frustum const& frustum, size_t bit) noexcept;
+            Frustum const& frustum, size_t bit,
+            CullingHierarchy const* hierarchy = nullptr) noexcept;
+
+    // Same as above, but the results are accumulated in visibleArray instead of VISIBLE_MASK.
+    // visibleArray must have room for renderableData.size() rounded up to Culler::MODULO.
+    static void cullRenderables(utils::JobSystem& js,
+            FScene::RenderableSoa const& renderableData, Frustum const& frustum, size_t bit,
+            CullingHierarchy const* hierarchy, FScene::VisibleMaskType* visibleArray) noexcept;
 
     UniformBuffer& getViewUniforms() const { return mPerViewUb; }
     backend::SamplerGroup& getViewSamplers() const { return mPerViewSb; }
@@ -425,13 +478,17 @@ public:
     void commitFrameHistory(FEngine& engine) noexcept;
 
 private:
-    void prepareVisibleRenderables(utils::JobSystem& js,
-            Frustum const& frustum, FScene::RenderableSoa& renderableData) const noexcept;
+    void prepareVisibleRenderables(utils::JobSystem& js, Frustum const& frustum,
+            FScene::RenderableSoa& renderableData,
+            CullingHierarchy const* hierarchy) const noexcept;
 
     static void prepareVisibleLights(
             FLightManager const& lcm, utils::JobSystem& js, Frustum const& frustum,
             FScene::LightSoa& lightData) noexcept;
 
+    void prepareVisibleInstances(FEngine& engine,
+            FScene::RenderableSoa& renderableData, Range range) const noexcept;
+
     static void computeVisibilityMasks(
             uint8_t visibleLayers, uint8_t const* layers,
             FRenderableManager::Visibility const* visibility, uint8_t* visibleMask,
@@ -488,6 +545,8 @@ private:
     AmbientOcclusionOptions mAmbientOcclusionOptions{};
     ShadowType mShadowType = ShadowType::PCF;
     VsmShadowOptions mVsmShadowOptions = {};
+    bool mShadowMapCaching = false;
+    bool mShadowAtlas = false;
     BloomOptions mBloomOptions;
     FogOptions mFogOptions;
     DepthOfFieldOptions mDepthOfFieldOptions;
@@ -510,6 +569,9 @@ private:
 
     mutable FrameHistory mFrameHistory{};
 
+    // level of detail picked last frame by the color pass, indexed by renderable instance
+    std::vector<uint8_t> mLodHistory;
+
     utils::CString mName;
 
     // the following values are set by prepare()
@@ -517,6 +579,7 @@ private:
     Range mVisibleDirectionalShadowCasters;
     Range mSpotLightShadowCasters;
     uint32_t mRenderableUBOSize = 0;
+    backend::BufferUsage mRenderableUBOUsage = backend::BufferUsage::STREAM;
     mutable bool mHasDirectionalLight = false;
     mutable bool mHasDynamicLighting = false;
     mutable bool mHasShadowing = false;
@@ -16,6 +16,7 @@
 
 #include <iostream>
 #include <random>
+#include <vector>
 
 #include <gtest/gtest.h>
 
@@ -36,13 +37,30 @@
 #include <private/filament/UibGenerator.h>
 #include <private/backend/BackendUtils.h>
 
+#include <utils/EntityManager.h>
+#include <utils/JobSystem.h>
+
 #include "details/Allocators.h"
 #include "details/Material.h"
 #include "details/Camera.h"
+#include "details/Culler.h"
+#include "details/CullingHierarchy.h"
 #include "details/Froxelizer.h"
 #include "details/Engine.h"
+#include "details/RenderPrimitive.h"
+#include "details/Scene.h"
+#include "details/IndexBuffer.h"
+#include "details/ShadowMap.h"
+#include "details/ShadowMapManager.h"
+#include "details/VertexBuffer.h"
+#include "details/View.h"
 #include "components/RenderableManager.h"
 #include "components/TransformManager.h"
+#include "AffineTransform.h"
+#include "BonePool.h"
+#include "RenderPass.h"
+#include "ShadowAtlasAllocator.h"
+#include "SimdKernel.h"
 #include "UniformBuffer.h"
 
 using namespace filament;
@@ -179,6 +197,32 @@ TEST(FilamentTest, SkinningMath) {
     }
 }
 
+TEST(FilamentTest, AffineTransform) {
+    std::default_random_engine generator(82828); // NOLINT
+    std::uniform_real_distribution<float> rand(-10.0f, 10.0f);
+    auto randomTransform = [&]() {
+        return mat4f::translation(float3{ rand(generator), rand(generator), rand(generator) }) *
+               mat4f::rotation(rand(generator), normalize(float3{ 1, rand(generator), 1 })) *
+               mat4f::scaling(float3{ rand(generator), rand(generator), rand(generator) });
+    };
+
+    for (size_t i = 0; i < 100; i++) {
+        const mat4f a = randomTransform();
+        const mat4f b = randomTransform();
+        EXPECT_TRUE(AffineTransform::isAffine(a));
+        EXPECT_EQ(AffineTransform(a).asMat4(), a);
+        EXPECT_EQ((AffineTransform(a) * AffineTransform(b)).asMat4(), a * b);
+        EXPECT_EQ(AffineTransform::multiply(a, b), a * b);
+    }
+
+    // non-affine matrices use the general product
+    const mat4f p = mat4f::perspective(90.0f, 1.0f, 0.1f, 100.0f);
+    const mat4f m = randomTransform();
+    EXPECT_FALSE(AffineTransform::isAffine(p));
+    EXPECT_EQ(AffineTransform::multiply(p, m), p * m);
+    EXPECT_EQ(AffineTransform::multiply(m, p), m * p);
+}
+
 TEST(FilamentTest, TransformManager) {
     filament::FTransformManager tcm;
     EntityManager& em = EntityManager::get();
@@ -277,6 +321,134 @@ TEST(FilamentTest, TransformManager) {
     EXPECT_EQ(c, tcm.getChildCount(newParent));
 }
 
+TEST(FilamentTest, TransformManagerVersions) {
+    filament::FTransformManager tcm;
+    EntityManager& em = EntityManager::get();
+    std::array<Entity, 3> entities;
+    em.create(entities.size(), entities.data());
+
+    const uint32_t layoutVersion = tcm.getLayoutVersion();
+    tcm.create(entities[0]);
+    tcm.create(entities[1], tcm.getInstance(entities[0]), mat4f{});
+    tcm.create(entities[2]);
+    EXPECT_NE(layoutVersion, tcm.getLayoutVersion());
+
+    TransformManager::Instance parent = tcm.getInstance(entities[0]);
+    TransformManager::Instance child = tcm.getInstance(entities[1]);
+    TransformManager::Instance other = tcm.getInstance(entities[2]);
+
+    // changing a transform changes the version of its descendants, and only theirs
+    uint32_t parentVersion = tcm.getWorldTransformVersion(parent);
+    uint32_t childVersion = tcm.getWorldTransformVersion(child);
+    uint32_t otherVersion = tcm.getWorldTransformVersion(other);
+    tcm.setTransform(parent, mat4f{ float4{ 2 }});
+    EXPECT_NE(parentVersion, tcm.getWorldTransformVersion(parent));
+    EXPECT_NE(childVersion, tcm.getWorldTransformVersion(child));
+    EXPECT_EQ(otherVersion, tcm.getWorldTransformVersion(other));
+
+    // same thing with a transaction
+    parentVersion = tcm.getWorldTransformVersion(parent);
+    childVersion = tcm.getWorldTransformVersion(child);
+    otherVersion = tcm.getWorldTransformVersion(other);
+    tcm.openLocalTransformTransaction();
+    tcm.setTransform(parent, mat4f{ float4{ 4 }});
+    tcm.commitLocalTransformTransaction();
+
+    // local transaction invalidates Instances
+    parent = tcm.getInstance(entities[0]);
+    child = tcm.getInstance(entities[1]);
+    other = tcm.getInstance(entities[2]);
+    EXPECT_NE(parentVersion, tcm.getWorldTransformVersion(parent));
+    EXPECT_NE(childVersion, tcm.getWorldTransformVersion(child));
+    EXPECT_EQ(otherVersion, tcm.getWorldTransformVersion(other));
+
+    // destroying a component changes the layout
+    const uint32_t v = tcm.getLayoutVersion();
+    tcm.destroy(entities[2]);
+    EXPECT_NE(v, tcm.getLayoutVersion());
+
+    tcm.destroy(entities[1]);
+    tcm.destroy(entities[0]);
+    em.destroy(entities.size(), entities.data());
+}
+
+TEST(FilamentTest, TransformManagerLevels) {
+    JobSystem js;
+    js.adopt();
+
+    filament::FTransformManager tcm(&js);
+    EntityManager& em = EntityManager::get();
+    std::vector<Entity> entities(4096);
+    em.create(entities.size(), entities.data());
+
+    // a wide and deep hierarchy, with parents created after some of their children
+    std::default_random_engine gen; // NOLINT
+    std::uniform_real_distribution<float> rand(-1.0f, 1.0f);
+    for (Entity e : entities) {
+        tcm.create(e);
+    }
+    for (size_t i = 16; i < entities.size(); i++) {
+        const size_t p = i < 2048 ? i / 8 : i - 2048;
+        tcm.setParent(tcm.getInstance(entities[i]), tcm.getInstance(entities[p]));
+    }
+
+    // returns the world transform computed from the local transforms of the ancestors
+    auto expected = [&tcm](Entity e) {
+        std::vector<Entity> ancestry;
+        for (; e; e = tcm.getParent(tcm.getInstance(e))) {
+            ancestry.push_back(e);
+        }
+        mat4f world;
+        for (auto it = ancestry.rbegin(); it != ancestry.rend(); ++it) {
+            world = world * tcm.getTransform(tcm.getInstance(*it));
+        }
+        return world;
+    };
+
+    // update all the transforms with the batched API
+    std::vector<TransformManager::Instance> instances(entities.size());
+    std::vector<mat4f> transforms(entities.size());
+    for (size_t i = 0; i < entities.size(); i++) {
+        instances[i] = tcm.getInstance(entities[i]);
+        transforms[i] = mat4f::translation(float3{ rand(gen), rand(gen), rand(gen) }) *
+                mat4f::scaling(float3{ 1.0f + rand(gen) * 0.01f });
+    }
+    tcm.setTransform(instances.data(), transforms.data(), instances.size());
+
+    // parents are always before their children
+    for (Entity e : entities) {
+        TransformManager::Instance i = tcm.getInstance(e);
+        Entity p = tcm.getParent(i);
+        if (p) {
+            EXPECT_LT(tcm.getInstance(p), i);
+        }
+        EXPECT_EQ(tcm.getWorldTransform(i), expected(e));
+    }
+
+    // only the descendants of an updated node change
+    TransformManager::Instance node = tcm.getInstance(entities[1]);
+    TransformManager::Instance other = tcm.getInstance(entities[2]);
+    const uint32_t otherVersion = tcm.getWorldTransformVersion(other);
+    const mat4f m = mat4f::translation(float3{ 1, 2, 3 });
+    tcm.setTransform(&node, &m, 1);
+    EXPECT_EQ(otherVersion, tcm.getWorldTransformVersion(other));
+    for (Entity e : entities) {
+        EXPECT_EQ(tcm.getWorldTransform(tcm.getInstance(e)), expected(e));
+    }
+
+    // destroying a node makes its children roots
+    tcm.destroy(entities[1]);
+    for (size_t i = 2; i < entities.size(); i++) {
+        EXPECT_EQ(tcm.getWorldTransform(tcm.getInstance(entities[i])), expected(entities[i]));
+    }
+
+    for (Entity e : entities) {
+        tcm.destroy(e);
+    }
+    em.destroy(entities.size(), entities.data());
+    js.emancipate();
+}
+
 TEST(FilamentTest, UniformInterfaceBlock) {
 
     UniformInterfaceBlock::Builder b;
@@ -581,6 +753,238 @@ TEST(FilamentTest, SphereCulling) {
     EXPECT_TRUE(frustum.intersects({ 0, 200 }));
 }
 
+TEST(FilamentTest, CullingKernels) {
+    std::default_random_engine gen; // NOLINT
+    std::uniform_real_distribution<float> rand(-100.0f, 100.0f);
+    std::uniform_real_distribution<float> size(0.1f, 5.0f);
+
+    const size_t count = 1024;
+    std::vector<float3> centers(count);
+    std::vector<float3> extents(count);
+    std::vector<float4> spheres(count);
+    for (size_t i = 0; i < count; i++) {
+        centers[i] = { rand(gen), rand(gen), rand(gen) };
+        extents[i] = { size(gen), size(gen), size(gen) };
+        spheres[i] = { centers[i], size(gen) };
+    }
+
+    Frustum frustum(mat4f::perspective(45.0f, 1.0f, 0.1f, 100.0f) *
+            mat4f::lookAt(float3{ 0, 0, 0 }, float3{ 1, 0.2f, -1 }, float3{ 0, 1, 0 }));
+
+    std::vector<Culler::result_type> expectedBoxes(count, 0);
+    std::vector<Culler::result_type> expectedSpheres(count, 0);
+    Culler::Test::intersects(expectedBoxes.data(), frustum, centers.data(), extents.data(),
+            count, Culler::Kernel::SCALAR);
+    Culler::Test::intersects(expectedSpheres.data(), frustum, spheres.data(),
+            count, Culler::Kernel::SCALAR);
+
+    for (auto kernel : { Culler::Kernel::AVX2, Culler::Kernel::NEON }) {
+        if (!Culler::isKernelSupported(kernel)) {
+            continue;
+        }
+        std::vector<Culler::result_type> boxes(count, 0);
+        std::vector<Culler::result_type> spheresResults(count, 0);
+        Culler::Test::intersects(boxes.data(), frustum, centers.data(), extents.data(),
+                count, kernel);
+        Culler::Test::intersects(spheresResults.data(), frustum, spheres.data(),
+                count, kernel);
+        for (size_t i = 0; i < count; i++) {
+            EXPECT_EQ(expectedBoxes[i], boxes[i]) << "box " << i;
+            EXPECT_EQ(expectedSpheres[i], spheresResults[i]) << "sphere " << i;
+        }
+    }
+
+    // the selected kernel must be supported
+    EXPECT_TRUE(Culler::isKernelSupported(Culler::getKernel()));
+}
+
+TEST(FilamentTest, CullingHierarchy) {
+    JobSystem js;
+    js.adopt();
+
+    std::default_random_engine gen; // NOLINT
+    std::uniform_real_distribution<float> rand(-100.0f, 100.0f);
+    std::uniform_real_distribution<float> size(0.1f, 5.0f);
+
+    const size_t count = 5000;
+    const size_t capacity = Culler::round(count);
+    std::vector<CullingHierarchy::Instance> instances(count);
+    std::vector<float3> centers(capacity);
+    std::vector<float3> extents(capacity);
+    for (size_t i = 0; i < count; i++) {
+        instances[i] = CullingHierarchy::Instance(i + 1);
+        centers[i] = { rand(gen), rand(gen), rand(gen) };
+        extents[i] = { size(gen), size(gen), size(gen) };
+    }
+
+    Frustum frustum(mat4f::perspective(45.0f, 1.0f, 0.1f, 100.0f) *
+            mat4f::lookAt(float3{ 0, 0, 0 }, float3{ 1, 0.2f, -1 }, float3{ 0, 1, 0 }));
+
+    auto check = [&](CullingHierarchy const& hierarchy) {
+        std::vector<Culler::result_type> expected(capacity, 0);
+        std::vector<Culler::result_type> results(capacity, 0);
+        Culler::Test::intersects(expected.data(), frustum, centers.data(), extents.data(), capacity);
+        hierarchy.cull(js, frustum, results.data(), centers.data(), extents.data(), 0);
+        size_t visible = 0;
+        for (size_t i = 0; i < count; i++) {
+            EXPECT_EQ(expected[i], results[i]) << "renderable " << i;
+            visible += results[i];
+        }
+        // make sure the test is meaningful
+        EXPECT_GT(visible, 0);
+        EXPECT_LT(visible, count);
+    };
+
+    CullingHierarchy hierarchy;
+    EXPECT_TRUE(hierarchy.update(instances.data(), centers.data(), extents.data(), count));
+    EXPECT_EQ(count, hierarchy.size());
+    check(hierarchy);
+
+    // nothing changed
+    EXPECT_FALSE(hierarchy.update(instances.data(), centers.data(), extents.data(), count));
+    check(hierarchy);
+
+    // move a few renderables, this only refits the hierarchy
+    for (size_t i = 0; i < count; i += 97) {
+        centers[i] += float3{ 1.0f, -1.0f, 0.5f };
+    }
+    EXPECT_FALSE(hierarchy.update(instances.data(), centers.data(), extents.data(), count));
+    check(hierarchy);
+
+    // a different set of renderables forces a rebuild
+    std::swap(instances[0], instances[1]);
+    EXPECT_TRUE(hierarchy.update(instances.data(), centers.data(), extents.data(), count));
+    check(hierarchy);
+
+    js.emancipate();
+}
+
+TEST(FilamentTest, SceneCache) {
+    FEngine* engine = FEngine::create();
+    FRenderableManager& rcm = engine->getRenderableManager();
+    FTransformManager& tcm = engine->getTransformManager();
+    utils::EntityManager& em = utils::EntityManager::get();
+    FScene* scene = upcast(engine->createScene());
+
+    utils::Entity entities[3];
+    em.create(3, entities);
+    for (size_t i = 0; i < 3; i++) {
+        tcm.create(entities[i], {}, mat4f::translation(float3{ float(i), 0, 0 }));
+        RenderableManager::Builder(1)
+                .boundingBox({ { 0, 0, 0 }, { 1, 1, 1 } })
+                .build(*engine, entities[i]);
+        scene->addEntity(entities[i]);
+    }
+
+    // prepare() copies the cache in order, so the renderables are at the same index in both
+    auto indexOf = [&](utils::Entity e) {
+        FScene::RenderableSoa const& cache = scene->mRenderableCache;
+        auto const* instances = cache.data<FScene::RENDERABLE_INSTANCE>();
+        auto it = std::find(instances, instances + cache.size(), rcm.getInstance(e));
+        return it == instances + cache.size() ? -1 : int(it - instances);
+    };
+    auto center = [&](utils::Entity e) {
+        return scene->getRenderableData().elementAt<FScene::WORLD_AABB_CENTER>(indexOf(e));
+    };
+    auto layers = [&](utils::Entity e) {
+        return scene->getRenderableData().elementAt<FScene::LAYERS>(indexOf(e));
+    };
+
+    scene->prepare(mat4f{});
+    ASSERT_EQ(3, scene->getRenderableData().size());
+    for (size_t i = 0; i < 3; i++) {
+        EXPECT_EQ(float3(i, 0, 0), center(entities[i]));
+    }
+
+    // Renderables that didn't change aren't gathered again. Tag the cached layers of all of them,
+    // which their component doesn't have, to tell which ones were.
+    auto tagCache = [&]() {
+        for (auto& l : scene->mRenderableCache.slice<FScene::LAYERS>()) {
+            l = 0x80;
+        }
+    };
+    tagCache();
+    scene->prepare(mat4f{});
+    for (utils::Entity e : entities) {
+        EXPECT_EQ(0x80, layers(e));
+    }
+
+    // a new world transform gathers that renderable only
+    tcm.setTransform(tcm.getInstance(entities[1]), mat4f::translation(float3{ 5, 0, 0 }));
+    scene->prepare(mat4f{});
+    EXPECT_EQ(float3(5, 0, 0), center(entities[1]));
+    EXPECT_NE(0x80, layers(entities[1]));
+    EXPECT_EQ(0x80, layers(entities[0]));
+    EXPECT_EQ(0x80, layers(entities[2]));
+
+    // so does a change to the renderable component
+    tagCache();
+    rcm.setAxisAlignedBoundingBox(rcm.getInstance(entities[2]), { { 0, 1, 0 }, { 1, 1, 1 } });
+    scene->prepare(mat4f{});
+    EXPECT_EQ(float3(2, 1, 0), center(entities[2]));
+    EXPECT_NE(0x80, layers(entities[2]));
+    EXPECT_EQ(0x80, layers(entities[0]));
+    EXPECT_EQ(0x80, layers(entities[1]));
+
+    // removing an entity from the scene rebuilds the cache
+    tagCache();
+    scene->remove(entities[0]);
+    scene->prepare(mat4f{});
+    ASSERT_EQ(2, scene->getRenderableData().size());
+    EXPECT_EQ(-1, indexOf(entities[0]));
+    EXPECT_NE(0x80, layers(entities[1]));
+    EXPECT_NE(0x80, layers(entities[2]));
+
+    // and so does a change of the layout of a component manager, even for entities that are
+    // still in the scene
+    tagCache();
+    rcm.destroy(entities[2]);
+    scene->prepare(mat4f{});
+    ASSERT_EQ(1, scene->getRenderableData().size());
+    EXPECT_EQ(0, indexOf(entities[1]));
+    EXPECT_NE(0x80, layers(entities[1]));
+    EXPECT_EQ(float3(5, 0, 0), center(entities[1]));
+
+    engine->destroy(scene);
+    for (utils::Entity e : entities) {
+        rcm.destroy(e);
+        tcm.destroy(e);
+    }
+    em.destroy(3, entities);
+    Engine::destroy((Engine **)&engine);
+}
+
+TEST(FilamentTest, RadixSortCommands) {
+    JobSystem js;
+    js.adopt();
+
+    std::default_random_engine gen; // NOLINT
+    std::uniform_int_distribution<uint64_t> rand;
+
+    for (size_t count : { 1, 1000, 1024, 5000, 33333 }) {
+        std::vector<RenderPass::Command> commands(count);
+        for (size_t i = 0; i < count; i++) {
+            // leave some bytes constant, so that some passes are skipped
+            commands[i].key = (i % 3) ? uint64_t(RenderPass::Pass::SENTINEL) :
+                    (rand(gen) & 0x0000FFFF0000FFF0llu) | uint64_t(RenderPass::Pass::COLOR);
+            // remember the original position to check the sort is stable
+            commands[i].primitive.index = uint16_t(i);
+        }
+
+        std::vector<RenderPass::Command> expected(commands);
+        std::stable_sort(expected.begin(), expected.end());
+
+        std::vector<RenderPass::Command> scratch(count);
+        RenderPass::radixSortCommands(js, commands.data(), scratch.data(), count);
+        for (size_t i = 0; i < count; i++) {
+            EXPECT_EQ(expected[i].key, commands[i].key) << "count " << count << ", command " << i;
+            EXPECT_EQ(expected[i].primitive.index, commands[i].primitive.index);
+        }
+    }
+
+    js.emancipate();
+}
+
 TEST(FilamentTest, ColorConversion) {
     // Linear to Gamma
     // 0.0 stays 0.0
@@ -641,7 +1045,7 @@ TEST(FilamentTest, FroxelData) {
 
     Froxelizer froxelData(*engine);
     froxelData.setOptions(5, 100);
-    froxelData.prepare(engine->getDriverApi(), scope, vp, p, 0.1, 100);
+    froxelData.prepare(scope, vp, p, 0.1, 100);
 
     Froxel f = froxelData.getFroxelAt(0,0,0);
 
@@ -702,6 +1106,11 @@ TEST(FilamentTest, FroxelData) {
             pointCount += entry.count;
         }
         EXPECT_GT(pointCount, 0);
+        EXPECT_FALSE(froxelData.isFroxelDataReused());
+
+        // nothing changed, the previous froxelization is reused
+        froxelData.froxelizeLights(*engine, {}, lights);
+        EXPECT_TRUE(froxelData.isFroxelDataReused());
     }
 
     {
@@ -711,7 +1120,9 @@ TEST(FilamentTest, FroxelData) {
         auto pos = lights.elementAt<FScene::POSITION_RADIUS>(1);
         EXPECT_TRUE(pos == float4( 0, 0, -3, 1 ));
 
+        // only the light that moved is froxelized again
         froxelData.froxelizeLights(*engine, {}, lights);
+        EXPECT_FALSE(froxelData.isFroxelDataReused());
         auto const& froxelBuffer = froxelData.getFroxelBufferUser();
         auto const& recordBuffer = froxelData.getRecordBufferUser();
         size_t pointCount = 0;
@@ -722,6 +1133,39 @@ TEST(FilamentTest, FroxelData) {
         EXPECT_GT(pointCount, 0);
     }
 
+    {
+        // with the large light count, the froxels are smaller, and the lights past the
+        // light UBO are assigned too
+        froxelData.setLargeLightCountEnabled(true);
+        froxelData.prepare(scope, vp, p, 0.1, 100);
+        EXPECT_GT(froxelData.getFroxelCount(), FROXEL_BUFFER_ENTRY_COUNT_MAX);
+        EXPECT_LE(froxelData.getFroxelCount(), FROXEL_BUFFER_LARGE_ENTRY_COUNT_MAX);
+
+        FScene::LightSoa manyLights;
+        manyLights.push_back({}, {}, {}, {}, {}, {});   // first one is always skipped
+        for (size_t i = 0; i < 400; i++) {
+            // two groups of 200 lights, left and right
+            const float x = i < 200 ? -3.0f : 3.0f;
+            manyLights.push_back(float4{ x, 0, -10, 1 }, {}, instance, 1, {}, {});
+        }
+
+        froxelData.froxelizeLights(*engine, {}, manyLights);
+        EXPECT_EQ(froxelData.getDroppedTileCount(), 0);
+        auto const& froxelBuffer = froxelData.getFroxelBufferUser();
+        auto const& recordBuffer = froxelData.getLargeRecordBufferUser();
+        size_t maxLightIndex = 0;
+        for (size_t f = 0; f < froxelData.getFroxelCount(); f++) {
+            auto const& entry = froxelBuffer[f];
+            EXPECT_LE(entry.count, 200);
+            for (size_t i = 0; i < entry.count; i++) {
+                size_t lightIndex = recordBuffer[entry.getOffset() + i];
+                EXPECT_LT(lightIndex, 400);
+                maxLightIndex = std::max(maxLightIndex, lightIndex);
+            }
+        }
+        EXPECT_EQ(maxLightIndex, 399);
+    }
+
     froxelData.terminate(engine->getDriverApi());
 
     Engine::destroy((Engine **)&engine);
@@ -860,6 +1304,720 @@ TEST(FilamentTest, Bones) {
     }
 }
 
+TEST(FilamentTest, Instancing) {
+    FEngine* engine = FEngine::create();
+    FRenderableManager& rcm = engine->getRenderableManager();
+    utils::Entity e = utils::EntityManager::get().create();
+
+    const mat4f transforms[] = {
+            mat4f::translation(float3{ 0, 0, 0 }),
+            mat4f::translation(float3{ 10, 0, 0 }) * mat4f::scaling(float3{ 1, 2, 3 }),
+            mat4f::translation(float3{ 100, 0, 0 }),
+    };
+    RenderableManager::Builder(1)
+            .boundingBox({ { 0, 0, 0 }, { 1, 1, 1 } })
+            .instances(3, transforms)
+            .build(*engine, e);
+    auto ri = rcm.getInstance(e);
+    ASSERT_EQ(3, rcm.getInstanceCount(ri));
+
+    // the culling box encloses all the instances
+    Box const& bounds = rcm.getCullingAABB(ri);
+    EXPECT_EQ(float3(50, 0, 0), bounds.center);
+    EXPECT_EQ(float3(51, 2, 3), bounds.halfExtent);
+
+    const float4 data[] = { { 1, 2, 3, 4 }, { 5, 6, 7, 8 }, { 9, 10, 11, 12 } };
+    rcm.setInstanceData(ri, data, 3);
+
+    // the instances are written in world space, as the rows of their affine transform
+    auto toMat4 = [](PerRenderableUibInstance const& instance) {
+        return transpose(mat4f{ instance.worldFromModelRows[0], instance.worldFromModelRows[1],
+                instance.worldFromModelRows[2], float4{ 0, 0, 0, 1 } });
+    };
+    const AffineTransform world(mat4f::translation(float3{ 0, 0, -5 }));
+    PerRenderableUibInstance out[3];
+    ASSERT_EQ(3, rcm.writeVisibleInstances(ri, world, nullptr, 0, out));
+    for (size_t i = 0; i < 3; i++) {
+        EXPECT_EQ(world.asMat4() * transforms[i], toMat4(out[i]));
+        EXPECT_EQ(data[i], out[i].data);
+    }
+
+    // the shader computes the normal matrix from the cofactors of the world transform, which
+    // must match the CPU's normal matrix up to a positive scale
+    const mat3f linear = (mat4f::rotation(F_PI_2 / 3, float3{ 1, 2, 3 }) *
+            mat4f::scaling(float3{ 1, 2, 3 })).upperLeft();
+    const mat3f cofactor{ cross(linear[1], linear[2]), cross(linear[2], linear[0]),
+            cross(linear[0], linear[1]) };
+    const mat3f expected = mat3f::getTransformForNormals(linear);
+    for (size_t i = 0; i < 3; i++) {
+        EXPECT_NEAR(0, length(cross(normalize(cofactor[i]), normalize(expected[i]))), 1e-6f);
+        EXPECT_GT(dot(cofactor[i], expected[i]), 0);
+    }
+
+    // only the instances in the frustum are written, in order
+    const Frustum frustum(mat4f::ortho(-5, 20, -5, 5, 0, 10));
+    ASSERT_EQ(2, rcm.writeVisibleInstances(ri, world, &frustum, 1, out));
+    EXPECT_EQ(0, out[0].worldFromModelRows[0].w);
+    EXPECT_EQ(10, out[1].worldFromModelRows[0].w);
+    EXPECT_EQ(data[1], out[1].data);
+
+    // with several frusta (e.g. the camera's and the shadow maps'), the instances in any of them
+    const Frustum frusta[] = {
+            Frustum(mat4f::ortho(-5, 5, -5, 5, 0, 10)),
+            Frustum(mat4f::ortho(95, 105, -5, 5, 0, 10)) };
+    ASSERT_EQ(2, rcm.writeVisibleInstances(ri, world, frusta, 2, out));
+    EXPECT_EQ(0, out[0].worldFromModelRows[0].w);
+    EXPECT_EQ(100, out[1].worldFromModelRows[0].w);
+
+    // the view writes them in the bone pool instead, after the bones, to upload them at once
+    ASSERT_EQ(2, rcm.updateVisibleInstances(ri, world, &frustum, 1));
+    EXPECT_TRUE(rcm.getBonePool().isDirty());
+    auto const* const pooled = static_cast<PerRenderableUibInstance const*>(
+            rcm.getBonePool().getData(uint32_t(rcm.getBonesOffset(ri) +
+                    CONFIG_FIRST_INSTANCE_BONE * sizeof(PerRenderableUibBone))));
+    EXPECT_EQ(10, pooled[1].worldFromModelRows[0].w);
+    EXPECT_EQ(data[1], pooled[1].data);
+
+    // the culling box follows the transforms
+    const mat4f moved = mat4f::translation(float3{ -100, 0, 0 });
+    rcm.setInstanceTransforms(ri, &moved, 1, 2);
+    EXPECT_EQ(float3(-45, 0, 0), rcm.getCullingAABB(ri).center);
+
+    rcm.destroy(e);
+    utils::EntityManager::get().destroy(e);
+    Engine::destroy((Engine **)&engine);
+}
+
+TEST(FilamentTest, LevelsOfDetail) {
+    FEngine* engine = FEngine::create();
+    FRenderableManager& rcm = engine->getRenderableManager();
+    utils::Entity e = utils::EntityManager::get().create();
+
+    const size_t primitiveCounts[] = { 2, 1, 1 };
+    const float screenSizes[] = { 0.5f, 0.1f };
+    RenderableManager::Builder(4)
+            .boundingBox({ { 0, 0, 0 }, { 1, 1, 1 } })
+            .levels(3, primitiveCounts, screenSizes, 0.2f)
+            .build(*engine, e);
+    auto ri = rcm.getInstance(e);
+    ASSERT_EQ(3, rcm.getLevelCount(ri));
+
+    // each level addresses its own primitives, ALL_LEVELS addresses all of them
+    auto all = rcm.getRenderPrimitives(ri, FRenderableManager::ALL_LEVELS);
+    EXPECT_EQ(4, all.size());
+    EXPECT_EQ(4, rcm.getPrimitiveCount(ri, FRenderableManager::ALL_LEVELS));
+    for (uint8_t level = 0, offset = 0; level < 3; offset += primitiveCounts[level], level++) {
+        auto primitives = rcm.getRenderPrimitives(ri, level);
+        EXPECT_EQ(primitiveCounts[level], primitives.size());
+        EXPECT_EQ(all.data() + offset, primitives.data());
+    }
+
+    // without history
+    EXPECT_EQ(0, rcm.selectLevel(ri, 1.0f, 0));
+    EXPECT_EQ(1, rcm.selectLevel(ri, 0.3f, 1));
+    EXPECT_EQ(2, rcm.selectLevel(ri, 0.01f, 2));
+
+    // the screen size must cross the threshold by 20% to switch levels
+    EXPECT_EQ(0, rcm.selectLevel(ri, 0.45f, 0));
+    EXPECT_EQ(1, rcm.selectLevel(ri, 0.39f, 0));
+    EXPECT_EQ(1, rcm.selectLevel(ri, 0.55f, 1));
+    EXPECT_EQ(0, rcm.selectLevel(ri, 0.61f, 1));
+    EXPECT_EQ(2, rcm.selectLevel(ri, 0.11f, 2));
+    EXPECT_EQ(1, rcm.selectLevel(ri, 0.13f, 2));
+    EXPECT_EQ(2, rcm.selectLevel(ri, 0.0f, 0));
+
+    // renderables without levels always draw level 0
+    utils::Entity e1 = utils::EntityManager::get().create();
+    RenderableManager::Builder(1)
+            .boundingBox({ { 0, 0, 0 }, { 1, 1, 1 } })
+            .build(*engine, e1);
+    auto ri1 = rcm.getInstance(e1);
+    EXPECT_EQ(1, rcm.getLevelCount(ri1));
+    EXPECT_EQ(0, rcm.selectLevel(ri1, 0.0f, 0));
+
+    rcm.destroy(e);
+    rcm.destroy(e1);
+    utils::EntityManager::get().destroy(e);
+    utils::EntityManager::get().destroy(e1);
+    Engine::destroy((Engine **)&engine);
+}
+
+TEST(FilamentTest, MorphWeights) {
+    // only the non-zero weights are packed, with the index of their target
+    const float weights[] = { 0.0f, 0.5f, 0.0f, 0.0f, 0.25f, 1.0f, 0.0f, -0.5f, 0.75f };
+    PerRenderableMorphingUib uib{};
+    FRenderableManager::packMorphWeights(&uib, weights, 9);
+    EXPECT_EQ(5, uib.count);
+    EXPECT_EQ(int4(1, 4, 5, 7), uib.indices[0]);
+    EXPECT_EQ(float4(0.5f, 0.25f, 1.0f, -0.5f), uib.weights[0]);
+    EXPECT_EQ(8, uib.indices[1].x);
+    EXPECT_EQ(0.75f, uib.weights[1].x);
+
+    FRenderableManager::packMorphWeights(&uib, weights, 1);
+    EXPECT_EQ(0, uib.count);
+
+    FEngine* engine = FEngine::create();
+    FRenderableManager& rcm = engine->getRenderableManager();
+    utils::Entity e = utils::EntityManager::get().create();
+
+    RenderableManager::Builder(1)
+            .boundingBox({ { 0, 0, 0 }, { 1, 1, 1 } })
+            .morphTargets(9)
+            .build(*engine, e);
+    auto ri = rcm.getInstance(e);
+    EXPECT_EQ(9, rcm.getMorphTargetCount(ri));
+    EXPECT_TRUE(rcm.getVisibility(ri).morphTargets);
+
+    // a partial update repacks all the weights, and changes the version so that a cached shadow
+    // map seeing this renderable is rendered again
+    rcm.setMorphWeights(ri, weights, 9);
+    const uint32_t version = rcm.getVersion(ri);
+    const float more[] = { 1.0f, 0.0f };
+    rcm.setMorphWeights(ri, more, 2, 4);
+    EXPECT_NE(version, rcm.getVersion(ri));
+    auto const& packed = *static_cast<PerRenderableMorphingUib const*>(
+            rcm.mManager[ri].morphTargets->weights.getBuffer());
+    EXPECT_EQ(5, packed.count);
+    EXPECT_EQ(int4(1, 4, 7, 8), packed.indices[0]);
+    EXPECT_EQ(float4(0.5f, 1.0f, -0.5f, 0.75f), packed.weights[0]);
+    EXPECT_TRUE(rcm.mManager[ri].morphTargets->weights.isDirty());
+
+    rcm.destroy(e);
+    utils::EntityManager::get().destroy(e);
+    Engine::destroy((Engine **)&engine);
+}
+
+TEST(FilamentTest, CpuDeformation) {
+    // the CPU deformation is the reference for the vertex shader, it must match the transforms
+    const mat4f transforms[] = {
+            mat4f::translation(float3{ 1, 2, 3 }) *
+                    mat4f::rotation(0.5f, float3{ 0, 1, 0 }) * mat4f::scaling(float3{ 2, 1, 1 }),
+            mat4f::translation(float3{ -1, 0, 1 }) *
+                    mat4f::rotation(1.5f, float3{ 1, 0, 0 }) * mat4f::scaling(float3{ 1, 3, 1 }),
+    };
+    PerRenderableUibBone bones[2];
+    PerRenderableUibBoneMatrix matrices[2];
+    for (size_t i = 0; i < 2; i++) {
+        FRenderableManager::makeBone(&bones[i], transforms[i]);
+        FRenderableManager::makeBone(&matrices[i], transforms[i]);
+    }
+
+    // vertex 0 is blended, vertex 1 follows bone 1 and is morphed
+    FRenderableManager::Deformation::Buffer buffer;
+    buffer.positions = { float3{ 1, 1, 1 }, float3{ 0, 1, -2 } };
+    buffer.tangents = { quatf{ 1, 0, 0, 0 }, -quatf{ 1, 0, 0, 0 } };
+    buffer.boneIndices = { ushort4{ 0, 1, 0, 0 }, ushort4{ 1, 0, 0, 0 } };
+    buffer.boneWeights = { float4{ 0.25f, 0.75f, 0, 0 }, float4{ 1, 0, 0, 0 } };
+    buffer.positionDeltas = { float3{ 0 }, float3{ 0, 0, 4 } };
+    buffer.normalDeltas = { float3{ 0 }, float3{ 0 } };
+
+    const float morphWeights[] = { 0.5f };
+    PerRenderableMorphingUib uib{};
+    FRenderableManager::packMorphWeights(&uib, morphWeights, 1);
+
+    const float3 expectedPositions[] = {
+            0.25f * (transforms[0] * float4{ 1, 1, 1, 1 }).xyz +
+            0.75f * (transforms[1] * float4{ 1, 1, 1, 1 }).xyz,
+            (transforms[1] * float4{ 0, 1, 0, 1 }).xyz,
+    };
+    const float3 expectedNormal = normalize(
+            inverse(transpose(transforms[1].upperLeft())) * float3{ 0, 0, 1 });
+
+    for (void const* palette : { (void const*)bones, (void const*)matrices }) {
+        float3 positions[2];
+        quatf tangents[2];
+        FRenderableManager::DeformationParams params{};
+        params.buffer = &buffer;
+        params.bones = palette;
+        params.boneFormat = palette == bones ? RenderableManager::BoneFormat::QUATERNION :
+                RenderableManager::BoneFormat::MATRIX_3X4;
+        params.weights = &uib;
+        params.positions = positions;
+        params.tangents = tangents;
+        FRenderableManager::deformVertices(params, 0, 2);
+
+        for (size_t i = 0; i < 2; i++) {
+            for (size_t j = 0; j < 3; j++) {
+                EXPECT_NEAR(expectedPositions[i][j], positions[i][j], 1e-5);
+            }
+        }
+
+        // the tangent frames keep their handedness
+        const float3 normal = mat3f(tangents[1])[2];
+        for (size_t j = 0; j < 3; j++) {
+            EXPECT_NEAR(expectedNormal[j], normal[j], 1e-5);
+        }
+        EXPECT_GT(tangents[0].w, 0);
+        EXPECT_LT(tangents[1].w, 0);
+    }
+
+    // the SIMD kernels accumulate the morph targets like the scalar one
+    std::default_random_engine gen; // NOLINT
+    std::uniform_real_distribution<float> rand(-1.0f, 1.0f);
+    const size_t vertexCount = 1000;
+    const size_t targetCount = 5;
+    FRenderableManager::Deformation::Buffer morphed;
+    morphed.positions.resize(vertexCount);
+    morphed.tangents.resize(vertexCount, quatf{ 1, 0, 0, 0 });
+    morphed.positionDeltas.resize(vertexCount * targetCount);
+    morphed.normalDeltas.resize(vertexCount * targetCount);
+    for (auto& p : morphed.positions) {
+        p = { rand(gen), rand(gen), rand(gen) };
+    }
+    for (size_t i = 0; i < vertexCount * targetCount; i++) {
+        morphed.positionDeltas[i] = { rand(gen), rand(gen), rand(gen) };
+        morphed.normalDeltas[i] = 0.1f * float3{ rand(gen), rand(gen), rand(gen) };
+    }
+    const float targetWeights[targetCount] = { 0.25f, 0.0f, -0.5f, 1.0f, 0.125f };
+    FRenderableManager::packMorphWeights(&uib, targetWeights, targetCount);
+
+    auto deformMorphed = [&](SimdKernel kernel,
+            std::vector<float3>& positions, std::vector<quatf>& tangents) {
+        positions.resize(vertexCount);
+        tangents.resize(vertexCount);
+        FRenderableManager::DeformationParams params{};
+        params.buffer = &morphed;
+        params.weights = &uib;
+        params.positions = positions.data();
+        params.tangents = tangents.data();
+        params.kernel = kernel;
+        // in two ranges, like the jobs of deform() do
+        FRenderableManager::deformVertices(params, 0, 300);
+        FRenderableManager::deformVertices(params, 300, vertexCount - 300);
+    };
+
+    std::vector<float3> expectedMorphedPositions;
+    std::vector<quatf> expectedMorphedTangents;
+    deformMorphed(SimdKernel::SCALAR, expectedMorphedPositions, expectedMorphedTangents);
+    for (size_t v = 0; v < vertexCount; v += 97) {
+        float3 p = morphed.positions[v];
+        for (size_t i = 0; i < targetCount; i++) {
+            p += targetWeights[i] * morphed.positionDeltas[i * vertexCount + v];
+        }
+        for (size_t j = 0; j < 3; j++) {
+            EXPECT_NEAR(p[j], expectedMorphedPositions[v][j], 1e-5);
+        }
+    }
+    for (auto kernel : { SimdKernel::AVX2, SimdKernel::NEON }) {
+        if (!isSimdKernelSupported(kernel)) {
+            continue;
+        }
+        std::vector<float3> morphedPositions;
+        std::vector<quatf> morphedTangents;
+        deformMorphed(kernel, morphedPositions, morphedTangents);
+        for (size_t v = 0; v < vertexCount; v++) {
+            for (size_t j = 0; j < 3; j++) {
+                EXPECT_NEAR(expectedMorphedPositions[v][j], morphedPositions[v][j], 1e-5);
+            }
+            for (size_t j = 0; j < 4; j++) {
+                EXPECT_NEAR(expectedMorphedTangents[v][j], morphedTangents[v][j], 1e-4);
+            }
+        }
+    }
+
+    // renderables sharing a VertexBuffer are each deformed into a VertexBuffer of their own
+    FEngine* engine = FEngine::create(backend::Backend::NOOP);
+    FRenderableManager& rcm = engine->getRenderableManager();
+    FVertexBuffer* vb = upcast(VertexBuffer::Builder()
+            .vertexCount(2)
+            .bufferCount(3)
+            .attribute(VertexAttribute::POSITION, 0, VertexBuffer::AttributeType::FLOAT3)
+            .attribute(VertexAttribute::TANGENTS, 1, VertexBuffer::AttributeType::FLOAT4)
+            .attribute(VertexAttribute::UV0, 2, VertexBuffer::AttributeType::FLOAT2)
+            .build(*engine));
+    FIndexBuffer* ib = upcast(IndexBuffer::Builder()
+            .indexCount(2)
+            .bufferType(IndexBuffer::IndexType::USHORT)
+            .build(*engine));
+    const float2 uvs[] = { { 0, 0 }, { 1, 1 } };
+    void const* const buffers[] = { nullptr, nullptr, uvs };
+    RenderableManager::CpuDeformation deformation;
+    deformation.positions = buffer.positions.data();
+    deformation.tangents = buffer.tangents.data();
+    deformation.boneIndices = buffer.boneIndices.data();
+    deformation.boneWeights = buffer.boneWeights.data();
+    deformation.buffers = buffers;
+
+    utils::Entity e[2];
+    utils::EntityManager::get().create(2, e);
+    for (utils::Entity entity : e) {
+        RenderableManager::Builder(1)
+                .boundingBox({ { 0, 0, 0 }, { 1, 1, 1 } })
+                .geometry(0, RenderableManager::PrimitiveType::LINES, vb, ib)
+                .skinning(2)
+                .cpuDeformation(0, deformation)
+                .build(*engine, entity);
+    }
+    FVertexBuffer const* vertices[2];
+    for (size_t i = 0; i < 2; i++) {
+        auto ri = rcm.getInstance(e[i]);
+        EXPECT_FALSE(rcm.getVisibility(ri).skinning);
+        vertices[i] = rcm.mManager[ri].deformation->buffers[0].vertices;
+        ASSERT_NE(nullptr, vertices[i]);
+        EXPECT_NE(vb, vertices[i]);
+        EXPECT_EQ(vb->getVertexCount(), vertices[i]->getVertexCount());
+        EXPECT_EQ(vb->getDeclaredAttributes(), vertices[i]->getDeclaredAttributes());
+        EXPECT_EQ(sizeof(uvs), vertices[i]->getBufferSize(2));
+    }
+    EXPECT_NE(vertices[0], vertices[1]);
+
+    for (utils::Entity entity : e) {
+        rcm.destroy(entity);
+    }
+    utils::EntityManager::get().destroy(2, e);
+    engine->destroy(vb);
+    engine->destroy(ib);
+    Engine::destroy((Engine **)&engine);
+}
+
+TEST(FilamentTest, BonePool) {
+    BonePool pool;
+    EXPECT_EQ(0, pool.getCapacity());
+
+    // nothing to allocate
+    EXPECT_EQ(0, pool.allocate(0));
+    EXPECT_EQ(0, pool.getCapacity());
+
+    // ranges are aligned, and the pool grows as needed
+    uint32_t a = pool.allocate(10 * sizeof(PerRenderableUibBone));
+    uint32_t b = pool.allocate(100);
+    uint32_t c = pool.allocate(BonePool::RANGE_SIZE);
+    EXPECT_EQ(0, a);
+    EXPECT_EQ(768, b);
+    EXPECT_EQ(1024, c);
+    EXPECT_EQ(4 * BonePool::RANGE_SIZE, pool.getCapacity());
+
+    // freed ranges are reused, and merged with their neighbors
+    pool.free(a, 10 * sizeof(PerRenderableUibBone));
+    pool.free(b, 100);
+    EXPECT_EQ(0, pool.allocate(1024));
+    EXPECT_EQ(1024 + BonePool::RANGE_SIZE, pool.allocate(3 * BonePool::RANGE_SIZE - 1024));
+    EXPECT_EQ(4 * BonePool::RANGE_SIZE, pool.getCapacity());
+
+    uint32_t d = pool.allocate(BonePool::RANGE_SIZE);
+    EXPECT_EQ(4 * BonePool::RANGE_SIZE, d);
+    EXPECT_EQ(8 * BonePool::RANGE_SIZE, pool.getCapacity());
+
+    // invalidated ranges are uploaded by the next commit
+    EXPECT_FALSE(pool.isDirty());
+    PerRenderableUibBone* bones = (PerRenderableUibBone*)pool.invalidate(
+            d, sizeof(PerRenderableUibBone));
+    *bones = {};
+    EXPECT_TRUE(pool.isDirty());
+
+    // the bones of all the renderables share the pool
+    FEngine* engine = FEngine::create();
+    FRenderableManager& rcm = engine->getRenderableManager();
+    utils::Entity e[3];
+    utils::EntityManager::get().create(3, e);
+
+    RenderableManager::Builder(1)
+            .boundingBox({ { 0, 0, 0 }, { 1, 1, 1 } })
+            .skinning(20)
+            .build(*engine, e[0]);
+    RenderableManager::Builder(1)
+            .boundingBox({ { 0, 0, 0 }, { 1, 1, 1 } })
+            .skinning(20)
+            .boneFormat(RenderableManager::BoneFormat::MATRIX_3X4)
+            .build(*engine, e[1]);
+    RenderableManager::Builder(1)
+            .boundingBox({ { 0, 0, 0 }, { 1, 1, 1 } })
+            .morphing(true)
+            .build(*engine, e[2]);
+
+    auto r0 = rcm.getInstance(e[0]);
+    auto r1 = rcm.getInstance(e[1]);
+    auto r2 = rcm.getInstance(e[2]);
+    EXPECT_EQ(0, rcm.getBonesOffset(r0));
+    EXPECT_EQ(20 * sizeof(PerRenderableUibBone), rcm.getBonesOffset(r1));
+    EXPECT_EQ(0, rcm.getBonesOffset(r2));
+    EXPECT_FALSE(rcm.getVisibility(r0).matrixBones);
+    EXPECT_TRUE(rcm.getVisibility(r1).matrixBones);
+
+    // bulk updates
+    std::vector<mat4f> transforms(20, mat4f::translation(float3{ 1, 2, 3 }));
+    RenderableManager::BoneTransforms updates[] = {
+            { r0, transforms.data(), 20 },
+            { r1, transforms.data(), 10, 10 },
+    };
+    rcm.setBones(updates, 2);
+
+    // the new bones are in the pool, waiting for the next commit
+    BonePool const& bonePool = rcm.getBonePool();
+    EXPECT_TRUE(bonePool.isDirty());
+    auto const* bones0 = (PerRenderableUibBone const*)bonePool.getData(rcm.getBonesOffset(r0));
+    for (size_t i = 0; i < 20; i++) {
+        EXPECT_PRED2(vec3eq, (float3{ 1, 2, 3 }), bones0[i].t.xyz);
+        EXPECT_PRED2(vec3eq, (float3{ 1, 1, 1 }), bones0[i].s.xyz);
+    }
+    auto const* bones1 = (PerRenderableUibBoneMatrix const*)bonePool.getData(
+            rcm.getBonesOffset(r1));
+    for (size_t i = 0; i < 10; i++) {
+        // the bones before the update's offset are still the identity
+        EXPECT_EQ(0.0f, bones1[i].rows[0].w);
+        EXPECT_EQ(0.0f, bones1[i].rows[1].w);
+        EXPECT_EQ(0.0f, bones1[i].rows[2].w);
+    }
+    for (size_t i = 10; i < 20; i++) {
+        EXPECT_PRED2(vec3eq, (float3{ 1, 0, 0 }), bones1[i].rows[0].xyz);
+        EXPECT_PRED2(vec3eq, (float3{ 0, 0, 1 }), bones1[i].rows[2].xyz);
+        EXPECT_EQ(1.0f, bones1[i].rows[0].w);
+        EXPECT_EQ(2.0f, bones1[i].rows[1].w);
+        EXPECT_EQ(3.0f, bones1[i].rows[2].w);
+    }
+
+    rcm.destroy(e[0]);
+    RenderableManager::Builder(1)
+            .boundingBox({ { 0, 0, 0 }, { 1, 1, 1 } })
+            .skinning(4)
+            .build(*engine, e[0]);
+    EXPECT_EQ(0, rcm.getBonesOffset(rcm.getInstance(e[0])));
+
+    for (utils::Entity entity : e) {
+        rcm.destroy(entity);
+    }
+    utils::EntityManager::get().destroy(3, e);
+    Engine::destroy((Engine **)&engine);
+}
+
+TEST(FilamentTest, ShadowAtlasAllocator) {
+    using Request = ShadowAtlasAllocator::Request;
+    using Tile = ShadowAtlasAllocator::Tile;
+
+    auto overlap = [](Tile const& a, Tile const& b) {
+        const uint32_t sa = 16u >> a.level;
+        const uint32_t sb = 16u >> b.level;
+        return a.layer == b.layer &&
+                a.x * sa < b.x * sb + sb && b.x * sb < a.x * sa + sa &&
+                a.y * sa < b.y * sb + sb && b.y * sb < a.y * sa + sa;
+    };
+
+    auto checkTiles = [&overlap](std::vector<Request> const& requests) {
+        for (size_t i = 0; i < requests.size(); i++) {
+            EXPECT_TRUE(requests[i].tile.isValid());
+            for (size_t j = 0; j < i; j++) {
+                EXPECT_FALSE(overlap(requests[i].tile, requests[j].tile));
+                EXPECT_NE(requests[i].slot, requests[j].slot);
+            }
+        }
+    };
+
+    ShadowAtlasAllocator allocator;
+
+    // one tile of half the layer, and 20 tiles of a quarter of the layer, in two layers
+    std::vector<Request> requests(21);
+    for (size_t i = 0; i < requests.size(); i++) {
+        requests[i].key = uint32_t(i);
+        requests[i].level = i ? 2 : 1;
+    }
+    allocator.allocate(requests.data(), requests.size(), 2);
+    checkTiles(requests);
+    EXPECT_EQ(1, requests[0].tile.level);
+    EXPECT_EQ(2, requests[5].tile.level);
+
+    // the tiles of unchanged requests don't move
+    const Tile tile = requests[5].tile;
+    const uint8_t slot = requests[5].slot;
+    requests[3].level = 3;
+    std::swap(requests[5], requests[7]);
+    allocator.allocate(requests.data(), requests.size(), 2);
+    checkTiles(requests);
+    EXPECT_EQ(3, requests[3].tile.level);
+    EXPECT_EQ(tile.layer, requests[7].tile.layer);
+    EXPECT_EQ(tile.x, requests[7].tile.x);
+    EXPECT_EQ(tile.y, requests[7].tile.y);
+    EXPECT_EQ(slot, requests[7].slot);
+
+    // the largest tiles are made smaller when the atlas is full
+    std::vector<Request> more(40);
+    for (size_t i = 0; i < more.size(); i++) {
+        more[i].key = uint32_t(100 + i);
+        more[i].level = 2;
+    }
+    allocator.allocate(more.data(), more.size(), 2);
+    checkTiles(more);
+    size_t smallerTiles = 0;
+    for (Request const& request : more) {
+        smallerTiles += request.tile.level == 3 ? 1 : 0;
+    }
+    EXPECT_EQ(11, smallerTiles);
+
+    // freed tiles are merged with their buddies
+    std::vector<Request> layers(2);
+    layers[0].key = 1000;
+    layers[1].key = 1001;
+    allocator.allocate(layers.data(), layers.size(), 2);
+    checkTiles(layers);
+    EXPECT_EQ(0, layers[0].tile.level);
+    EXPECT_EQ(0, layers[1].tile.level);
+
+    // there is no room for a third layer-sized tile
+    layers.push_back({});
+    layers[2].key = 1002;
+    allocator.allocate(layers.data(), layers.size(), 2);
+    EXPECT_FALSE(layers[2].tile.isValid());
+    EXPECT_EQ(ShadowAtlasAllocator::INVALID_SLOT, layers[2].slot);
+
+    // empty layers are removed, and layers are added, without moving the tiles
+    std::vector<Request> kept{ layers[0].tile.layer == 0 ? layers[0] : layers[1] };
+    const Request first = kept[0];
+    allocator.allocate(kept.data(), kept.size(), 2);
+    EXPECT_EQ(1, allocator.getUsedLayerCount());
+    allocator.allocate(kept.data(), kept.size(), 1);
+    EXPECT_EQ(1, allocator.getLayerCount());
+    EXPECT_EQ(0, kept[0].tile.layer);
+    EXPECT_EQ(first.slot, kept[0].slot);
+    kept.push_back({});
+    kept[1].key = 1003;
+    allocator.allocate(kept.data(), kept.size(), 2);
+    checkTiles(kept);
+    EXPECT_EQ(0, kept[0].tile.layer);
+    EXPECT_EQ(first.slot, kept[0].slot);
+    EXPECT_EQ(2, allocator.getUsedLayerCount());
+
+    // removing a layer holding a tile frees all the tiles, which are allocated again
+    allocator.allocate(kept.data(), kept.size(), 1);
+    checkTiles(kept);
+    EXPECT_EQ(1, allocator.getUsedLayerCount());
+    EXPECT_EQ(1, kept[0].tile.level);
+    EXPECT_EQ(1, kept[1].tile.level);
+}
+
+TEST(FilamentTest, ShadowMapCache) {
+    FEngine* engine = FEngine::create(backend::Backend::NOOP);
+    FRenderableManager& rcm = engine->getRenderableManager();
+    FTransformManager& tcm = engine->getTransformManager();
+    utils::EntityManager& em = utils::EntityManager::get();
+    FScene* scene = upcast(engine->createScene());
+    FView* view = upcast(engine->createView());
+    view->setScene(scene);
+
+    FVertexBuffer* vb = upcast(VertexBuffer::Builder()
+            .vertexCount(3)
+            .bufferCount(1)
+            .attribute(VertexAttribute::POSITION, 0, VertexBuffer::AttributeType::FLOAT3)
+            .build(*engine));
+    FIndexBuffer* ib = upcast(IndexBuffer::Builder()
+            .indexCount(3)
+            .bufferType(IndexBuffer::IndexType::USHORT)
+            .build(*engine));
+
+    // two static casters and a skinned one
+    utils::Entity entities[3];
+    em.create(3, entities);
+    for (size_t i = 0; i < 3; i++) {
+        tcm.create(entities[i], {}, mat4f::translation(float3{ float(i), 0, 0 }));
+        RenderableManager::Builder(1)
+                .boundingBox({ { 0, 0, 0 }, { 1, 1, 1 } })
+                .geometry(0, RenderableManager::PrimitiveType::TRIANGLES, vb, ib)
+                .castShadows(true)
+                .skinning(i == 2 ? 1 : 0)
+                .build(*engine, entities[i]);
+        scene->addEntity(entities[i]);
+    }
+
+    {
+        ShadowMapManager smm(*engine);
+        ShadowMap shadowMap(*engine);
+        ShadowMapManager::ShadowMapEntry entry(&shadowMap, 0);
+        ShadowMapManager::ShadowMapState state;
+
+        // the entities whose casters are visible from the light
+        bool casting[3] = { true, true, false };
+
+        // runs what a frame does before deciding whether the shadow map must be rendered
+        auto isCached = [&]() {
+            scene->prepare(mat4f{});
+            FScene::RenderableSoa& renderableData = scene->getRenderableData();
+            auto const* instances = renderableData.data<FScene::RENDERABLE_INSTANCE>();
+            auto* masks = renderableData.data<FScene::VISIBLE_MASK>();
+            for (size_t i = 0; i < renderableData.size(); i++) {
+                masks[i] = 0;
+                for (size_t j = 0; j < 3; j++) {
+                    if (casting[j] && instances[i] == rcm.getInstance(entities[j])) {
+                        masks[i] = VISIBLE_DIR_SHADOW_RENDERABLE;
+                    }
+                }
+            }
+            shadowMap.prepareGeometry(renderableData,
+                    { 0, uint32_t(renderableData.size()) }, -1);
+            return smm.isShadowMapCached(*engine, *view, entry, state,
+                    VISIBLE_DIR_SHADOW_RENDERABLE);
+        };
+
+        // nothing is cached until there is a shadow texture to reuse
+        EXPECT_FALSE(isCached());
+        EXPECT_FALSE(isCached());
+        smm.mCachedShadows.texture = backend::Handle<backend::HwTexture>(0);
+
+        // the state of the last frame is kept, the shadow map stays cached while it doesn't change
+        EXPECT_TRUE(isCached());
+        EXPECT_TRUE(isCached());
+        EXPECT_TRUE(isCached());
+
+        // a caster moves
+        tcm.setTransform(tcm.getInstance(entities[0]), mat4f::translation(float3{ 5, 0, 0 }));
+        EXPECT_FALSE(isCached());
+        EXPECT_TRUE(isCached());
+
+        // a caster leaves, then enters the light's view
+        casting[1] = false;
+        EXPECT_FALSE(isCached());
+        EXPECT_TRUE(isCached());
+        casting[1] = true;
+        EXPECT_FALSE(isCached());
+        EXPECT_TRUE(isCached());
+
+        // the geometry of a caster changes
+        rcm.setGeometryAt(rcm.getInstance(entities[1]), 0, 0,
+                RenderableManager::PrimitiveType::TRIANGLES, vb, ib, 0, 3);
+        EXPECT_FALSE(isCached());
+        EXPECT_TRUE(isCached());
+
+        // so does its material
+        FMaterialInstance* mi = engine->getDefaultMaterial()->createInstance(nullptr);
+        rcm.setMaterialInstanceAt(rcm.getInstance(entities[1]), 0, 0, mi);
+        EXPECT_FALSE(isCached());
+        EXPECT_TRUE(isCached());
+
+        // the polygon offset of the light changes
+        shadowMap.mPolygonOffset = { .slope = -2.0f, .constant = -1.0f };
+        EXPECT_FALSE(isCached());
+        EXPECT_TRUE(isCached());
+
+        // the shadow map moves in the shadow texture
+        entry.setLayout({ .layer = 1, .size = 512 });
+        EXPECT_FALSE(isCached());
+        EXPECT_TRUE(isCached());
+
+        // a skinned caster can change without notice, it's never cached
+        casting[2] = true;
+        EXPECT_FALSE(isCached());
+        EXPECT_FALSE(isCached());
+        EXPECT_FALSE(isCached());
+        casting[2] = false;
+        EXPECT_FALSE(isCached());
+        EXPECT_TRUE(isCached());
+
+        // the handle isn't a real texture
+        smm.mCachedShadows = {};
+        rcm.setMaterialInstanceAt(rcm.getInstance(entities[1]), 0, 0,
+                engine->getDefaultMaterial()->getDefaultInstance());
+        engine->destroy(mi);
+    }
+
+    engine->destroy(view);
+    engine->destroy(scene);
+    for (utils::Entity e : entities) {
+        rcm.destroy(e);
+        tcm.destroy(e);
+    }
+    em.destroy(3, entities);
+    engine->destroy(vb);
+    engine->destroy(ib);
+    Engine::destroy((Engine **)&engine);
+}
+
 TEST(FilamentTest, GoogleLineDirective) {
     {
         char s[512] = "#line 10 \"foobar\"";
@@ -36,9 +36,10 @@ namespace BindingPoints {
     constexpr uint8_t PER_RENDERABLE_BONES    = 2;    // bones data, per renderable
     constexpr uint8_t LIGHTS                  = 3;    // lights data array
     constexpr uint8_t SHADOW                  = 4;    // punctual shadow data
-    constexpr uint8_t PER_MATERIAL_INSTANCE   = 5;    // uniforms/samplers updates per material
-    constexpr uint8_t COUNT                   = 6;
-    // These are limited by Program::UNIFORM_BINDING_COUNT (currently 6)
+    constexpr uint8_t PER_RENDERABLE_MORPHING = 5;    // morph weights and targets, per renderable
+    constexpr uint8_t PER_MATERIAL_INSTANCE   = 6;    // uniforms/samplers updates per material
+    constexpr uint8_t COUNT                   = 7;
+    // These are limited by Program::UNIFORM_BINDING_COUNT (currently 7)
 }
 
 static_assert(BindingPoints::PER_MATERIAL_INSTANCE == BindingPoints::COUNT - 1,
@@ -49,12 +50,25 @@ static_assert(BindingPoints::PER_MATERIAL_INSTANCE == BindingPoints::COUNT - 1,
 constexpr size_t CONFIG_MAX_LIGHT_COUNT = 256;
 constexpr size_t CONFIG_MAX_LIGHT_INDEX = CONFIG_MAX_LIGHT_COUNT - 1;
 
+// With View::setLargeLightCountEnabled(), the lights past the first CONFIG_MAX_LIGHT_COUNT are
+// stored in the froxel buffer. Light indices must fit in the 16 bits of the froxel records.
+constexpr size_t CONFIG_MAX_LARGE_LIGHT_COUNT = 4096;
+constexpr size_t CONFIG_MAX_LARGE_LIGHT_INDEX = CONFIG_MAX_LARGE_LIGHT_COUNT - 1;
+
 // The maximum number of spot lights in a scene that can cast shadows.
 // Light space coordinates are computed in the vertex shader and interpolated across fragments.
 // Thus, each additional shadow-casting spot light adds 4 additional varying components. Higher
 // values may cause the number of varyings to exceed the driver limit.
 constexpr size_t CONFIG_MAX_SHADOW_CASTING_SPOTS = 2;
 
+// With View::setShadowAtlasEnabled(), the shadows of the spot lights are stored in tiles of a
+// shadow atlas instead, and their light space coordinates are computed in the fragment shader.
+// Per-renderable visibility is tracked with one bit per atlas shadow, in a 64-bit mask.
+constexpr size_t CONFIG_MAX_SHADOW_ATLAS_SPOTS = 64;
+
+// The maximum number of layers of the shadow texture array used by the shadow atlas.
+constexpr size_t CONFIG_MAX_SHADOW_ATLAS_LAYERS = 4;
+
 // The maximum number of shadow cascades that can be used for directional lights.
 constexpr size_t CONFIG_MAX_SHADOW_CASCADES = 4;
 
@@ -62,6 +76,15 @@ constexpr size_t CONFIG_MAX_SHADOW_CASCADES = 4;
 // We store 64 bytes per bone.
 constexpr size_t CONFIG_MAX_BONE_COUNT = 256;
 
+// Instances are stored in the last CONFIG_MAX_INSTANCE_COUNT slots of the bones UBO, and take
+// 64 bytes each, like a bone. Instanced renderables can therefore use fewer bones.
+constexpr size_t CONFIG_MAX_INSTANCE_COUNT = 128;
+constexpr size_t CONFIG_FIRST_INSTANCE_BONE = CONFIG_MAX_BONE_COUNT - CONFIG_MAX_INSTANCE_COUNT;
+
+// Morph targets are stored in a 2D array texture, with two layers per target (positions and
+// normals). ES3.0 only guarantees 256 layers.
+constexpr size_t CONFIG_MAX_MORPH_TARGET_COUNT = 128;
+
 } // namespace filament
 
 #endif // TNT_FILAMENT_driver/EngineEnums.h
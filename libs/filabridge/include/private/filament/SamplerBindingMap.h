@@ -72,6 +72,10 @@ public:
         return mSamplerBlockOffsets[bindingPoint];
     }
 
+    // Returns true if populate() gave the PER_RENDERABLE_MORPHING samplers a binding. Morph
+    // targets are only supported by materials that have enough samplers left for them.
+    bool hasMorphTargets() const { return mHasMorphTargets; }
+
 private:
     constexpr static uint8_t UNKNOWN_OFFSET = 0xff;
     typedef uint32_t BindingKey;
@@ -80,6 +84,7 @@ private:
     }
     tsl::robin_map<BindingKey, SamplerBindingInfo> mBindingMap;
     uint8_t mSamplerBlockOffsets[filament::BindingPoints::COUNT] = { UNKNOWN_OFFSET };
+    bool mHasMorphTargets = false;
 };
 
 
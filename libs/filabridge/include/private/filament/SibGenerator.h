@@ -30,6 +30,7 @@ class SamplerInterfaceBlock;
 class SibGenerator {
 public:
     static SamplerInterfaceBlock const& getPerViewSib(uint8_t variantKey) noexcept;
+    static SamplerInterfaceBlock const& getPerRenderableMorphingSib(uint8_t variantKey) noexcept;
     static SamplerInterfaceBlock const* getSib(uint8_t bindingPoint, uint8_t variantKey) noexcept;
 };
 
@@ -47,5 +48,12 @@ struct PerViewSib {
     static constexpr size_t SAMPLER_COUNT  = 8;
 };
 
+struct PerRenderableMorphingSib {
+    // indices of each samplers in this SamplerInterfaceBlock (see: getPerRenderableMorphingSib())
+    static constexpr size_t TARGETS        = 0;
+
+    static constexpr size_t SAMPLER_COUNT  = 1;
+};
+
 }
 #endif // TNT_FILABRIDGE_SIBGENERATOR_H
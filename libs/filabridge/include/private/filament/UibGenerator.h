@@ -20,6 +20,8 @@
 #include <math/mat4.h>
 #include <math/vec4.h>
 
+#include <stddef.h>
+
 #include <private/filament/EngineEnums.h>
 
 namespace filament {
@@ -33,6 +35,7 @@ public:
     static UniformInterfaceBlock const& getLightsUib() noexcept;
     static UniformInterfaceBlock const& getShadowUib() noexcept;
     static UniformInterfaceBlock const& getPerRenderableBonesUib() noexcept;
+    static UniformInterfaceBlock const& getPerRenderableMorphingUib() noexcept;
 };
 
 /*
@@ -142,10 +145,10 @@ struct alignas(256) PerRenderableUib {
     filament::math::mat3f worldFromModelNormalMatrix; // this gets expanded to 48 bytes during the copy to the UBO
     alignas(16) filament::math::float4 morphWeights;
     // TODO: we can pack all the boolean bellow
-    int32_t skinningEnabled; // 0=disabled, 1=enabled, ignored unless variant & SKINNING_OR_MORPHING
+    int32_t skinningEnabled; // 0=disabled, 1=quaternion bones, 2=3x4 matrix bones, ignored unless variant & SKINNING_OR_MORPHING
     int32_t morphingEnabled; // 0=disabled, 1=enabled, ignored unless variant & SKINNING_OR_MORPHING
     uint32_t screenSpaceContactShadows; // 0=disabled, 1=enabled, ignored unless variant & SKINNING_OR_MORPHING
-    float padding0;
+    int32_t instancingEnabled; // 0=disabled, 1=enabled, ignored unless variant & SKINNING_OR_MORPHING
 };
 
 struct LightsUib {
@@ -168,6 +171,8 @@ struct ShadowUib {
 
     filament::math::mat4f spotLightFromWorldMatrix[CONFIG_MAX_SHADOW_CASTING_SPOTS];
     filament::math::float4 directionShadowBias[CONFIG_MAX_SHADOW_CASTING_SPOTS]; // light direction, normal bias
+    filament::math::mat4f atlasSpotLightFromWorldMatrix[CONFIG_MAX_SHADOW_ATLAS_SPOTS];
+    filament::math::float4 atlasDirectionShadowBias[CONFIG_MAX_SHADOW_ATLAS_SPOTS]; // light direction, normal bias
 };
 
 // This is not the UBO proper, but just an element of a bone array.
@@ -178,6 +183,34 @@ struct PerRenderableUibBone {
     filament::math::float4 ns = { 1, 1, 1, 0 };
 };
 
+// This is not the UBO proper, but just an element of a bone array, for renderables whose bones
+// use the compact format (see RenderableManager::BoneFormat::MATRIX_3X4).
+struct PerRenderableUibBoneMatrix {
+    filament::math::float4 rows[3];     // rows of the affine transform
+};
+
+// This is not the UBO proper, but just an element of the instance array, which is stored in the
+// bones UBO, starting at bone CONFIG_FIRST_INSTANCE_BONE.
+struct PerRenderableUibInstance {
+    filament::math::float4 worldFromModelRows[3]; // rows of the affine world transform
+    filament::math::float4 data;                  // user data
+};
+
+static_assert(sizeof(PerRenderableUibInstance) == sizeof(PerRenderableUibBone),
+        "an instance must take the same space as a bone in the bones UBO");
+
+// The morph targets with a non-zero weight, packed 4 per element of indices and weights. Only
+// the first `count` are used.
+struct PerRenderableMorphingUib {
+    int32_t count;
+    alignas(16) filament::math::int4 indices[CONFIG_MAX_MORPH_TARGET_COUNT / 4];
+    filament::math::float4 weights[CONFIG_MAX_MORPH_TARGET_COUNT / 4];
+};
+
+static_assert(offsetof(PerRenderableMorphingUib, indices) == 16 &&
+        offsetof(PerRenderableMorphingUib, weights) == 16 + sizeof(PerRenderableMorphingUib::indices),
+        "PerRenderableMorphingUib doesn't match the std140 layout of MorphingUniforms");
+
 } // namespace filament
 
 #endif // TNT_FILABRIDGE_UIBGENERATOR_H
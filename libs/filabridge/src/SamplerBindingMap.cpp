@@ -32,11 +32,29 @@ void SamplerBindingMap::populate(const SamplerInterfaceBlock* perMaterialSib,
     uint8_t offset = 0;
     size_t maxSamplerIndex = backend::MAX_SAMPLER_COUNT - 1;
     bool overflow = false;
+
+    // The morph targets sampler is optional, it's only given to materials that have a sampler
+    // left once all the other blocks are counted.
+    size_t requiredSamplerCount = perMaterialSib ? perMaterialSib->getSize() : 0;
+    for (uint8_t blockIndex = 0; blockIndex < filament::BindingPoints::COUNT; blockIndex++) {
+        if (blockIndex != filament::BindingPoints::PER_MATERIAL_INSTANCE &&
+            blockIndex != filament::BindingPoints::PER_RENDERABLE_MORPHING) {
+            filament::SamplerInterfaceBlock const* sib =
+                    filament::SibGenerator::getSib(blockIndex, variantKey);
+            requiredSamplerCount += sib ? sib->getSize() : 0;
+        }
+    }
+    mHasMorphTargets = requiredSamplerCount +
+            filament::PerRenderableMorphingSib::SAMPLER_COUNT <= backend::MAX_SAMPLER_COUNT;
+
     for (uint8_t blockIndex = 0; blockIndex < filament::BindingPoints::COUNT; blockIndex++) {
         mSamplerBlockOffsets[blockIndex] = offset;
         filament::SamplerInterfaceBlock const* sib;
         if (blockIndex == filament::BindingPoints::PER_MATERIAL_INSTANCE) {
             sib = perMaterialSib;
+        } else if (blockIndex == filament::BindingPoints::PER_RENDERABLE_MORPHING &&
+                !mHasMorphTargets) {
+            sib = nullptr;
         } else {
             sib = filament::SibGenerator::getSib(blockIndex, variantKey);
         }
@@ -68,6 +86,9 @@ void SamplerBindingMap::populate(const SamplerInterfaceBlock* perMaterialSib,
             filament::SamplerInterfaceBlock const* sib;
             if (blockIndex == filament::BindingPoints::PER_MATERIAL_INSTANCE) {
                 sib = perMaterialSib;
+            } else if (blockIndex == filament::BindingPoints::PER_RENDERABLE_MORPHING &&
+                    !mHasMorphTargets) {
+                sib = nullptr;
             } else {
                 sib = filament::SibGenerator::getSib(blockIndex, variantKey);
             }
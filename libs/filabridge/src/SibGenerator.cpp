@@ -67,6 +67,22 @@ SamplerInterfaceBlock const& SibGenerator::getPerViewSib(uint8_t variantKey) noe
     return v.hasVsm() ? sibVsm : sibPcf;
 }
 
+SamplerInterfaceBlock const& SibGenerator::getPerRenderableMorphingSib(uint8_t variantKey) noexcept {
+    using Type = SamplerInterfaceBlock::Type;
+    using Format = SamplerInterfaceBlock::Format;
+    using Precision = SamplerInterfaceBlock::Precision;
+
+    // layer 2*i holds the position deltas of target i, layer 2*i+1 its normal deltas
+    static SamplerInterfaceBlock sib = SamplerInterfaceBlock::Builder()
+            .name("Morphing")
+            .add("targets", Type::SAMPLER_2D_ARRAY, Format::FLOAT, Precision::HIGH)
+            .build();
+
+    assert(sib.getSize() == PerRenderableMorphingSib::SAMPLER_COUNT);
+
+    return sib;
+}
+
 SamplerInterfaceBlock const* SibGenerator::getSib(uint8_t bindingPoint, uint8_t variantKey) noexcept {
     switch (bindingPoint) {
         case BindingPoints::PER_VIEW:
@@ -75,6 +91,8 @@ SamplerInterfaceBlock const* SibGenerator::getSib(uint8_t bindingPoint, uint8_t
             return nullptr;
         case BindingPoints::LIGHTS:
             return nullptr;
+        case BindingPoints::PER_RENDERABLE_MORPHING:
+            return &getPerRenderableMorphingSib(variantKey);
         default:
             return nullptr;
     }
@@ -124,7 +124,7 @@ UniformInterfaceBlock const& UibGenerator::getPerRenderableUib() noexcept {
             .add("skinningEnabled", 1, UniformInterfaceBlock::Type::INT)
             .add("morphingEnabled", 1, UniformInterfaceBlock::Type::INT)
             .add("screenSpaceContactShadows", 1, UniformInterfaceBlock::Type::UINT)
-            .add("padding0", 1, UniformInterfaceBlock::Type::FLOAT)
+            .add("instancingEnabled", 1, UniformInterfaceBlock::Type::INT)
             .build();
     return uib;
 }
@@ -142,6 +142,8 @@ UniformInterfaceBlock const& UibGenerator::getShadowUib() noexcept {
             .name("ShadowUniforms")
             .add("spotLightFromWorldMatrix", CONFIG_MAX_SHADOW_CASTING_SPOTS, UniformInterfaceBlock::Type::MAT4, Precision::HIGH)
             .add("directionShadowBias", CONFIG_MAX_SHADOW_CASTING_SPOTS, UniformInterfaceBlock::Type::FLOAT4, Precision::HIGH)
+            .add("atlasSpotLightFromWorldMatrix", CONFIG_MAX_SHADOW_ATLAS_SPOTS, UniformInterfaceBlock::Type::MAT4, Precision::HIGH)
+            .add("atlasDirectionShadowBias", CONFIG_MAX_SHADOW_ATLAS_SPOTS, UniformInterfaceBlock::Type::FLOAT4, Precision::HIGH)
             .build();
     return uib;
 }
@@ -149,7 +151,18 @@ UniformInterfaceBlock const& UibGenerator::getShadowUib() noexcept {
 UniformInterfaceBlock const& UibGenerator::getPerRenderableBonesUib() noexcept {
     static UniformInterfaceBlock uib = UniformInterfaceBlock::Builder()
             .name("BonesUniforms")
-            .add("bones", CONFIG_MAX_BONE_COUNT * 4, UniformInterfaceBlock::Type::FLOAT4, Precision::MEDIUM)
+            // instances store their world transform here, which needs high precision
+            .add("bones", CONFIG_MAX_BONE_COUNT * 4, UniformInterfaceBlock::Type::FLOAT4, Precision::HIGH)
+            .build();
+    return uib;
+}
+
+UniformInterfaceBlock const& UibGenerator::getPerRenderableMorphingUib() noexcept {
+    static UniformInterfaceBlock uib = UniformInterfaceBlock::Builder()
+            .name("MorphingUniforms")
+            .add("count", 1, UniformInterfaceBlock::Type::INT)
+            .add("indices", CONFIG_MAX_MORPH_TARGET_COUNT / 4, UniformInterfaceBlock::Type::INT4)
+            .add("weights", CONFIG_MAX_MORPH_TARGET_COUNT / 4, UniformInterfaceBlock::Type::FLOAT4)
             .build();
     return uib;
 }
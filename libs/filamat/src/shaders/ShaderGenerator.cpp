@@ -184,6 +184,7 @@ std::string ShaderGenerator::createVertexProgram(filament::backend::ShaderModel
     cg.generateProlog(vs, ShaderType::VERTEX, material.hasExternalSamplers);
 
     cg.generateDefine(vs, "MAX_SHADOW_CASTING_SPOTS", uint32_t(CONFIG_MAX_SHADOW_CASTING_SPOTS));
+    cg.generateDefine(vs, "FIRST_INSTANCE_BONE", uint32_t(CONFIG_FIRST_INSTANCE_BONE));
 
     cg.generateDefine(vs, "FLIP_UV_ATTRIBUTE", material.flipUV);
 
@@ -193,6 +194,8 @@ std::string ShaderGenerator::createVertexProgram(filament::backend::ShaderModel
     cg.generateDefine(vs, "HAS_SHADOWING", litVariants && variant.hasShadowReceiver());
     cg.generateDefine(vs, "HAS_SHADOW_MULTIPLIER", material.hasShadowMultiplier);
     cg.generateDefine(vs, "HAS_SKINNING_OR_MORPHING", variant.hasSkinningOrMorphing());
+    cg.generateDefine(vs, "HAS_MORPH_TARGETS",
+            variant.hasSkinningOrMorphing() && material.samplerBindings.hasMorphTargets());
     cg.generateDefine(vs, "HAS_VSM", variant.hasVsm());
     cg.generateDefine(vs, getShadingDefine(material.shading), true);
     generateMaterialDefines(vs, cg, mProperties, mDefines);
@@ -234,10 +237,18 @@ std::string ShaderGenerator::createVertexProgram(filament::backend::ShaderModel
         cg.generateUniforms(vs, ShaderType::VERTEX,
                 BindingPoints::PER_RENDERABLE_BONES,
                 UibGenerator::getPerRenderableBonesUib());
+        cg.generateUniforms(vs, ShaderType::VERTEX,
+                BindingPoints::PER_RENDERABLE_MORPHING,
+                UibGenerator::getPerRenderableMorphingUib());
     }
     cg.generateUniforms(vs, ShaderType::VERTEX,
             BindingPoints::PER_MATERIAL_INSTANCE, material.uib);
     cg.generateSeparator(vs);
+    if (variant.hasSkinningOrMorphing() && material.samplerBindings.hasMorphTargets()) {
+        cg.generateSamplers(vs,
+                material.samplerBindings.getBlockOffset(BindingPoints::PER_RENDERABLE_MORPHING),
+                SibGenerator::getPerRenderableMorphingSib(variantKey));
+    }
     // TODO: should we generate per-view SIB in the vertex shader?
     cg.generateSamplers(vs,
             material.samplerBindings.getBlockOffset(BindingPoints::PER_MATERIAL_INSTANCE),
@@ -416,6 +427,11 @@ std::string ShaderGenerator::createFragmentProgram(filament::backend::ShaderMode
             BindingPoints::PER_RENDERABLE, UibGenerator::getPerRenderableUib());
     cg.generateUniforms(fs, ShaderType::FRAGMENT,
             BindingPoints::LIGHTS, UibGenerator::getLightsUib());
+    if (litVariants && variant.hasShadowReceiver()) {
+        // the light space positions of the atlas shadows are computed per fragment
+        cg.generateUniforms(fs, ShaderType::FRAGMENT,
+                BindingPoints::SHADOW, UibGenerator::getShadowUib());
+    }
     cg.generateUniforms(fs, ShaderType::FRAGMENT,
             BindingPoints::PER_MATERIAL_INSTANCE, material.uib);
     cg.generateSeparator(fs);
@@ -685,7 +685,10 @@ bool ResourceLoader::Impl::createTextures(bool async) {
         return true;
     }
 
+    // Decoding is background work, it must not delay the engine's per-frame jobs. The decoding
+    // jobs inherit the priority of their parent.
     JobSystem::Job* parent = js->createJob();
+    js->setPriority(parent, JobSystem::JobPriority::LOW);
 
     // Create a copy of the shared_ptr to the source data to prevent it from being freed during
     // the texture decoding process.
@@ -21,6 +21,10 @@
 
 #include <benchmark/benchmark.h>
 
+#include <atomic>
+#include <chrono>
+#include <thread>
+
 using namespace utils;
 
 
@@ -78,7 +82,72 @@ static void BM_JobSystemParallelFor(benchmark::State& state) {
     js.emancipate();
 }
 
+// Measures how long it takes for a job to start running while all the threads are busy with
+// background (LOW priority) work. range(0) is the priority of the measured job.
+static void BM_JobSystemPriorityLatency(benchmark::State& state) {
+    using clock = std::chrono::steady_clock;
+
+    const auto priority = JobSystem::JobPriority(state.range(0));
+    JobSystem js;
+    js.adopt();
+
+    // enough background work to keep all threads busy while we measure
+    const size_t backgroundJobCount = 64 * (js.getThreadCount() + 1);
+
+    struct Background {
+        void operator()(JobSystem&, JobSystem::Job*) {
+            auto end = clock::now() + std::chrono::microseconds(20);
+            while (clock::now() < end) {
+            }
+        }
+    };
+
+    struct Probe {
+        std::atomic<bool>* started;
+        clock::time_point* time;
+        void operator()(JobSystem&, JobSystem::Job*) {
+            *time = clock::now();
+            started->store(true, std::memory_order_release);
+        }
+    };
+
+    for (auto _ : state) {
+        JobSystem::Job* background = js.createJob();
+        js.setPriority(background, JobSystem::JobPriority::LOW);
+        for (size_t i = 0; i < backgroundJobCount; i++) {
+            js.run(js.createJob(background, Background{}), JobSystem::DONT_SIGNAL);
+        }
+        background = js.runAndRetain(background);
+
+        // give the threads a chance to pick-up the background work
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+
+        std::atomic<bool> started = { false };
+        clock::time_point time;
+        JobSystem::Job* probe = js.createJob(nullptr, Probe{ &started, &time });
+        js.setPriority(probe, priority);
+
+        // don't execute jobs on this thread, the probe must be picked-up by another thread
+        const auto start = clock::now();
+        probe = js.runAndRetain(probe);
+        while (!started.load(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+        state.SetIterationTime(std::chrono::duration<double>(time - start).count());
+
+        js.waitAndRelease(probe);
+        js.waitAndRelease(background);
+    }
+
+    js.emancipate();
+}
+
 
 BENCHMARK(BM_JobSystem);
 BENCHMARK(BM_JobSystemAsChildren4k);
 BENCHMARK(BM_JobSystemParallelFor);
+BENCHMARK(BM_JobSystemPriorityLatency)
+        ->Arg(int(JobSystem::JobPriority::HIGH))
+        ->Arg(int(JobSystem::JobPriority::LOW))
+        ->Iterations(1000)  // the measured time is a small fraction of each iteration
+        ->UseManualTime();
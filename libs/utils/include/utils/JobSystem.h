@@ -21,11 +21,13 @@
 
 #include <atomic>
 #include <functional>
+#include <memory>
 #include <thread>
 #include <vector>
 
 #include <tsl/robin_map.h>
 
+#include <utils/algorithm.h>
 #include <utils/Allocator.h>
 #include <utils/architecture.h>
 #include <utils/compiler.h>
@@ -39,15 +41,38 @@
 namespace utils {
 
 class JobSystem {
-    static constexpr size_t MAX_JOB_COUNT = 4096;
-    static_assert(MAX_JOB_COUNT <= 0x7FFE, "MAX_JOB_COUNT must be <= 0x7FFE");
-    using WorkQueue = WorkStealingDequeue<uint16_t, MAX_JOB_COUNT>;
+    // Jobs are allocated from segments of growing sizes, segment k holds JOB_SEGMENT_SIZE << k
+    // jobs. Only the first segment is allocated upfront, job ids are contiguous across segments.
+    static constexpr uint32_t JOB_SEGMENT_SIZE = 4096;
+    static constexpr uint32_t MAX_JOB_SEGMENT_COUNT = 11;
+    static constexpr uint32_t MAX_JOB_COUNT =
+            JOB_SEGMENT_SIZE * ((1u << MAX_JOB_SEGMENT_COUNT) - 1u);
+    // Job ids are stored in 23 bits (Job::parent) to keep a Job in a cache line, this limits
+    // MAX_JOB_COUNT to about 8M jobs.
+    static constexpr uint32_t INVALID_JOB_ID = 0x7FFFFF;
+    static_assert(MAX_JOB_COUNT <= INVALID_JOB_ID, "MAX_JOB_COUNT must be < 2^23");
+
+    // A job that can't be added to a full WorkQueue is spilled to mSpilledJobs
+    static constexpr uint32_t WORK_QUEUE_SIZE = 4096;
+    using WorkQueue = WorkStealingDequeue<uint32_t, WORK_QUEUE_SIZE>;
 
 public:
     class Job;
 
     using JobFunc = void(*)(void*, JobSystem&, Job*);
 
+    /*
+     * Jobs are queued in one lane per priority, and threads always drain the HIGH lane (their
+     * own and other threads') before running LOW priority jobs.
+     * HIGH is the default and should be used for latency-critical work (e.g. per-frame
+     * jobs). Background work (e.g. texture decoding) should use LOW, so it doesn't delay the
+     * former.
+     */
+    enum class JobPriority : uint8_t {
+        HIGH,
+        LOW
+    };
+
     class alignas(CACHELINE_SIZE) Job {
     public:
         Job() noexcept {} /* = default; */ /* clang bug */ // NOLINT(modernize-use-equals-default,cppcoreguidelines-pro-type-member-init)
@@ -69,13 +94,19 @@ public:
                                                                 // v7 | v8
         void* storage[JOB_STORAGE_SIZE_WORDS];                  // 48 | 48
         JobFunc function;                                       //  4 |  8
-        uint16_t parent;                                        //  2 |  2
-        std::atomic<uint16_t> runningJobCount = { 1 };          //  2 |  2
+        uint32_t parent : 23;                                   //  3 |  3 (see INVALID_JOB_ID)
+        uint32_t hasSuccessors : 1;                             //    |
+        uint32_t priority : 1;                                  //  1 |  1
+        uint32_t affinity : 6;                                  //    |
+        uint32_t continuation : 1;                              //    |
+        std::atomic<uint16_t> runningJobCount = { 1 };          //  2 |  2 (65535 children max)
         mutable std::atomic<uint16_t> refCount = { 1 };         //  2 |  2
-                                                                //  6 |  2 (padding)
+                                                                //  4 |  0 (padding)
                                                                 // 64 | 64
     };
 
+    static_assert(sizeof(Job) == CACHELINE_SIZE, "a Job must fit in a cache line");
+
     explicit JobSystem(size_t threadCount = 0, size_t adoptableThreadsCount = 1) noexcept;
 
     ~JobSystem();
@@ -101,6 +132,68 @@ public:
 
     Job* create(Job* parent, JobFunc func) noexcept;
 
+    /*
+     * Sets the priority of a job. Must be called before the job is run.
+     * By default, jobs inherit the priority of their parent, or are HIGH priority.
+     */
+    void setPriority(Job* job, JobPriority priority) noexcept {
+        job->priority = uint32_t(priority);
+    }
+
+    /*
+     * Pins a job to one of the JobSystem's own threads, in [0, getThreadCount()). A pinned job
+     * can't be stolen by other threads and always wakes its thread up when run. Must be called
+     * before the job is run. Children of a pinned job are not pinned.
+     */
+    void setAffinity(Job* job, size_t threadIndex) noexcept {
+        assert(threadIndex < mThreadCount);
+        job->affinity = uint8_t(threadIndex);
+    }
+
+    /*
+     * Makes a job a continuation of its children: instead of being queued by run(), the job
+     * is queued once all its children have completed, by the thread that completed the last
+     * one. No thread blocks waiting for the children, which allows a DAG of jobs to be
+     * expressed without calls to runAndWait().
+     *
+     * Must be called before any of the job's children is run. The job must still be run()
+     * (typically after its children), and can be waited on like any other job.
+     *
+     *  Job* c = js.createJob(nullptr, ...);    // runs after a and b
+     *  js.setContinuation(c);
+     *  js.run(js.createJob(c, a));
+     *  js.run(js.createJob(c, b));
+     *  js.run(c);
+     */
+    void setContinuation(Job* job) noexcept {
+        assert(!job->continuation);
+        job->continuation = 1;
+        // this reference is dropped by run(), so the job can't be queued before that
+        job->runningJobCount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /*
+     * Makes a continuation also wait on a job that is not one of its children. A job can have
+     * any number of successors and a continuation any number of predecessors, which allows
+     * graphs where a job feeds several continuations (e.g. a diamond a -> (b, c) -> d, where b
+     * and c are continuations of a, and d of both b and c).
+     *
+     * successor must be a continuation, and this must be called before either job is run().
+     * Like a child, a predecessor holds the successor's completion, so waiting on the successor
+     * also waits for it.
+     *
+     *  Job* b = js.createJob(nullptr, ...);    // runs after a
+     *  Job* c = js.createJob(nullptr, ...);    // runs after a
+     *  js.setContinuation(b);
+     *  js.setContinuation(c);
+     *  js.addSuccessor(a, b);
+     *  js.addSuccessor(a, c);
+     *  js.run(a);
+     *  js.run(b);
+     *  js.run(c);
+     */
+    void addSuccessor(Job* job, Job* successor) noexcept;
+
     // NOTE: All methods below must be called from the same thread and that thread must be
     // owned by JobSystem's thread pool.
 
@@ -220,6 +313,7 @@ public:
 
     /*
      * Jobs are normally finished automatically, this can be used to cancel a job before it is run.
+     * A cancelled continuation still completes after its children, but doesn't run.
      *
      * Never use this once a flavor of run() has been called.
      */
@@ -313,6 +407,11 @@ public:
         return mParallelSplitCount;
     }
 
+    // number of threads owned by the JobSystem, not counting adopted threads
+    size_t getThreadCount() const noexcept {
+        return mThreadCount;
+    }
+
 private:
     // this is just to avoid using std::default_random_engine, since we're in a public header.
     class default_random_engine {
@@ -327,9 +426,25 @@ private:
         }
     };
 
-    struct alignas(CACHELINE_SIZE) ThreadState {    // this causes 40-bytes padding
+    static constexpr size_t PRIORITY_COUNT = 2;
+    static constexpr uint8_t NO_AFFINITY = 0x3F;            // Job::affinity is 6 bits
+
+    // A FIFO of jobs, unlike a WorkQueue any thread can add jobs to it and it grows as needed.
+    // It holds the jobs pinned to a thread, which are only ever removed by that thread, and the
+    // jobs that didn't fit in a full WorkQueue, which any thread can remove.
+    struct JobQueue {
+        utils::SpinLock lock;
+        std::atomic<uint32_t> count = { 0 };
+        uint32_t head = 0;
+        std::vector<uint32_t> jobs;
+    };
+
+    struct alignas(CACHELINE_SIZE) ThreadState {
         // make sure storage is cache-line aligned
-        WorkQueue workQueue;
+        WorkQueue workQueues[PRIORITY_COUNT];
+
+        alignas(CACHELINE_SIZE)
+        JobQueue pinnedQueues[PRIORITY_COUNT];
 
         // these are not accessed by the worker threads
         alignas(CACHELINE_SIZE)     // this causes 56-bytes padding
@@ -348,34 +463,99 @@ private:
     void decRef(Job const* job) noexcept;
 
     Job* allocateJob() noexcept;
+    bool growJobStorage(uint32_t segmentCount) noexcept;
     JobSystem::ThreadState* getStateToStealFrom(JobSystem::ThreadState& state) noexcept;
     bool hasJobCompleted(Job const* job) noexcept;
 
     void requestExit() noexcept;
     bool exitRequested() const noexcept;
     bool hasActiveJobs() const noexcept;
+    bool hasActiveJobs(size_t priority) const noexcept;
+    static bool hasPinnedJobs(ThreadState const& state) noexcept;
 
     void loop(ThreadState* state) noexcept;
     bool execute(JobSystem::ThreadState& state) noexcept;
-    Job* steal(JobSystem::ThreadState& state) noexcept;
+    Job* steal(JobSystem::ThreadState& state, size_t priority) noexcept;
     void finish(Job* job) noexcept;
+    void finishSuccessors(Job const* job) noexcept;
+    void schedule(ThreadState& state, Job* job, uint32_t flags) noexcept;
+
+    void push(JobQueue& jobQueue, Job* job) noexcept;
+    Job* pop(JobQueue& jobQueue) noexcept;
+
+    using JobPool = utils::Arena<utils::ThreadSafeObjectPoolAllocator<Job>,
+            LockingPolicy::NoLock>;
+
+    struct JobSegment {
+        Job* base = nullptr;        // first job of the segment, base for conversion to ids
+        uint32_t firstId = 0;       // id of 'base'
+        uint32_t size = 0;          // number of jobs in this segment
+        JobPool* pool = nullptr;
+    };
 
-    void put(WorkQueue& workQueue, Job* job) noexcept {
-        size_t index = job - mJobStorageBase;
-        assert(index >= 0 && index < MAX_JOB_COUNT);
-        workQueue.push(uint16_t(index + 1));
+    // segment of a job given its id
+    static uint32_t getSegmentIndex(uint32_t id) noexcept {
+        // segment k starts at id JOB_SEGMENT_SIZE * (2^k - 1)
+        const uint32_t n = id / JOB_SEGMENT_SIZE + 1u;
+        return 31u - utils::clz(n);
+    }
+
+    Job* getJob(uint32_t id) noexcept {
+        if (UTILS_LIKELY(id < JOB_SEGMENT_SIZE)) {
+            return &mJobStorageBase[id];
+        }
+        JobSegment const& segment = mJobSegments[getSegmentIndex(id)];
+        return &segment.base[id - segment.firstId];
+    }
+
+    // index of 'job' in 'base', wraps around if 'job' is before 'base'
+    static size_t offsetOf(Job const* job, Job const* base) noexcept {
+        return (uintptr_t(job) - uintptr_t(base)) / sizeof(Job);
+    }
+
+    JobSegment const& getSegment(Job const* job) const noexcept {
+        // fast path: the first segment
+        if (UTILS_LIKELY(offsetOf(job, mJobStorageBase) < JOB_SEGMENT_SIZE)) {
+            return mJobSegments[0];
+        }
+        const uint32_t count = mJobSegmentCount.load(std::memory_order_acquire);
+        for (uint32_t i = 1; i < count; i++) {
+            JobSegment const& segment = mJobSegments[i];
+            if (offsetOf(job, segment.base) < segment.size) {
+                return segment;
+            }
+        }
+        assert(false);
+        return mJobSegments[0];
+    }
+
+    uint32_t getJobId(Job const* job) const noexcept {
+        JobSegment const& segment = getSegment(job);
+        return segment.firstId + uint32_t(offsetOf(job, segment.base));
+    }
+
+    // returns false if the queue is full
+    bool put(WorkQueue& workQueue, Job* job) noexcept {
+        // getCount() can only overestimate the count, since other threads only remove items
+        if (UTILS_UNLIKELY(workQueue.getCount() >= workQueue.getSize())) {
+            return false;
+        }
+        const uint32_t id = getJobId(job);
+        assert(id < MAX_JOB_COUNT);
+        workQueue.push(id + 1u);
+        return true;
     }
 
     Job* pop(WorkQueue& workQueue) noexcept {
-        size_t index = workQueue.pop();
-        assert(index <= MAX_JOB_COUNT);
-        return !index ? nullptr : &mJobStorageBase[index - 1];
+        uint32_t id = workQueue.pop();
+        assert(id <= MAX_JOB_COUNT);
+        return !id ? nullptr : getJob(id - 1u);
     }
 
     Job* steal(WorkQueue& workQueue) noexcept {
-        size_t index = workQueue.steal();
-        assert(index <= MAX_JOB_COUNT);
-        return !index ? nullptr : &mJobStorageBase[index - 1];
+        uint32_t id = workQueue.steal();
+        assert(id <= MAX_JOB_COUNT);
+        return !id ? nullptr : getJob(id - 1u);
     }
 
     void wait(std::unique_lock<Mutex>& lock) noexcept;
@@ -386,8 +566,20 @@ private:
     utils::Condition mWaiterCondition;
     uint32_t mWaiterCount = 0;
 
-    std::atomic<uint32_t> mActiveJobs = { 0 };
-    utils::Arena<utils::ThreadSafeObjectPoolAllocator<Job>, LockingPolicy::NoLock> mJobPool;
+    // number of jobs in the WorkQueues and mSpilledJobs of each priority (i.e. not counting
+    // pinned jobs)
+    std::atomic<uint32_t> mActiveJobs[PRIORITY_COUNT] = {};
+
+    // jobs that didn't fit in the WorkQueue of the thread that ran them
+    JobQueue mSpilledJobs[PRIORITY_COUNT];
+    JobPool mJobPool;                                   // first segment
+
+    // Segments are never freed until the JobSystem is destroyed, new ones are published by
+    // incrementing mJobSegmentCount.
+    std::atomic<uint32_t> mJobSegmentCount = { 1 };
+    JobSegment mJobSegments[MAX_JOB_SEGMENT_COUNT];
+    std::unique_ptr<JobPool> mJobSegmentPools[MAX_JOB_SEGMENT_COUNT];
+    utils::Mutex mJobSegmentLock;
 
     template <typename T>
     using aligned_vector = std::vector<T, utils::STLAlignedAllocator<T>>;
@@ -402,13 +594,17 @@ private:
     aligned_vector<ThreadState> mThreadStates;          // actual data is stored offline
     std::atomic<bool> mExitRequested = { false };       // this one is almost never written
     std::atomic<uint16_t> mAdoptedThreads = { 0 };      // this one is almost never written
-    Job* const mJobStorageBase;                         // Base for conversion to indices
+    Job* const mJobStorageBase;                         // Base of the first segment
     uint16_t mThreadCount = 0;                          // total # of threads in the pool
     uint8_t mParallelSplitCount = 0;                    // # of split allowable in parallel_for
     Job* mRootJob = nullptr;
 
     utils::SpinLock mThreadMapLock; // this should have very little contention
     tsl::robin_map<std::thread::id, ThreadState *> mThreadMap;
+
+    // successors of the jobs that have Job::hasSuccessors set, taken out when the job completes
+    utils::SpinLock mSuccessorsLock;
+    tsl::robin_map<uint32_t, std::vector<Job*>> mSuccessors;
 };
 
 // -------------------------------------------------------------------------------------------------
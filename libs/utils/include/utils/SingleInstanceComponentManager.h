@@ -104,6 +104,13 @@ public:
         return getComponentCount() == 0;
     }
 
+    // Incremented each time a component is added, removed or moved, i.e. whenever an Instance
+    // obtained from getInstance() may have become invalid, or an Entity may have gained a
+    // component. This allows users to cache Instances.
+    uint32_t getLayoutVersion() const noexcept {
+        return mLayoutVersion;
+    }
+
     // returns a pointer to the Entity array. This is basically the list
     // of entities this component manager handles.
     // The pointer becomes invalid when adding or removing a component.
@@ -227,6 +234,7 @@ protected:
             if (ej) {
                 map[ej] = j;
             }
+            mLayoutVersion++;
         }
     }
 
@@ -258,6 +266,7 @@ private:
     // maps an entity to an instance index
     tsl::robin_map<Entity, Instance> mInstanceMap;
     default_random_engine mRng;
+    uint32_t mLayoutVersion = 0;
 };
 
 // Keep these outside of the class because CLion has trouble parsing them
@@ -272,6 +281,7 @@ SingleInstanceComponentManager<Elements ...>::addComponent(Entity e) {
             // index 0 is used when the component doesn't exist
             ci = Instance(mData.size() - 1);
             mInstanceMap[e] = ci;
+            mLayoutVersion++;
         } else {
             // if the entity already has this component, just return its instance
             ci = mInstanceMap[e];
@@ -303,6 +313,7 @@ SingleInstanceComponentManager<Elements ... >::removeComponent(Entity e) {
         }
         mData.pop_back();
         map.erase(pos);
+        mLayoutVersion++;
         return last;
     }
     return 0;
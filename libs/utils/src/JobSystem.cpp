@@ -24,6 +24,8 @@
 #include <utils/JobSystem.h>
 
 #include <cmath>
+#include <limits>
+#include <new>
 #include <random>
 
 #include <utils/compiler.h>
@@ -104,11 +106,13 @@ void JobSystem::setThreadAffinityById(size_t id) noexcept {
 }
 
 JobSystem::JobSystem(const size_t userThreadCount, const size_t adoptableThreadsCount) noexcept
-    : mJobPool("JobSystem Job pool", MAX_JOB_COUNT * sizeof(Job)),
+    : mJobPool("JobSystem Job pool", JOB_SEGMENT_SIZE * sizeof(Job)),
       mJobStorageBase(static_cast<Job *>(mJobPool.getAllocator().getCurrent()))
 {
     SYSTRACE_ENABLE();
 
+    mJobSegments[0] = { mJobStorageBase, 0, JOB_SEGMENT_SIZE, &mJobPool };
+
     int threadPoolCount = userThreadCount;
     if (threadPoolCount == 0) {
         // default value, system dependant
@@ -184,7 +188,7 @@ void JobSystem::decRef(Job const* job) noexcept {
     assert(c > 0);
     if (c == 1) {
         // This was the last reference, it's safe to destroy the job.
-        mJobPool.destroy(job);
+        getSegment(job).pool->destroy(job);
     }
 }
 
@@ -201,7 +205,23 @@ inline bool JobSystem::exitRequested() const noexcept {
 }
 
 inline bool JobSystem::hasActiveJobs() const noexcept {
-    return mActiveJobs.load(std::memory_order_relaxed) > 0;
+    bool active = false;
+    for (size_t p = 0; p < PRIORITY_COUNT; p++) {
+        active = active || hasActiveJobs(p);
+    }
+    return active;
+}
+
+inline bool JobSystem::hasActiveJobs(size_t priority) const noexcept {
+    return mActiveJobs[priority].load(std::memory_order_relaxed) > 0;
+}
+
+inline bool JobSystem::hasPinnedJobs(ThreadState const& state) noexcept {
+    bool pinned = false;
+    for (size_t p = 0; p < PRIORITY_COUNT; p++) {
+        pinned = pinned || state.pinnedQueues[p].count.load(std::memory_order_relaxed) > 0;
+    }
+    return pinned;
 }
 
 inline bool JobSystem::hasJobCompleted(JobSystem::Job const* job) noexcept {
@@ -230,7 +250,56 @@ inline JobSystem::ThreadState& JobSystem::getState() noexcept {
 }
 
 JobSystem::Job* JobSystem::allocateJob() noexcept {
-    return mJobPool.make<Job>();
+    // fast path: the first segment
+    Job* job = mJobPool.make<Job>();
+    if (UTILS_LIKELY(job)) {
+        return job;
+    }
+
+    uint32_t count = mJobSegmentCount.load(std::memory_order_acquire);
+    do {
+        for (uint32_t i = 1; i < count && !job; i++) {
+            job = mJobSegments[i].pool->make<Job>();
+        }
+        if (job) {
+            break;
+        }
+        // all segments are full, add a new one (or see the one another thread just added)
+        if (!growJobStorage(count)) {
+            break;
+        }
+        count = mJobSegmentCount.load(std::memory_order_acquire);
+    } while (true);
+    return job;
+}
+
+UTILS_NOINLINE
+bool JobSystem::growJobStorage(uint32_t segmentCount) noexcept {
+    std::lock_guard<Mutex> lock(mJobSegmentLock);
+    const uint32_t count = mJobSegmentCount.load(std::memory_order_relaxed);
+    if (count != segmentCount) {
+        // another thread added a segment already
+        return true;
+    }
+    if (UTILS_UNLIKELY(count == MAX_JOB_SEGMENT_COUNT)) {
+        return false;
+    }
+
+    SYSTRACE_CALL();
+
+    const uint32_t size = JOB_SEGMENT_SIZE << count;
+    std::unique_ptr<JobPool> pool(new(std::nothrow) JobPool("JobSystem Job pool", size * sizeof(Job)));
+    if (UTILS_UNLIKELY(!pool || !pool->getAllocator().getCurrent())) {
+        return false;
+    }
+
+    Job* const base = static_cast<Job*>(pool->getAllocator().getCurrent());
+    mJobSegments[count] = { base, JOB_SEGMENT_SIZE * ((1u << count) - 1u), size, pool.get() };
+    mJobSegmentPools[count] = std::move(pool);
+
+    // publish the new segment
+    mJobSegmentCount.store(count + 1, std::memory_order_release);
+    return true;
 }
 
 inline JobSystem::ThreadState* JobSystem::getStateToStealFrom(JobSystem::ThreadState& state) noexcept {
@@ -255,35 +324,76 @@ inline JobSystem::ThreadState* JobSystem::getStateToStealFrom(JobSystem::ThreadS
     return stateToStealFrom;
 }
 
-JobSystem::Job* JobSystem::steal(JobSystem::ThreadState& state) noexcept {
+JobSystem::Job* JobSystem::steal(JobSystem::ThreadState& state, size_t priority) noexcept {
     HEAVY_SYSTRACE_CALL();
     Job* job = nullptr;
     do {
         ThreadState* const stateToStealFrom = getStateToStealFrom(state);
         if (UTILS_LIKELY(stateToStealFrom)) {
-            job = steal(stateToStealFrom->workQueue);
+            job = steal(stateToStealFrom->workQueues[priority]);
+        }
+        if (UTILS_UNLIKELY(!job)) {
+            // the active jobs could be the ones that didn't fit in a WorkQueue
+            job = pop(mSpilledJobs[priority]);
         }
         // nullptr -> nothing to steal in that queue either, if there are active jobs,
         // continue to try stealing one.
-    } while (!job && hasActiveJobs());
+    } while (!job && hasActiveJobs(priority));
     return job;
 }
 
+void JobSystem::push(JobQueue& jobQueue, Job* job) noexcept {
+    const uint32_t id = getJobId(job);
+    assert(id < MAX_JOB_COUNT);
+    std::lock_guard<utils::SpinLock> lock(jobQueue.lock);
+    jobQueue.jobs.push_back(id);
+    jobQueue.count.fetch_add(1, std::memory_order_relaxed);
+}
+
+JobSystem::Job* JobSystem::pop(JobQueue& jobQueue) noexcept {
+    if (UTILS_LIKELY(!jobQueue.count.load(std::memory_order_relaxed))) {
+        return nullptr;
+    }
+    std::lock_guard<utils::SpinLock> lock(jobQueue.lock);
+    // another thread could have emptied the queue (it can't happen with pinned jobs)
+    if (UTILS_UNLIKELY(jobQueue.head == jobQueue.jobs.size())) {
+        return nullptr;
+    }
+    const uint32_t id = jobQueue.jobs[jobQueue.head++];
+    if (jobQueue.head == jobQueue.jobs.size()) {
+        jobQueue.jobs.clear();
+        jobQueue.head = 0;
+    }
+    jobQueue.count.fetch_sub(1, std::memory_order_relaxed);
+    return getJob(id);
+}
+
 bool JobSystem::execute(JobSystem::ThreadState& state) noexcept {
     HEAVY_SYSTRACE_CALL();
 
-    Job* job = pop(state.workQueue);
-    if (UTILS_UNLIKELY(job == nullptr)) {
-        // our queue is empty, try to steal a job
-        job = steal(state);
+    // drain the lanes in priority order, our pinned jobs first since nobody else can run them
+    Job* job = nullptr;
+    for (size_t p = 0; p < PRIORITY_COUNT && !job; p++) {
+        job = pop(state.pinnedQueues[p]);
+        if (job) {
+            break;
+        }
+
+        job = pop(state.workQueues[p]);
+        if (UTILS_UNLIKELY(job == nullptr)) {
+            // our queue is empty, try to steal a job
+            job = steal(state, p);
+        }
+
+        if (job) {
+            UTILS_UNUSED_IN_RELEASE
+            uint32_t activeJobs = mActiveJobs[p].fetch_sub(1, std::memory_order_relaxed);
+            assert(activeJobs); // whoops, we were already at 0
+            HEAVY_SYSTRACE_VALUE32("JobSystem::activeJobs", activeJobs - 1);
+        }
     }
 
     if (job) {
-        UTILS_UNUSED_IN_RELEASE
-        uint32_t activeJobs = mActiveJobs.fetch_sub(1, std::memory_order_relaxed);
-        assert(activeJobs); // whoops, we were already at 0
-        HEAVY_SYSTRACE_VALUE32("JobSystem::activeJobs", activeJobs - 1);
-
         if (UTILS_LIKELY(job->function)) {
             HEAVY_SYSTRACE_NAME("job->function");
             job->function(job->storage, *this, job);
@@ -311,7 +421,7 @@ void JobSystem::loop(ThreadState* state) noexcept {
     do {
         if (!execute(*state)) {
             std::unique_lock<Mutex> lock(mWaiterLock);
-            while (!exitRequested() && !hasActiveJobs()) {
+            while (!exitRequested() && !hasActiveJobs() && !hasPinnedJobs(*state)) {
                 wait(lock);
                 setThreadAffinityById(state->id);
             }
@@ -326,7 +436,6 @@ void JobSystem::finish(Job* job) noexcept {
     bool notify = false;
 
     // terminate this job and notify its parent
-    Job* const storage = mJobStorageBase;
     do {
         // std::memory_order_release here is needed to synchronize with JobSystem::wait()
         // which needs to "see" all changes that happened before the job terminated.
@@ -335,11 +444,20 @@ void JobSystem::finish(Job* job) noexcept {
         if (runningJobCount == 1) {
             // no more work, destroy this job and notify its parent
             notify = true;
-            Job* const parent = job->parent == 0x7FFF ? nullptr : &storage[job->parent];
+            if (UTILS_UNLIKELY(job->hasSuccessors)) {
+                finishSuccessors(job);
+            }
+            Job* const parent = job->parent == INVALID_JOB_ID ? nullptr : getJob(job->parent);
             decRef(job);
             job = parent;
         } else {
             // there is still work (e.g.: children), we're done.
+            if (runningJobCount == 2 && job->continuation) {
+                // This was the last child of a continuation that has already been run() (until
+                // then it holds an extra reference), so it's now our job to queue it.
+                job->continuation = 0;
+                schedule(getState(), job, 0);
+            }
             break;
         }
     } while (job);
@@ -350,15 +468,31 @@ void JobSystem::finish(Job* job) noexcept {
     }
 }
 
+UTILS_NOINLINE
+void JobSystem::finishSuccessors(Job const* job) noexcept {
+    std::vector<Job*> successors;
+    {
+        std::lock_guard<utils::SpinLock> lock(mSuccessorsLock);
+        auto pos = mSuccessors.find(getJobId(job));
+        assert(pos != mSuccessors.end());
+        successors = std::move(pos.value());
+        mSuccessors.erase(pos);
+    }
+    // for each successor this is the same as a child completing, the last one queues it
+    for (Job* successor : successors) {
+        finish(successor);
+    }
+}
+
 // -----------------------------------------------------------------------------------------------
 // public API...
 
 
 JobSystem::Job* JobSystem::create(JobSystem::Job* parent, JobFunc func) noexcept {
     parent = (parent == nullptr) ? mRootJob : parent;
-    Job* const job = allocateJob();
+    Job* job = allocateJob();
     if (UTILS_LIKELY(job)) {
-        size_t index = 0x7FFF;
+        uint32_t id = INVALID_JOB_ID;
         if (parent) {
             // add a reference to the parent to make sure it can't be terminated.
             // memory_order_relaxed is safe because no action is taken at this point
@@ -368,16 +502,47 @@ JobSystem::Job* JobSystem::create(JobSystem::Job* parent, JobFunc func) noexcept
             // can't create a child job of a terminated parent
             assert(parentJobCount > 0);
 
-            index = parent - mJobStorageBase;
-            assert(index < MAX_JOB_COUNT);
+            if (UTILS_UNLIKELY(parentJobCount == std::numeric_limits<uint16_t>::max())) {
+                // the parent has too many running children, we must fail, just like when we
+                // run out of jobs. the counter wrapped to zero, but nobody can observe it since
+                // the parent can't finish while it has children.
+                parent->runningJobCount.fetch_sub(1, std::memory_order_relaxed);
+                decRef(job);
+                return nullptr;
+            }
+
+            id = getJobId(parent);
+            assert(id < MAX_JOB_COUNT);
         }
         job->function = func;
-        job->parent = uint16_t(index);
+        job->parent = id;
+        job->priority = parent ? parent->priority : uint32_t(JobPriority::HIGH);
+        job->affinity = NO_AFFINITY;
+        job->continuation = 0;
+        job->hasSuccessors = 0;
     }
     return job;
 }
 
+void JobSystem::addSuccessor(Job* job, Job* successor) noexcept {
+    assert(successor->continuation);
+    // this is released when job completes, like a child of successor
+    UTILS_UNUSED_IN_RELEASE auto count =
+            successor->runningJobCount.fetch_add(1, std::memory_order_relaxed);
+    assert(count < std::numeric_limits<uint16_t>::max());
+    job->hasSuccessors = 1;
+    std::lock_guard<utils::SpinLock> lock(mSuccessorsLock);
+    mSuccessors[getJobId(job)].push_back(successor);
+}
+
 void JobSystem::cancel(Job*& job) noexcept {
+    if (UTILS_UNLIKELY(job->continuation)) {
+        // children may still be running, so the job can't be finished here. Instead it will
+        // complete without running, after its children.
+        job->function = nullptr;
+        run(job);
+        return;
+    }
     finish(job);
     job = nullptr;
 }
@@ -402,12 +567,48 @@ void JobSystem::run(JobSystem::Job*& job, uint32_t flags) noexcept {
 
     ThreadState& state(getState());
 
+    if (UTILS_UNLIKELY(job->continuation)) {
+        // drop the reference taken by setContinuation(), if all the children have already
+        // completed, the job is ready to go. Otherwise the last child will queue it.
+        auto runningJobCount = job->runningJobCount.fetch_sub(1, std::memory_order_acq_rel);
+        assert(runningJobCount > 1);
+        if (runningJobCount == 2) {
+            job->continuation = 0;
+            schedule(state, job, flags);
+        }
+        // after run() returns, the job is virtually invalid (it'll die on its own)
+        job = nullptr;
+        return;
+    }
+
+    schedule(state, job, flags);
+
+    // after run() returns, the job is virtually invalid (it'll die on its own)
+    job = nullptr;
+}
+
+void JobSystem::schedule(ThreadState& state, Job* job, uint32_t flags) noexcept {
+    const size_t priority = size_t(job->priority);
+    assert(priority < PRIORITY_COUNT);
+
+    if (UTILS_UNLIKELY(job->affinity != NO_AFFINITY)) {
+        // pinned jobs don't count as active jobs, since other threads can't steal them.
+        push(mThreadStates[job->affinity].pinnedQueues[priority], job);
+        // we don't know if the pinned thread is awake, so we always signal
+        wake();
+        return;
+    }
+
     // increase the active job count before we add the job to the queue, because otherwise
     // the job could run and finish before the counter is incremented, which would trigger
     // an assert() in execute(). Either way, it's not "wrong", but the assert() is useful.
-    uint32_t activeJobs = mActiveJobs.fetch_add(1, std::memory_order_relaxed);
+    uint32_t activeJobs = mActiveJobs[priority].fetch_add(1, std::memory_order_relaxed);
 
-    put(state.workQueue, job);
+    if (UTILS_UNLIKELY(!put(state.workQueues[priority], job))) {
+        // our queue is full, the job is spilled where any thread can pick it up. It's still an
+        // active job, so threads keep looking for it.
+        push(mSpilledJobs[priority], job);
+    }
 
     HEAVY_SYSTRACE_VALUE32("JobSystem::activeJobs", activeJobs + 1);
 
@@ -417,9 +618,6 @@ void JobSystem::run(JobSystem::Job*& job, uint32_t flags) noexcept {
         // especially if DONT_SIGNAL was used
         wake();
     }
-
-    // after run() returns, the job is virtually invalid (it'll die on its own)
-    job = nullptr;
 }
 
 JobSystem::Job* JobSystem::runAndRetain(JobSystem::Job* job, uint32_t flags) noexcept {
@@ -452,7 +650,8 @@ void JobSystem::waitAndRelease(Job*& job) noexcept {
             // continue to handle more jobs, as they get added.
 
             std::unique_lock<Mutex> lock(mWaiterLock);
-            if (!hasJobCompleted(job) && !hasActiveJobs() && !exitRequested()) {
+            if (!hasJobCompleted(job) && !hasActiveJobs() && !hasPinnedJobs(state) &&
+                    !exitRequested()) {
                 wait(lock);
             }
         }
@@ -516,7 +715,13 @@ void JobSystem::emancipate() {
 
 io::ostream& operator<<(io::ostream& out, JobSystem const& js) {
     for (auto const& item : js.mThreadStates) {
-        out << size_t(item.id) << ": " << item.workQueue.getCount() << io::endl;
+        out << size_t(item.id) << ":";
+        for (size_t p = 0; p < JobSystem::PRIORITY_COUNT; p++) {
+            out << " " << item.workQueues[p].getCount()
+                << " (+" << item.pinnedQueues[p].count.load(std::memory_order_relaxed)
+                << " pinned)";
+        }
+        out << io::endl;
     }
     return out;
 }
@@ -22,7 +22,9 @@
 #include <math/vec3.h>
 #include <math/mat3.h>
 
+#include <algorithm>
 #include <array>
+#include <chrono>
 #include <thread>
 #include <utils/Allocator.h>
 
@@ -342,5 +344,224 @@ TEST(JobSystem, JobSystemDelegates) {
     EXPECT_EQ(4, functor.result);
 
 
+    js.emancipate();
+}
+
+TEST(JobSystem, JobSystemPriorities) {
+    // a single worker thread, so that the order in which jobs run is deterministic
+    JobSystem js(1);
+    js.adopt();
+
+    // keep the worker busy while we queue work
+    std::atomic_bool started = { false };
+    std::atomic_bool release = { false };
+    JobSystem::Job* blocker = js.runAndRetain(jobs::createJob(js, nullptr,
+            [&started, &release]() {
+                started = true;
+                while (!release) {
+                    std::this_thread::yield();
+                }
+            }));
+    while (!started) {
+        std::this_thread::yield();
+    }
+
+    // queue LOW priority work first...
+    std::atomic_int calls = { 0 };
+    JobSystem::Job* root = js.createJob();
+    js.setPriority(root, JobSystem::JobPriority::LOW);
+    for (int i = 0; i < 256; i++) {
+        // children inherit the priority of their parent
+        js.run(jobs::createJob(js, root, [&calls]() { calls++; }), JobSystem::DONT_SIGNAL);
+    }
+
+    // ...then a HIGH priority job, which must run before all the queued LOW jobs
+    std::atomic_int callsBeforeHigh = { -1 };
+    std::atomic_bool highDone = { false };
+    js.run(jobs::createJob(js, nullptr, [&calls, &callsBeforeHigh, &highDone]() {
+        callsBeforeHigh = calls.load();
+        highDone = true;
+    }));
+
+    // let the worker go; this thread doesn't run jobs until the HIGH job is done
+    release = true;
+    while (!highDone) {
+        std::this_thread::yield();
+    }
+    EXPECT_EQ(0, callsBeforeHigh.load());
+
+    js.waitAndRelease(blocker);
+    js.runAndWait(root);
+    EXPECT_EQ(256, calls.load());
+
+    js.emancipate();
+}
+
+TEST(JobSystem, JobSystemAffinity) {
+    JobSystem js(2);
+    js.adopt();
+
+    std::array<std::thread::id, 64> ids;
+    JobSystem::Job* root = js.createJob();
+    for (size_t i = 0; i < ids.size(); i++) {
+        JobSystem::Job* job = jobs::createJob(js, root, [&ids, i]() {
+            ids[i] = std::this_thread::get_id();
+        });
+        js.setAffinity(job, 1);
+        js.run(job, JobSystem::DONT_SIGNAL);
+    }
+    js.runAndWait(root);
+
+    // all jobs ran on the same thread, which is not this one
+    for (size_t i = 0; i < ids.size(); i++) {
+        EXPECT_EQ(ids[0], ids[i]);
+    }
+    EXPECT_NE(std::this_thread::get_id(), ids[0]);
+
+    js.emancipate();
+}
+
+TEST(JobSystem, JobSystemManyJobs) {
+    JobSystem js;
+    js.adopt();
+
+    // more jobs than fit in the first segment of the job storage, or in a WorkQueue. run()
+    // never runs the job itself, even when the WorkQueue is full.
+    std::atomic_int calls = { 0 };
+    std::atomic_int reentrantCalls = { 0 };
+    static thread_local bool running = false;
+    JobSystem::Job* root = js.createJob();
+    for (int i = 0; i < 20000; i++) {
+        JobSystem::Job* job = jobs::createJob(js, root, [&calls, &reentrantCalls]() {
+            calls++;
+            reentrantCalls += running ? 1 : 0;
+        });
+        ASSERT_NE(nullptr, job);
+        running = true;
+        js.run(job, JobSystem::DONT_SIGNAL);
+        running = false;
+    }
+    js.runAndWait(root);
+    EXPECT_EQ(20000, calls.load());
+    EXPECT_EQ(0, reentrantCalls.load());
+
+    // a fine-grained parallel_for over a large array
+    std::vector<uint32_t> data(1u << 18u, 0);
+    JobSystem::Job* job = parallel_for(js, nullptr, data.data(), uint32_t(data.size()),
+            [](uint32_t* d, uint32_t c) {
+                for (uint32_t i = 0; i < c; i++) {
+                    d[i]++;
+                }
+            }, CountSplitter<8, 16>());
+    js.runAndWait(job);
+    EXPECT_TRUE(std::all_of(data.begin(), data.end(), [](uint32_t v) { return v == 1; }));
+
+    js.emancipate();
+}
+
+TEST(JobSystem, JobSystemContinuation) {
+    JobSystem js;
+    js.adopt();
+
+    // fan-in: the continuation runs once all its children have completed
+    std::atomic_int calls = { 0 };
+    int seen = -1;
+    JobSystem::Job* continuation = jobs::createJob(js, nullptr, [&calls, &seen]() {
+        seen = calls.load();
+    });
+    js.setContinuation(continuation);
+    for (int i = 0; i < 16; i++) {
+        js.run(jobs::createJob(js, continuation, [&calls]() {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            calls++;
+        }));
+    }
+    js.runAndWait(continuation);
+    EXPECT_EQ(16, seen);
+
+    // children that complete before the continuation is run
+    seen = -1;
+    calls = 0;
+    continuation = jobs::createJob(js, nullptr, [&calls, &seen]() { seen = calls.load(); });
+    js.setContinuation(continuation);
+    JobSystem::Job* child = jobs::createJob(js, continuation, [&calls]() { calls++; });
+    js.runAndWait(child);
+    EXPECT_EQ(-1, seen);
+    js.runAndWait(continuation);
+    EXPECT_EQ(1, seen);
+
+    // a cancelled continuation still waits for its children
+    calls = 0;
+    continuation = jobs::createJob(js, nullptr, [&seen]() { seen = -2; });
+    js.setContinuation(continuation);
+    js.run(jobs::createJob(js, continuation, [&calls]() { calls++; }));
+    JobSystem::Job* retained = js.retain(continuation);
+    js.cancel(continuation);
+    js.waitAndRelease(retained);
+    EXPECT_EQ(1, calls.load());
+    EXPECT_EQ(1, seen);
+
+    js.emancipate();
+}
+
+TEST(JobSystem, JobSystemContinuationGraph) {
+    JobSystem js;
+    js.adopt();
+
+    // a -> (b, c) -> d, without any thread waiting between the stages
+    std::atomic_int order = { 0 };
+    int a = 0, b = 0, c = 0, d = 0;
+    JobSystem::Job* jd = jobs::createJob(js, nullptr, [&]() { d = ++order; });
+    js.setContinuation(jd);
+    JobSystem::Job* ja = js.createJob(jd, [&, jd](JobSystem& js, JobSystem::Job*) {
+        a = ++order;
+        // b and c are created from a, as children of d so it also waits on them
+        js.run(jobs::createJob(js, jd, [&]() { b = ++order; }));
+        js.run(jobs::createJob(js, jd, [&]() { c = ++order; }));
+    });
+    js.run(ja);
+    js.runAndWait(jd);
+
+    EXPECT_EQ(1, a);
+    EXPECT_LT(a, b);
+    EXPECT_LT(a, c);
+    EXPECT_EQ(4, d);
+
+    js.emancipate();
+}
+
+TEST(JobSystem, JobSystemContinuationSuccessors) {
+    JobSystem js;
+    js.adopt();
+
+    // a diamond a -> (b, c) -> d: a feeds two continuations, d waits on both
+    for (int i = 0; i < 64; i++) {
+        std::atomic_int order = { 0 };
+        int a = 0, b = 0, c = 0, d = 0;
+        JobSystem::Job* ja = jobs::createJob(js, nullptr, [&]() {
+            std::this_thread::sleep_for(std::chrono::microseconds(i % 4 * 50));
+            a = ++order;
+        });
+        JobSystem::Job* jb = jobs::createJob(js, nullptr, [&]() { b = ++order; });
+        JobSystem::Job* jc = jobs::createJob(js, nullptr, [&]() { c = ++order; });
+        JobSystem::Job* jd = jobs::createJob(js, nullptr, [&]() { d = ++order; });
+        js.setContinuation(jb);
+        js.setContinuation(jc);
+        js.setContinuation(jd);
+        js.addSuccessor(ja, jb);
+        js.addSuccessor(ja, jc);
+        js.addSuccessor(jb, jd);
+        js.addSuccessor(jc, jd);
+        // the continuations are run first, they must still wait for their predecessors
+        JobSystem::Job* retained = js.runAndRetain(jd);
+        js.run(jb);
+        js.run(jc);
+        js.run(ja);
+        js.waitAndRelease(retained);
+        EXPECT_EQ(1, a);
+        EXPECT_EQ(5, b + c);
+        EXPECT_EQ(4, d);
+    }
+
     js.emancipate();
 }
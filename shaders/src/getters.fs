@@ -107,7 +107,17 @@ highp vec3 getNormalizedViewportCoord() {
 
 #if defined(HAS_SHADOWING) && defined(HAS_DYNAMIC_LIGHTING)
 highp vec3 getSpotLightSpacePosition(uint index) {
-    highp vec4 position = vertex_spotLightSpacePosition[index];
+    highp vec4 position;
+    if (index < uint(MAX_SHADOW_CASTING_SPOTS)) {
+        position = vertex_spotLightSpacePosition[index];
+    } else {
+        // the spot light shadows of the shadow atlas don't have varyings
+        uint i = index - uint(MAX_SHADOW_CASTING_SPOTS);
+        position = computeLightSpacePosition(getWorldPosition(), getWorldNormalVector(),
+                shadowUniforms.atlasDirectionShadowBias[i].xyz,
+                shadowUniforms.atlasDirectionShadowBias[i].w,
+                shadowUniforms.atlasSpotLightFromWorldMatrix[i]);
+    }
 #if defined(HAS_VSM)
     // For VSM, do not project the Z coordinate. It remains as linear Z in light space.
     // See the computeVsmLightSpaceMatrix comments in ShadowMap.cpp.
@@ -12,16 +12,77 @@ mat4 getSpotLightFromWorldMatrix(uint index) {
 }
 #endif
 
+/** @public-api */
+int getInstanceIndex() {
+#if defined(TARGET_METAL_ENVIRONMENT) || defined(TARGET_VULKAN_ENVIRONMENT)
+    return gl_InstanceIndex;
+#else
+    return gl_InstanceID;
+#endif
+}
+
+/** @public-api */
+int getVertexIndex() {
+#if defined(TARGET_METAL_ENVIRONMENT) || defined(TARGET_VULKAN_ENVIRONMENT)
+    return gl_VertexIndex;
+#else
+    return gl_VertexID;
+#endif
+}
+
+#if defined(HAS_SKINNING_OR_MORPHING)
+// Instances are stored at the end of the bones UBO, see PerRenderableUibInstance
+uint getInstanceOffset() {
+    return (uint(FIRST_INSTANCE_BONE) + uint(getInstanceIndex())) * 4u;
+}
+
+mat4 getInstanceWorldFromModelMatrix() {
+    uint i = getInstanceOffset();
+    // the first 3 float4 are the rows of the instance's affine world transform
+    return transpose(mat4(
+            bonesUniforms.bones[i + 0u],
+            bonesUniforms.bones[i + 1u],
+            bonesUniforms.bones[i + 2u],
+            vec4(0.0, 0.0, 0.0, 1.0)));
+}
+#endif
+
 /** @public-api */
 mat4 getWorldFromModelMatrix() {
+#if defined(HAS_SKINNING_OR_MORPHING)
+    if (objectUniforms.instancingEnabled == 1) {
+        return getInstanceWorldFromModelMatrix();
+    }
+#endif
     return objectUniforms.worldFromModelMatrix;
 }
 
 /** @public-api */
 mat3 getWorldFromModelNormalMatrix() {
+#if defined(HAS_SKINNING_OR_MORPHING)
+    if (objectUniforms.instancingEnabled == 1) {
+        // The cofactor matrix is the inverse transpose scaled by the determinant, so it also
+        // flips the normals of mirror transforms. Like the per-renderable normal matrix, it's
+        // pre-scaled by the inverse of its largest scale factor.
+        mat3 m = mat3(getInstanceWorldFromModelMatrix());
+        m = mat3(cross(m[1], m[2]), cross(m[2], m[0]), cross(m[0], m[1]));
+        return m * inversesqrt(max(dot(m[0], m[0]), max(dot(m[1], m[1]), dot(m[2], m[2]))));
+    }
+#endif
     return objectUniforms.worldFromModelNormalMatrix;
 }
 
+/** @public-api */
+vec4 getInstanceData() {
+#if defined(HAS_SKINNING_OR_MORPHING)
+    if (objectUniforms.instancingEnabled == 1) {
+        // the last float4 of an instance is its user data
+        return bonesUniforms.bones[getInstanceOffset() + 3u];
+    }
+#endif
+    return vec4(0.0);
+}
+
 //------------------------------------------------------------------------------
 // Attributes access
 //------------------------------------------------------------------------------
@@ -54,7 +115,33 @@ vec3 mulBoneVertex(vec3 v, uint i) {
     return v;
 }
 
+// 3x4 matrix bones (skinningEnabled == 2) are stored as the three rows of the affine transform
+vec3 mulBoneMatrixNormal(vec3 n, uint i) {
+    mat3 m = transpose(mat3(
+            bonesUniforms.bones[i + 0u].xyz,
+            bonesUniforms.bones[i + 1u].xyz,
+            bonesUniforms.bones[i + 2u].xyz));
+    // the cofactor matrix is the inverse transpose scaled by the determinant
+    m = mat3(cross(m[1], m[2]), cross(m[2], m[0]), cross(m[0], m[1]));
+    return normalize(m * n);
+}
+
+vec3 mulBoneMatrixVertex(vec3 v, uint i) {
+    vec4 p = vec4(v, 1.0);
+    return vec3(
+            dot(bonesUniforms.bones[i + 0u], p),
+            dot(bonesUniforms.bones[i + 1u], p),
+            dot(bonesUniforms.bones[i + 2u], p));
+}
+
 void skinNormal(inout vec3 n, const uvec4 ids, const vec4 weights) {
+    if (objectUniforms.skinningEnabled == 2) {
+        n =   mulBoneMatrixNormal(n, ids.x * 3u) * weights.x
+            + mulBoneMatrixNormal(n, ids.y * 3u) * weights.y
+            + mulBoneMatrixNormal(n, ids.z * 3u) * weights.z
+            + mulBoneMatrixNormal(n, ids.w * 3u) * weights.w;
+        return;
+    }
     n =   mulBoneNormal(n, ids.x * 4u) * weights.x
         + mulBoneNormal(n, ids.y * 4u) * weights.y
         + mulBoneNormal(n, ids.z * 4u) * weights.z
@@ -62,11 +149,48 @@ void skinNormal(inout vec3 n, const uvec4 ids, const vec4 weights) {
 }
 
 void skinPosition(inout vec3 p, const uvec4 ids, const vec4 weights) {
+    if (objectUniforms.skinningEnabled == 2) {
+        p =   mulBoneMatrixVertex(p, ids.x * 3u) * weights.x
+            + mulBoneMatrixVertex(p, ids.y * 3u) * weights.y
+            + mulBoneMatrixVertex(p, ids.z * 3u) * weights.z
+            + mulBoneMatrixVertex(p, ids.w * 3u) * weights.w;
+        return;
+    }
     p =   mulBoneVertex(p, ids.x * 4u) * weights.x
         + mulBoneVertex(p, ids.y * 4u) * weights.y
         + mulBoneVertex(p, ids.z * 4u) * weights.z
         + mulBoneVertex(p, ids.w * 4u) * weights.w;
 }
+
+#if defined(HAS_MORPH_TARGETS)
+// The deltas of the morph targets are stored one texel per vertex, in rows of textureSize().x
+// texels. Layer 2 * target holds the position deltas and layer 2 * target + 1 the normal deltas.
+vec3 getMorphTargetDelta(int layer) {
+    int width = textureSize(morphing_targets, 0).x;
+    int v = getVertexIndex();
+    return texelFetch(morphing_targets, ivec3(v % width, v / width, layer), 0).xyz;
+}
+#endif
+
+// morphingUniforms only holds the targets with a non-zero weight, 4 per vector. Materials without
+// a sampler left for the morph targets ignore them.
+void morphPosition(inout vec4 p) {
+#if defined(HAS_MORPH_TARGETS)
+    for (int i = 0; i < morphingUniforms.count; i++) {
+        int target = morphingUniforms.indices[i >> 2][i & 3];
+        p.xyz += morphingUniforms.weights[i >> 2][i & 3] * getMorphTargetDelta(target * 2);
+    }
+#endif
+}
+
+void morphNormal(inout vec3 n) {
+#if defined(HAS_MORPH_TARGETS)
+    for (int i = 0; i < morphingUniforms.count; i++) {
+        int target = morphingUniforms.indices[i >> 2][i & 3];
+        n += morphingUniforms.weights[i >> 2][i & 3] * getMorphTargetDelta(target * 2 + 1);
+    }
+#endif
+}
 #endif
 
 /** @public-api */
@@ -82,7 +206,9 @@ vec4 getPosition() {
         pos += objectUniforms.morphWeights.w * mesh_custom3;
     }
 
-    if (objectUniforms.skinningEnabled == 1) {
+    morphPosition(pos);
+
+    if (objectUniforms.skinningEnabled != 0) {
         skinPosition(pos.xyz, mesh_bone_indices, mesh_bone_weights);
     }
 
@@ -116,15 +242,6 @@ vec4 getCustom6() { return mesh_custom6; }
 vec4 getCustom7() { return mesh_custom7; }
 #endif
 
-/** @public-api */
-int getVertexIndex() {
-#if defined(TARGET_METAL_ENVIRONMENT) || defined(TARGET_VULKAN_ENVIRONMENT)
-    return gl_VertexIndex;
-#else
-    return gl_VertexID;
-#endif
-}
-
 //------------------------------------------------------------------------------
 // Helpers
 //------------------------------------------------------------------------------
@@ -7,16 +7,20 @@
 #define FROXEL_BUFFER_WIDTH         (1u << FROXEL_BUFFER_WIDTH_SHIFT)
 #define FROXEL_BUFFER_WIDTH_MASK    (FROXEL_BUFFER_WIDTH - 1u)
 
-#define RECORD_BUFFER_WIDTH_SHIFT   5u
+#define RECORD_BUFFER_WIDTH_SHIFT   6u
 #define RECORD_BUFFER_WIDTH         (1u << RECORD_BUFFER_WIDTH_SHIFT)
 #define RECORD_BUFFER_WIDTH_MASK    (RECORD_BUFFER_WIDTH - 1u)
 
+// Make sure this matches the same constants in Froxelizer.h and EngineEnums.h
+#define FROXEL_BUFFER_LIGHT_OFFSET  16384u
+#define LIGHT_UNIFORMS_COUNT        256u
+
 #define LIGHT_TYPE_POINT            0u
 #define LIGHT_TYPE_SPOT             1u
 
 
 struct FroxelParams {
-    uint recordOffset; // offset at which the list of lights for this froxel starts
+    highp uint recordOffset; // offset at which the list of lights for this froxel starts
     uint count;   // number lights in this froxel
 };
 
@@ -53,7 +57,7 @@ uint getFroxelIndex(const highp vec3 fragCoords) {
 /**
  * Computes the texture coordinates of the froxel data given a froxel index.
  */
-ivec2 getFroxelTexCoord(uint froxelIndex) {
+ivec2 getFroxelTexCoord(highp uint froxelIndex) {
     return ivec2(froxelIndex & FROXEL_BUFFER_WIDTH_MASK, froxelIndex >> FROXEL_BUFFER_WIDTH_SHIFT);
 }
 
@@ -63,10 +67,11 @@ ivec2 getFroxelTexCoord(uint froxelIndex) {
  */
 FroxelParams getFroxelParams(uint froxelIndex) {
     ivec2 texCoord = getFroxelTexCoord(froxelIndex);
-    uvec2 entry = texelFetch(light_froxels, texCoord, 0).rg;
+    highp uvec2 entry = texelFetch(light_froxels, texCoord, 0).rg;
 
+    // the high bits of the offset are only used with the large light count
     FroxelParams froxel;
-    froxel.recordOffset = entry.r;
+    froxel.recordOffset = entry.r | ((entry.g >> 8u) << 16u);
     froxel.count = entry.g & 0xFFu;
     return froxel;
 }
@@ -76,7 +81,7 @@ FroxelParams getFroxelParams(uint froxelIndex) {
  * given the specified index. A light record is a single uint index into the
  * lights data buffer (lightsUniforms UBO).
  */
-ivec2 getRecordTexCoord(uint index) {
+ivec2 getRecordTexCoord(highp uint index) {
     return ivec2(index & RECORD_BUFFER_WIDTH_MASK, index >> RECORD_BUFFER_WIDTH_SHIFT);
 }
 
@@ -101,23 +106,51 @@ float getAngleAttenuation(const vec3 lightDir, const vec3 l, const vec2 scaleOff
     return attenuation * attenuation;
 }
 
+/**
+ * Returns 4 words of the data of a light stored in the light_froxels texture (with the large
+ * light count). Each 32-bit word is split in the two 16-bit channels of a texel.
+ */
+highp vec4 getFroxelBufferLightData(const ivec2 texCoord) {
+    highp uvec2 x = texelFetch(light_froxels, texCoord, 0).rg;
+    highp uvec2 y = texelFetch(light_froxels, texCoord + ivec2(1, 0), 0).rg;
+    highp uvec2 z = texelFetch(light_froxels, texCoord + ivec2(2, 0), 0).rg;
+    highp uvec2 w = texelFetch(light_froxels, texCoord + ivec2(3, 0), 0).rg;
+    return uintBitsToFloat(uvec4(x.r | (x.g << 16u), y.r | (y.g << 16u),
+            z.r | (z.g << 16u), w.r | (w.g << 16u)));
+}
+
 /**
  * Returns a Light structure (see common_lighting.fs) describing a point or spot light.
  * The colorIntensity field will store the *pre-exposed* intensity of the light
  * in the w component.
  *
  * The light parameters used to compute the Light structure are fetched from the
- * lightsUniforms uniform buffer.
+ * lightsUniforms uniform buffer, or from the light_froxels texture for the lights
+ * past the uniform buffer (with the large light count).
  */
-Light getLight(const uint index) {
+Light getLight(const highp uint index) {
 
     // retrieve the light data from the UBO
     ivec2 texCoord = getRecordTexCoord(index);
     uint lightIndex = texelFetch(light_records, texCoord, 0).r;
-    highp vec4 positionFalloff       = lightsUniforms.lights[lightIndex][0];
-    highp vec4 colorIntensity        = lightsUniforms.lights[lightIndex][1];
-          vec4 directionIES          = lightsUniforms.lights[lightIndex][2];
-    highp vec4 scaleOffsetShadowType = lightsUniforms.lights[lightIndex][3];
+    highp vec4 positionFalloff;
+    highp vec4 colorIntensity;
+          vec4 directionIES;
+    highp vec4 scaleOffsetShadowType;
+    if (lightIndex < LIGHT_UNIFORMS_COUNT) {
+        positionFalloff       = lightsUniforms.lights[lightIndex][0];
+        colorIntensity        = lightsUniforms.lights[lightIndex][1];
+        directionIES          = lightsUniforms.lights[lightIndex][2];
+        scaleOffsetShadowType = lightsUniforms.lights[lightIndex][3];
+    } else {
+        // each light is 16 texels of the same row, after the froxels
+        highp uint texel = FROXEL_BUFFER_LIGHT_OFFSET + (lightIndex - LIGHT_UNIFORMS_COUNT) * 16u;
+        ivec2 lightCoord = getFroxelTexCoord(texel);
+        positionFalloff       = getFroxelBufferLightData(lightCoord);
+        colorIntensity        = getFroxelBufferLightData(lightCoord + ivec2(4, 0));
+        directionIES          = getFroxelBufferLightData(lightCoord + ivec2(8, 0));
+        scaleOffsetShadowType = getFroxelBufferLightData(lightCoord + ivec2(12, 0));
+    }
 
     // poition-to-light vector
     highp vec3 worldPosition = vertex_worldPosition;
@@ -138,8 +171,8 @@ Light getLight(const uint index) {
         uint shadowBits = floatBitsToUint(scaleOffsetShadowType.z);
         light.castsShadows = bool(shadowBits & 0x1u);
         light.contactShadows = bool((shadowBits >> 1u) & 0x1u);
-        light.shadowIndex = (shadowBits >> 2u) & 0xFu;
-        light.shadowLayer = (shadowBits >> 6u) & 0xFu;
+        light.shadowIndex = (shadowBits >> 2u) & 0x7Fu;
+        light.shadowLayer = (shadowBits >> 9u) & 0xFu;
     }
 
     return light;
@@ -161,8 +194,8 @@ void evaluatePunctualLights(const PixelParams pixel, inout vec3 color) {
     // texture. The records texture contains the indices of the actual
     // light data in the lightsUniforms uniform buffer
 
-    uint index = froxel.recordOffset;
-    uint end = index + froxel.count;
+    highp uint index = froxel.recordOffset;
+    highp uint end = index + froxel.count;
 
     // Iterate point lights
     for ( ; index < end; index++) {
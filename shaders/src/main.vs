@@ -25,7 +25,12 @@ void main() {
             material.worldNormal = normalize(material.worldNormal);
         }
 
-        if (objectUniforms.skinningEnabled == 1) {
+        if (morphingUniforms.count > 0) {
+            morphNormal(material.worldNormal);
+            material.worldNormal = normalize(material.worldNormal);
+        }
+
+        if (objectUniforms.skinningEnabled != 0) {
             skinNormal(material.worldNormal, mesh_bone_indices, mesh_bone_weights);
             skinNormal(vertex_worldTangent.xyz, mesh_bone_indices, mesh_bone_weights);
         }
@@ -35,20 +40,26 @@ void main() {
         // because we ensure the worldFromModelNormalMatrix pre-scales the normal such that
         // all its components are < 1.0. This prevents the bitangent to exceed the range of fp16
         // in the fragment shader, where we renormalize after interpolation
-        vertex_worldTangent.xyz = objectUniforms.worldFromModelNormalMatrix * vertex_worldTangent.xyz;
+        mat3 worldFromModelNormalMatrix = getWorldFromModelNormalMatrix();
+        vertex_worldTangent.xyz = worldFromModelNormalMatrix * vertex_worldTangent.xyz;
         vertex_worldTangent.w = mesh_tangents.w;
-        material.worldNormal = objectUniforms.worldFromModelNormalMatrix * material.worldNormal;
+        material.worldNormal = worldFromModelNormalMatrix * material.worldNormal;
     #else // MATERIAL_NEEDS_TBN
         // Without anisotropy or normal mapping we only need the normal vector
         toTangentFrame(mesh_tangents, material.worldNormal);
 
         #if defined(HAS_SKINNING_OR_MORPHING)
-            if (objectUniforms.skinningEnabled == 1) {
+            if (morphingUniforms.count > 0) {
+                morphNormal(material.worldNormal);
+                material.worldNormal = normalize(material.worldNormal);
+            }
+
+            if (objectUniforms.skinningEnabled != 0) {
                 skinNormal(material.worldNormal, mesh_bone_indices, mesh_bone_weights);
             }
         #endif
 
-        material.worldNormal = objectUniforms.worldFromModelNormalMatrix * material.worldNormal;
+        material.worldNormal = getWorldFromModelNormalMatrix() * material.worldNormal;
 
     #endif // MATERIAL_HAS_ANISOTROPY || MATERIAL_HAS_NORMAL || MATERIAL_HAS_CLEAR_COAT_NORMAL
 #endif // HAS_ATTRIBUTE_TANGENTS